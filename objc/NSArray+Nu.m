@@ -77,7 +77,13 @@
             id object = [self objectAtIndex:i];
             [args setCar:result];
             [[args cdr] setCar: object];
-            result = [callable evalWithArguments:args context:nil];
+            id value = [callable evalWithArguments:args context:nil];
+            if (nu_control.signal) {
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else
+                result = value;
         }
     }
     [args release];
@@ -91,20 +97,10 @@
         NSEnumerator *enumerator = [self reverseObjectEnumerator];
         id object;
         while ((object = [enumerator nextObject])) {
-            @try
-            {
-                [args setCar:object];
-                [callable evalWithArguments:args context:nil];
-            }
-            @catch (NuBreakException *exception) {
+            [args setCar:object];
+            [callable evalWithArguments:args context:nil];
+            if (nu_loop_should_stop())
                 break;
-            }
-            @catch (NuContinueException *exception) {
-                // do nothing, just continue with the next loop iteration
-            }
-            @catch (id exception) {
-                @throw(exception);
-            }
         }
     }
     [args release];
@@ -123,6 +119,8 @@ static NSComparisonResult sortedArrayUsingBlockHelper(id a, id b, void *context)
     id result = [block evalWithArguments:args context:nil];
     
     [args release];
+    // a break, continue or return-from in the block stops the sort
+    nu_raise_pending_control_signal();
     return [result intValue];
 }
 
@@ -9,6 +9,7 @@
 #import "NSBundle+Nu.h"
 #import "NuInternals.h"
 #import "NSDictionary+Nu.h"
+#import "NuParseCache.h"
 
 @implementation NSBundle(Nu)
 
@@ -55,11 +56,10 @@
 {
     NSString *fileName = [self pathForResource:nuFileName ofType:@"nu"];
     if (fileName) {
-        NSString *string = [NSString stringWithContentsOfFile:fileName encoding:NSUTF8StringEncoding error:NULL];
-        if (string) {
-            NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
-            id parser = [context lookupObjectForKey:[symbolTable symbolWithString:@"_parser"]];
-            id body = [parser parse:string asIfFromFilename:[fileName UTF8String]];
+        NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
+        id parser = [context lookupObjectForKey:[symbolTable symbolWithString:@"_parser"]];
+        id body = [NuParseCache parseContentsOfFile:fileName withParser:parser];
+        if (body) {
             [body evalWithContext:context];
             return [symbolTable symbolWithString:@"t"];
         }
@@ -19,6 +19,18 @@
 + (NSDictionary *) dictionaryWithList:(id) list;
 /*! Look up an object by key, returning the specified default if no object is found. */
 - (id) objectForKey:(id)key withDefault:(id)defaultValue;
+/*! Evaluate a block with two arguments (key object) for each entry of a dictionary on the worker pool (see NuParallel.h). */
+- (id) peach:(id) block;
+/*! Evaluate a block with two arguments (key object) for each entry of a dictionary on the worker pool,
+ returning a dictionary of the results keyed by the entries' keys. */
+- (NSDictionary *) pmap:(id) block;
+/*! Evaluate a block with two arguments (key object) for each entry of a dictionary on the worker pool,
+ returning a dictionary of the entries for which it evaluates non-nil. */
+- (NSDictionary *) pselect:(id) block;
+/*! Reduce ranges of a dictionary's entries on the worker pool with a block of three arguments (accumulated key object),
+ starting each range from initial, and combine the results of the ranges with combiner.
+ Initial should be a value that combiner leaves unchanged, and since entries have no order, combiner should be commutative. */
+- (id) preduce:(id) block from:(id) initial combine:(id) combiner;
 @end
 
 /*!
@@ -9,6 +9,7 @@
 #import "NSDictionary+Nu.h"
 #import "NuCell.h"
 #import "NuInternals.h"
+#import "NuParallel.h"
 
 @implementation NSDictionary(Nu)
 
@@ -81,21 +82,11 @@
     NSEnumerator *keyEnumerator = [[self allKeys] objectEnumerator];
     id key;
     while ((key = [keyEnumerator nextObject])) {
-        @try
-        {
-            [args setCar:key];
-            [[args cdr] setCar:[self objectForKey:key]];
-            [block evalWithArguments:args context:Nu__null];
-        }
-        @catch (NuBreakException *exception) {
+        [args setCar:key];
+        [[args cdr] setCar:[self objectForKey:key]];
+        [block evalWithArguments:args context:Nu__null];
+        if (nu_loop_should_stop())
             break;
-        }
-        @catch (NuContinueException *exception) {
-            // do nothing, just continue with the next loop iteration
-        }
-        @catch (id exception) {
-            @throw(exception);
-        }
     }
     [args release];
     return self;
@@ -112,13 +103,60 @@
             [args setCar:object];
             [args setCdr:[[[NuCell alloc] init] autorelease]];
             [[args cdr] setCar:[self objectForKey:object]];
-            [results setObject:[callable evalWithArguments:args context:nil] forKey:object];
+            id result = [callable evalWithArguments:args context:nil];
+            if (nu_control.signal) {
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else
+                [results setObject:result forKey:object];
         }
     }
     [args release];
     return results;
 }
 
+- (id) peach:(id) block
+{
+    NSArray *keys = [self allKeys];
+    nu_parallel_map(block, keys, [self objectsForKeys:keys notFoundMarker:Nu__null], NULL);
+    return self;
+}
+
+- (NSDictionary *) pmap:(id) block
+{
+    NSArray *keys = [self allKeys];
+    id *results = (id *) [[NSMutableData dataWithLength:([keys count] + 1) * sizeof(id)] mutableBytes];
+    NSUInteger count = nu_parallel_map(block, keys, [self objectsForKeys:keys notFoundMarker:Nu__null], results);
+    NSMutableDictionary *mapped = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < count; i++) {
+        [mapped setPossiblyNullObject:results[i] forKey:[keys objectAtIndex:i]];
+        [results[i] release];
+    }
+    return mapped;
+}
+
+- (NSDictionary *) pselect:(id) block
+{
+    NSArray *keys = [self allKeys];
+    NSArray *values = [self objectsForKeys:keys notFoundMarker:Nu__null];
+    id *results = (id *) [[NSMutableData dataWithLength:([keys count] + 1) * sizeof(id)] mutableBytes];
+    NSUInteger count = nu_parallel_map(block, keys, values, results);
+    NSMutableDictionary *selected = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < count; i++) {
+        if (nu_valueIsTrue(results[i]))
+            [selected setObject:[values objectAtIndex:i] forKey:[keys objectAtIndex:i]];
+        [results[i] release];
+    }
+    return selected;
+}
+
+- (id) preduce:(id) block from:(id) initial combine:(id) combiner
+{
+    NSArray *keys = [self allKeys];
+    return nu_parallel_reduce(block, keys, [self objectsForKeys:keys notFoundMarker:Nu__null], initial, combiner);
+}
+
 @end
 
 @implementation NSMutableDictionary(Nu)
@@ -10,6 +10,30 @@
 #import "NuInternals.h"
 #import "NuBlock.h"
 #import "NuCell.h"
+#include <pthread.h>
+
+// Numbers in this range are created once and shared by the parser, the arithmetic operators and the iterators.
+#define NU_SMALL_INTEGER_MIN -128
+#define NU_SMALL_INTEGER_MAX 1023
+
+static NSNumber *nu_small_integers[NU_SMALL_INTEGER_MAX - NU_SMALL_INTEGER_MIN + 1];
+static pthread_once_t nu_small_integers_once = PTHREAD_ONCE_INIT;
+
+static void nu_small_integers_init(void)
+{
+    long i;
+    for (i = NU_SMALL_INTEGER_MIN; i <= NU_SMALL_INTEGER_MAX; i++)
+        nu_small_integers[i - NU_SMALL_INTEGER_MIN] = [[NSNumber alloc] initWithLong:i];
+}
+
+NSNumber *nu_number_with_long(long value)
+{
+    if ((value >= NU_SMALL_INTEGER_MIN) && (value <= NU_SMALL_INTEGER_MAX)) {
+        pthread_once(&nu_small_integers_once, nu_small_integers_init);
+        return nu_small_integers[value - NU_SMALL_INTEGER_MIN];
+    }
+    return [NSNumber numberWithLong:value];
+}
 
 @implementation NSNumber(Nu)
 
@@ -20,22 +44,12 @@
         int x = [self intValue];
         int i;
         for (i = 0; i < x; i++) {
-            @try
-            {
-                NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
-                [args setCar:@(i)];
-                [block evalWithArguments:args context:Nu__null];
-                [pool release];
-            }
-            @catch (NuBreakException *exception) {
+            NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+            [args setCar:nu_number_with_long(i)];
+            [block evalWithArguments:args context:Nu__null];
+            [pool release];
+            if (nu_loop_should_stop())
                 break;
-            }
-            @catch (NuContinueException *exception) {
-                // do nothing, just continue with the next loop iteration
-            }
-            @catch (id exception) {
-                @throw(exception);
-            }
         }
         [args release];
     }
@@ -54,20 +68,10 @@
         if (nu_objectIsKindOfClass(block, [NuBlock class])) {
             int i;
             for (i = startValue; i >= finalValue; i--) {
-                @try
-                {
-                    [args setCar:@(i)];
-                    [block evalWithArguments:args context:Nu__null];
-                }
-                @catch (NuBreakException *exception) {
+                [args setCar:nu_number_with_long(i)];
+                [block evalWithArguments:args context:Nu__null];
+                if (nu_loop_should_stop())
                     break;
-                }
-                @catch (NuContinueException *exception) {
-                    // do nothing, just continue with the next loop iteration
-                }
-                @catch (id exception) {
-                    @throw(exception);
-                }
             }
         }
         [args release];
@@ -83,20 +87,10 @@
     if (nu_objectIsKindOfClass(block, [NuBlock class])) {
         int i;
         for (i = startValue; i <= finalValue; i++) {
-            @try
-            {
-                [args setCar:@(i)];
-                [block evalWithArguments:args context:Nu__null];
-            }
-            @catch (NuBreakException *exception) {
+            [args setCar:nu_number_with_long(i)];
+            [block evalWithArguments:args context:Nu__null];
+            if (nu_loop_should_stop())
                 break;
-            }
-            @catch (NuContinueException *exception) {
-                // do nothing, just continue with the next loop iteration
-            }
-            @catch (id exception) {
-                @throw(exception);
-            }
         }
     }
     [args release];
@@ -19,6 +19,7 @@
 /*!
  Evaluation operator.  In Nu, strings may contain embedded Nu expressions that are evaluated when this method is called.
  Expressions are wrapped in #{...} where the ellipses correspond to a Nu expression.
+ String literals are parsed into NuInterpolatedStrings, whose expressions are only parsed once.
  */
 - (id) evalWithContext:(NSMutableDictionary *) context;
 
@@ -65,3 +66,16 @@
 - (void) appendCharacter:(unichar) c;
 @end
 
+/*!
+ @class NuInterpolatedString
+ @abstract A string literal whose embedded expressions have been parsed.
+ @discussion The parser creates these for string literals that contain #{...} expressions, so that
+ the expressions are parsed once rather than each time the literal is evaluated. They are strings with
+ the text of the literal, and evaluating one gives the same result as evaluating its text.
+ */
+@interface NuInterpolatedString : NSString
+@end
+
+// Get a string literal with its #{...} expressions parsed, or the literal itself if it has none
+// or if they can't be parsed, in which case they are left to be parsed when the literal is evaluated.
+NSString *nu_interpolated_string(NSString *literal);
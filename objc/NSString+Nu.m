@@ -11,6 +11,9 @@
 #import "NSDictionary+Nu.h"
 #import "NSData+Nu.h"
 #import "NuCell.h"
+#import "NuParser.h"
+
+#import <pthread.h>
 
 @interface NuStringEnumerator : NSEnumerator
 {
@@ -222,20 +225,10 @@
     NSEnumerator *characterEnumerator = [self objectEnumerator];
     id character;
     while ((character = [characterEnumerator nextObject])) {
-        @try
-        {
-            [args setCar:character];
-            [block evalWithArguments:args context:Nu__null];
-        }
-        @catch (NuBreakException *exception) {
+        [args setCar:character];
+        [block evalWithArguments:args context:Nu__null];
+        if (nu_loop_should_stop())
             break;
-        }
-        @catch (NuContinueException *exception) {
-            // do nothing, just continue with the next loop iteration
-        }
-        @catch (id exception) {
-            @throw(exception);
-        }
     }
     [args release];
     return self;
@@ -250,3 +243,148 @@
 }
 
 @end
+
+#pragma mark - Interpolated strings
+
+@interface NuInterpolatedString ()
+{
+    NSString *text;
+    id *segments;                   // retained; text at even indices and parsed expressions at odd ones
+    NSUInteger segmentCount;
+    NSUInteger estimatedLength;     // the length of the text and some room for each expression's value
+}
+- (id) initWithLiteral:(NSString *) literal;
+@end
+
+// Expressions are parsed with a parser of their own for each thread,
+// since the parser that found the literal is in the middle of a parse.
+static pthread_key_t expressionParserKey;
+static pthread_once_t expressionParserOnce = PTHREAD_ONCE_INIT;
+static __thread bool parsingExpressions = false;
+
+static void nu_expression_parser_free(void *parser)
+{
+    [(NuParser *) parser close];
+    [(NuParser *) parser release];
+}
+
+static void nu_expression_parser_create_key(void)
+{
+    pthread_key_create(&expressionParserKey, nu_expression_parser_free);
+}
+
+static NuParser *nu_expression_parser(void)
+{
+    pthread_once(&expressionParserOnce, nu_expression_parser_create_key);
+    NuParser *parser = (NuParser *) pthread_getspecific(expressionParserKey);
+    if (!parser) {
+        parser = [[NuParser alloc] init];
+        pthread_setspecific(expressionParserKey, parser);
+    }
+    return parser;
+}
+
+@implementation NuInterpolatedString
+
+// Divide the literal as evaluation does: each #{ starts an expression that ends at the next }.
+// Returns nil if an expression is unterminated or can't be parsed.
+- (id) initWithLiteral:(NSString *) literal
+{
+    if (!(self = [super init]))
+        return nil;
+    text = [literal copy];
+    NSArray *components = [text componentsSeparatedByString:@"#{"];
+    segmentCount = 2 * [components count] - 1;
+    segments = (id *) calloc(segmentCount, sizeof(id));
+    segments[0] = [[components objectAtIndex:0] retain];
+    estimatedLength = [text length];
+    NuParser *parser = nu_expression_parser();
+    parsingExpressions = true;
+    BOOL parsed = YES;
+    for (NSUInteger i = 1; parsed && (i < [components count]); i++) {
+        NSString *component = [components objectAtIndex:i];
+        NSRange close = [component rangeOfString:@"}"];
+        if (close.location == NSNotFound) {
+            parsed = NO;
+            break;
+        }
+        id body = nil;
+        @try {
+            body = [parser parse:[component substringToIndex:close.location]];
+        }
+        @catch (id exception) {
+            body = nil;
+        }
+        if (!nu_objectIsKindOfClass(body, [NuCell class])) {
+            [parser reset];
+            parsed = NO;
+            break;
+        }
+        segments[2*i - 1] = [body retain];
+        segments[2*i] = [[component substringFromIndex:close.location + 1] retain];
+        estimatedLength += 16;
+    }
+    parsingExpressions = false;
+    if (!parsed) {
+        [self release];
+        return nil;
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    for (NSUInteger i = 0; i < segmentCount; i++)
+        [segments[i] release];
+    free(segments);
+    [text release];
+    [super dealloc];
+}
+
+- (NSUInteger) length
+{
+    return [text length];
+}
+
+- (unichar) characterAtIndex:(NSUInteger) index
+{
+    return [text characterAtIndex:index];
+}
+
+- (void) getCharacters:(unichar *) buffer range:(NSRange) range
+{
+    [text getCharacters:buffer range:range];
+}
+
+- (const char *) UTF8String
+{
+    return [text UTF8String];
+}
+
+- (id) copyWithZone:(NSZone *) zone
+{
+    return [self retain];
+}
+
+- (id) evalWithContext:(NSMutableDictionary *) context
+{
+    NSMutableString *result = [NSMutableString stringWithCapacity:estimatedLength];
+    [result appendString:segments[0]];
+    for (NSUInteger i = 1; i < segmentCount; i += 2) {
+        id value = [segments[i] evalWithContext:context];
+        [result appendString:[value stringValue]];
+        [result appendString:segments[i + 1]];
+    }
+    return result;
+}
+
+@end
+
+NSString *nu_interpolated_string(NSString *literal)
+{
+    if (!literal || parsingExpressions || nu_objectIsKindOfClass(literal, [NuInterpolatedString class])
+        || ([literal rangeOfString:@"#{"].location == NSNotFound))
+        return literal;
+    NuInterpolatedString *string = [[[NuInterpolatedString alloc] initWithLiteral:literal] autorelease];
+    return string ? string : literal;
+}
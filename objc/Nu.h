@@ -38,6 +38,19 @@ void NuInit(void);
  @abstract An Objective-C class that provides access to a Nu parser.
  @discussion This class provides a simple interface that allows Objective-C code to run code written in Nu.
  It is intended for use in Objective-C programs that include Nu as a framework.
+
+ <b>Threads.</b> Call NuInit before starting threads that evaluate Nu code. After that, each thread
+ should evaluate code with a parser of its own (see <b>parser</b>); parsers and their contexts are not
+ thread-safe, but everything that they share is: the symbol table, the global values of symbols,
+ selector lookup, method caches, the analysis and compiled code of blocks, macro expansions, the methods
+ and classes defined by Nu, the names of parsed files and the default profiler. Code that was parsed once
+ may be evaluated on several threads at once. Changing parsed code (for example with <b>setCar:</b>)
+ while another thread is evaluating it is not supported, and neither is sharing a mutable collection
+ between threads without a lock of its own. Reading a global value retains and autoreleases it, so a value
+ that another thread replaces stays valid until the reader's autorelease pool is drained; native code that
+ keeps a value it got from Nu longer than that should retain it.
+ Method cache statistics and macro expansion counts are not synchronized and are approximate when
+ several threads are running.
  */
 @interface Nu : NSObject
 /*!
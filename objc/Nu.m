@@ -35,6 +35,7 @@
 #import <time.h>
 #import <sys/stat.h>
 #import <sys/mman.h>
+#import <pthread.h>
 
 #ifdef DARWIN
 #import <mach/mach.h>
@@ -72,6 +73,9 @@
 #import "NuBridge.h"
 #import "NuBridgedFunction.h"
 #import "NuClass.h"
+#import "NuParseCache.h"
+#import "NuImage.h"
+#import "NuProfiler.h"
 
 #ifdef LINUX
 id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable);
@@ -135,10 +139,9 @@ int NuMain(int argc, const char *argv[])
             // first we try to load main.nu from the application bundle.
             NSString *main_path = [[NSBundle mainBundle] pathForResource:@"main" ofType:@"nu"];
             if (main_path) {
-                NSString *main_nu = [NSString stringWithContentsOfFile:main_path encoding:NSUTF8StringEncoding error:NULL];
-                if (main_nu) {
-                    NuParser *parser = [Nu sharedParser];
-                    id script = [parser parse:main_nu asIfFromFilename:[main_nu UTF8String]];
+                NuParser *parser = [Nu sharedParser];
+                id script = [NuParseCache parseContentsOfFile:main_path withParser:parser];
+                if (script) {
                     [parser eval:script];
                     [parser release];
                     return 0;
@@ -152,7 +155,17 @@ int NuMain(int argc, const char *argv[])
                 bool goInteractive = false;
                 int i = 1;
                 bool fileEvaluated = false;           // only evaluate one filename
+                const char *imagePath = NULL;         // write an image here when done
                 while ((i < argc) && !fileEvaluated) {
+                    // these options take the argument that follows them
+                    if ((!strcmp(argv[i], "-e") || !strcmp(argv[i], "-f")
+                         || !strcmp(argv[i], "--image") || !strcmp(argv[i], "--dump-image"))
+                        && (i + 1 >= argc)) {
+                        fprintf(stderr, "usage: nu %s <%s>\n", argv[i],
+                                strcmp(argv[i], "-e") ? "file" : "expression");
+                        [parser release];
+                        return 1;
+                    }
                     if (!strcmp(argv[i], "-e")) {
                         i++;
                         script = [parser parse:[NSString stringWithCString:argv[i] encoding:NSUTF8StringEncoding]];
@@ -171,12 +184,22 @@ int NuMain(int argc, const char *argv[])
                     else if (!strcmp(argv[i], "-i")) {
                         goInteractive = true;
                     }
+                    else if (!strcmp(argv[i], "--image")) {
+                        i++;
+                        [NuImage loadImageFromFile:[NSString stringWithCString:argv[i] encoding:NSUTF8StringEncoding]
+                                        intoParser:parser];
+                    }
+                    else if (!strcmp(argv[i], "--dump-image")) {
+                        i++;
+                        imagePath = argv[i];
+                        didSomething = true;
+                    }
                     else {
                         // collect the command-line arguments
                         [[NuApplication sharedApplication] setArgc:argc argv:argv startingAtIndex:i+1];
-                        id string = [NSString stringWithContentsOfFile:[NSString stringWithCString:argv[i] encoding:NSUTF8StringEncoding] encoding:NSUTF8StringEncoding error:NULL];
-                        if (string) {
-                            id script = [parser parse:string asIfFromFilename:argv[i]];
+                        id script = [NuParseCache parseContentsOfFile:[NSString stringWithCString:argv[i] encoding:NSUTF8StringEncoding]
+                                                           withParser:parser];
+                        if (script) {
                             [parser eval:script];
                             fileEvaluated = true;
                         }
@@ -188,6 +211,9 @@ int NuMain(int argc, const char *argv[])
                     }
                     i++;
                 }
+                if (imagePath)
+                    [NuImage writeImageOfParser:parser
+                                         toFile:[NSString stringWithCString:imagePath encoding:NSUTF8StringEncoding]];
 #if !TARGET_OS_IPHONE
                 if (!didSomething || goInteractive)
                     [parser interact];
@@ -288,6 +314,12 @@ void NuInit()
         loadNuLibraryFile(@"nu", parser, [parser context], [parser symbolTable]);
 #endif
 #endif
+        
+        // definitions made after this point are saved in images
+        nu_image_begin_recording();
+        
+        // sample the program if NU_PROFILE names a file for the samples
+        nu_profiler_start_from_environment();
     }
 }
 
@@ -339,12 +371,12 @@ id _nucell(id car, id cdr)
 
 id _nuregex(const unsigned char *pattern, int options)
 {
-    return [NSRegularExpression regexWithPattern:_nustring(pattern) options:options];
+    return nu_regex_cached(_nustring(pattern), options);
 }
 
 id _nuregex_with_length(const unsigned char *pattern, int length, int options)
 {
-    return [NSRegularExpression regexWithPattern:_nustring_with_length(pattern, length) options:options];
+    return nu_regex_cached(_nustring_with_length(pattern, length), options);
 }
 
 id _nulist(id firstObject, ...)
@@ -378,12 +410,17 @@ id _nulist(id firstObject, ...)
     return [[[NuParser alloc] init] autorelease];
 }
 
+static NuParser *sharedParser = nil;
+static pthread_once_t sharedParserOnce = PTHREAD_ONCE_INIT;
+
+static void nu_create_shared_parser(void)
+{
+    sharedParser = [[NuParser alloc] init];
+}
+
 + (NuParser *) sharedParser
 {
-    static NuParser *sharedParser = nil;
-    if (!sharedParser) {
-        sharedParser = [[NuParser alloc] init];
-    }
+    pthread_once(&sharedParserOnce, nu_create_shared_parser);
     return sharedParser;
 }
 
@@ -399,10 +436,9 @@ id _nulist(id firstObject, ...)
     NSBundle *bundle = [NSBundle bundleWithIdentifier:bundleIdentifier];
     NSString *filePath = [bundle pathForResource:fileName ofType:@"nu"];
     if (filePath) {
-        NSString *fileNu = [NSString stringWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
-        if (fileNu) {
-            NuParser *parser = [Nu sharedParser];
-            id script = [parser parse:fileNu asIfFromFilename:[filePath UTF8String]];
+        NuParser *parser = [Nu sharedParser];
+        id script = [NuParseCache parseContentsOfFile:filePath withParser:parser];
+        if (script) {
             if (!context) context = [parser context];
             [script evalWithContext:context];
             success = YES;
@@ -0,0 +1,38 @@
+//
+//  NuActor.h
+//  Nu
+//
+//  Actors that handle messages one at a time on the worker pool.
+//
+
+#import <Foundation/Foundation.h>
+#import "NuParallel.h"
+
+@class NuFuture;
+
+/*!
+ @class NuActor
+ @abstract An object that handles the messages sent to it one at a time on the worker pool.
+ @discussion In Nu programs, actors are created with <b>(actor block)</b>, where the block takes one argument.
+ <b>(a send:message)</b> adds a message to the actor's mailbox and returns without waiting,
+ and <b>(a ask:message)</b> does the same but returns a future of the block's result for the message.
+ The block is called with each message in the order that the messages were sent, and never on two threads at once,
+ so variables of the context that the block was created in can hold the actor's state without locks
+ as long as nothing else uses them.
+
+ An actor uses a thread of the worker pool only while it has messages, so a program may have many more actors than threads.
+ Exceptions raised while handling a message that was sent with <b>ask:</b> are raised by its future;
+ those raised for messages sent with <b>send:</b> are logged, and the actor goes on to its next message.
+ */
+@interface NuActor : NSObject <NuTask>
+
+/*! Create an actor that handles each of its messages by calling a block with the message. */
+- (id) initWithBlock:(id) block;
+/*! Send a message to the actor without waiting for it to be handled. */
+- (id) send:(id) message;
+/*! Send a message to the actor and return a future of the result of handling it. */
+- (NuFuture *) ask:(id) message;
+/*! Get the number of messages waiting in the actor's mailbox. */
+- (NSUInteger) pendingMessageCount;
+
+@end
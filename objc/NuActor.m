@@ -0,0 +1,133 @@
+//
+//  NuActor.m
+//  Nu
+//
+//  Actors that handle messages one at a time on the worker pool.
+//
+
+#import "NuActor.h"
+#import "NuFuture.h"
+#import "NuInternals.h"
+#import "NuCell.h"
+
+#import <pthread.h>
+
+// The number of messages an actor handles before it gives its thread back to the pool.
+#define NU_ACTOR_BATCH 64
+
+@interface NuActor ()
+{
+    id block;
+    pthread_mutex_t lock;
+    NSMutableArray *mailbox;        // messages and their futures (or null), in pairs; guarded by lock
+    bool scheduled;                 // true while the actor is queued or running; guarded by lock
+}
+@end
+
+@implementation NuActor
+
+- (id) initWithBlock:(id) b
+{
+    if ((self = [super init])) {
+        if (![b respondsToSelector:@selector(evalWithArguments:context:)]) {
+            [self release];
+            [NSException raise:@"NuActorError" format:@"actors require a block"];
+        }
+        block = [b retain];
+        mailbox = [[NSMutableArray alloc] init];
+        pthread_mutex_init(&lock, NULL);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    [block release];
+    [mailbox release];
+    pthread_mutex_destroy(&lock);
+    [super dealloc];
+}
+
+- (void) deliver:(id) message future:(NuFuture *) future
+{
+    pthread_mutex_lock(&lock);
+    [mailbox addObject:(message ? message : Nu__null)];
+    [mailbox addObject:(future ? (id) future : Nu__null)];
+    bool schedule = !scheduled;
+    scheduled = true;
+    pthread_mutex_unlock(&lock);
+    if (schedule)
+        nu_parallel_submit(self);
+}
+
+- (id) send:(id) message
+{
+    [self deliver:message future:nil];
+    return self;
+}
+
+- (NuFuture *) ask:(id) message
+{
+    NuFuture *future = [[[NuFuture alloc] init] autorelease];
+    [self deliver:message future:future];
+    return future;
+}
+
+- (NSUInteger) pendingMessageCount
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger count = [mailbox count] / 2;
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+// Handle a batch of messages, then queue the actor again if more are waiting.
+- (void) runTask
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger count = MIN([mailbox count], 2 * NU_ACTOR_BATCH);
+    NSArray *batch = [mailbox subarrayWithRange:NSMakeRange(0, count)];
+    [mailbox removeObjectsInRange:NSMakeRange(0, count)];
+    pthread_mutex_unlock(&lock);
+
+    id args = [[NuCell alloc] init];
+    for (NSUInteger i = 0; i < count; i += 2) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        id message = [batch objectAtIndex:i];
+        id future = [batch objectAtIndex:i + 1];
+        id result = Nu__null;
+        id exception = nil;
+        nu_control_state saved;
+        nu_suspend_control_signal(&saved);
+        @try {
+            [args setCar:message];
+            result = [block evalWithArguments:args context:nil];
+        }
+        @catch (id e) {
+            if (!nu_control_signal_from_exception(e))
+                exception = e;
+        }
+        nu_clear_control_signal();
+        nu_resume_control_signal(&saved);
+        if (future != Nu__null)
+            [future finishWithValue:result exception:exception];
+        else if (exception)
+            NSLog(@"Nu actor %@ raised an exception for message %@: %@", self, message, exception);
+        [pool drain];
+    }
+    [args release];
+
+    pthread_mutex_lock(&lock);
+    bool more = ([mailbox count] > 0);
+    scheduled = more;
+    pthread_mutex_unlock(&lock);
+    if (more)
+        nu_parallel_submit(self);
+}
+
+- (NSString *) description
+{
+    return [NSString stringWithFormat:@"<NuActor:%lx>", (unsigned long) self];
+}
+
+@end
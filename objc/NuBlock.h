@@ -9,6 +9,7 @@
 #import <Foundation/Foundation.h>
 
 @class NuCell;
+@class NuScope;
 
 /*!
  @class NuBlock
@@ -47,8 +48,29 @@
  This is a dictionary containing the symbols and associated values at the point
  where the block was created. */
 - (NSMutableDictionary *) context;
+/*! Get the lexical scope information that was computed for the block's body. */
+- (NuScope *) scope;
 /*! Evaluate a block using the specified arguments and calling context. */
 - (id) evalWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context;
+/*! Prepare a call of a block that is in tail position.
+ The arguments are evaluated in the calling context, but the body is evaluated by the block
+ whose body contains the call, after that body has finished. */
+- (id) tailCallWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context;
+/*! Call a block with arguments whose values have already been computed.
+ The unevaluated arguments are bound to <b>*args</b>. This is used by compiled code. */
+- (id) callWithArguments:(id)cdr values:(id)values;
+/*! Prepare a call in tail position of a block with arguments whose values have already been computed. */
+- (id) tailCallWithArguments:(id)cdr values:(id)values;
+/*! Compile the body of the block so that calls of the block are evaluated by the bytecode machine
+ (NuBytecode). Returns the block. */
+- (id) compile;
+/*! Returns true if calls of the block are evaluated by compiled code. */
+- (BOOL) isCompiled;
+/*! Set whether new blocks are compiled when they are created.
+ The default is taken from the NU_BYTECODE environment variable. */
++ (void) setCompilesBodies:(BOOL)compiles;
+/*! Returns true if new blocks are compiled when they are created. */
++ (BOOL) compilesBodies;
 /*! Evaluate a block using the specified arguments, calling context, and owner.
  This is the mechanism used to evaluate blocks as methods. */
 - (id) evalWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context self:(id)object;
@@ -12,22 +12,59 @@
 #import "NSDictionary+Nu.h"
 #import "NuCell.h"
 #import "NuClass.h"
+#import "NuScope.h"
+#import "NuFrame.h"
+#import "NuBytecode.h"
 
 @interface NuBlock ()
 {
     NuCell *parameters;
     NuCell *body;
     NSMutableDictionary *context;
+    NuScope *scope;
+    NuBytecode *bytecode;
 }
 @end
 
+__thread nu_tail_call_state nu_tail_call = {false, false, nil, nil};
+
+static BOOL compilesBodies = NO;
+
+// the symbols that method calls bind; they are set before any block can be called
+static NuSymbol *argsSymbol = nil, *selfSymbol = nil, *superSymbol = nil, *classSymbol = nil;
+
 @implementation NuBlock
 
++ (void) initialize
+{
+    if (self == [NuBlock class]) {
+        const char *setting = getenv("NU_BYTECODE");
+        compilesBodies = (setting && (setting[0] != '\0') && strcmp(setting, "0"));
+        NuSymbolTable *symbolTable = [NuSymbolTable sharedSymbolTable];
+        argsSymbol = [[symbolTable symbolWithString:@"*args"] retain];
+        selfSymbol = [[symbolTable symbolWithString:@"self"] retain];
+        superSymbol = [[symbolTable symbolWithString:@"super"] retain];
+        classSymbol = [[symbolTable symbolWithString:@"_class"] retain];
+    }
+}
+
++ (void) setCompilesBodies:(BOOL)compiles
+{
+    compilesBodies = compiles;
+}
+
++ (BOOL) compilesBodies
+{
+    return compilesBodies;
+}
+
 - (void) dealloc
 {
     [parameters release];
     [body release];
     [context release];
+    [scope release];
+    [bytecode release];
     [super dealloc];
 }
 
@@ -38,11 +75,16 @@
         body = [b retain];
 #ifdef CLOSE_ON_VALUES
         context = [c mutableCopy];
+        scope = nil;
 #else
         context = [[NSMutableDictionary alloc] init];
         [context setPossiblyNullObject:c forKey:PARENT_KEY];
         [context setPossiblyNullObject:[c objectForKey:SYMBOLS_KEY] forKey:SYMBOLS_KEY];
+        // resolve the symbols in the body so that lookups can skip contexts that can't bind them
+        scope = [[NuScope scopeForBlockWithParameters:p body:b context:c] retain];
 #endif
+        if (compilesBodies)
+            [self compile];
         
         // Check for the presence of "*args" in parameter list
         id plist = parameters;
@@ -72,7 +114,143 @@
     return [NSString stringWithFormat:@"(do %@ %@)", [parameters stringValue], [body stringValue]];
 }
 
-- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context
+- (id) compile
+{
+    if (!bytecode)
+        bytecode = [[NuBytecode bytecodeForBody:body] retain];
+    return self;
+}
+
+- (BOOL) isCompiled
+{
+    return bytecode != nil;
+}
+
+// Create the context that a call of the block is evaluated in.
+- (NSMutableDictionary *) newEvaluationContext
+{
+    if (scope)
+        return [[NuFrame frameWithScope:scope context:context] retain];
+    return [context mutableCopy];
+}
+
+// Bind a value in an evaluation context; slot is the symbol's position in the block's scope.
+static void bindValue(NSMutableDictionary *evaluation_context, NSUInteger slot, id symbol, id value)
+{
+    if (nu_context_scope(evaluation_context))
+        nu_frame_bind((NuFrame *) evaluation_context, slot, symbol, value);
+    else
+        [evaluation_context setPossiblyNullObject:value forKey:symbol];
+}
+
+// Evaluate the body of a block. The last expression is in tail position.
+static id evaluateBlockBody(NuBlock *block, NSMutableDictionary *evaluation_context)
+{
+    if (block->bytecode)
+        return [block->bytecode evalWithContext:evaluation_context];
+    id value = Nu__null;
+    id body = block->body;
+    id cursor = body;
+    while (cursor && (cursor != Nu__null)) {
+        id next = [cursor cdr];
+        if (!IS_NOT_NULL(next))
+            return nu_evaluateTail(cursor, evaluation_context, true);
+        value = nu_evaluateCar(cursor, evaluation_context);
+        if (nu_control.signal)
+            break;
+        cursor = next;
+    }
+    return value;
+}
+
+// Returns true if a block is one of the blocks that tail calls replaced in a trampoline.
+static bool nu_blocks_contain(NuBlock **blocks, NSUInteger count, id block)
+{
+    for (NSUInteger i = 0; i < count; i++) {
+        if (blocks[i] == block)
+            return true;
+    }
+    return false;
+}
+
+// Evaluate the body of the block, handling a return from it.
+// When the body ends with a call in tail position, the call is evaluated here in place of the body,
+// so chains of tail calls run in constant stack space. A return from any block in the chain
+// is a return from the whole chain, since the frames of the blocks that were replaced are gone.
+- (id) evaluateBodyWithContext:(NSMutableDictionary *)evaluation_context
+{
+    if (nu_evaluation_begin()) {
+        // the block was called from native code, so this is the outermost evaluation on this thread
+        @try
+        {
+            return [self evaluateBodyWithContext:evaluation_context];
+        }
+        @finally
+        {
+            nu_evaluation_end();
+        }
+    }
+    NuBlock *block = [self retain];
+    NSMutableDictionary *block_context = [evaluation_context retain];
+    NSAutoreleasePool *pool = nil;
+    NuBlock **replaced = NULL;      // retained; each block that was replaced in the chain, other than self
+    NSUInteger replacedCount = 0;
+    id value = nil;
+    @try
+    {
+        while (1) {
+            value = evaluateBlockBody(block, block_context);
+            if (nu_control.signal == NuControlSignalReturn) {
+                id target = nu_control.blockForReturn;
+                if (!target || (target == block) || (target == self) || nu_blocks_contain(replaced, replacedCount, target))
+                    value = nu_take_control_value();
+            }
+            if (!nu_tail_call.pending)
+                break;
+            if ((block == self) || nu_blocks_contain(replaced, replacedCount, block)) {
+                [block release];
+            }
+            else {
+                replaced = (NuBlock **) realloc(replaced, (replacedCount + 1) * sizeof(NuBlock *));
+                replaced[replacedCount++] = block;
+            }
+            [block_context release];
+            block = nu_tail_call.block;
+            block_context = nu_tail_call.context;
+            nu_tail_call.pending = false;
+            nu_tail_call.block = nil;
+            nu_tail_call.context = nil;
+            // don't let a long chain of tail calls accumulate autoreleased objects
+            [pool drain];
+            pool = [[NSAutoreleasePool alloc] init];
+        }
+        [value retain];
+    }
+    @catch (id exception) {
+        // the exception may have been autoreleased in the tail call pool, so it goes to the enclosing pool
+        [exception retain];
+        [pool drain];
+        pool = nil;
+        @throw [exception autorelease];
+    }
+    @finally
+    {
+        [pool drain];
+        [block release];
+        [block_context release];
+        for (NSUInteger i = 0; i < replacedCount; i++)
+            [replaced[i] release];
+        free(replaced);
+    }
+    // the value is retained, so the block's return is a quiescent point
+    nu_evaluation_quiescent();
+    return [value autorelease];
+}
+
+// Create the context for a call of the block, evaluating its arguments in the calling context.
+// If values is not nil, it holds the arguments' values and they are not evaluated again.
+// Returns nil if an argument raised a control signal.
+- (NSMutableDictionary *) newContextWithArguments:(id)cdr values:(id)values context:(NSMutableDictionary *)calling_context
 {
     NSUInteger numberOfArguments = [cdr length];
     NSUInteger numberOfParameters = [parameters length];
@@ -100,13 +278,16 @@
     //NSLog(@"block eval %@", [cdr stringValue]);
     // loop over the parameters, looking up their values in the calling_context and copying them into the evaluation_context
     id plist = parameters;
-    id vlist = cdr;
-    id evaluation_context = [context mutableCopy];
+    id vlist = values ? values : cdr;
+    if (values)
+        calling_context = nil;
+    id evaluation_context = [self newEvaluationContext];
     
     // Insert the implicit variable "*args".  It contains the entire parameter list.
-    NuSymbolTable *symbolTable = [evaluation_context objectForKey:SYMBOLS_KEY];
-    [evaluation_context setPossiblyNullObject:cdr forKey:[symbolTable symbolWithString:@"*args"]];
+    bindValue(evaluation_context, 0, argsSymbol, cdr);
     
+    // parameters occupy the slots that follow "*args"
+    NSUInteger slot = 1;
     while (plist && (plist != Nu__null)) {
         id parameter = [plist car];
         if ([[parameter stringValue] characterAtIndex:0] == '*') {
@@ -117,11 +298,11 @@
                 cursor = [cursor cdr];
                 id value = [vlist car];
                 if (calling_context && (calling_context != Nu__null))
-                    value = [value evalWithContext:calling_context];
+                    value = nu_evaluateCar(vlist, calling_context);
                 [cursor setCar:value];
                 vlist = [vlist cdr];
             }
-            [evaluation_context setPossiblyNullObject:[varargs cdr] forKey:parameter];
+            bindValue(evaluation_context, slot, parameter, [varargs cdr]);
             plist = [plist cdr];
             // this must be the last element in the parameter list
             if (plist != Nu__null) {
@@ -133,38 +314,68 @@
         else {
             id value = [vlist car];
             if (calling_context && (calling_context != Nu__null))
-                value = [value evalWithContext:calling_context];
+                value = nu_evaluateCar(vlist, calling_context);
             //NSLog(@"setting %@ = %@", parameter, value);
-            [evaluation_context setPossiblyNullObject:value forKey:parameter];
+            bindValue(evaluation_context, slot++, parameter, value);
             plist = [plist cdr];
             vlist = [vlist cdr];
         }
     }
-    // evaluate the body of the block with the saved context (implicit progn)
-    id value = Nu__null;
-    id cursor = body;
-    @try
-    {
-        while (cursor && (cursor != Nu__null)) {
-            value = [[cursor car] evalWithContext:evaluation_context];
-            cursor = [cursor cdr];
-        }
-    }
-    @catch (NuReturnException *exception) {
-        value = [exception value];
-        if ([exception blockForReturn] && ([exception blockForReturn] != self)) {
-            @throw(exception);
-        }
-    }
-    @catch (id exception) {
-        @throw(exception);
+    if (nu_control.signal) {
+        // an argument raised a control signal, so the call is abandoned
+        [evaluation_context release];
+        return nil;
     }
-    [value retain];
-    [value autorelease];
+    return evaluation_context;
+}
+
+- (NSMutableDictionary *) newContextWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context
+{
+    return [self newContextWithArguments:cdr values:nil context:calling_context];
+}
+
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context
+{
+    id evaluation_context = [self newContextWithArguments:cdr context:calling_context];
+    if (!evaluation_context)
+        return Nu__null;
+    // evaluate the body of the block with the saved context (implicit progn)
+    id value = [self evaluateBodyWithContext:evaluation_context];
+    [evaluation_context release];
+    return value;
+}
+
+- (id) callWithArguments:(id)cdr values:(id)values
+{
+    id evaluation_context = [self newContextWithArguments:cdr values:values context:nil];
+    if (!evaluation_context)
+        return Nu__null;
+    id value = [self evaluateBodyWithContext:evaluation_context];
     [evaluation_context release];
     return value;
 }
 
+// Leave a call with a prepared context pending for the block whose body is being evaluated.
+static id setPendingTailCall(NuBlock *block, NSMutableDictionary *evaluation_context)
+{
+    if (evaluation_context) {
+        nu_tail_call.pending = true;
+        nu_tail_call.block = [block retain];
+        nu_tail_call.context = evaluation_context;
+    }
+    return Nu__null;
+}
+
+- (id) tailCallWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context
+{
+    return setPendingTailCall(self, [self newContextWithArguments:cdr context:calling_context]);
+}
+
+- (id) tailCallWithArguments:(id)cdr values:(id)values
+{
+    return setPendingTailCall(self, [self newContextWithArguments:cdr values:values context:nil]);
+}
+
 - (id) evalWithArguments:(id)cdr context:(NSMutableDictionary *)calling_context
 {
     return [self callWithArguments:cdr context:calling_context];
@@ -196,46 +407,32 @@ static id getObjectFromContext(id context, id symbol)
     // loop over the arguments, looking up their values in the calling_context and copying them into the evaluation_context
     id plist = parameters;
     id vlist = cdr;
-    id evaluation_context = [context mutableCopy];
+    if (object && scope) {
+        // give self and super slots in this block's frames
+        [scope bindSymbol:selfSymbol];
+        [scope bindSymbol:superSymbol];
+    }
+    id evaluation_context = [self newEvaluationContext];
     //    NSLog(@"after copying, evaluation context %@ retain count %d", evaluation_context, [evaluation_context retainCount]);
     if (object) {
-        NuSymbolTable *symbolTable = [evaluation_context objectForKey:SYMBOLS_KEY];
         // look up one level for the _class value, but allow for it to be higher (in the perverse case of nested method declarations).
-        NuClass *c = getObjectFromContext([context objectForKey:PARENT_KEY], [symbolTable symbolWithString:@"_class"]);
-        [evaluation_context setPossiblyNullObject:object forKey:[symbolTable symbolWithString:@"self"]];
-        [evaluation_context setPossiblyNullObject:[NuSuper superWithObject:object ofClass:[c wrappedClass]] forKey:[symbolTable symbolWithString:@"super"]];
+        NuClass *c = getObjectFromContext([context objectForKey:PARENT_KEY], classSymbol);
+        bindValue(evaluation_context, NSNotFound, selfSymbol, object);
+        bindValue(evaluation_context, NSNotFound, superSymbol, [NuSuper superWithObject:object ofClass:[c wrappedClass]]);
     }
+    NSUInteger slot = 1;
     while (plist && (plist != Nu__null) && vlist && (vlist != Nu__null)) {
         id arg = [plist car];
         // since this message is sent by a method handler (which has already evaluated the block arguments),
         // we don't evaluate them here; instead we just copy them
         id value = [vlist car];
         //        NSLog(@"setting %@ = %@", arg, value);
-        [evaluation_context setPossiblyNullObject:value forKey:arg];
+        bindValue(evaluation_context, slot++, arg, value);
         plist = [plist cdr];
         vlist = [vlist cdr];
     }
     // evaluate the body of the block with the saved context (implicit progn)
-    id value = Nu__null;
-    id cursor = body;
-    @try
-    {
-        while (cursor && (cursor != Nu__null)) {
-            value = [[cursor car] evalWithContext:evaluation_context];
-            cursor = [cursor cdr];
-        }
-    }
-    @catch (NuReturnException *exception) {
-        value = [exception value];
-        if ([exception blockForReturn] && ([exception blockForReturn] != self)) {
-            @throw(exception);
-        }
-    }
-    @catch (id exception) {
-        @throw(exception);
-    }
-    [value retain];
-    [value autorelease];
+    id value = [self evaluateBodyWithContext:evaluation_context];
     [evaluation_context release];
     return value;
 }
@@ -255,4 +452,9 @@ static id getObjectFromContext(id context, id symbol)
     return body;
 }
 
+- (NuScope *) scope
+{
+    return scope;
+}
+
 @end
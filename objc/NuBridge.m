@@ -14,6 +14,8 @@
 
 #import <Foundation/Foundation.h>
 #import <unistd.h>
+#import <pthread.h>
+#import <alloca.h>
 
 #if TARGET_OS_IPHONE
 #import <CoreGraphics/CoreGraphics.h>
@@ -44,6 +46,7 @@
 #import "NuReference.h"
 #import "NuPointer.h"
 #import "NuClass.h"
+#import "NuImage.h"
 #import "NSMethodSignature+Nu.h"
 #import "NSDictionary+Nu.h"
 
@@ -84,7 +87,18 @@
  * V oneway
  */
 
-NSMutableDictionary *nu_block_table = nil;
+// The blocks of the method handlers that Nu has created, keyed by their implementations.
+// Entries are never removed, so blocks that are found stay valid.
+static NSMutableDictionary *nu_block_table = nil;
+static pthread_mutex_t blockTableLock = PTHREAD_MUTEX_INITIALIZER;
+
+NuBlock *nu_block_for_imp(IMP imp)
+{
+    pthread_mutex_lock(&blockTableLock);
+    NuBlock *block = nu_block_table ? [nu_block_table objectForKey:[NSNumber numberWithUnsignedLong:(unsigned long) imp]] : nil;
+    pthread_mutex_unlock(&blockTableLock);
+    return block;
+}
 
 #if defined(__x86_64__) || defined(__arm64__)
 
@@ -935,7 +949,161 @@ static void raise_argc_exception(SEL s, NSUInteger count, NSUInteger given)
     }
 }
 
-#define BUFSIZE 500
+// The implementation of a method and the block behind it, if it was written in Nu.
+// Bindings are immutable once published; a binding that is replaced is kept because other threads may still read it.
+typedef struct nu_method_binding {
+    IMP imp;
+    NuBlock *block;
+} nu_method_binding;
+
+// The parts of a call of an Objective-C method that don't depend on its arguments.
+// They are prepared the first time the method is called from Nu and kept for the life of the process.
+typedef struct nu_method_call {
+    Method method;
+    nu_method_binding *binding; // published atomically; replaced when the method's implementation is exchanged
+    int argumentCount;
+    char *returnType;
+    char **argumentTypes;
+    ffi_type **ffiArgumentTypes;
+    size_t *argumentOffsets;    // the offsets of argument values in a call's value buffer, which begins with the result
+    size_t bufferSize;
+    ffi_cif cif;
+    bool prepared;
+    bool returnsVoid;
+    bool initializer;
+    bool alreadyRetained;
+} nu_method_call;
+
+// Prepared calls are created under a lock and then published in a fixed-size open-addressed table
+// that is read without locking. Calls that find no free slot within a few probes are only in the map table.
+#define NU_METHOD_CALL_SLOTS 4096
+#define NU_METHOD_CALL_PROBES 8
+
+static nu_method_call *publishedMethodCalls[NU_METHOD_CALL_SLOTS];
+static NSMapTable *methodCalls = NULL;
+static pthread_mutex_t methodCallsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline NSUInteger nu_method_call_slot(Method m)
+{
+    uintptr_t h = (uintptr_t) m;
+    h ^= h >> 17;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (NSUInteger) (h >> 20) & (NU_METHOD_CALL_SLOTS - 1);
+}
+
+static nu_method_call *nu_method_call_find_published(Method m)
+{
+    NSUInteger slot = nu_method_call_slot(m);
+    for (int i = 0; i < NU_METHOD_CALL_PROBES; i++) {
+        nu_method_call *call = __atomic_load_n(&publishedMethodCalls[slot], __ATOMIC_ACQUIRE);
+        if (!call)
+            return NULL;
+        if (call->method == m)
+            return call;
+        slot = (slot + 1) & (NU_METHOD_CALL_SLOTS - 1);
+    }
+    return NULL;
+}
+
+// Publishing happens under methodCallsLock, so slots only go from empty to full once.
+static void nu_method_call_publish(nu_method_call *call)
+{
+    NSUInteger slot = nu_method_call_slot(call->method);
+    for (int i = 0; i < NU_METHOD_CALL_PROBES; i++) {
+        if (!publishedMethodCalls[slot]) {
+            __atomic_store_n(&publishedMethodCalls[slot], call, __ATOMIC_RELEASE);
+            return;
+        }
+        slot = (slot + 1) & (NU_METHOD_CALL_SLOTS - 1);
+    }
+}
+
+// Value buffers are aligned for any type.
+static inline size_t nu_value_slot_size(size_t size)
+{
+    return (size + 15) & ~((size_t) 15);
+}
+
+static nu_method_call *nu_method_call_create(Method m)
+{
+    nu_method_call *call = (nu_method_call *) calloc(1, sizeof(nu_method_call));
+    call->method = m;
+    int argument_count = method_getNumberOfArguments(m);
+    call->argumentCount = argument_count;
+    call->returnType = method_copyReturnType(m);
+    call->returnsVoid = !strcmp(call->returnType, "v");
+    call->argumentTypes = (char **) malloc(argument_count * sizeof(char *));
+    call->ffiArgumentTypes = (ffi_type **) malloc(argument_count * sizeof(ffi_type *));
+    call->argumentOffsets = (size_t *) malloc(argument_count * sizeof(size_t));
+    // ffi writes at least a full register for small return values
+    size_t offset = nu_value_slot_size(MAX(size_of_objc_type(call->returnType), sizeof(ffi_arg)));
+    int i;
+    for (i = 0; i < argument_count; i++) {
+        call->argumentTypes[i] = method_copyArgumentType(m, i);
+        call->ffiArgumentTypes[i] = ffi_type_for_objc_type(call->argumentTypes[i]);
+        call->argumentOffsets[i] = offset;
+        offset += nu_value_slot_size(size_of_objc_type(call->argumentTypes[i]));
+    }
+    call->bufferSize = offset;
+    int status = ffi_prep_cif(&call->cif, FFI_DEFAULT_ABI, (unsigned int) argument_count,
+                              ffi_type_for_objc_type(call->returnType), call->ffiArgumentTypes);
+    call->prepared = (status == FFI_OK);
+    
+    SEL s = method_getName(m);
+    const char *methodName = sel_getName(s);
+    call->initializer = !strncmp("init", methodName, 4);
+    // Return values should not require a release.
+    // Either they are owned by an existing object or are autoreleased.
+    // Exceptions to this rule are handled when the method is called.
+#ifdef LINUX
+    call->alreadyRetained = !strcmp(methodName,"alloc") ||
+    !strcmp(methodName,"allocWithZone:") ||
+    !strcmp(methodName,"copy") ||
+    !strcmp(methodName,"copyWithZone:") ||
+    !strcmp(methodName,"mutableCopy:") ||
+    !strcmp(methodName,"mutableCopyWithZone:") ||
+    !strcmp(methodName,"new");
+#else
+    call->alreadyRetained =               // see Anguish/Buck/Yacktman, p. 104
+    (s == @selector(alloc)) || (s == @selector(allocWithZone:))
+    || (s == @selector(copy)) || (s == @selector(copyWithZone:))
+    || (s == @selector(mutableCopy)) || (s == @selector(mutableCopyWithZone:))
+    || (s == @selector(new));
+#endif
+    return call;
+}
+
+// Get the prepared call for a method, and the block that implements it if it was written in Nu.
+// After the first call of a method with its current implementation, this takes no locks.
+static nu_method_call *nu_method_call_for_method(Method m, IMP imp, NuBlock **block)
+{
+    nu_method_call *call = nu_method_call_find_published(m);
+    if (!call) {
+        pthread_mutex_lock(&methodCallsLock);
+        if (!methodCalls)
+            methodCalls = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks, NSNonOwnedPointerMapValueCallBacks, 0);
+        call = (nu_method_call *) NSMapGet(methodCalls, m);
+        if (!call) {
+            call = nu_method_call_create(m);
+            NSMapInsert(methodCalls, m, call);
+            nu_method_call_publish(call);
+        }
+        pthread_mutex_unlock(&methodCallsLock);
+    }
+    nu_method_binding *binding = __atomic_load_n(&call->binding, __ATOMIC_ACQUIRE);
+    while (!binding || (binding->imp != imp)) {
+        // the method is new or its implementation was exchanged
+        nu_method_binding *replacement = (nu_method_binding *) malloc(sizeof(nu_method_binding));
+        replacement->imp = imp;
+        replacement->block = nu_block_for_imp(imp);
+        if (__atomic_compare_exchange_n(&call->binding, &binding, replacement, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            binding = replacement;
+        else
+            free(replacement);
+    }
+    *block = binding->block;
+    return call;
+}
 
 id nu_calling_objc_method_handler(id target, Method m, NSMutableArray *args)
 {
@@ -949,8 +1117,8 @@ id nu_calling_objc_method_handler(id target, Method m, NSMutableArray *args)
     // if the imp has an associated block, this is a nu-to-nu call.
     // skip going through the ObjC runtime and evaluate the block directly.
     NuBlock *block = nil;
-    if (nu_block_table &&
-        ((block = [nu_block_table objectForKey:[NSNumber numberWithUnsignedLong:(unsigned long)imp]]))) {
+    nu_method_call *call = nu_method_call_for_method(m, imp, &block);
+    if (block) {
         // NSLog(@"nu calling nu method %s of class %@", sel_getName(method_getName(m)), [target class]);
         id arguments = [[NuCell alloc] init];
         id cursor = arguments;
@@ -966,9 +1134,7 @@ id nu_calling_objc_method_handler(id target, Method m, NSMutableArray *args)
         id result = [block evalWithArguments:[arguments cdr] context:nil self:target];
         [arguments release];
         // ensure that methods declared to return void always return void.
-        char return_type_buffer[BUFSIZE];
-        method_getReturnType(m, return_type_buffer, BUFSIZE);
-        return (!strcmp(return_type_buffer, "v")) ? Nu__null : result;
+        return call->returnsVoid ? Nu__null : result;
     }
     
     id result;
@@ -981,99 +1147,59 @@ id nu_calling_objc_method_handler(id target, Method m, NSMutableArray *args)
     // dynamically construct the method call
     
     
-    int argument_count = method_getNumberOfArguments(m);
+    int argument_count = call->argumentCount;
     
     if ( [args count] != argument_count-2) {
         
         raise_argc_exception(s, argument_count-2, [args count]);
     }
+    else if (!call->prepared) {
+        NSLog (@"failed to prepare cif structure");
+    }
     else {
-        char return_type_buffer[BUFSIZE], arg_type_buffer[BUFSIZE];
-        method_getReturnType(m, return_type_buffer, BUFSIZE);
-        ffi_type *result_type = ffi_type_for_objc_type(&return_type_buffer[0]);
-        void *result_value = value_buffer_for_objc_type(&return_type_buffer[0]);
-        ffi_type **argument_types = (ffi_type **) malloc (argument_count * sizeof(ffi_type *));
-        void **argument_values = (void **) malloc (argument_count * sizeof(void *));
-        int *argument_needs_retained = (int *) malloc (argument_count * sizeof(int));
+        // the result and argument values share one buffer on the stack
+        char *value_buffer = (char *) alloca(call->bufferSize);
+        void *result_value = value_buffer;
+        void **argument_values = (void **) alloca(argument_count * sizeof(void *));
+        int *argument_needs_retained = (int *) alloca(argument_count * sizeof(int));
         int i;
         for (i = 0; i < argument_count; i++) {
-            
-            method_getArgumentType(m, i, &arg_type_buffer[0], BUFSIZE);
-            
-            argument_types[i] = ffi_type_for_objc_type(&arg_type_buffer[0]);
-            argument_values[i] = value_buffer_for_objc_type(&arg_type_buffer[0]);
+            argument_values[i] = value_buffer + call->argumentOffsets[i];
             if (i == 0)
                 *((id *) argument_values[i]) = target;
             else if (i == 1)
-                *((SEL *) argument_values[i]) = method_getName(m);
+                *((SEL *) argument_values[i]) = s;
             else
-                argument_needs_retained[i-2] = set_objc_value_from_nu_value(argument_values[i], [args objectAtIndex:(i-2)], &arg_type_buffer[0]);
+                argument_needs_retained[i-2] = set_objc_value_from_nu_value(argument_values[i], [args objectAtIndex:(i-2)], call->argumentTypes[i]);
         }
-        ffi_cif cif2;
-        int status = ffi_prep_cif(&cif2, FFI_DEFAULT_ABI, (unsigned int) argument_count, result_type, argument_types);
-        if (status != FFI_OK) {
-            NSLog (@"failed to prepare cif structure");
+        if (call->initializer) {
+            [target retain]; // in case an init method releases its target (to return something else), we preemptively retain it
         }
-        else {
-            const char *method_name = sel_getName(method_getName(m));
-            BOOL callingInitializer = !strncmp("init", method_name, 4);
-            if (callingInitializer) {
-                [target retain]; // in case an init method releases its target (to return something else), we preemptively retain it
-            }
-            // call the method handler
-            ffi_call(&cif2, FFI_FN(imp), result_value, argument_values);
-            // extract the return value
-            result = get_nu_value_from_objc_value(result_value, &return_type_buffer[0]);
-            // NSLog(@"result is %@", result);
-            // NSLog(@"retain count %d", [result retainCount]);
-            
-            // Return values should not require a release.
-            // Either they are owned by an existing object or are autoreleased.
-            // Exceptions to this rule are handled below.
-            // Since these methods create new objects that aren't autoreleased, we autorelease them.
-#ifdef LINUX
-            const char *methodName = sel_getName(s);
-            bool already_retained = !strcmp(methodName,"alloc") ||
-            !strcmp(methodName,"allocWithZone:") ||
-            !strcmp(methodName,"copy") ||
-            !strcmp(methodName,"copyWithZone:") ||
-            !strcmp(methodName,"mutableCopy:") ||
-            !strcmp(methodName,"mutableCopyWithZone:") ||
-            !strcmp(methodName,"new");
-#else
-            bool already_retained =               // see Anguish/Buck/Yacktman, p. 104
-            (s == @selector(alloc)) || (s == @selector(allocWithZone:))
-            || (s == @selector(copy)) || (s == @selector(copyWithZone:))
-            || (s == @selector(mutableCopy)) || (s == @selector(mutableCopyWithZone:))
-            || (s == @selector(new));
-#endif
-            // NSLog(@"already retained? %d", already_retained);
-            if (already_retained) {
-                [result autorelease];
-            }
-            
-            if (callingInitializer) {
-                if (result == target) {
-                    // NSLog(@"undoing preemptive retain of init target %@", [target className]);
-                    [target release]; // undo our preemptive retain
-                } else {
-                    // NSLog(@"keeping preemptive retain of init target %@", [target className]);
-                }
-            }
-            
-            for (i = 0; i < [args count]; i++) {
-                if (argument_needs_retained[i])
-                    [[args objectAtIndex:i] retainReferencedObject];
-            }
-            
-            // free the value structures
-            for (i = 0; i < argument_count; i++) {
-                free(argument_values[i]);
+        // call the method handler
+        ffi_call(&call->cif, FFI_FN(imp), result_value, argument_values);
+        // extract the return value
+        result = get_nu_value_from_objc_value(result_value, call->returnType);
+        // NSLog(@"result is %@", result);
+        // NSLog(@"retain count %d", [result retainCount]);
+        
+        // Since these methods create new objects that aren't autoreleased, we autorelease them.
+        // NSLog(@"already retained? %d", call->alreadyRetained);
+        if (call->alreadyRetained) {
+            [result autorelease];
+        }
+        
+        if (call->initializer) {
+            if (result == target) {
+                // NSLog(@"undoing preemptive retain of init target %@", [target className]);
+                [target release]; // undo our preemptive retain
+            } else {
+                // NSLog(@"keeping preemptive retain of init target %@", [target className]);
             }
-            free(argument_values);
-            free(result_value);
-            free(argument_types);
-            free(argument_needs_retained);
+        }
+        
+        for (i = 0; i < argument_count-2; i++) {
+            if (argument_needs_retained[i])
+                [[args objectAtIndex:i] retainReferencedObject];
         }
     }
     [result retain];
@@ -1111,6 +1237,8 @@ static void objc_calling_nu_method_handler(ffi_cif* cif, void* returnvalue, void
         [cursor setCar:value];
     }
     id result = [block evalWithArguments:[arguments cdr] context:nil self:rcv];
+    // break, continue and return-from signals that escape the method are carried through the caller as exceptions
+    nu_raise_pending_control_signal();
     //NSLog(@"in nu method handler, putting result %@ in %x with type %s", [result stringValue], (int) returnvalue, ((char **)userdata)[0]);
     char *resultType = (((char **)userdata)[0])+1;// skip the first character, it's a flag
     set_objc_value_from_nu_value(returnvalue, result, resultType);
@@ -1272,11 +1400,15 @@ id add_method_to_class(Class c, NSString *methodName, NSString *signature, NuBlo
     
     // save the block in a hash table keyed by the imp.
     // this will let us introspect methods and optimize nu-to-nu method calls
+    pthread_mutex_lock(&blockTableLock);
     if (!nu_block_table) nu_block_table = [[NSMutableDictionary alloc] init];
     // watch for problems caused by these ugly casts...
     [nu_block_table setObject:block forKey:[NSNumber numberWithUnsignedLong:(unsigned long) imp]];
+    pthread_mutex_unlock(&blockTableLock);
     // insert the method handler in the class method table
     nu_class_replaceMethod(c, selector, imp, signature_str);
+    // remember the method so that it can be added again when an image is loaded
+    nu_image_record_method(c, methodName, signature, block);
     //NSLog(@"setting handler for %s(%s) in class %s", method_name_str, signature_str, class_getName(c));
     return Nu__null;
 }
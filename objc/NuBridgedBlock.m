@@ -115,10 +115,12 @@ static void objc_calling_nu_block_handler(ffi_cif* cif, void* returnvalue, void*
     }
     //NSLog(@"in nu method handler, using arguments %@", [arguments stringValue]);
     id result = [block evalWithArguments:[arguments cdr] context:nil];
+    [arguments release];
+    // break, continue and return-from signals that escape the block are carried through the caller as exceptions
+    nu_raise_pending_control_signal();
     //NSLog(@"in nu method handler, putting result %@ in %x with type %s", [result stringValue], (size_t) returnvalue, ((char **)userdata)[0]);
     char *resultType = (((char **)userdata)[0])+1;// skip the first character, it's a flag
     set_objc_value_from_nu_value(returnvalue, result, resultType);
-    [arguments release];
     if (pool) {
         if (resultType[0] == '@')
             [*((id *)returnvalue) retain];
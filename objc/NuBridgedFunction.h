@@ -39,6 +39,7 @@
  </div>
  
  The signature string used to create a NuBridgedFunction must be a valid Objective-C type signature.
+ It is parsed and its libFFI call interface is prepared when the wrapper is created.
  In the future, convenience methods may be added to make those signatures easier to generate.
  But in practice, this has not been much of a problem.
  */
@@ -57,8 +58,17 @@
  symbol, that symbol may be used as the name of the bridged function.
  */
 - (NuBridgedFunction *) initWithName:(NSString *)name signature:(NSString *)signature;
+/*! Get the name of the wrapped function. */
+- (NSString *) name;
+/*! Get the signature of the wrapped function. */
+- (NSString *) signature;
 /*! Evaluate a bridged function with the specified arguments and context.
  Arguments must be in a Nu list.
  */
 - (id) evalWithArguments:(id)arguments context:(NSMutableDictionary *)context;
+/*! Call a function of one argument with each element of an array or list and return an array of the results.
+ Functions that take and return doubles (signature "dd") or floats ("ff") are called directly,
+ without converting each value through libFFI.
+ */
+- (NSArray *) mapValues:(id)values;
 @end
\ No newline at end of file
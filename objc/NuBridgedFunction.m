@@ -10,38 +10,103 @@
 #import "NuBridgedFunction.h"
 #import "NuBridge.h"
 #import "NuInternals.h"
+#import "NuCell.h"
+#import <alloca.h>
 
 @interface NuBridgedFunction ()
 {
     char *name;
     char *signature;
     void *function;
+    // the call interface, prepared when the function is created
+    char *returnType;
+    int argumentCount;
+    char **argumentTypes;
+    ffi_type **ffiArgumentTypes;
+    size_t *argumentOffsets;    // the offsets of argument values in a call's value buffer, which begins with the result
+    size_t bufferSize;
+    ffi_cif cif;
+    BOOL prepared;
 }
 @end
 
+// Value buffers are aligned for any type.
+static inline size_t nu_value_slot_size(size_t size)
+{
+    return (size + 15) & ~((size_t) 15);
+}
+
 @implementation NuBridgedFunction
 
 - (void) dealloc
 {
     free(name);
     free(signature);
+    free(returnType);
+    for (int i = 0; i < argumentCount; i++)
+        free(argumentTypes[i]);
+    free(argumentTypes);
+    free(ffiArgumentTypes);
+    free(argumentOffsets);
     [super dealloc];
 }
 
+// Parse the signature and prepare the call interface.
+- (void) prepareCall
+{
+    returnType = strdup(signature);
+    nu_markEndOfObjCTypeString(returnType, strlen(returnType));
+    
+    char *cursor = &signature[strlen(returnType)];
+    while (*cursor != 0) {
+        argumentTypes = (char **) realloc(argumentTypes, (argumentCount + 1) * sizeof(char *));
+        argumentTypes[argumentCount] = strdup(cursor);
+        nu_markEndOfObjCTypeString(argumentTypes[argumentCount], strlen(cursor));
+        cursor = &cursor[strlen(argumentTypes[argumentCount])];
+        argumentCount++;
+    }
+    
+    ffiArgumentTypes = (argumentCount == 0) ? NULL : (ffi_type **) malloc(argumentCount * sizeof(ffi_type *));
+    argumentOffsets = (argumentCount == 0) ? NULL : (size_t *) malloc(argumentCount * sizeof(size_t));
+    // ffi writes at least a full register for small return values
+    size_t offset = nu_value_slot_size(MAX(size_of_objc_type(returnType), sizeof(ffi_arg)));
+    for (int i = 0; i < argumentCount; i++) {
+        ffiArgumentTypes[i] = ffi_type_for_objc_type(argumentTypes[i]);
+        argumentOffsets[i] = offset;
+        offset += nu_value_slot_size(size_of_objc_type(argumentTypes[i]));
+    }
+    bufferSize = offset;
+    int status = ffi_prep_cif(&cif, FFI_DEFAULT_ABI, argumentCount, ffi_type_for_objc_type(returnType), ffiArgumentTypes);
+    prepared = (status == FFI_OK);
+}
+
 - (NuBridgedFunction *) initWithName:(NSString *)n signature:(NSString *)s
 {
-    name = strdup([n UTF8String]);
-    signature = strdup([s UTF8String]);
-    function = dlsym(RTLD_DEFAULT, name);
-    if (!function) {
-        [NSException raise:@"NuCantFindBridgedFunction"
-                    format:@"%s\n%s\n%s\n", dlerror(),
-         "If you are using a release build, try rebuilding with the KEEP_PRIVATE_EXTERNS variable set.",
-         "In Xcode, check the 'Preserve Private External Symbols' checkbox."];
+    if ((self = [super init])) {
+        name = strdup([n UTF8String]);
+        signature = strdup([s UTF8String]);
+        function = dlsym(RTLD_DEFAULT, name);
+        if (!function) {
+            [NSException raise:@"NuCantFindBridgedFunction"
+                        format:@"%s\n%s\n%s\n", dlerror(),
+             "If you are using a release build, try rebuilding with the KEEP_PRIVATE_EXTERNS variable set.",
+             "In Xcode, check the 'Preserve Private External Symbols' checkbox."];
+        }
+        [self prepareCall];
     }
     return self;
 }
 
+- (NSString *) name
+{
+    return [NSString stringWithCString:name encoding:NSUTF8StringEncoding];
+}
+
+- (NSString *) signature
+{
+    return [NSString stringWithCString:signature encoding:NSUTF8StringEncoding];
+}
+
 + (NuBridgedFunction *) functionWithName:(NSString *)name signature:(NSString *)signature
 {
     const char *function_name = [name UTF8String];
@@ -60,63 +125,32 @@
 {
     //NSLog(@"----------------------------------------");
     //NSLog(@"calling C function %s with signature %s", name, signature);
-    id result;
-    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
-    
-    char *return_type_identifier = strdup(signature);
-    nu_markEndOfObjCTypeString(return_type_identifier, strlen(return_type_identifier));
-    
-    int argument_count = 0;
-    char *argument_type_identifiers[100];
-    char *cursor = &signature[strlen(return_type_identifier)];
-    while (*cursor != 0) {
-        argument_type_identifiers[argument_count] = strdup(cursor);
-        nu_markEndOfObjCTypeString(argument_type_identifiers[argument_count], strlen(cursor));
-        cursor = &cursor[strlen(argument_type_identifiers[argument_count])];
-        argument_count++;
-    }
-    //NSLog(@"calling return type is %s", return_type_identifier);
-    int i;
-    for (i = 0; i < argument_count; i++) {
-        //    NSLog(@"argument %d type is %s", i, argument_type_identifiers[i]);
-    }
-    
-    ffi_cif *cif = (ffi_cif *)malloc(sizeof(ffi_cif));
-    
-    ffi_type *result_type = ffi_type_for_objc_type(return_type_identifier);
-    ffi_type **argument_types = (argument_count == 0) ? NULL : (ffi_type **) malloc (argument_count * sizeof(ffi_type *));
-    for (i = 0; i < argument_count; i++)
-        argument_types[i] = ffi_type_for_objc_type(argument_type_identifiers[i]);
-    
-    int status = ffi_prep_cif(cif, FFI_DEFAULT_ABI, argument_count, result_type, argument_types);
-    if (status != FFI_OK) {
+    if (!prepared) {
         NSLog (@"failed to prepare cif structure");
         return Nu__null;
     }
+    id result;
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
-    id arg_cursor = cdr;
-    void *result_value = value_buffer_for_objc_type(return_type_identifier);
-    void **argument_values = (void **) (argument_count ? malloc (argument_count * sizeof(void *)) : NULL);
+    // the result and argument values share one buffer on the stack
+    char *value_buffer = (char *) alloca(bufferSize);
+    void *result_value = value_buffer;
+    void **argument_values = (void **) alloca((argumentCount ? argumentCount : 1) * sizeof(void *));
     
-    for (i = 0; i < argument_count; i++) {
-        argument_values[i] = value_buffer_for_objc_type( argument_type_identifiers[i]);
-        id arg_value = [[arg_cursor car] evalWithContext:context];
-        set_objc_value_from_nu_value(argument_values[i], arg_value, argument_type_identifiers[i]);
+    id arg_cursor = cdr;
+    for (int i = 0; i < argumentCount; i++) {
+        argument_values[i] = value_buffer + argumentOffsets[i];
+        id arg_value = nu_evaluateCar(arg_cursor, context);
+        if (nu_control.signal) {
+            // an argument raised a break, continue or return, so the function isn't called
+            [pool drain];
+            return Nu__null;
+        }
+        set_objc_value_from_nu_value(argument_values[i], arg_value, argumentTypes[i]);
         arg_cursor = [arg_cursor cdr];
     }
-    ffi_call(cif, FFI_FN(function), result_value, argument_values);
-    result = get_nu_value_from_objc_value(result_value, return_type_identifier);
-    
-    // free the value structures
-    for (i = 0; i < argument_count; i++) {
-        free(argument_values[i]);
-        free(argument_type_identifiers[i]);
-    }
-    free(argument_values);
-    free(result_value);
-    free(return_type_identifier);
-    free(argument_types);
-    free(cif);
+    ffi_call(&cif, FFI_FN(function), result_value, argument_values);
+    result = get_nu_value_from_objc_value(result_value, returnType);
     
     [result retain];
     [pool drain];
@@ -124,4 +158,40 @@
     return result;
 }
 
+- (NSArray *) mapValues:(id)values
+{
+    if (argumentCount != 1) {
+        [NSException raise:@"NuIncorrectNumberOfArguments"
+                    format:@"mapValues: requires a function of one argument, but %s takes %d", name, argumentCount];
+    }
+    if (!IS_NOT_NULL(values))
+        return [NSMutableArray array];
+    NSArray *array = nu_objectIsKindOfClass(values, [NuCell class]) ? [values array] : values;
+    NSUInteger count = [array count];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:count];
+    if (!strcmp(returnType, "d") && !strcmp(argumentTypes[0], "d")) {
+        // functions from double to double are called directly
+        double (*f)(double) = (double (*)(double)) function;
+        for (NSUInteger i = 0; i < count; i++)
+            [results addObject:[NSNumber numberWithDouble:f([[array objectAtIndex:i] doubleValue])]];
+        return results;
+    }
+    if (!strcmp(returnType, "f") && !strcmp(argumentTypes[0], "f")) {
+        float (*f)(float) = (float (*)(float)) function;
+        for (NSUInteger i = 0; i < count; i++)
+            [results addObject:[NSNumber numberWithFloat:f([[array objectAtIndex:i] floatValue])]];
+        return results;
+    }
+    if (!prepared)
+        return results;
+    char *value_buffer = (char *) alloca(bufferSize);
+    void *argument_values[1] = {value_buffer + argumentOffsets[0]};
+    for (NSUInteger i = 0; i < count; i++) {
+        set_objc_value_from_nu_value(argument_values[0], [array objectAtIndex:i], argumentTypes[0]);
+        ffi_call(&cif, FFI_FN(function), value_buffer, argument_values);
+        [results addObject:get_nu_value_from_objc_value(value_buffer, returnType)];
+    }
+    return results;
+}
+
 @end
@@ -0,0 +1,36 @@
+//
+//  NuBytecode.h
+//  Nu
+//
+//  Compiled code for block bodies.
+//
+
+#import <Foundation/Foundation.h>
+
+/*!
+ @class NuBytecode
+ @abstract Compiled code for the body of a Nu block.
+ @discussion A NuBytecode holds the body of a block compiled to instructions for a small stack machine.
+ The core special forms (<b>if</b>, <b>unless</b>, <b>cond</b>, <b>case</b>, <b>while</b>, <b>until</b>,
+ <b>for</b>, <b>set</b>, <b>local</b>, <b>let</b>, <b>do</b>, <b>function</b>, <b>progn</b> and <b>quote</b>)
+ are compiled into jumps and stack operations, and calls of blocks evaluate their arguments
+ on the machine's stack. Calls of operators, macros and methods, and any list the compiler doesn't
+ understand, are evaluated by the tree walker, so compiled code behaves like the code it was compiled from.
+
+ Special forms are recognized when a body is compiled, by the values of their names at that time.
+ Lists whose heads are bound by an enclosing block are never treated as special forms.
+
+ Compiled code is attached to the first cell of the body, so each body is compiled once
+ and shared by every block created from it. Blocks use compiled code after they are sent
+ <b>compile</b>, or when NuBlock's <b>setCompilesBodies:</b> is set.
+ */
+@interface NuBytecode : NSObject
+
+/*! Get the compiled code for a block body, compiling it if necessary. Returns nil for an empty body. */
++ (NuBytecode *) bytecodeForBody:(id)body;
+/*! Evaluate the code in the specified context. The last expression of the body is in tail position. */
+- (id) evalWithContext:(NSMutableDictionary *)context;
+/*! Get a readable listing of the instructions. */
+- (NSString *) disassembly;
+
+@end
@@ -0,0 +1,877 @@
+//
+//  NuBytecode.m
+//  Nu
+//
+//  Compiled code for block bodies.
+//
+
+#import "NuBytecode.h"
+#import "NuInternals.h"
+#import "NuCell.h"
+#import "NuSymbol.h"
+#import "NuBlock.h"
+#import "NuScope.h"
+#import "NSDictionary+Nu.h"
+#include <alloca.h>
+
+typedef enum {
+    NU_OP_CONST,            // push operand
+    NU_OP_LOAD,             // push the value of the symbol in the car of the operand cell
+    NU_OP_EVAL,             // push the value of the car of the operand cell, using the tree walker; arg is 1 in tail position
+    NU_OP_POP,
+    NU_OP_DUP,
+    NU_OP_REPLACE,          // pop a value and store it in place of the value beneath it
+    NU_OP_JUMP,             // jump to arg
+    NU_OP_JUMP_IF_FALSE,    // pop a value and jump to arg if it is false
+    NU_OP_JUMP_IF_TRUE,     // pop a value and jump to arg if it is true
+    NU_OP_JUMP_IF_UNEQUAL,  // pop a value and jump to arg if it isn't equal to the value beneath it
+    NU_OP_HEAD,             // evaluate the head of the operand list; push it if it is a block, otherwise push the value of the list and jump to arg
+    NU_OP_TAIL_HEAD,
+    NU_OP_CALL,             // call a block with arg values pushed after it; operand is the list being evaluated
+    NU_OP_TAIL_CALL,
+    NU_OP_SET,              // assign the top value to the operand symbol like set
+    NU_OP_LOCAL,            // assign the top value to the operand symbol like local
+    NU_OP_BLOCK,            // push a block made from the operand (parameters . body)
+    NU_OP_FUNCTION,         // push a block made from the operand (name parameters . body) and bind it to its name
+    NU_OP_LET,              // call a block made from the operand (names . expressions) and operand2 body with arg values
+    NU_OP_TAIL_LET,
+    NU_OP_RETURN,           // return the top value
+    NU_OP_FORM              // resolve the head of the list in the car of the operand cell; unless it is operand2,
+                            // push the value of the list, using the tree walker, and jump to arg
+} nu_opcode;
+
+static const char *nu_opcode_names[] = {
+    "const", "load", "eval", "pop", "dup", "replace", "jump", "jump-if-false", "jump-if-true", "jump-if-unequal",
+    "head", "tail-head", "call", "tail-call", "set", "local", "block", "function", "let", "tail-let", "return", "form"
+};
+
+typedef struct nu_instruction {
+    nu_opcode opcode;
+    int arg;
+    id operand;             // not retained; operands are parts of the compiled body or are kept in constants
+    id operand2;
+} nu_instruction;
+
+// The instructions of a loop's body, where break and continue go, and the state of the machine in the body.
+typedef struct nu_loop {
+    int start;
+    int end;
+    int next;
+    int exit;
+    int depth;              // stack depth, including the loop's result
+    int calls;              // calls whose arguments are being evaluated
+} nu_loop;
+
+// The machine state that is needed to resume after an exception.
+typedef struct nu_machine_state {
+    int pc;
+    int sp;
+    NSUInteger expressionDepth;     // the depth of the expression stack on entry
+    id cell;                        // the list whose call is being made, for exception reports
+    NSUInteger cellDepth;           // the depth of the expression stack outside that call
+} nu_machine_state;
+
+typedef enum {
+    NU_FORM_NONE,
+    NU_FORM_IF,
+    NU_FORM_UNLESS,
+    NU_FORM_COND,
+    NU_FORM_CASE,
+    NU_FORM_WHILE,
+    NU_FORM_UNTIL,
+    NU_FORM_FOR,
+    NU_FORM_SET,
+    NU_FORM_LOCAL,
+    NU_FORM_LET,
+    NU_FORM_DO,
+    NU_FORM_FUNCTION,
+    NU_FORM_PROGN,
+    NU_FORM_QUOTE
+} nu_form;
+
+@interface NuBytecode ()
+{
+@public
+    nu_instruction *instructions;
+    int count;
+    int capacity;
+    nu_loop *loops;                 // innermost loops first
+    int loopCount;
+    int depth;                      // while compiling, the stack depth
+    int maxDepth;
+    int calls;                      // while compiling, the calls whose arguments are being compiled
+    NSMutableArray *constants;      // objects made by the compiler
+}
+- (id) initWithBody:(id)body;
+@end
+
+static Class NuBlockClass;
+static NuSymbol *elseSymbol;
+static NSDictionary *specialForms;
+
+static bool nu_is_symbol(id object)
+{
+    return object && (object_getClass(object) == [NuSymbol class]);
+}
+
+static bool nu_is_cell(id object)
+{
+    return object && (object != Nu__null) && nu_objectIsKindOfClass(object, [NuCell class]);
+}
+
+// Returns true if a list ends with nil, so that it can be walked with car and cdr.
+static bool nu_is_proper_list(id list)
+{
+    while (nu_is_cell(list))
+        list = [list cdr];
+    return !list || (list == Nu__null);
+}
+
+#pragma mark - Compiler
+
+static int nu_emit(NuBytecode *code, nu_opcode opcode, int arg, id operand, id operand2, int stackEffect)
+{
+    if (code->count == code->capacity) {
+        code->capacity = code->capacity ? 2 * code->capacity : 32;
+        code->instructions = (nu_instruction *) realloc(code->instructions, code->capacity * sizeof(nu_instruction));
+    }
+    nu_instruction *instruction = &code->instructions[code->count];
+    instruction->opcode = opcode;
+    instruction->arg = arg;
+    instruction->operand = operand;
+    instruction->operand2 = operand2;
+    code->depth += stackEffect;
+    if (code->depth > code->maxDepth)
+        code->maxDepth = code->depth;
+    return code->count++;
+}
+
+// Point a jump at the next instruction.
+static void nu_patch(NuBytecode *code, int jump)
+{
+    code->instructions[jump].arg = code->count;
+}
+
+static id nu_keep(NuBytecode *code, id object)
+{
+    [code->constants addObject:object];
+    return object;
+}
+
+// Find the special form that a list is, if it is one that can be compiled, and the operator that implements it.
+// The head is only assumed to name the operator when the block's scope doesn't bind it; the compiled code
+// checks that it still resolves to the operator in the context that the code is evaluated in.
+static nu_form nu_special_form(id form, id *operatorValue)
+{
+    id head = [form car];
+    if (!nu_is_symbol(head))
+        return NU_FORM_NONE;
+    nu_lexical_address *address = nu_cell_lexical_address(form, false);
+    if (address && address->scope) {
+        int depth, slot;
+        nu_lexical_address_location(address, &depth, &slot);
+        if (slot >= 0)
+            return NU_FORM_NONE;
+    }
+    id value = [head value];
+    if (!value)
+        return NU_FORM_NONE;
+    NSNumber *number = [specialForms objectForKey:NSStringFromClass(object_getClass(value))];
+    if (!number)
+        return NU_FORM_NONE;
+    *operatorValue = value;
+    return (nu_form) [number intValue];
+}
+
+static void nu_compile_expression(NuBytecode *code, id holder, bool tail);
+
+// Compile expressions held by cells in an array; the value of the last one is left on the stack.
+static void nu_compile_holders(NuBytecode *code, NSArray *holders, bool tail)
+{
+    NSUInteger n = [holders count];
+    if (n == 0) {
+        nu_emit(code, NU_OP_CONST, 0, Nu__null, nil, 1);
+        return;
+    }
+    for (NSUInteger i = 0; i < n; i++) {
+        nu_compile_expression(code, [holders objectAtIndex:i], tail && (i == n - 1));
+        if (i < n - 1)
+            nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+    }
+}
+
+static void nu_compile_sequence(NuBytecode *code, id list, bool tail)
+{
+    NSMutableArray *holders = [NSMutableArray array];
+    for (id cursor = list; nu_is_cell(cursor); cursor = [cursor cdr])
+        [holders addObject:cursor];
+    nu_compile_holders(code, holders, tail);
+}
+
+// Compile the expressions that an if operator evaluates when its test has the specified outcome.
+static void nu_compile_if_branch(NuBytecode *code, id expressions, bool testIsTrue, bool tail)
+{
+    bool noneIsTrue = !testIsTrue;
+    NSMutableArray *holders = [NSMutableArray array];
+    for (id cursor = expressions; nu_is_cell(cursor); cursor = [cursor cdr]) {
+        id nextExpression = [cursor car];
+        if (nu_is_cell(nextExpression)) {
+            if ([nextExpression car] == elseSymbol) {
+                if (noneIsTrue)
+                    [holders addObject:cursor];
+            }
+            else if (testIsTrue) {
+                [holders addObject:cursor];
+            }
+        }
+        else if (nextExpression == elseSymbol) {
+            testIsTrue = noneIsTrue;
+            noneIsTrue = false;
+        }
+        else if (testIsTrue) {
+            [holders addObject:cursor];
+        }
+    }
+    nu_compile_holders(code, holders, tail);
+}
+
+static void nu_compile_if(NuBytecode *code, id form, bool flipped, bool tail)
+{
+    id cdr = [form cdr];
+    int base = code->depth;
+    nu_compile_expression(code, cdr, false);
+    int jump = nu_emit(code, flipped ? NU_OP_JUMP_IF_TRUE : NU_OP_JUMP_IF_FALSE, 0, nil, nil, -1);
+    nu_compile_if_branch(code, [cdr cdr], true, tail);
+    int end = nu_emit(code, NU_OP_JUMP, 0, nil, nil, 0);
+    nu_patch(code, jump);
+    code->depth = base;
+    nu_compile_if_branch(code, [cdr cdr], false, tail);
+    nu_patch(code, end);
+}
+
+static void nu_compile_cond(NuBytecode *code, id form, bool tail)
+{
+    int base = code->depth;
+    NSMutableArray *ends = [NSMutableArray array];
+    for (id pairs = [form cdr]; nu_is_cell(pairs); pairs = [pairs cdr]) {
+        id clause = [pairs car];
+        code->depth = base;
+        nu_compile_expression(code, clause, false);
+        nu_emit(code, NU_OP_DUP, 0, nil, nil, 1);
+        int next = nu_emit(code, NU_OP_JUMP_IF_FALSE, 0, nil, nil, -1);
+        if (nu_is_cell([clause cdr])) {
+            // a clause without a body has the value of its test
+            nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+            nu_compile_sequence(code, [clause cdr], tail);
+        }
+        [ends addObject:[NSNumber numberWithInt:nu_emit(code, NU_OP_JUMP, 0, nil, nil, 0)]];
+        nu_patch(code, next);
+        code->depth = base + 1;
+        nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+    }
+    nu_emit(code, NU_OP_CONST, 0, Nu__null, nil, 1);
+    for (NSNumber *end in ends)
+        nu_patch(code, [end intValue]);
+}
+
+static void nu_compile_case(NuBytecode *code, id form, bool tail)
+{
+    id cdr = [form cdr];
+    int base = code->depth;
+    NSMutableArray *ends = [NSMutableArray array];
+    nu_compile_expression(code, cdr, false);
+    id cases = [cdr cdr];
+    while ([cases cdr] != Nu__null) {
+        id clause = [cases car];
+        nu_compile_expression(code, clause, false);
+        int next = nu_emit(code, NU_OP_JUMP_IF_UNEQUAL, 0, nil, nil, -1);
+        nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+        nu_compile_sequence(code, [clause cdr], tail);
+        [ends addObject:[NSNumber numberWithInt:nu_emit(code, NU_OP_JUMP, 0, nil, nil, 0)]];
+        nu_patch(code, next);
+        code->depth = base + 1;
+        cases = [cases cdr];
+    }
+    // the last clause is used when no other one matches
+    nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+    nu_compile_sequence(code, [[cases car] cdr], tail);
+    for (NSNumber *end in ends)
+        nu_patch(code, [end intValue]);
+}
+
+static void nu_add_loop(NuBytecode *code, int start, int end, int next, int exit, int depth)
+{
+    code->loops = (nu_loop *) realloc(code->loops, (code->loopCount + 1) * sizeof(nu_loop));
+    nu_loop *loop = &code->loops[code->loopCount++];
+    loop->start = start;
+    loop->end = end;
+    loop->next = next;
+    loop->exit = exit;
+    loop->depth = depth;
+    loop->calls = code->calls;
+}
+
+// Compile the body of a loop; each expression's value replaces the loop's result.
+static void nu_compile_loop_body(NuBytecode *code, id body)
+{
+    for (id cursor = body; nu_is_cell(cursor); cursor = [cursor cdr]) {
+        nu_compile_expression(code, cursor, false);
+        nu_emit(code, NU_OP_REPLACE, 0, nil, nil, -1);
+    }
+}
+
+static void nu_compile_while(NuBytecode *code, id form, bool until)
+{
+    id cdr = [form cdr];
+    nu_emit(code, NU_OP_CONST, 0, Nu__null, nil, 1);
+    int loopDepth = code->depth;
+    int test = code->count;
+    nu_compile_expression(code, cdr, false);
+    int exit = nu_emit(code, until ? NU_OP_JUMP_IF_TRUE : NU_OP_JUMP_IF_FALSE, 0, nil, nil, -1);
+    int start = code->count;
+    nu_compile_loop_body(code, [cdr cdr]);
+    int end = code->count;
+    nu_emit(code, NU_OP_JUMP, test, nil, nil, 0);
+    nu_patch(code, exit);
+    nu_add_loop(code, start, end, test, code->count, loopDepth);
+}
+
+static void nu_compile_for(NuBytecode *code, id form)
+{
+    id cdr = [form cdr];
+    id controls = [cdr car];
+    nu_compile_expression(code, controls, false);
+    nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+    nu_emit(code, NU_OP_CONST, 0, Nu__null, nil, 1);
+    int loopDepth = code->depth;
+    int test = code->count;
+    nu_compile_expression(code, [controls cdr], false);
+    int exit = nu_emit(code, NU_OP_JUMP_IF_FALSE, 0, nil, nil, -1);
+    int start = code->count;
+    nu_compile_loop_body(code, [cdr cdr]);
+    int end = code->count;
+    int next = code->count;
+    nu_compile_expression(code, [[controls cdr] cdr], false);
+    nu_emit(code, NU_OP_POP, 0, nil, nil, -1);
+    nu_emit(code, NU_OP_JUMP, test, nil, nil, 0);
+    nu_patch(code, exit);
+    nu_add_loop(code, start, end, next, code->count, loopDepth);
+}
+
+static void nu_compile_let(NuBytecode *code, id form, bool tail)
+{
+    id bindings = [[form cdr] car];
+    NSMutableArray *names = [NSMutableArray array];
+    NSMutableArray *holders = [NSMutableArray array];
+    if ([[bindings car] atom]) {
+        [names addObject:[bindings car]];
+        [holders addObject:[bindings cdr]];
+    }
+    else {
+        for (id cursor = bindings; nu_is_cell(cursor); cursor = [cursor cdr]) {
+            [names addObject:[[cursor car] car]];
+            [holders addObject:[[cursor car] cdr]];
+        }
+    }
+    // the block is called with the value expressions as its *args, as the let operator does
+    id nameList = Nu__null;
+    id expressionList = Nu__null;
+    for (NSInteger i = [names count] - 1; i >= 0; i--) {
+        nameList = [NuCell cellWithCar:[names objectAtIndex:i] cdr:nameList];
+        expressionList = [NuCell cellWithCar:[[holders objectAtIndex:i] car] cdr:expressionList];
+    }
+    for (id holder in holders)
+        nu_compile_expression(code, holder, false);
+    int n = (int) [holders count];
+    nu_emit(code, tail ? NU_OP_TAIL_LET : NU_OP_LET, n,
+            nu_keep(code, [NuCell cellWithCar:nameList cdr:expressionList]), [[form cdr] cdr], 1 - n);
+}
+
+static void nu_compile_call(NuBytecode *code, id form, bool tail)
+{
+    int head = nu_emit(code, tail ? NU_OP_TAIL_HEAD : NU_OP_HEAD, 0, form, nil, 1);
+    code->calls++;
+    int n = 0;
+    for (id cursor = [form cdr]; nu_is_cell(cursor); cursor = [cursor cdr]) {
+        nu_compile_expression(code, cursor, false);
+        n++;
+    }
+    code->calls--;
+    nu_emit(code, tail ? NU_OP_TAIL_CALL : NU_OP_CALL, n, form, nil, -n);
+    nu_patch(code, head);
+}
+
+// Returns true if a special form is well-formed enough to be compiled.
+static bool nu_form_can_compile(nu_form kind, id form)
+{
+    id cdr = [form cdr];
+    switch (kind) {
+        case NU_FORM_IF:
+        case NU_FORM_UNLESS:
+        case NU_FORM_WHILE:
+        case NU_FORM_UNTIL:
+            return nu_is_cell(cdr);
+        case NU_FORM_COND:
+            for (id cursor = cdr; nu_is_cell(cursor); cursor = [cursor cdr])
+                if (!nu_is_cell([cursor car]) || !nu_is_proper_list([cursor car]))
+                    return false;
+            return true;
+        case NU_FORM_CASE:
+            if (!nu_is_cell(cdr) || !nu_is_cell([cdr cdr]))
+                return false;
+            for (id cursor = [cdr cdr]; nu_is_cell(cursor); cursor = [cursor cdr])
+                if (!nu_is_cell([cursor car]) || !nu_is_proper_list([cursor car]))
+                    return false;
+            return true;
+        case NU_FORM_FOR: {
+            id controls = [cdr car];
+            return nu_is_cell(controls) && nu_is_cell([controls cdr]) && nu_is_cell([[controls cdr] cdr]);
+        }
+        case NU_FORM_SET:
+        case NU_FORM_LOCAL:
+            return nu_is_symbol([cdr car]) && nu_is_cell([cdr cdr]);
+        case NU_FORM_LET: {
+            id bindings = [cdr car];
+            if (!nu_is_cell(bindings))
+                return false;
+            if ([[bindings car] atom])
+                return nu_is_cell([bindings cdr]);
+            for (id cursor = bindings; nu_is_cell(cursor); cursor = [cursor cdr])
+                if (!nu_is_cell([cursor car]) || !nu_is_cell([[cursor car] cdr]))
+                    return false;
+            return true;
+        }
+        case NU_FORM_DO:
+            return nu_is_cell(cdr);
+        case NU_FORM_FUNCTION:
+            return nu_is_cell(cdr) && nu_is_cell([cdr cdr]);
+        case NU_FORM_QUOTE:
+            return nu_is_cell(cdr);
+        default:
+            return true;
+    }
+}
+
+// Compile the expression in the car of a cell.
+static void nu_compile_expression(NuBytecode *code, id holder, bool tail)
+{
+    id expression = [holder car];
+    if (nu_is_symbol(expression)) {
+        nu_emit(code, NU_OP_LOAD, 0, holder, nil, 1);
+        return;
+    }
+    if (!expression || (expression == Nu__null) || [expression isKindOfClass:[NSNumber class]]) {
+        nu_emit(code, NU_OP_CONST, 0, expression ? expression : Nu__null, nil, 1);
+        return;
+    }
+    if (!nu_is_cell(expression) || !nu_is_proper_list(expression)) {
+        nu_emit(code, NU_OP_EVAL, tail, holder, nil, 1);
+        return;
+    }
+    id operatorValue = nil;
+    nu_form kind = nu_special_form(expression, &operatorValue);
+    if (!nu_form_can_compile(kind, expression)) {
+        nu_emit(code, NU_OP_EVAL, tail, holder, nil, 1);
+        return;
+    }
+    // a context may bind the head to something else, and then the list is evaluated as it is written
+    int guard = (kind != NU_FORM_NONE) ? nu_emit(code, NU_OP_FORM, 0, holder, nu_keep(code, operatorValue), 0) : -1;
+    id cdr = [expression cdr];
+    switch (kind) {
+        case NU_FORM_IF:
+            nu_compile_if(code, expression, false, tail);
+            break;
+        case NU_FORM_UNLESS:
+            nu_compile_if(code, expression, true, tail);
+            break;
+        case NU_FORM_COND:
+            nu_compile_cond(code, expression, tail);
+            break;
+        case NU_FORM_CASE:
+            nu_compile_case(code, expression, tail);
+            break;
+        case NU_FORM_WHILE:
+            nu_compile_while(code, expression, false);
+            break;
+        case NU_FORM_UNTIL:
+            nu_compile_while(code, expression, true);
+            break;
+        case NU_FORM_FOR:
+            nu_compile_for(code, expression);
+            break;
+        case NU_FORM_SET:
+            nu_compile_expression(code, [cdr cdr], false);
+            nu_emit(code, NU_OP_SET, 0, [cdr car], nil, 0);
+            break;
+        case NU_FORM_LOCAL:
+            nu_compile_expression(code, [cdr cdr], false);
+            nu_emit(code, NU_OP_LOCAL, 0, [cdr car], nil, 0);
+            break;
+        case NU_FORM_LET:
+            nu_compile_let(code, expression, tail);
+            break;
+        case NU_FORM_DO:
+            nu_emit(code, NU_OP_BLOCK, 0, cdr, nil, 1);
+            break;
+        case NU_FORM_FUNCTION:
+            nu_emit(code, NU_OP_FUNCTION, 0, cdr, nil, 1);
+            break;
+        case NU_FORM_PROGN:
+            nu_compile_sequence(code, cdr, tail);
+            break;
+        case NU_FORM_QUOTE:
+            nu_emit(code, NU_OP_CONST, 0, [cdr car], nil, 1);
+            break;
+        default:
+            if (nu_is_symbol([expression car]) || nu_is_cell([expression car]))
+                nu_compile_call(code, expression, tail);
+            else
+                nu_emit(code, NU_OP_EVAL, tail, holder, nil, 1);
+            break;
+    }
+    if (guard >= 0)
+        nu_patch(code, guard);
+}
+
+#pragma mark - Machine
+
+// Make a block the way the function operator does.
+static NuBlock *nu_make_function(id cdr, NSMutableDictionary *context)
+{
+    id symbol = [cdr car];
+    NuBlock *block = [[[NuBlock alloc] initWithParameters:[[cdr cdr] car] body:[[cdr cdr] cdr] context:context] autorelease];
+    [block compile];
+    [context setPossiblyNullObject:block forKey:symbol];
+#ifdef CLOSE_ON_VALUES
+    [[block context] setPossiblyNullObject:block forKey:symbol];
+#endif
+    return block;
+}
+
+// Collect the top n values of the stack into a list.
+static inline id nu_stack_list(id *stack, int sp, int n)
+{
+    id list = Nu__null;
+    for (int i = sp - 1; i >= sp - n; i--)
+        list = [NuCell cellWithCar:stack[i] cdr:list];
+    return list;
+}
+
+// The machine's stack holds retained values, since the objects that own them may let them go
+// while they are on it, for example when a variable is set while its old value is an argument.
+static inline void nu_machine_release(id *stack, int from, int to)
+{
+    for (int i = from; i < to; i++)
+        [stack[i] release];
+}
+
+// Handle a pending control signal raised by the instruction at state->pc.
+// Returns true if a loop in the code handled it and evaluation should continue.
+static bool nu_machine_handle_signal(NuBytecode *code, nu_machine_state *state, id *stack)
+{
+    int index = state->pc;
+    for (int i = 0; i < code->loopCount; i++) {
+        nu_loop *loop = &code->loops[i];
+        if ((index < loop->start) || (index >= loop->end))
+            continue;
+        if (nu_control.signal == NuControlSignalBreak)
+            state->pc = loop->exit;
+        else if (nu_control.signal == NuControlSignalContinue)
+            state->pc = loop->next;
+        else
+            break;
+        nu_clear_control_signal();
+        nu_machine_release(stack, loop->depth, state->sp);
+        state->sp = loop->depth;
+        nu_expression_stack_unwind(state->expressionDepth + loop->calls);
+        return true;
+    }
+    nu_expression_stack_unwind(state->expressionDepth);
+    return false;
+}
+
+static id nu_machine_run(NuBytecode *code, NSMutableDictionary *context, id *stack, nu_machine_state *state)
+{
+    nu_instruction *instructions = code->instructions;
+    int pc = state->pc;
+    int sp = state->sp;
+    while (1) {
+        nu_instruction *instruction = &instructions[pc];
+        state->pc = pc++;
+        state->sp = sp;
+        switch (instruction->opcode) {
+            case NU_OP_CONST:
+                stack[sp++] = [instruction->operand retain];
+                continue;
+            case NU_OP_LOAD:
+                stack[sp++] = [nu_evaluateCar(instruction->operand, context) retain];
+                break;
+            case NU_OP_EVAL:
+                stack[sp++] = [nu_evaluateTail(instruction->operand, context, instruction->arg) retain];
+                break;
+            case NU_OP_POP:
+                [stack[--sp] release];
+                continue;
+            case NU_OP_DUP:
+                stack[sp] = [stack[sp - 1] retain];
+                sp++;
+                continue;
+            case NU_OP_REPLACE:
+                sp--;
+                [stack[sp - 1] release];
+                stack[sp - 1] = stack[sp];
+                continue;
+            case NU_OP_JUMP:
+                pc = instruction->arg;
+                continue;
+            case NU_OP_JUMP_IF_FALSE: {
+                id value = stack[--sp];
+                if (!nu_valueIsTrue(value))
+                    pc = instruction->arg;
+                [value release];
+                continue;
+            }
+            case NU_OP_JUMP_IF_TRUE: {
+                id value = stack[--sp];
+                if (nu_valueIsTrue(value))
+                    pc = instruction->arg;
+                [value release];
+                continue;
+            }
+            case NU_OP_JUMP_IF_UNEQUAL: {
+                id value = stack[sp - 1];
+                if (![value isEqual:stack[sp - 2]])
+                    pc = instruction->arg;
+                [value release];
+                sp--;
+                continue;
+            }
+            case NU_OP_HEAD:
+            case NU_OP_TAIL_HEAD: {
+                id form = instruction->operand;
+                state->cell = form;
+                state->cellDepth = nu_expression_stack_depth();
+                id head = nu_evaluateCar(form, context);
+                state->cell = nil;
+                if (nu_objectIsKindOfClass(head, NuBlockClass)) {
+                    // the arguments follow, and the call pops the expression when it is done
+                    nu_expression_stack_enter(form);
+                    stack[sp++] = [head retain];
+                }
+                else {
+                    stack[sp++] = [nu_applyCell(form, head, context, instruction->opcode == NU_OP_TAIL_HEAD) retain];
+                    pc = instruction->arg;
+                }
+                break;
+            }
+            case NU_OP_CALL:
+            case NU_OP_TAIL_CALL: {
+                int n = instruction->arg;
+                id values = nu_stack_list(stack, sp, n);
+                NuBlock *block = stack[sp - n - 1];
+                id form = instruction->operand;
+                state->cell = form;
+                state->cellDepth = nu_expression_stack_depth() - 1;
+                id result = (instruction->opcode == NU_OP_TAIL_CALL)
+                ? [block tailCallWithArguments:[form cdr] values:values]
+                : [block callWithArguments:[form cdr] values:values];
+                state->cell = nil;
+                nu_expression_stack_unwind(state->cellDepth);
+                [result retain];
+                nu_machine_release(stack, sp - n - 1, sp);
+                sp -= n + 1;
+                stack[sp++] = result;
+                break;
+            }
+            case NU_OP_SET: {
+                id value = [nu_setSymbolValue(instruction->operand, stack[sp - 1], context) retain];
+                [stack[sp - 1] release];
+                stack[sp - 1] = value;
+                break;
+            }
+            case NU_OP_LOCAL:
+                [context setPossiblyNullObject:stack[sp - 1] forKey:instruction->operand];
+                continue;
+            case NU_OP_BLOCK: {
+                id cdr = instruction->operand;
+                NuBlock *block = [[NuBlock alloc] initWithParameters:[cdr car] body:[cdr cdr] context:context];
+                stack[sp++] = [block compile];
+                continue;
+            }
+            case NU_OP_FUNCTION:
+                stack[sp++] = [nu_make_function(instruction->operand, context) retain];
+                continue;
+            case NU_OP_LET:
+            case NU_OP_TAIL_LET: {
+                int n = instruction->arg;
+                id values = nu_stack_list(stack, sp, n);
+                id names = [instruction->operand car];
+                id expressions = [instruction->operand cdr];
+                NuBlock *block = [[[NuBlock alloc] initWithParameters:names body:instruction->operand2 context:context] autorelease];
+                [block compile];
+                id result = (instruction->opcode == NU_OP_TAIL_LET)
+                ? [block tailCallWithArguments:expressions values:values]
+                : [block callWithArguments:expressions values:values];
+                [result retain];
+                nu_machine_release(stack, sp - n, sp);
+                sp -= n;
+                stack[sp++] = result;
+                break;
+            }
+            case NU_OP_RETURN:
+                return stack[sp - 1];
+            case NU_OP_FORM: {
+                // the head is resolved through the list's lexical address, as the tree walker resolves it
+                id form = [instruction->operand car];
+                if (nu_evaluateCar(form, context) == instruction->operand2)
+                    continue;
+                stack[sp++] = [nu_evaluateTail(instruction->operand, context, false) retain];
+                pc = instruction->arg;
+                break;
+            }
+        }
+        if (nu_control.signal) {
+            state->sp = sp;
+            if (!nu_machine_handle_signal(code, state, stack))
+                return Nu__null;
+            pc = state->pc;
+            sp = state->sp;
+        }
+    }
+}
+
+@implementation NuBytecode
+
++ (void) initialize
+{
+    if (self == [NuBytecode class]) {
+        NuBlockClass = [NuBlock class];
+        elseSymbol = [[[NuSymbolTable sharedSymbolTable] symbolWithString:@"else"] retain];
+        specialForms = [[NSDictionary alloc] initWithObjectsAndKeys:
+                        [NSNumber numberWithInt:NU_FORM_IF], @"Nu_if_operator",
+                        [NSNumber numberWithInt:NU_FORM_UNLESS], @"Nu_unless_operator",
+                        [NSNumber numberWithInt:NU_FORM_COND], @"Nu_cond_operator",
+                        [NSNumber numberWithInt:NU_FORM_CASE], @"Nu_case_operator",
+                        [NSNumber numberWithInt:NU_FORM_WHILE], @"Nu_while_operator",
+                        [NSNumber numberWithInt:NU_FORM_UNTIL], @"Nu_until_operator",
+                        [NSNumber numberWithInt:NU_FORM_FOR], @"Nu_for_operator",
+                        [NSNumber numberWithInt:NU_FORM_SET], @"Nu_set_operator",
+                        [NSNumber numberWithInt:NU_FORM_LOCAL], @"Nu_local_operator",
+                        [NSNumber numberWithInt:NU_FORM_LET], @"Nu_let_operator",
+                        [NSNumber numberWithInt:NU_FORM_DO], @"Nu_do_operator",
+                        [NSNumber numberWithInt:NU_FORM_FUNCTION], @"Nu_function_operator",
+                        [NSNumber numberWithInt:NU_FORM_PROGN], @"Nu_progn_operator",
+                        [NSNumber numberWithInt:NU_FORM_QUOTE], @"Nu_quote_operator",
+                        nil];
+    }
+}
+
++ (NuBytecode *) bytecodeForBody:(id)body
+{
+    if (!nu_is_cell(body))
+        return nil;
+    nu_lexical_address *address = nu_cell_lexical_address(body, true);
+    NuBytecode *bytecode = __atomic_load_n(&address->bytecode, __ATOMIC_ACQUIRE);
+    if (!bytecode) {
+        // threads that compile the same body at once keep the first result
+        bytecode = [[NuBytecode alloc] initWithBody:body];
+        id expected = nil;
+        if (!__atomic_compare_exchange_n(&address->bytecode, &expected, bytecode, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            [bytecode release];
+            bytecode = expected;
+        }
+    }
+    return bytecode;
+}
+
+- (id) initWithBody:(id)body
+{
+    if ((self = [super init])) {
+        constants = [[NSMutableArray alloc] init];
+        nu_compile_sequence(self, body, true);
+        nu_emit(self, NU_OP_RETURN, 0, nil, nil, 0);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    free(instructions);
+    free(loops);
+    [constants release];
+    [super dealloc];
+}
+
+- (id) evalWithContext:(NSMutableDictionary *)context
+{
+    id *stack = (id *) alloca((maxDepth + 1) * sizeof(id));
+    nu_machine_state state = {0, 0, nu_expression_stack_depth(), nil, 0};
+    id result = nil;
+    bool finished = false;
+    @try
+    {
+        while (!finished) {
+            @try
+            {
+                result = [nu_machine_run(self, context, stack, &state) retain];
+                finished = true;
+            }
+            @catch (NSException *e) {
+                id cell = state.cell;
+                state.cell = nil;
+                if (cell)
+                    nu_cellValueForException(cell, e, state.cellDepth);
+                else if (!nu_control_signal_from_exception(e))
+                    @throw e;
+                // the exception carried a break, continue or return through native code
+                if (!nu_machine_handle_signal(self, &state, stack)) {
+                    result = [Nu__null retain];
+                    finished = true;
+                }
+            }
+        }
+    }
+    @finally
+    {
+        // release the values that are still on the stack, including the result
+        nu_machine_release(stack, 0, state.sp);
+    }
+    return [result autorelease];
+}
+
+- (NSString *) disassembly
+{
+    NSMutableString *listing = [NSMutableString string];
+    for (int i = 0; i < count; i++) {
+        nu_instruction *instruction = &instructions[i];
+        [listing appendFormat:@"%4d %s", i, nu_opcode_names[instruction->opcode]];
+        switch (instruction->opcode) {
+            case NU_OP_JUMP:
+            case NU_OP_JUMP_IF_FALSE:
+            case NU_OP_JUMP_IF_TRUE:
+            case NU_OP_JUMP_IF_UNEQUAL:
+            case NU_OP_HEAD:
+            case NU_OP_TAIL_HEAD:
+            case NU_OP_CALL:
+            case NU_OP_TAIL_CALL:
+            case NU_OP_LET:
+            case NU_OP_TAIL_LET:
+            case NU_OP_FORM:
+                [listing appendFormat:@" %d", instruction->arg];
+                break;
+            default:
+                break;
+        }
+        if (instruction->operand)
+            [listing appendFormat:@" %@", [instruction->operand stringValue]];
+        [listing appendString:@"\n"];
+    }
+    return listing;
+}
+
+- (NSString *) description
+{
+    return [NSString stringWithFormat:@"<NuBytecode %d instructions>", count];
+}
+
+@end
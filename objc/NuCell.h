@@ -57,6 +57,15 @@
 - (id) map:(id) block;
 /*! Iterate over each element of the list headed by a NuCell, using the provided block to combine elements into a single return value. */
 - (id) reduce:(id) block from:(id) initial;
+/*! Apply the provided block to each element of the list headed by a NuCell on the worker pool (see NuParallel.h), returning a list of the results in order. */
+- (id) pmap:(id) block;
+/*! Evaluate the provided block for each element of the list headed by a NuCell on the worker pool, returning a list of the elements for which it evaluates non-nil. */
+- (id) pselect:(id) block;
+/*! Evaluate the provided block for each element of the list headed by a NuCell on the worker pool. */
+- (id) peach:(id) block;
+/*! Reduce ranges of the list headed by a NuCell with the provided block on the worker pool, starting each range from initial,
+ and combine the results of the ranges in order with combiner. Initial should be a value that combiner leaves unchanged. */
+- (id) preduce:(id) block from:(id) initial combine:(id) combiner;
 /*! Get the length of a list beginning at a NuCell. */
 - (NSUInteger) length;
 /*! Get the number of elements in a list. Synonymous with length. */
@@ -64,8 +73,12 @@
 /*! Get an array containing the elements of a list. */
 - (NSMutableArray *) array;
 
+/*! Set the source file and line of a cell. Locations are kept in a table shared by all cells,
+ and cells that were not created by the parser have none. */
 - (void) setFile:(int) f line:(int) l;
+/*! Get the index of a cell's source file, or -1 if it has no location. */
 - (int) file;
+/*! Get the source line of a cell, or -1 if it has no location. */
 - (int) line;
 
 - (void)encodeWithCoder:(NSCoder *)coder;
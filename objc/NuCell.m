@@ -11,18 +11,385 @@
 #import "NSString+Nu.h"
 #import "NuException.h"
 #import "NuBlock.h"
+#import "NuOperators.h"
+#import "NuScope.h"
+#import "NuFrame.h"
+#import "NuMacro.h"
+#import "NuParallel.h"
+#import "NSArray+Nu.h"
+#import "NuProfiler.h"
+#include <pthread.h>
+#include <limits.h>
 
 @interface NuCell ()
 {
     id car;
     id cdr;
-    int file;
-    int line;
+    nu_lexical_address *address;
+    // the number of references beyond the first; cells count their own references so that they can be reused
+    uint32_t references;
+    // the index of the cell's source location, or zero if it wasn't created by the parser
+    uint32_t location;
 }
 @end
 
 @implementation NuCell
 
+#pragma mark - Source locations
+
+// The file and line of each cell created by the parser. Every distinct location is stored once,
+// in a table that only grows, and cells hold the index of their location. Locations are stored in
+// chunks that never move, so they are read without locking. Finding the index of a location takes
+// the lock of one of several shards, chosen by the location's hash; a thread that asks for the same
+// location as its previous request (as the parser does for the cells of a line) takes no lock.
+
+typedef struct nu_source_location {
+    int file;
+    int line;
+} nu_source_location;
+
+#define NU_SOURCE_LOCATION_CHUNK_BITS 12
+#define NU_SOURCE_LOCATION_CHUNK_SIZE (1 << NU_SOURCE_LOCATION_CHUNK_BITS)
+#define NU_SOURCE_LOCATION_CHUNKS (1 << 16)
+#define NU_SOURCE_LOCATION_SHARDS 16
+
+static nu_source_location *sourceLocationChunks[NU_SOURCE_LOCATION_CHUNKS];
+static uint32_t sourceLocationCount = 1;            // entry zero is unused
+
+typedef struct nu_source_location_shard {
+    pthread_mutex_t lock;
+    uint32_t *table;                                // location indices, open-addressed by file and line
+    uint32_t size;
+    uint32_t count;
+} nu_source_location_shard;
+
+static nu_source_location_shard sourceLocationShards[NU_SOURCE_LOCATION_SHARDS];
+static pthread_once_t sourceLocationShardsOnce = PTHREAD_ONCE_INIT;
+
+static __thread struct {
+    int file;
+    int line;
+    uint32_t index;
+} lastSourceLocation = {-1, -1, 0};
+
+static void nu_source_location_init_shards(void)
+{
+    for (int i = 0; i < NU_SOURCE_LOCATION_SHARDS; i++)
+        pthread_mutex_init(&sourceLocationShards[i].lock, NULL);
+}
+
+static inline uint32_t nu_source_location_hash(int file, int line)
+{
+    uint64_t key = (((uint64_t) (uint32_t) file) << 32) | (uint32_t) line;
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static inline nu_source_location *nu_source_location_entry(uint32_t index)
+{
+    nu_source_location *chunk = __atomic_load_n(&sourceLocationChunks[index >> NU_SOURCE_LOCATION_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    return chunk ? &chunk[index & (NU_SOURCE_LOCATION_CHUNK_SIZE - 1)] : NULL;
+}
+
+// Store a new location and return its index, or zero if the table is full.
+static uint32_t nu_source_location_add(int file, int line)
+{
+    uint32_t index = __atomic_fetch_add(&sourceLocationCount, 1, __ATOMIC_RELAXED);
+    uint32_t c = index >> NU_SOURCE_LOCATION_CHUNK_BITS;
+    if (c >= NU_SOURCE_LOCATION_CHUNKS)
+        return 0;
+    nu_source_location *chunk = __atomic_load_n(&sourceLocationChunks[c], __ATOMIC_ACQUIRE);
+    if (!chunk) {
+        nu_source_location *created = (nu_source_location *) calloc(NU_SOURCE_LOCATION_CHUNK_SIZE, sizeof(nu_source_location));
+        if (__atomic_compare_exchange_n(&sourceLocationChunks[c], &chunk, created, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            chunk = created;
+        else
+            free(created);
+    }
+    nu_source_location *entry = &chunk[index & (NU_SOURCE_LOCATION_CHUNK_SIZE - 1)];
+    entry->file = file;
+    entry->line = line;
+    return index;
+}
+
+static void nu_source_location_resize(nu_source_location_shard *shard, uint32_t size)
+{
+    uint32_t *table = (uint32_t *) calloc(size, sizeof(uint32_t));
+    uint32_t i;
+    for (i = 0; i < shard->size; i++) {
+        uint32_t index = shard->table[i];
+        if (!index)
+            continue;
+        nu_source_location *entry = nu_source_location_entry(index);
+        uint32_t slot = nu_source_location_hash(entry->file, entry->line) & (size - 1);
+        while (table[slot])
+            slot = (slot + 1) & (size - 1);
+        table[slot] = index;
+    }
+    free(shard->table);
+    shard->table = table;
+    shard->size = size;
+}
+
+static uint32_t nu_source_location_index(int file, int line)
+{
+    if ((file == -1) && (line == -1))
+        return 0;
+    if ((lastSourceLocation.file == file) && (lastSourceLocation.line == line))
+        return lastSourceLocation.index;
+    pthread_once(&sourceLocationShardsOnce, nu_source_location_init_shards);
+    uint32_t hash = nu_source_location_hash(file, line);
+    nu_source_location_shard *shard = &sourceLocationShards[hash >> 28];
+    pthread_mutex_lock(&shard->lock);
+    if (!shard->table)
+        nu_source_location_resize(shard, 256);
+    uint32_t mask = shard->size - 1;
+    uint32_t slot = hash & mask;
+    uint32_t index;
+    while ((index = shard->table[slot])) {
+        nu_source_location *entry = nu_source_location_entry(index);
+        if ((entry->file == file) && (entry->line == line))
+            break;
+        slot = (slot + 1) & mask;
+    }
+    if (!index) {
+        index = nu_source_location_add(file, line);
+        if (index) {
+            shard->table[slot] = index;
+            shard->count++;
+            if (2 * shard->count > shard->size)
+                nu_source_location_resize(shard, 2 * shard->size);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    lastSourceLocation.file = file;
+    lastSourceLocation.line = line;
+    lastSourceLocation.index = index;
+    return index;
+}
+
+static nu_source_location nu_source_location_at(uint32_t index)
+{
+    nu_source_location location = {-1, -1};
+    if (index) {
+        nu_source_location *entry = nu_source_location_entry(index);
+        if (entry)
+            location = *entry;
+    }
+    return location;
+}
+
+#pragma mark - Cell allocation
+
+// Cells are allocated from per-thread pools. A cell that is released for the last time goes back to
+// the pool of the thread that released it, still initialized as an object, and is handed out again
+// by the next allocation on that thread. On Darwin, new cells are carved from slabs of
+// NU_CELL_SLAB_COUNT cells, and slabs are never returned to malloc, even when the threads that
+// allocated them exit, so a process keeps the slabs it has allocated for as long as it runs.
+// Elsewhere cells are allocated individually and each pool keeps at most NU_CELL_POOL_LIMIT of them.
+// When a thread exits, its free cells are freed, or on Darwin passed on to the next thread that
+// needs a new slab.
+// Only NuCells themselves are pooled; subclasses are allocated and freed normally.
+
+#define NU_CELL_SLAB_COUNT 1024
+#define NU_CELL_POOL_LIMIT (1 << 20)
+
+typedef struct nu_cell_pool {
+    NuCell *free;               // released cells, linked through their cars
+    NSUInteger count;
+    bool registered;            // set when the pool has a thread-exit destructor
+    bool exited;                // set when the pool's thread has exited
+#ifdef DARWIN
+    char *slab;
+    NSUInteger slabRemaining;
+#endif
+} nu_cell_pool;
+
+static __thread nu_cell_pool cellPool = {nil, 0};
+
+static Class nuCellClass = Nil;
+static size_t nuCellSize = 0;
+
+static pthread_key_t cellPoolKey;
+static pthread_once_t cellPoolKeyOnce = PTHREAD_ONCE_INIT;
+
+#ifdef DARWIN
+// Slab cells can't be freed one at a time, so the free cells of threads that exit are kept here
+// until another thread adopts them instead of allocating a new slab.
+static pthread_mutex_t orphanedCellsLock = PTHREAD_MUTEX_INITIALIZER;
+static NuCell *orphanedCells = nil;
+static NSUInteger orphanedCellCount = 0;
+
+static void nu_cell_orphan(NuCell *first, NuCell *last, NSUInteger count)
+{
+    pthread_mutex_lock(&orphanedCellsLock);
+    last->car = orphanedCells;
+    __atomic_store_n(&orphanedCells, first, __ATOMIC_RELAXED);
+    orphanedCellCount += count;
+    pthread_mutex_unlock(&orphanedCellsLock);
+}
+
+static void nu_cell_pool_adopt_orphans(nu_cell_pool *pool)
+{
+    pthread_mutex_lock(&orphanedCellsLock);
+    pool->free = orphanedCells;
+    pool->count = orphanedCellCount;
+    __atomic_store_n(&orphanedCells, nil, __ATOMIC_RELAXED);
+    orphanedCellCount = 0;
+    pthread_mutex_unlock(&orphanedCellsLock);
+}
+#endif
+
+// Give back the cells of a thread that is exiting. Cells that are released after this are not pooled.
+static void nu_cell_pool_release(void *value)
+{
+    nu_cell_pool *pool = (nu_cell_pool *) value;
+    pool->exited = true;
+#ifdef DARWIN
+    // the unused part of the current slab becomes free cells too
+    while (pool->slabRemaining) {
+        NuCell *cell = (NuCell *) pool->slab;
+        cell->car = pool->free;
+        pool->free = cell;
+        pool->count++;
+        pool->slab += nuCellSize;
+        pool->slabRemaining--;
+    }
+    if (pool->free) {
+        NuCell *last = pool->free;
+        while (last->car)
+            last = (NuCell *) last->car;
+        nu_cell_orphan(pool->free, last, pool->count);
+    }
+#else
+    while (pool->free) {
+        NuCell *cell = pool->free;
+        pool->free = (NuCell *) cell->car;
+        NSDeallocateObject(cell);
+    }
+#endif
+    pool->free = nil;
+    pool->count = 0;
+}
+
+static void nu_cell_pool_create_key(void)
+{
+    pthread_key_create(&cellPoolKey, nu_cell_pool_release);
+}
+
+static void nu_cell_pool_register(nu_cell_pool *pool)
+{
+    pthread_once(&cellPoolKeyOnce, nu_cell_pool_create_key);
+    pthread_setspecific(cellPoolKey, pool);
+    pool->registered = true;
+}
+
+static NuCell *nu_cell_allocate(void)
+{
+    nu_cell_pool *pool = &cellPool;
+    NuCell *cell = pool->free;
+    if (cell) {
+        pool->free = (NuCell *) cell->car;
+        pool->count--;
+#ifdef DARWIN
+        // objc_constructInstance expects zero-filled memory, and the car still links the free list
+        memset(cell, 0, nuCellSize);
+        objc_constructInstance(nuCellClass, cell);
+#else
+        cell->car = nil;
+        cell->cdr = nil;
+        cell->address = NULL;
+        cell->references = 0;
+        cell->location = 0;
+#endif
+        return cell;
+    }
+#ifdef DARWIN
+    if (pool->slabRemaining == 0) {
+        if (__atomic_load_n(&orphanedCells, __ATOMIC_RELAXED) && !pool->exited) {
+            nu_cell_pool_adopt_orphans(pool);
+            if (pool->free)
+                return nu_cell_allocate();
+        }
+        if (!pool->registered)
+            nu_cell_pool_register(pool);
+        pool->slab = (char *) calloc(NU_CELL_SLAB_COUNT, nuCellSize);
+        pool->slabRemaining = NU_CELL_SLAB_COUNT;
+    }
+    cell = (NuCell *) objc_constructInstance(nuCellClass, pool->slab);
+    pool->slab += nuCellSize;
+    pool->slabRemaining--;
+    return cell;
+#else
+    return (NuCell *) NSAllocateObject(nuCellClass, 0, NSDefaultMallocZone());
+#endif
+}
+
+static void nu_cell_recycle(NuCell *cell)
+{
+    nu_cell_pool *pool = &cellPool;
+#ifdef DARWIN
+    objc_destructInstance(cell);
+    if (pool->exited) {
+        nu_cell_orphan(cell, cell, 1);
+        return;
+    }
+#else
+    if ((pool->count >= NU_CELL_POOL_LIMIT) || pool->exited) {
+        NSDeallocateObject(cell);
+        return;
+    }
+#endif
+    if (!pool->registered)
+        nu_cell_pool_register(pool);
+    cell->car = pool->free;
+    pool->free = cell;
+    pool->count++;
+}
+
+static inline void nu_cell_free_address(nu_lexical_address *address)
+{
+    if (address) {
+        [address->scope release];
+        [address->bodyScope release];
+        [address->bytecode release];
+        free(address->inlineCache);
+        nu_macro_expansion_free(address->expansion);
+        free(address);
+    }
+}
+
++ (void) initialize
+{
+    if (self == [NuCell class]) {
+        nuCellClass = self;
+        nuCellSize = (class_getInstanceSize(self) + 15) & ~((size_t) 15);
+    }
+}
+
++ (id) allocWithZone:(NSZone *)zone
+{
+    if (self == nuCellClass)
+        return nu_cell_allocate();
+    return [super allocWithZone:zone];
+}
+
+- (id) retain
+{
+    __atomic_add_fetch(&references, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
+- (oneway void) release
+{
+    if (__atomic_fetch_sub(&references, 1, __ATOMIC_ACQ_REL) == 0)
+        [self dealloc];
+}
+
+- (NSUInteger) retainCount
+{
+    return (NSUInteger) __atomic_load_n(&references, __ATOMIC_RELAXED) + 1;
+}
+
 + (id) cellWithCar:(id)car cdr:(id)cdr
 {
     NuCell *cell = [[self alloc] init];
@@ -36,8 +403,8 @@
     if ((self = [super init])) {
         car = Nu__null;
         cdr = Nu__null;
-        file = -1;
-        line = -1;
+        location = 0;
+        address = NULL;
     }
     return self;
 }
@@ -45,21 +412,270 @@
 - (void) dealloc
 {
     [car release];
-    [cdr release];
+    nu_cell_free_address(address);
+    // release the rest of the list here instead of recursively, so that long lists don't exhaust the stack
+    id rest = cdr;
+    while (rest && (object_getClass(rest) == nuCellClass)) {
+        NuCell *cell = (NuCell *) rest;
+        if (__atomic_fetch_sub(&cell->references, 1, __ATOMIC_ACQ_REL) != 0) {
+            rest = nil;
+            break;
+        }
+        rest = cell->cdr;
+        [cell->car release];
+        nu_cell_free_address(cell->address);
+        nu_cell_recycle(cell);
+    }
+    [rest release];
+    if (object_getClass(self) == nuCellClass) {
+        nu_cell_recycle(self);
+        return;
+    }
     [super dealloc];
 }
 
+nu_lexical_address *nu_cell_lexical_address(id object, bool create)
+{
+    NuCell *cell = (NuCell *) object;
+    nu_lexical_address *address = __atomic_load_n(&cell->address, __ATOMIC_ACQUIRE);
+    if (!address && create) {
+        // cells may be shared by threads, so an address is only attached if no other thread attached one first
+        address = (nu_lexical_address *) calloc(1, sizeof(nu_lexical_address));
+        nu_lexical_address *expected = NULL;
+        if (!__atomic_compare_exchange_n(&cell->address, &expected, address, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(address);
+            address = expected;
+        }
+    }
+    return address;
+}
+
+// The expressions that each thread is currently evaluating, innermost last.
+// They are only read when an error is reported or a profile sample is taken, so cells are stored without being retained.
+// Each thread's stack is registered when it is first used, so that the sampling profiler can ask the threads
+// that are evaluating expressions to record samples; a thread records its pending samples the next time
+// it enters or leaves an expression.
+typedef struct nu_expression_stack {
+    NSUInteger depth;
+    NSUInteger capacity;
+    id *cells;
+    unsigned int pendingSamples;
+    unsigned long epoch;            // the global value epoch at the thread's last quiescent point, or 0 if it isn't evaluating
+    struct nu_expression_stack *next;
+} nu_expression_stack;
+
+static __thread nu_expression_stack expressionStack = {0, 0, NULL, 0, 0, NULL};
+
+static pthread_mutex_t expressionStacksLock = PTHREAD_MUTEX_INITIALIZER;
+static nu_expression_stack *expressionStacks = NULL;
+static pthread_key_t expressionStackKey;
+static pthread_once_t expressionStackKeyOnce = PTHREAD_ONCE_INIT;
+
+static void nu_expression_stack_unregister(void *value)
+{
+    nu_expression_stack *stack = (nu_expression_stack *) value;
+    pthread_mutex_lock(&expressionStacksLock);
+    nu_expression_stack **link = &expressionStacks;
+    while (*link && (*link != stack))
+        link = &(*link)->next;
+    if (*link)
+        *link = stack->next;
+    pthread_mutex_unlock(&expressionStacksLock);
+    free(stack->cells);
+    stack->cells = NULL;
+    stack->capacity = stack->depth = 0;
+}
+
+static void nu_expression_stack_create_key(void)
+{
+    pthread_key_create(&expressionStackKey, nu_expression_stack_unregister);
+}
+
+static void nu_expression_stack_register(nu_expression_stack *stack)
+{
+    pthread_once(&expressionStackKeyOnce, nu_expression_stack_create_key);
+    pthread_setspecific(expressionStackKey, stack);
+    pthread_mutex_lock(&expressionStacksLock);
+    stack->next = expressionStacks;
+    expressionStacks = stack;
+    pthread_mutex_unlock(&expressionStacksLock);
+}
+
+void nu_expression_stacks_request_samples(void)
+{
+    pthread_mutex_lock(&expressionStacksLock);
+    for (nu_expression_stack *stack = expressionStacks; stack; stack = stack->next) {
+        if (__atomic_load_n(&stack->depth, __ATOMIC_RELAXED))
+            __atomic_add_fetch(&stack->pendingSamples, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&expressionStacksLock);
+}
+
+static void nu_expression_stack_record_samples(nu_expression_stack *stack)
+{
+    unsigned int count = __atomic_exchange_n(&stack->pendingSamples, 0, __ATOMIC_RELAXED);
+    if (count && stack->depth)
+        nu_profiler_record_sample(stack->cells, stack->depth, count);
+}
+
+unsigned long nu_expression_stacks_oldest_epoch(void)
+{
+    unsigned long oldest = ULONG_MAX;
+    pthread_mutex_lock(&expressionStacksLock);
+    for (nu_expression_stack *stack = expressionStacks; stack; stack = stack->next) {
+        unsigned long epoch = __atomic_load_n(&stack->epoch, __ATOMIC_SEQ_CST);
+        if (epoch && (epoch < oldest))
+            oldest = epoch;
+    }
+    pthread_mutex_unlock(&expressionStacksLock);
+    return oldest;
+}
+
+static void nu_expression_stack_grow(nu_expression_stack *stack)
+{
+    if (!stack->capacity)
+        nu_expression_stack_register(stack);
+    stack->capacity = stack->capacity ? 2 * stack->capacity : 256;
+    stack->cells = (id *) realloc(stack->cells, stack->capacity * sizeof(id));
+}
+
+bool nu_evaluation_begin(void)
+{
+    nu_expression_stack *stack = &expressionStack;
+    if (stack->epoch)
+        return false;
+    if (!stack->capacity)
+        nu_expression_stack_grow(stack);
+    __atomic_store_n(&stack->epoch, __atomic_load_n(&nu_global_value_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    // global values must not be read before the epoch is visible to threads that replace them
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return true;
+}
+
+void nu_evaluation_end(void)
+{
+    __atomic_store_n(&expressionStack.epoch, 0, __ATOMIC_RELEASE);
+    nu_release_retired_values();
+}
+
+// Called where the thread holds no unretained pointers to memory that can be retired: when a block returns
+// and between the iterations of loops. Memory retired before the epoch that it announces can be reclaimed.
+void nu_evaluation_quiescent(void)
+{
+    nu_expression_stack *stack = &expressionStack;
+    if (!stack->epoch)
+        return;
+    unsigned long epoch = __atomic_load_n(&nu_global_value_epoch, __ATOMIC_ACQUIRE);
+    if (epoch == stack->epoch)
+        return;
+    __atomic_store_n(&stack->epoch, epoch, __ATOMIC_RELEASE);
+    nu_release_retired_values();
+}
+
+static inline NSUInteger nu_expression_stack_push(id cell)
+{
+    nu_expression_stack *stack = &expressionStack;
+    if (stack->depth == stack->capacity)
+        nu_expression_stack_grow(stack);
+    if (stack->pendingSamples)
+        nu_expression_stack_record_samples(stack);
+    stack->cells[stack->depth] = cell;
+    return stack->depth++;
+}
+
+static inline void nu_expression_stack_pop(NSUInteger depth)
+{
+    nu_expression_stack *stack = &expressionStack;
+    if (stack->pendingSamples)
+        nu_expression_stack_record_samples(stack);
+    stack->depth = depth;
+}
+
+NSUInteger nu_expression_stack_enter(id cell)
+{
+    return nu_expression_stack_push(cell);
+}
+
+id nu_current_expression(void)
+{
+    nu_expression_stack *stack = &expressionStack;
+    return stack->depth ? stack->cells[stack->depth - 1] : nil;
+}
+
+NSUInteger nu_expression_stack_depth(void)
+{
+    return expressionStack.depth;
+}
+
+void nu_expression_stack_unwind(NSUInteger depth)
+{
+    if (depth < expressionStack.depth)
+        nu_expression_stack_pop(depth);
+}
+
+id nu_evaluateCar(id cell, NSMutableDictionary *context)
+{
+    static Class cellClass = nil;
+    if (!cellClass)
+        cellClass = [NuCell class];
+    if (cell && (cell != Nu__null) && nu_objectIsKindOfClass(cell, cellClass)) {
+        NuCell *c = (NuCell *) cell;
+        nu_lexical_address *a = c->address;
+        if (a && a->scope && (a->scope == nu_context_scope(context)))
+            return nu_frame_lookup_resolved(c->car, a, context);
+        return [c->car evalWithContext:context];
+    }
+    return [[cell car] evalWithContext:context];
+}
+
+id nu_evaluateTail(id cell, NSMutableDictionary *context, bool tail)
+{
+    id expression = [cell car];
+    if (tail && expression && (expression != Nu__null) && nu_objectIsKindOfClass(expression, [NuCell class])) {
+        nu_tail_call.position = true;
+        return [expression evalWithContext:context];
+    }
+    return nu_evaluateCar(cell, context);
+}
+
+id nu_evaluateBody(id expressions, NSMutableDictionary *context, id result)
+{
+    while (expressions && (expressions != Nu__null)) {
+        id value = nu_evaluateCar(expressions, context);
+        if (nu_control.signal)
+            break;
+        result = value;
+        expressions = [expressions cdr];
+    }
+    return result;
+}
+
 - (bool) atom {return false;}
 
 - (id) car {return car;}
 
 - (id) cdr {return cdr;}
 
+// A cell that begins a message caches its selector and a cell that begins a macro call caches
+// its expansion, so changing it empties the caches.
+static inline void nu_cell_forget_message(nu_lexical_address *address)
+{
+    if (address && address->inlineCache) {
+        free(address->inlineCache);
+        address->inlineCache = NULL;
+    }
+    if (address && address->expansion) {
+        nu_macro_expansion_free(address->expansion);
+        address->expansion = NULL;
+    }
+}
+
 - (void) setCar:(id) c
 {
     [c retain];
     [car release];
     car = c;
+    nu_cell_forget_message(address);
 }
 
 - (void) setCdr:(id) c
@@ -67,6 +683,7 @@
     [c retain];
     [cdr release];
     cdr = c;
+    nu_cell_forget_message(address);
 }
 
 // additional accessors, for efficiency (from Nu)
@@ -236,45 +853,120 @@
 
 - (void) addToException:(NuException*)e value:(id)value
 {
-    const char *parsedFilename = nu_parsedFilename(self->file);
+    nu_source_location source = nu_source_location_at(location);
+    const char *parsedFilename = nu_parsedFilename(source.file);
     
     if (parsedFilename) {
         NSString* filename = [NSString stringWithCString:parsedFilename encoding:NSUTF8StringEncoding];
-        [e addFunction:value lineNumber:[self line] filename:filename];
+        [e addFunction:value lineNumber:source.line filename:filename];
     }
     else {
-        [e addFunction:value lineNumber:[self line]];
+        [e addFunction:value lineNumber:source.line];
+    }
+}
+
+// Handle an exception raised while evaluating the list. Exceptions that carry control signals through
+// native code become pending signals again; others are annotated with the list's location and rethrown.
+- (id) valueForException:(NSException *)e expressionDepth:(NSUInteger)depth
+{
+    nu_expression_stack_unwind(depth);
+    if (nu_objectIsKindOfClass(e, [NuException class])) {
+        [self addToException:(NuException *) e value:[car stringValue]];
+        @throw e;
     }
+    if (nu_control_signal_from_exception(e))
+        return Nu__null;
+    NuException* nuException = [[NuException alloc] initWithName:[e name]
+                                                          reason:[e reason]
+                                                        userInfo:[e userInfo]];
+    [self addToException:nuException value:[car stringValue]];
+    @throw nuException;
+    return nil;
+}
+
+// Call the evaluated head of a list with the rest of the list.
+static inline id nu_cell_apply(NuCell *cell, id value, NSMutableDictionary *context, bool tail)
+{
+    // to improve error reporting, keep track of the currently-evaluating expression
+    NSUInteger depth = nu_expression_stack_push(cell);
+    id result;
+    if (tail && nu_objectIsKindOfClass(value, [NuBlock class])) {
+        // the caller's block will evaluate this call after its own body has finished
+        result = [value tailCallWithArguments:cell->cdr context:context];
+    }
+    else {
+        if (tail && nu_objectIsKindOfClass(value, [NuOperator class]) && [value propagatesTailPosition])
+            nu_tail_call.position = true;
+        result = [value evalWithArguments:cell->cdr context:context];
+    }
+    nu_expression_stack_pop(depth);
+    return result;
+}
+
+id nu_applyCell(id cell, id value, NSMutableDictionary *context, bool tail)
+{
+    NSUInteger depth = expressionStack.depth;
+    @try
+    {
+        return nu_cell_apply((NuCell *) cell, value, context, tail);
+    }
+    @catch (NSException* e) {
+        return [cell valueForException:e expressionDepth:depth];
+    }
+}
+
+id nu_cellValueForException(id cell, NSException *exception, NSUInteger depth)
+{
+    return [cell valueForException:exception expressionDepth:depth];
 }
 
 - (id) evalWithContext:(NSMutableDictionary *)context
 {
+    if (!expressionStack.epoch && nu_evaluation_begin()) {
+        // this is the outermost evaluation on this thread
+        @try
+        {
+            return [self evalWithContext:context];
+        }
+        @finally
+        {
+            nu_evaluation_end();
+        }
+    }
+    bool tail = nu_take_tail_position();
+    // nothing is evaluated while a break, continue or return is unwinding
+    if (nu_control.signal)
+        return Nu__null;
+    
     id value = nil;
     id result = nil;
+    NSUInteger depth = expressionStack.depth;
     
     @try
     {
-        value = [car evalWithContext:context];
+        if (address && address->scope && (address->scope == nu_context_scope(context)))
+            value = nu_frame_lookup_resolved(car, address, context);
+        else
+            value = [car evalWithContext:context];
         
 #ifdef DARWIN
         if (NU_LIST_EVAL_BEGIN_ENABLED()) {
-            if ((self->line != -1) && (self->file != -1)) {
-                NU_LIST_EVAL_BEGIN(nu_parsedFilename(self->file), self->line);
+            nu_source_location source = nu_source_location_at(location);
+            if ((source.line != -1) && (source.file != -1)) {
+                NU_LIST_EVAL_BEGIN(nu_parsedFilename(source.file), source.line);
             }
             else {
                 NU_LIST_EVAL_BEGIN("", 0);
             }
         }
 #endif
-        // to improve error reporting, add the currently-evaluating expression to the context
-        [context setObject:self forKey:[[NuSymbolTable sharedSymbolTable] symbolWithString:@"_expression"]];
-        
-        result = [value evalWithArguments:cdr context:context];
+        result = nu_cell_apply(self, value, context, tail);
         
 #ifdef DARWIN
         if (NU_LIST_EVAL_END_ENABLED()) {
-            if ((self->line != -1) && (self->file != -1)) {
-                NU_LIST_EVAL_END(nu_parsedFilename(self->file), self->line);
+            nu_source_location source = nu_source_location_at(location);
+            if ((source.line != -1) && (source.file != -1)) {
+                NU_LIST_EVAL_END(nu_parsedFilename(source.file), source.line);
             }
             else {
                 NU_LIST_EVAL_END("", 0);
@@ -282,23 +974,8 @@
         }
 #endif
     }
-    @catch (NuException* nuException) {
-        [self addToException:nuException value:[car stringValue]];
-        @throw nuException;
-    }
     @catch (NSException* e) {
-        if (   nu_objectIsKindOfClass(e, [NuBreakException class])
-            || nu_objectIsKindOfClass(e, [NuContinueException class])
-            || nu_objectIsKindOfClass(e, [NuReturnException class])) {
-            @throw e;
-        }
-        else {
-            NuException* nuException = [[NuException alloc] initWithName:[e name]
-                                                                  reason:[e reason]
-                                                                userInfo:[e userInfo]];
-            [self addToException:nuException value:[car stringValue]];
-            @throw nuException;
-        }
+        result = [self valueForException:e expressionDepth:depth];
     }
     
     return result;
@@ -312,6 +989,8 @@
         while (cursor && (cursor != Nu__null)) {
             [args setCar:[cursor car]];
             [block evalWithArguments:args context:Nu__null];
+            if (nu_loop_should_stop())
+                break;
             cursor = [cursor cdr];
         }
         [args release];
@@ -329,6 +1008,8 @@
             [args setCar:[cursor car]];
             [[args cdr] setCar:[[cursor cdr] car]];
             [block evalWithArguments:args context:Nu__null];
+            if (nu_loop_should_stop())
+                break;
             cursor = [[cursor cdr] cdr];
         }
         [args release];
@@ -347,6 +1028,8 @@
             [args setCar:[cursor car]];
             [[args cdr] setCar:@(i)];
             [block evalWithArguments:args context:Nu__null];
+            if (nu_loop_should_stop())
+                break;
             cursor = [cursor cdr];
             i++;
         }
@@ -365,9 +1048,17 @@
         while (cursor && (cursor != Nu__null)) {
             [args setCar:[cursor car]];
             id result = [block evalWithArguments:args context:Nu__null];
-            if (nu_valueIsTrue(result)) {
-                [resultCursor setCdr:[NuCell cellWithCar:[cursor car] cdr:[resultCursor cdr]]];
-                resultCursor = [resultCursor cdr];
+            if (nu_control.signal) {
+                // a continue skips this element; a break or return ends the selection
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else if (nu_valueIsTrue(result)) {
+                NuCell *next = [[NuCell alloc] init];
+                [next setCar:[cursor car]];
+                [resultCursor setCdr:next];
+                [next release];
+                resultCursor = next;
             }
             cursor = [cursor cdr];
         }
@@ -387,7 +1078,11 @@
         while (cursor && (cursor != Nu__null)) {
             [args setCar:[cursor car]];
             id result = [block evalWithArguments:args context:Nu__null];
-            if (nu_valueIsTrue(result)) {
+            if (nu_control.signal) {
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else if (nu_valueIsTrue(result)) {
                 [args release];
                 return [cursor car];
             }
@@ -408,9 +1103,19 @@
         while (cursor && (cursor != Nu__null)) {
             [args setCar:[cursor car]];
             id result = [block evalWithArguments:args context:Nu__null];
-            [resultCursor setCdr:[NuCell cellWithCar:result cdr:[resultCursor cdr]]];
+            if (nu_control.signal) {
+                // a continue skips this element; a break or return ends the map
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else {
+                NuCell *next = [[NuCell alloc] init];
+                [next setCar:result];
+                [resultCursor setCdr:next];
+                [next release];
+                resultCursor = next;
+            }
             cursor = [cursor cdr];
-            resultCursor = [resultCursor cdr];
         }
         [args release];
     }
@@ -449,7 +1154,14 @@
         while (cursor && (cursor != Nu__null)) {
             [args setCar:result];
             [[args cdr] setCar:[cursor car]];
-            result = [block evalWithArguments:args context:Nu__null];
+            id value = [block evalWithArguments:args context:Nu__null];
+            if (nu_control.signal) {
+                // a continue keeps the value accumulated so far; a break or return ends the reduction
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else
+                result = value;
             cursor = [cursor cdr];
         }
         [args release];
@@ -457,6 +1169,49 @@
     return result;
 }
 
+- (id) pmap:(id) block
+{
+    if (!nu_objectIsKindOfClass(block, [NuBlock class]))
+        return Nu__null;
+    NSArray *elements = [self array];
+    id *results = (id *) [[NSMutableData dataWithLength:([elements count] + 1) * sizeof(id)] mutableBytes];
+    NSUInteger count = nu_parallel_map(block, elements, nil, results);
+    NuCell *result = [[NSArray arrayWithObjects:results count:count] list];
+    for (NSUInteger i = 0; i < count; i++)
+        [results[i] release];
+    return result;
+}
+
+- (id) pselect:(id) block
+{
+    if (!nu_objectIsKindOfClass(block, [NuBlock class]))
+        return Nu__null;
+    NSArray *elements = [self array];
+    id *results = (id *) [[NSMutableData dataWithLength:([elements count] + 1) * sizeof(id)] mutableBytes];
+    NSUInteger count = nu_parallel_map(block, elements, nil, results);
+    NSMutableArray *selected = [NSMutableArray array];
+    for (NSUInteger i = 0; i < count; i++) {
+        if (nu_valueIsTrue(results[i]))
+            [selected addObject:[elements objectAtIndex:i]];
+        [results[i] release];
+    }
+    return [selected list];
+}
+
+- (id) peach:(id) block
+{
+    if (nu_objectIsKindOfClass(block, [NuBlock class]))
+        nu_parallel_map(block, [self array], nil, NULL);
+    return self;
+}
+
+- (id) preduce:(id) block from:(id) initial combine:(id) combiner
+{
+    if (!nu_objectIsKindOfClass(block, [NuBlock class]))
+        return initial;
+    return nu_parallel_reduce(block, [self array], nil, initial, combiner);
+}
+
 - (NSUInteger) length
 {
     int count = 0;
@@ -503,12 +1258,11 @@
 
 - (void) setFile:(int) f line:(int) l
 {
-    file = f;
-    line = l;
+    location = nu_source_location_index(f, l);
 }
 
-- (int) file {return file;}
-- (int) line {return line;}
+- (int) file {return nu_source_location_at(location).file;}
+- (int) line {return nu_source_location_at(location).line;}
 @end
 
 @interface NuCellWithComments ()
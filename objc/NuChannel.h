@@ -0,0 +1,59 @@
+//
+//  NuChannel.h
+//  Nu
+//
+//  Bounded channels for passing values between threads.
+//
+
+#import <Foundation/Foundation.h>
+
+/*!
+ @class NuChannel
+ @abstract A bounded queue of values that threads pass to each other.
+ @discussion In Nu programs, channels are created with <b>(channel capacity)</b>.
+ <b>(ch put:x)</b> adds a value to a channel, waiting while the channel is full, and <b>(ch take)</b>
+ removes the oldest value, waiting while the channel is empty. Values are taken in the order they were put.
+
+ <b>(ch close)</b> closes a channel: putting a value into a closed channel raises a NuChannelClosed exception,
+ and once the values that were put before it was closed have been taken, <b>take</b> returns nil without waiting.
+ <b>(ch each:block)</b> calls a block with each value that is taken until the channel is closed and empty.
+
+ <b>(select (ch1 block1) (ch2 block2) ... (else expressions...))</b> takes a value from the first of several
+ channels that has one and returns the result of calling its block with the value. If none of them has a value,
+ the expressions of the <b>else</b> clause are evaluated if there is one; otherwise <b>select</b> waits for a value.
+ It returns nil once all of the channels are closed and empty.
+
+ Threads of the worker pool run other tasks while they wait on channels, like they do while
+ they wait for futures, so a task can wait for a value that a queued task will put. A waiting task
+ can only continue after the tasks that its thread started have finished, so tasks that wait on
+ each other both ways should use channels with room for the values they put.
+ */
+@interface NuChannel : NSObject
+
+/*! Create a channel that holds up to capacity values. A capacity of zero is treated as one. */
+- (id) initWithCapacity:(NSUInteger) capacity;
+/*! Add a value to the channel, waiting while it is full. Raises an exception if the channel is closed. */
+- (void) put:(id) value;
+/*! Remove and return the oldest value, waiting while the channel is empty. Returns nil if the channel is closed and empty. */
+- (id) take;
+/*! Call a block with each value that is taken from the channel until it is closed and empty. */
+- (id) each:(id) block;
+/*! Close the channel. */
+- (void) close;
+/*! Returns true if the channel has been closed. */
+- (BOOL) isClosed;
+/*! Get the number of values in the channel. */
+- (NSUInteger) count;
+/*! Get the number of values that the channel can hold. */
+- (NSUInteger) capacity;
+
+@end
+
+// Take a value from a channel without waiting. Returns true and stores the value if one was taken;
+// otherwise stores whether the channel is closed in closed if it is not NULL.
+bool nu_channel_poll(NuChannel *channel, id *value, bool *closed);
+
+// Take a value from the first of count channels that has one, waiting if none of them has one and wait is true.
+// Returns the index of the channel, or -1 if no value was taken because the channels are all closed and empty
+// or because wait is false.
+NSInteger nu_channel_select(NuChannel **channels, NSUInteger count, bool wait, id *value);
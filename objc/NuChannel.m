@@ -0,0 +1,325 @@
+//
+//  NuChannel.m
+//  Nu
+//
+//  Bounded channels for passing values between threads.
+//
+
+#import "NuChannel.h"
+#import "NuInternals.h"
+#import "NuCell.h"
+#import "NuParallel.h"
+
+#import <pthread.h>
+#import <time.h>
+
+// A thread that is selecting from several channels registers a waiter with each of them,
+// and the channels signal the waiter when values are put into them or they are closed.
+typedef struct nu_channel_waiter {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    bool signalled;
+} nu_channel_waiter;
+
+@interface NuChannel ()
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    id *values;                     // retained; a ring buffer of capacity values
+    NSUInteger head;                // the oldest value
+    NSUInteger count;
+    NSUInteger capacity;
+    bool closed;
+    int takers;                     // threads waiting in take
+    int putters;                    // threads waiting in put:
+    nu_channel_waiter **waiters;
+    NSUInteger waiterCount;
+    NSUInteger waiterCapacity;
+}
+@end
+
+static void nu_channel_waiter_signal(nu_channel_waiter *waiter)
+{
+    pthread_mutex_lock(&waiter->lock);
+    waiter->signalled = true;
+    pthread_cond_signal(&waiter->ready);
+    pthread_mutex_unlock(&waiter->lock);
+}
+
+// Wait on a condition with its lock held; the caller must check its condition again afterward.
+// A thread of the worker pool runs other tasks instead, since the task that will signal
+// the condition may be queued behind the one that is waiting.
+static void nu_channel_wait(pthread_cond_t *condition, pthread_mutex_t *lock)
+{
+    if (!nu_parallel_is_pool_thread()) {
+        pthread_cond_wait(condition, lock);
+        return;
+    }
+    pthread_mutex_unlock(lock);
+    bool helped = nu_parallel_help();
+    pthread_mutex_lock(lock);
+    if (helped)
+        return;
+    // nothing else to do, so wait briefly for the condition or for more tasks
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(condition, lock, &deadline);
+}
+
+@implementation NuChannel
+
+- (id) init
+{
+    return [self initWithCapacity:1];
+}
+
+- (id) initWithCapacity:(NSUInteger) c
+{
+    if ((self = [super init])) {
+        capacity = (c > 0) ? c : 1;
+        values = (id *) calloc(capacity, sizeof(id));
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&notEmpty, NULL);
+        pthread_cond_init(&notFull, NULL);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    for (NSUInteger i = 0; i < count; i++)
+        [values[(head + i) % capacity] release];
+    free(values);
+    free(waiters);
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&notEmpty);
+    pthread_cond_destroy(&notFull);
+    [super dealloc];
+}
+
+// Must be called with the channel's lock held.
+- (void) signalWaiters
+{
+    for (NSUInteger i = 0; i < waiterCount; i++)
+        nu_channel_waiter_signal(waiters[i]);
+}
+
+- (void) addWaiter:(nu_channel_waiter *) waiter
+{
+    pthread_mutex_lock(&lock);
+    if (waiterCount == waiterCapacity) {
+        waiterCapacity = waiterCapacity ? 2 * waiterCapacity : 4;
+        waiters = (nu_channel_waiter **) realloc(waiters, waiterCapacity * sizeof(nu_channel_waiter *));
+    }
+    waiters[waiterCount++] = waiter;
+    pthread_mutex_unlock(&lock);
+}
+
+- (void) removeWaiter:(nu_channel_waiter *) waiter
+{
+    pthread_mutex_lock(&lock);
+    for (NSUInteger i = 0; i < waiterCount; i++) {
+        if (waiters[i] == waiter) {
+            waiters[i] = waiters[--waiterCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+- (void) put:(id) value
+{
+    pthread_mutex_lock(&lock);
+    while (!closed && (count == capacity)) {
+        putters++;
+        nu_channel_wait(&notFull, &lock);
+        putters--;
+    }
+    if (closed) {
+        pthread_mutex_unlock(&lock);
+        [NSException raise:@"NuChannelClosed" format:@"a value was put into a closed channel"];
+    }
+    values[(head + count) % capacity] = [(value ? value : Nu__null) retain];
+    count++;
+    if (takers)
+        pthread_cond_signal(&notEmpty);
+    [self signalWaiters];
+    pthread_mutex_unlock(&lock);
+}
+
+// Remove the oldest value. Must be called with the channel's lock held and at least one value in the channel.
+- (id) removeValue
+{
+    id value = values[head];
+    values[head] = nil;
+    head = (head + 1) % capacity;
+    count--;
+    if (putters)
+        pthread_cond_signal(&notFull);
+    return [value autorelease];
+}
+
+- (id) take
+{
+    id value = nil;
+    pthread_mutex_lock(&lock);
+    while (!closed && (count == 0)) {
+        takers++;
+        nu_channel_wait(&notEmpty, &lock);
+        takers--;
+    }
+    if (count)
+        value = [self removeValue];
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+- (id) each:(id) block
+{
+    if (![block respondsToSelector:@selector(evalWithArguments:context:)])
+        return self;
+    id args = [[NuCell alloc] init];
+    id value;
+    NuChannel *channel = self;
+    NSAutoreleasePool *pool = nil;
+    @try
+    {
+        while (nu_channel_select(&channel, 1, true, &value) >= 0) {
+            pool = [[NSAutoreleasePool alloc] init];
+            [args setCar:value];
+            [block evalWithArguments:args context:nil];
+            [pool drain];
+            pool = nil;
+            if (nu_loop_should_stop())
+                break;
+        }
+    }
+    @catch (id exception) {
+        // the exception may have been autoreleased in the pool, so it goes to the enclosing pool
+        [exception retain];
+        [pool drain];
+        @throw [exception autorelease];
+    }
+    @finally
+    {
+        [args release];
+    }
+    return self;
+}
+
+- (void) close
+{
+    pthread_mutex_lock(&lock);
+    if (!closed) {
+        closed = true;
+        pthread_cond_broadcast(&notEmpty);
+        pthread_cond_broadcast(&notFull);
+        [self signalWaiters];
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+- (BOOL) isClosed
+{
+    pthread_mutex_lock(&lock);
+    BOOL result = closed;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+- (NSUInteger) count
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger result = count;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+- (NSUInteger) capacity
+{
+    return capacity;
+}
+
+- (bool) pollValue:(id *) value closed:(bool *) isClosed
+{
+    bool taken = false;
+    pthread_mutex_lock(&lock);
+    if (count) {
+        *value = [self removeValue];
+        taken = true;
+    }
+    else if (isClosed) {
+        *isClosed = closed;
+    }
+    pthread_mutex_unlock(&lock);
+    return taken;
+}
+
+- (NSString *) description
+{
+    return [NSString stringWithFormat:@"<NuChannel:%lx %lu/%lu%@>", (unsigned long) self,
+            (unsigned long) [self count], (unsigned long) capacity, [self isClosed] ? @" closed" : @""];
+}
+
+@end
+
+bool nu_channel_poll(NuChannel *channel, id *value, bool *closed)
+{
+    return [channel pollValue:value closed:closed];
+}
+
+// Selections start at a different channel each time, so that a busy channel doesn't starve the others.
+static __thread NSUInteger selectRotation = 0;
+
+NSInteger nu_channel_select(NuChannel **channels, NSUInteger count, bool wait, id *value)
+{
+    if (count == 0)
+        return -1;
+    nu_channel_waiter waiter;
+    bool registered = false;
+    NSInteger selected = -1;
+    NSUInteger first = selectRotation++ % count;
+    while (1) {
+        bool allClosed = true;
+        for (NSUInteger i = 0; i < count; i++) {
+            NSUInteger index = (first + i) % count;
+            bool closed = false;
+            if (nu_channel_poll(channels[index], value, &closed)) {
+                selected = index;
+                break;
+            }
+            if (!closed)
+                allClosed = false;
+        }
+        if ((selected >= 0) || allClosed || !wait)
+            break;
+        if (!registered) {
+            // poll again after registering, so that values put in the meantime aren't missed
+            pthread_mutex_init(&waiter.lock, NULL);
+            pthread_cond_init(&waiter.ready, NULL);
+            waiter.signalled = false;
+            for (NSUInteger i = 0; i < count; i++)
+                [channels[i] addWaiter:&waiter];
+            registered = true;
+            continue;
+        }
+        pthread_mutex_lock(&waiter.lock);
+        while (!waiter.signalled)
+            nu_channel_wait(&waiter.ready, &waiter.lock);
+        waiter.signalled = false;
+        pthread_mutex_unlock(&waiter.lock);
+    }
+    if (registered) {
+        for (NSUInteger i = 0; i < count; i++)
+            [channels[i] removeWaiter:&waiter];
+        pthread_mutex_destroy(&waiter.lock);
+        pthread_cond_destroy(&waiter.ready);
+    }
+    return selected;
+}
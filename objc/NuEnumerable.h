@@ -37,5 +37,14 @@
 - (id) reduce:(id) callable from:(id) initial;
 /*! Iterate over each member of a collection, applying the provided selector to each member, and returning an array of the results. */
 - (NSArray *) mapSelector:(SEL) selector;
+/*! Apply the provided callable to each member of a collection on the worker pool (see NuParallel.h), returning an array of the results in order. */
+- (NSArray *) pmap:(id) callable;
+/*! Evaluate the provided callable for each member of a collection on the worker pool, returning an array of the members for which it evaluates non-nil. */
+- (NSArray *) pselect:(id) callable;
+/*! Evaluate the provided callable for each member of a collection on the worker pool. */
+- (id) peach:(id) callable;
+/*! Reduce ranges of a collection's members with the provided callable on the worker pool, starting each range from initial,
+ and combine the results of the ranges in order with combiner. Initial should be a value that combiner leaves unchanged. */
+- (id) preduce:(id) callable from:(id) initial combine:(id) combiner;
 
 @end
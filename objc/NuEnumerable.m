@@ -10,6 +10,7 @@
 #import "NuInternals.h"
 #import "NuCell.h"
 #import "NuBlock.h"
+#import "NuParallel.h"
 
 #pragma mark - NuEnumerable.m
 
@@ -26,21 +27,10 @@
         NSEnumerator *enumerator = [self objectEnumerator];
         id object;
         while ((object = [enumerator nextObject])) {
-            @try
-            {
-                [args setCar:object];
-                [callable evalWithArguments:args context:nil];
-            }
-            @catch (NuBreakException *exception) {
+            [args setCar:object];
+            [callable evalWithArguments:args context:nil];
+            if (nu_loop_should_stop())
                 break;
-            }
-            @catch (NuContinueException *exception) {
-                // do nothing, just continue with the next loop iteration
-            }
-            @catch (id exception) {
-                [args release];
-                @throw(exception);
-            }
         }
     }
     [args release];
@@ -56,22 +46,11 @@
         id object;
         int i = 0;
         while ((object = [enumerator nextObject])) {
-            @try
-            {
-                [args setCar:object];
-                [[args cdr] setCar:@(i)];
-                [block evalWithArguments:args context:nil];
-            }
-            @catch (NuBreakException *exception) {
+            [args setCar:object];
+            [[args cdr] setCar:@(i)];
+            [block evalWithArguments:args context:nil];
+            if (nu_loop_should_stop())
                 break;
-            }
-            @catch (NuContinueException *exception) {
-                // do nothing, just continue with the next loop iteration
-            }
-            @catch (id exception) {
-                [args release];
-                @throw(exception);
-            }
             i++;
         }
     }
@@ -102,7 +81,12 @@
         while ((object = [enumerator nextObject])) {
             [args setCar:object];
             id result = [block evalWithArguments:args context:Nu__null];
-            if (nu_valueIsTrue(result)) {
+            if (nu_control.signal) {
+                // a continue skips this member; a break or return ends the selection
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else if (nu_valueIsTrue(result)) {
                 [selected addObject:object];
             }
         }
@@ -120,7 +104,11 @@
         while ((object = [enumerator nextObject])) {
             [args setCar:object];
             id result = [block evalWithArguments:args context:Nu__null];
-            if (nu_valueIsTrue(result)) {
+            if (nu_control.signal) {
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else if (nu_valueIsTrue(result)) {
                 [args release];
                 return object;
             }
@@ -139,7 +127,14 @@
         id object;
         while ((object = [enumerator nextObject])) {
             [args setCar:object];
-            [results addObject:[callable evalWithArguments:args context:nil]];
+            id result = [callable evalWithArguments:args context:nil];
+            if (nu_control.signal) {
+                // a continue skips this member; a break or return ends the map
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else
+                [results addObject:result];
         }
     }
     [args release];
@@ -158,7 +153,13 @@
         while ((object = [enumerator nextObject])) {
             [args setCar:object];
             [[args cdr] setCar:@(i)];
-            [results addObject:[callable evalWithArguments:args context:nil]];
+            id result = [callable evalWithArguments:args context:nil];
+            if (nu_control.signal) {
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else
+                [results addObject:result];
             i++;
         }
     }
@@ -189,13 +190,76 @@
         while ((object = [enumerator nextObject])) {
             [args setCar:result];
             [[args cdr] setCar: object];
-            result = [callable evalWithArguments:args context:nil];
+            id value = [callable evalWithArguments:args context:nil];
+            if (nu_control.signal) {
+                // a continue keeps the value accumulated so far; a break or return ends the reduction
+                if (nu_loop_should_stop())
+                    break;
+            }
+            else
+                result = value;
         }
     }
     [args release];
     return result;
 }
 
+// Get the members of a collection as an array, for the parallel methods.
+static NSArray *nu_enumerable_members(id collection)
+{
+    if (nu_objectIsKindOfClass(collection, [NSArray class]))
+        return collection;
+    return [[collection objectEnumerator] allObjects];
+}
+
+static bool nu_is_callable(id callable)
+{
+    return [callable respondsToSelector:@selector(evalWithArguments:context:)];
+}
+
+- (NSArray *) pmap:(id) callable
+{
+    if (!nu_is_callable(callable))
+        return [NSArray array];
+    NSArray *members = nu_enumerable_members(self);
+    id *results = (id *) [[NSMutableData dataWithLength:([members count] + 1) * sizeof(id)] mutableBytes];
+    NSUInteger count = nu_parallel_map(callable, members, nil, results);
+    NSArray *array = [NSArray arrayWithObjects:results count:count];
+    for (NSUInteger i = 0; i < count; i++)
+        [results[i] release];
+    return array;
+}
+
+- (NSArray *) pselect:(id) callable
+{
+    NSMutableArray *selected = [NSMutableArray array];
+    if (!nu_is_callable(callable))
+        return selected;
+    NSArray *members = nu_enumerable_members(self);
+    id *results = (id *) [[NSMutableData dataWithLength:([members count] + 1) * sizeof(id)] mutableBytes];
+    NSUInteger count = nu_parallel_map(callable, members, nil, results);
+    for (NSUInteger i = 0; i < count; i++) {
+        if (nu_valueIsTrue(results[i]))
+            [selected addObject:[members objectAtIndex:i]];
+        [results[i] release];
+    }
+    return selected;
+}
+
+- (id) peach:(id) callable
+{
+    if (nu_is_callable(callable))
+        nu_parallel_map(callable, nu_enumerable_members(self), nil, NULL);
+    return self;
+}
+
+- (id) preduce:(id) callable from:(id) initial combine:(id) combiner
+{
+    if (!nu_is_callable(callable) || !nu_is_callable(combiner))
+        return initial;
+    return nu_parallel_reduce(callable, nu_enumerable_members(self), nil, initial, combiner);
+}
+
 - (id) maximum:(NuBlock *) block
 {
     id bestObject = nil;
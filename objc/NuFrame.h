@@ -0,0 +1,45 @@
+//
+//  NuFrame.h
+//  Nu
+//
+//  Activation frames for blocks.
+//
+
+#import <Foundation/Foundation.h>
+#import "NuScope.h"
+
+@class NuSymbol;
+
+/*!
+ @class NuFrame
+ @abstract The evaluation context of a block call.
+ @discussion Each call of a block, method or <b>let</b> body is evaluated in a NuFrame.
+ A frame stores the values of the symbols that its block's scope can bind in a fixed array of slots
+ that is allocated together with the frame, so calling a block does not copy a dictionary.
+
+ NuFrame is a subclass of NSMutableDictionary, so frames can be used everywhere an execution
+ context is expected. Symbols that aren't in the scope and any other keys are kept in a dictionary
+ that is only created when one is stored, and operations that need all of the frame's keys,
+ such as enumeration, work on a dictionary that is built when they ask for it.
+ */
+@interface NuFrame : NSMutableDictionary
+
+/*! Create a frame for a call of a block with the specified scope and saved context. */
++ (NuFrame *) frameWithScope:(NuScope *)scope context:(NSMutableDictionary *)context;
+/*! Get the scope that the frame was created for. */
+- (NuScope *) scope;
+/*! Get the context that encloses the frame. */
+- (id) parent;
+/*! Get a dictionary containing all of the frame's bindings. */
+- (NSMutableDictionary *) dictionaryValue;
+
+@end
+
+// Get the scope of a context if it is a frame.
+NuScope *nu_context_scope(id context);
+
+// Bind a value to the symbol in the specified slot, or by key if the slot holds a different symbol.
+void nu_frame_bind(NuFrame *frame, NSUInteger slot, id symbol, id value);
+
+// Look up a symbol using the lexical address that the scope analyzer computed for it.
+id nu_frame_lookup_resolved(NuSymbol *symbol, nu_lexical_address *address, id context);
@@ -0,0 +1,389 @@
+//
+//  NuFrame.m
+//  Nu
+//
+//  Activation frames for blocks.
+//
+
+#import "NuFrame.h"
+#import "NuInternals.h"
+#import "NuSymbol.h"
+#import "NSDictionary+Nu.h"
+
+@interface NuFrame ()
+{
+@public
+    NuScope *scope;
+    id parent;
+    id symbolTable;
+    NSMutableDictionary *saved;     // the block's saved context, when it holds more than its parent and symbol table
+    NSMutableDictionary *bindings;  // keys that don't have slots
+    NSUInteger slotCount;
+    id *slots;                      // allocated with the frame
+}
+@end
+
+@interface NuFrameKeyEnumerator : NSEnumerator
+{
+    NuFrame *frame;
+    NSEnumerator *enumerator;
+    int state;
+    NSUInteger index;
+}
+- (id) initWithFrame:(NuFrame *)f;
+@end
+
+static Class NuFrameClass;
+static Class NuSymbolClass;
+
+static inline BOOL nu_key_is_string(id key, NSString *string)
+{
+    return (key == string) || ([key isKindOfClass:[NSString class]] && [key isEqualToString:string]);
+}
+
+// Get the slot index of a symbol in a frame, or NSNotFound.
+static inline NSUInteger nu_frame_slot_for_symbol(NuFrame *frame, id symbol)
+{
+    if (!frame->scope)
+        return NSNotFound;
+    id *symbols = nu_scope_slot_symbols(frame->scope);
+    NSUInteger count = frame->slotCount;
+    for (NSUInteger i = 0; i < count; i++) {
+        if (symbols[i] == symbol)
+            return i;
+    }
+    return NSNotFound;
+}
+
+// Get the value bound to a key in a frame without searching its parents.
+static id nu_frame_object_for_key(NuFrame *frame, id key)
+{
+    if (object_getClass(key) == NuSymbolClass) {
+        NSUInteger slot = nu_frame_slot_for_symbol(frame, key);
+        if ((slot != NSNotFound) && frame->slots[slot])
+            return frame->slots[slot];
+    }
+    else if (nu_key_is_string(key, PARENT_KEY)) {
+        return frame->parent;
+    }
+    else if (nu_key_is_string(key, SYMBOLS_KEY)) {
+        return frame->symbolTable;
+    }
+    id value = frame->bindings ? [frame->bindings objectForKey:key] : nil;
+    if (!value && frame->saved)
+        value = [frame->saved objectForKey:key];
+    return value;
+}
+
+NuScope *nu_context_scope(id context)
+{
+    if (context && (object_getClass(context) == NuFrameClass))
+        return ((NuFrame *) context)->scope;
+    return nil;
+}
+
+void nu_frame_bind(NuFrame *frame, NSUInteger slot, id symbol, id value)
+{
+    if (!value)
+        value = Nu__null;
+    if ((slot < frame->slotCount) && (nu_scope_slot_symbols(frame->scope)[slot] == symbol)) {
+        [value retain];
+        [frame->slots[slot] release];
+        frame->slots[slot] = value;
+    }
+    else {
+        [frame setObject:value forKey:symbol];
+    }
+}
+
+id nu_frame_lookup_resolved(NuSymbol *symbol, nu_lexical_address *address, id context)
+{
+    id frame = context;
+    NuScope *scope = address->scope;
+    int depth, slot;
+    nu_lexical_address_location(address, &depth, &slot);
+    for (int i = 0; (i < depth) && IS_NOT_NULL(frame); i++) {
+        if (object_getClass(frame) == NuFrameClass)
+            frame = ((NuFrame *) frame)->parent;
+        else
+            frame = [frame objectForKey:PARENT_KEY];
+        scope = nu_scope_parent(scope);
+    }
+    if ((slot >= 0) && frame && (object_getClass(frame) == NuFrameClass)) {
+        NuFrame *f = (NuFrame *) frame;
+        if ((f->scope == scope) && (slot < f->slotCount) && f->slots[slot])
+            return f->slots[slot];
+    }
+    if (IS_NOT_NULL(frame)) {
+        id value = [frame lookupObjectForKey:symbol];
+        if (value)
+            return value;
+    }
+    id value = [symbol value];
+    if (value)
+        return value;
+    // let the symbol handle classes, bridged values and errors
+    return [symbol evalWithContext:context];
+}
+
+@implementation NuFrame
+
++ (void) initialize
+{
+    if (self == [NuFrame class]) {
+        NuFrameClass = self;
+        NuSymbolClass = [NuSymbol class];
+    }
+}
+
++ (NuFrame *) frameWithScope:(NuScope *)scope context:(NSMutableDictionary *)context
+{
+    NSUInteger count = scope ? nu_scope_slot_count(scope) : 0;
+    NuFrame *frame = (NuFrame *) NSAllocateObject(self, count * sizeof(id), NULL);
+    frame->slotCount = count;
+    frame->slots = (id *) object_getIndexedIvars(frame);
+    frame->scope = [scope retain];
+    if (context) {
+        frame->parent = [[context objectForKey:PARENT_KEY] retain];
+        frame->symbolTable = [[context objectForKey:SYMBOLS_KEY] retain];
+        // labels and method declarations add bindings to a block's saved context
+        if ([context count] > 2)
+            frame->saved = [context retain];
+    }
+    return [frame autorelease];
+}
+
+// Frames don't call NSDictionary's initializers; they are all defined in terms of the primitive methods below.
+- (id) init
+{
+    slots = (id *) object_getIndexedIvars(self);
+    return self;
+}
+
+- (id) initWithCapacity:(NSUInteger)numItems
+{
+    return [self init];
+}
+
+- (id) initWithObjects:(const id [])objects forKeys:(const id <NSCopying> [])keys count:(NSUInteger)count
+{
+    if ((self = [self init])) {
+        for (NSUInteger i = 0; i < count; i++)
+            [self setObject:objects[i] forKey:keys[i]];
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    for (NSUInteger i = 0; i < slotCount; i++)
+        [slots[i] release];
+    [scope release];
+    [parent release];
+    [symbolTable release];
+    [saved release];
+    [bindings release];
+    [super dealloc];
+}
+
+- (NuScope *) scope
+{
+    return scope;
+}
+
+- (id) parent
+{
+    return parent;
+}
+
+- (id) objectForKey:(id)key
+{
+    return nu_frame_object_for_key(self, key);
+}
+
+- (id) lookupObjectForKey:(id)key
+{
+    id frame = self;
+    while (frame && (object_getClass(frame) == NuFrameClass)) {
+        id value = nu_frame_object_for_key((NuFrame *) frame, key);
+        if (value)
+            return value;
+        frame = ((NuFrame *) frame)->parent;
+    }
+    return IS_NOT_NULL(frame) ? [frame lookupObjectForKey:key] : nil;
+}
+
+- (void) setObject:(id)anObject forKey:(id)aKey
+{
+    if (object_getClass(aKey) == NuSymbolClass) {
+        NSUInteger slot = nu_frame_slot_for_symbol(self, aKey);
+        if (slot != NSNotFound) {
+            [anObject retain];
+            [slots[slot] release];
+            slots[slot] = anObject;
+            return;
+        }
+    }
+    else if (nu_key_is_string(aKey, PARENT_KEY)) {
+        [anObject retain];
+        [parent release];
+        parent = anObject;
+        return;
+    }
+    else if (nu_key_is_string(aKey, SYMBOLS_KEY)) {
+        [anObject retain];
+        [symbolTable release];
+        symbolTable = anObject;
+        return;
+    }
+    if (!bindings)
+        bindings = [[NSMutableDictionary alloc] init];
+    [bindings setObject:anObject forKey:aKey];
+}
+
+- (void) removeObjectForKey:(id)aKey
+{
+    if (object_getClass(aKey) == NuSymbolClass) {
+        NSUInteger slot = nu_frame_slot_for_symbol(self, aKey);
+        if (slot != NSNotFound) {
+            [slots[slot] release];
+            slots[slot] = nil;
+        }
+    }
+    else if (nu_key_is_string(aKey, PARENT_KEY)) {
+        [parent release];
+        parent = nil;
+    }
+    else if (nu_key_is_string(aKey, SYMBOLS_KEY)) {
+        [symbolTable release];
+        symbolTable = nil;
+    }
+    [bindings removeObjectForKey:aKey];
+}
+
+- (NSMutableDictionary *) dictionaryValue
+{
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+    if (saved)
+        [dictionary addEntriesFromDictionary:saved];
+    if (parent)
+        [dictionary setObject:parent forKey:PARENT_KEY];
+    if (symbolTable)
+        [dictionary setObject:symbolTable forKey:SYMBOLS_KEY];
+    if (bindings)
+        [dictionary addEntriesFromDictionary:bindings];
+    id *symbols = scope ? nu_scope_slot_symbols(scope) : NULL;
+    for (NSUInteger i = 0; i < slotCount; i++) {
+        if (slots[i])
+            [dictionary setObject:slots[i] forKey:symbols[i]];
+    }
+    return dictionary;
+}
+
+// A key of the saved context is hidden when the frame binds it itself.
+static BOOL nu_frame_hides_saved_key(NuFrame *frame, id key)
+{
+    if (object_getClass(key) == NuSymbolClass) {
+        NSUInteger slot = nu_frame_slot_for_symbol(frame, key);
+        if ((slot != NSNotFound) && frame->slots[slot])
+            return YES;
+    }
+    else if (nu_key_is_string(key, PARENT_KEY) || nu_key_is_string(key, SYMBOLS_KEY)) {
+        return YES;
+    }
+    return frame->bindings && [frame->bindings objectForKey:key];
+}
+
+- (NSUInteger) count
+{
+    NSUInteger count = 0;
+    for (NSUInteger i = 0; i < slotCount; i++) {
+        if (slots[i])
+            count++;
+    }
+    if (parent)
+        count++;
+    if (symbolTable)
+        count++;
+    count += [bindings count];
+    if (saved) {
+        for (id key in saved) {
+            if (!nu_frame_hides_saved_key(self, key))
+                count++;
+        }
+    }
+    return count;
+}
+
+- (NSEnumerator *) keyEnumerator
+{
+    return [[[NuFrameKeyEnumerator alloc] initWithFrame:self] autorelease];
+}
+
+@end
+
+// Enumerates the keys of a frame in place: its filled slots, its parent and symbol table,
+// its other bindings, and then the keys of its saved context that it doesn't hide.
+@implementation NuFrameKeyEnumerator
+
+- (id) initWithFrame:(NuFrame *)f
+{
+    if ((self = [super init])) {
+        frame = [f retain];
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    [frame release];
+    [enumerator release];
+    [super dealloc];
+}
+
+- (id) nextObject
+{
+    while (1) {
+        switch (state) {
+            case 0:
+                if (index < frame->slotCount) {
+                    NSUInteger i = index++;
+                    if (frame->slots[i])
+                        return nu_scope_slot_symbols(frame->scope)[i];
+                    continue;
+                }
+                state = 1;
+                if (frame->parent)
+                    return PARENT_KEY;
+            case 1:
+                state = 2;
+                if (frame->symbolTable)
+                    return SYMBOLS_KEY;
+            case 2:
+                state = 3;
+                enumerator = [[frame->bindings keyEnumerator] retain];
+            case 3: {
+                id key = [enumerator nextObject];
+                if (key)
+                    return key;
+                [enumerator release];
+                enumerator = [[frame->saved keyEnumerator] retain];
+                state = 4;
+            }
+            case 4: {
+                id key;
+                while ((key = [enumerator nextObject])) {
+                    if (!nu_frame_hides_saved_key(frame, key))
+                        return key;
+                }
+                [enumerator release];
+                enumerator = nil;
+                state = 5;
+            }
+            default:
+                return nil;
+        }
+    }
+}
+
+@end
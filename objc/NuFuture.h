@@ -0,0 +1,44 @@
+//
+//  NuFuture.h
+//  Nu
+//
+//  Values that are computed concurrently.
+//
+
+#import <Foundation/Foundation.h>
+#import "NuParallel.h"
+
+@class NuBlock;
+
+/*!
+ @class NuFuture
+ @abstract A value that is computed by a block on the worker pool.
+ @discussion In Nu programs, futures are created with the <b>future</b> operator, which evaluates
+ its expressions on a thread of the worker pool, in a context of its own that is enclosed by the context
+ where the future was created; variables of enclosing contexts are shared with the thread that created it,
+ so assign to them only with a lock of your own.
+
+ <b>(await f)</b> or <b>(f value)</b> waits for a future and returns its value, and <b>(all futures)</b>
+ waits for each of a list or array of futures and returns an array of their values.
+ If the evaluation raised an exception, the exception is raised again in each thread that waits for the value.
+ A future that hasn't started when it is awaited is evaluated by the waiting thread, and pool threads
+ that wait for futures run other queued tasks while they wait, so futures may wait for each other.
+ */
+@interface NuFuture : NSObject <NuTask>
+
+/*! Create a future that is computed by calling a block with no arguments. The future is not started until it is submitted with <b>start</b>. */
+- (id) initWithBlock:(NuBlock *) block;
+/*! Create a future that is computed elsewhere and finished with <b>finishWithValue:exception:</b>. */
+- (id) init;
+/*! Finish a future with a value, or with an exception if it is not nil. Later calls are ignored. */
+- (void) finishWithValue:(id) value exception:(id) exception;
+/*! Queue the future to be computed on the worker pool. */
+- (void) start;
+/*! Wait until the future has been computed and return its value, or raise the exception that its evaluation raised. */
+- (id) value;
+/*! Another name for <b>value</b>. */
+- (id) await;
+/*! Returns true if the future has been computed. */
+- (BOOL) isDone;
+
+@end
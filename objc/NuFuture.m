@@ -0,0 +1,168 @@
+//
+//  NuFuture.m
+//  Nu
+//
+//  Values that are computed concurrently.
+//
+
+#import "NuFuture.h"
+#import "NuBlock.h"
+#import "NuInternals.h"
+
+#import <pthread.h>
+#import <time.h>
+
+enum {
+    NuFuturePending = 0,
+    NuFutureRunning,
+    NuFutureDone
+};
+
+@interface NuFuture ()
+{
+    NuBlock *block;
+    id result;                  // retained
+    id exception;               // retained
+    int state;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+}
+@end
+
+@implementation NuFuture
+
+- (id) initWithBlock:(NuBlock *) b
+{
+    if ((self = [super init])) {
+        block = [b retain];
+        state = NuFuturePending;
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&done, NULL);
+    }
+    return self;
+}
+
+- (id) init
+{
+    if ((self = [super init])) {
+        // no thread claims a future without a block; it is finished by its owner
+        state = NuFutureRunning;
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&done, NULL);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    [block release];
+    [result release];
+    [exception release];
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&done);
+    [super dealloc];
+}
+
+- (void) start
+{
+    nu_parallel_submit(self);
+}
+
+// Evaluate the block if no other thread has started it. Returns false if the future was already claimed.
+- (bool) claimAndRun
+{
+    int expected = NuFuturePending;
+    if (!__atomic_compare_exchange_n(&state, &expected, NuFutureRunning, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return false;
+    // the future may be run by a thread that is in the middle of an evaluation of its own
+    nu_control_state saved;
+    nu_suspend_control_signal(&saved);
+    id value = Nu__null;
+    id raised = nil;
+    @try {
+        value = [block evalWithArguments:Nu__null context:nil];
+    }
+    @catch (id e) {
+        if (!nu_control_signal_from_exception(e))
+            raised = e;
+    }
+    nu_clear_control_signal();
+    nu_resume_control_signal(&saved);
+
+    [self finishWithValue:value exception:raised];
+    // the block and the context it refers to are no longer needed
+    [block release];
+    block = nil;
+    return true;
+}
+
+- (void) finishWithValue:(id) value exception:(id) raised
+{
+    pthread_mutex_lock(&lock);
+    if (state != NuFutureDone) {
+        if (raised)
+            exception = [raised retain];
+        else
+            result = [(value ? value : Nu__null) retain];
+        __atomic_store_n(&state, NuFutureDone, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&done);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+- (void) runTask
+{
+    [self claimAndRun];
+}
+
+- (BOOL) isDone
+{
+    return __atomic_load_n(&state, __ATOMIC_ACQUIRE) == NuFutureDone;
+}
+
+- (id) value
+{
+    if (![self claimAndRun]) {
+        if (nu_parallel_is_pool_thread()) {
+            // keep the pool busy with other tasks, which may include the ones this future is waiting for
+            while (![self isDone]) {
+                if (!nu_parallel_help()) {
+                    // nothing else to do, so wait briefly for the future or for more tasks
+                    struct timespec deadline;
+                    clock_gettime(CLOCK_REALTIME, &deadline);
+                    deadline.tv_nsec += 1000000;
+                    if (deadline.tv_nsec >= 1000000000) {
+                        deadline.tv_sec += 1;
+                        deadline.tv_nsec -= 1000000000;
+                    }
+                    pthread_mutex_lock(&lock);
+                    if (state != NuFutureDone)
+                        pthread_cond_timedwait(&done, &lock, &deadline);
+                    pthread_mutex_unlock(&lock);
+                }
+            }
+        }
+        else {
+            pthread_mutex_lock(&lock);
+            while (state != NuFutureDone)
+                pthread_cond_wait(&done, &lock);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    if (exception)
+        @throw [[exception retain] autorelease];
+    return [[result retain] autorelease];
+}
+
+- (id) await
+{
+    return [self value];
+}
+
+- (NSString *) description
+{
+    return [NSString stringWithFormat:@"<NuFuture:%lx %@>", (unsigned long) self,
+            [self isDone] ? (exception ? @"failed" : @"done") : @"pending"];
+}
+
+@end
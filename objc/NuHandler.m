@@ -107,6 +107,8 @@ static void nu_handler(void *return_value, struct nu_handler_description *handle
         // NSLog(@"handling %@", [block stringValue]);
         id arguments = collect_arguments(handler, ap);
         result = [block evalWithArguments:[arguments cdr] context:nil self:receiver];
+        // break, continue and return-from signals that escape the method are carried through the caller as exceptions
+        nu_raise_pending_control_signal();
         if (return_value) {
             // if the call returns an object, retain the result so that it will survive the autorelease.
             // we undo this retain once we're safely outside of the autorelease block.
@@ -0,0 +1,53 @@
+//
+//  NuImage.h
+//  Nu
+//
+//  Saved images of the definitions made by Nu programs.
+//
+
+#import <Foundation/Foundation.h>
+
+@class NuParser;
+@class NuBlock;
+@class NuSymbol;
+
+/*!
+ @class NuImage
+ @abstract Saved images of the definitions made by Nu programs.
+ @discussion An image holds the bindings in a parser's top-level context and the global values,
+ classes and methods that were defined in that context, so that a program that spends its startup
+ time loading files of definitions can be restored without parsing or evaluating them again.
+ <b>nush --dump-image file</b> writes an image after running its arguments, and <b>nush --image file</b>
+ loads one before running its arguments.
+
+ Functions and closures are saved as the parameters and bodies of their blocks together with the contexts
+ they were created in, and macros as their parameters and bodies. Saved values may also be symbols, strings,
+ numbers, regular expressions, lists, arrays, dictionaries, classes and bridged functions. Objects are
+ saved once, so values that are shared or refer to each other are restored that way.
+ Bindings and dictionary entries whose values can't be saved are left out, and other values
+ that can't be saved are restored as null.
+
+ When an image is loaded, the classes it defines are created unless classes with their names already exist,
+ and its methods are added with the same handlers that <b>imethod</b> and <b>cmethod</b> use.
+ Definitions made while Nu was being initialized are not saved, since they are made again when an image is loaded.
+ */
+@interface NuImage : NSObject
+
+/*! Write an image of the definitions made in a parser's context to a file. Raises an exception if the file can't be written. */
++ (void) writeImageOfParser:(NuParser *)parser toFile:(NSString *)path;
+/*! Load an image into a parser's context. Raises an exception if the file isn't a valid image for this version of Nu. */
++ (void) loadImageFromFile:(NSString *)path intoParser:(NuParser *)parser;
+
+@end
+
+// Start recording definitions for images. Everything defined before this is considered part of the initial state.
+void nu_image_begin_recording(void);
+
+// Record a symbol whose global value was set in the specified context.
+void nu_image_record_global(NuSymbol *symbol, NSMutableDictionary *context);
+
+// Record a class that was created by the class operator in the specified context.
+void nu_image_record_class(Class c, NSMutableDictionary *context);
+
+// Record a method that was added to a class.
+void nu_image_record_method(Class c, NSString *methodName, NSString *signature, NuBlock *block);
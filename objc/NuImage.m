@@ -0,0 +1,1000 @@
+//
+//  NuImage.m
+//  Nu
+//
+//  Saved images of the definitions made by Nu programs.
+//
+
+#import "NuImage.h"
+#import "NuParser.h"
+#import "NuBlock.h"
+#import "NuCell.h"
+#import "NuSymbol.h"
+#import "NuMacro.h"
+#import "NuClass.h"
+#import "NuBridgedFunction.h"
+#import "NSDictionary+Nu.h"
+#import "NSString+Nu.h"
+#import "NuRegex.h"
+#import "NuInternals.h"
+
+// An image is a header followed by the image's symbols, the names of the files that its cells
+// were parsed from, and six sections:
+//
+//   classes       the name, superclass and instance variables of each class to create
+//   objects       the kind of each object in the object table
+//   definitions   the parameters, bodies and contexts of blocks, macros and bridged functions
+//   contents      the entries of dictionaries, the elements of arrays and the bindings in blocks' contexts
+//   bindings      the parser's top-level bindings and the global values of symbols
+//   methods       the class, name, signature and block of each method to add
+//
+// Integers are written as base-128 varints, strings as a length and UTF-8 bytes, and values are
+// tagged with a byte. Objects that may be shared or refer to each other are written as references
+// to the object table; their kinds are read first so that empty objects exist before any reference
+// to them is read, and they are filled in once all of them have been created.
+// Parameters and bodies are read before the objects that they could refer to are complete,
+// so they may only contain atoms and lists.
+
+#define NU_IMAGE_MAGIC  0x4e75494d          // "NuIM"
+#define NU_IMAGE_FORMAT 1
+
+enum {
+    NU_IMAGE_NIL,
+    NU_IMAGE_NULL,
+    NU_IMAGE_SYMBOL,
+    NU_IMAGE_STRING,
+    NU_IMAGE_INTEGER,
+    NU_IMAGE_DOUBLE,
+    NU_IMAGE_REGEX,
+    NU_IMAGE_LIST,
+    NU_IMAGE_OBJECT,                        // an entry in the object table
+    NU_IMAGE_TOP,                           // the parser's top-level context
+    NU_IMAGE_PARSER,
+    NU_IMAGE_SYMBOL_TABLE,
+    NU_IMAGE_NUCLASS,
+    NU_IMAGE_CLASS
+};
+
+// Kinds of objects in the object table
+enum {
+    NU_IMAGE_DICTIONARY,
+    NU_IMAGE_ARRAY,
+    NU_IMAGE_BLOCK,
+    NU_IMAGE_MACRO_0,
+    NU_IMAGE_MACRO_1,
+    NU_IMAGE_FUNCTION
+};
+
+static BOOL recording = NO;
+static NSMutableDictionary *initialBindings = nil;      // symbol -> binding in the shared parser when recording began
+static NSMutableDictionary *recordedGlobals = nil;       // symbol -> top-level context it was last set in
+static NSMutableArray *recordedClasses = nil;           // (class, top-level context) pairs
+static NSMutableArray *recordedMethodKeys = nil;        // in the order that methods were first added
+static NSMutableDictionary *recordedMethods = nil;      // key -> (class, name, signature, block)
+
+// Get the outermost context that encloses a context.
+static id nu_image_top_context(id context)
+{
+    id parent;
+    while (IS_NOT_NULL(context) && IS_NOT_NULL(parent = [context objectForKey:PARENT_KEY]))
+        context = parent;
+    return context;
+}
+
+#pragma mark - Recording
+
+void nu_image_begin_recording()
+{
+    @synchronized([NuImage class]) {
+        if (recording)
+            return;
+        initialBindings = [[NSMutableDictionary alloc] initWithDictionary:[[Nu sharedParser] context]];
+        recordedGlobals = [[NSMutableDictionary alloc] init];
+        recordedClasses = [[NSMutableArray alloc] init];
+        recordedMethodKeys = [[NSMutableArray alloc] init];
+        recordedMethods = [[NSMutableDictionary alloc] init];
+        recording = YES;
+    }
+}
+
+void nu_image_record_global(NuSymbol *symbol, NSMutableDictionary *context)
+{
+    if (!recording)
+        return;
+    @synchronized([NuImage class]) {
+        [recordedGlobals setObject:[NSValue valueWithPointer:nu_image_top_context(context)] forKey:symbol];
+    }
+}
+
+void nu_image_record_class(Class c, NSMutableDictionary *context)
+{
+    if (!recording || !c)
+        return;
+    @synchronized([NuImage class]) {
+        [recordedClasses addObject:[NSArray arrayWithObjects:
+                                    [NSValue valueWithPointer:c],
+                                    [NSValue valueWithPointer:nu_image_top_context(context)], nil]];
+    }
+}
+
+void nu_image_record_method(Class c, NSString *methodName, NSString *signature, NuBlock *block)
+{
+    if (!recording)
+        return;
+    @synchronized([NuImage class]) {
+        NSString *key = [NSString stringWithFormat:@"%p %@", c, methodName];
+        if (![recordedMethods objectForKey:key])
+            [recordedMethodKeys addObject:key];
+        [recordedMethods setObject:[NSArray arrayWithObjects:
+                                    [NSValue valueWithPointer:c],
+                                    [NSString stringWithString:methodName],
+                                    [NSString stringWithString:signature],
+                                    block, nil]
+                            forKey:key];
+    }
+}
+
+#pragma mark - Writing
+
+typedef struct nu_image_writer {
+    NSMutableData *data;
+    NSMutableDictionary *symbols;                 // symbol -> index
+    NSMutableArray *symbolNames;
+    NSMutableDictionary *files;                   // file number -> reference
+    NSMutableArray *fileNames;
+    NSMapTable *objects;                          // object -> index + 1
+    NSMutableArray *objectList;
+    NuParser *parser;
+    NSMutableDictionary *top;
+    NuSymbolTable *symbolTable;
+    NuSymbol *parserSymbol;
+} nu_image_writer;
+
+static void nu_image_write_byte(NSMutableData *data, uint8_t byte)
+{
+    [data appendBytes:&byte length:1];
+}
+
+static void nu_image_write_varint(NSMutableData *data, uint64_t value)
+{
+    uint8_t buffer[10];
+    int count = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        buffer[count++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    [data appendBytes:buffer length:count];
+}
+
+static void nu_image_write_signed(NSMutableData *data, int64_t value)
+{
+    nu_image_write_varint(data, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static void nu_image_write_string(NSMutableData *data, NSString *string)
+{
+    NSData *bytes = [string dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
+    nu_image_write_varint(data, [bytes length]);
+    [data appendData:bytes];
+}
+
+static BOOL nu_image_is_integer_type(char type)
+{
+    switch (type) {
+        case 'c': case 'C': case 's': case 'S': case 'i': case 'I':
+        case 'l': case 'L': case 'q':
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+static BOOL nu_image_is_class(id value)
+{
+    return class_isMetaClass(object_getClass(value));
+}
+
+// Returns YES if a value is kept in the object table.
+static BOOL nu_image_is_object(nu_image_writer *writer, id value)
+{
+    if (!value || (value == Nu__null) || (value == writer->top))
+        return NO;
+    return (nu_objectIsKindOfClass(value, [NuBlock class])
+            || nu_objectIsKindOfClass(value, [NuMacro_0 class])
+            || nu_objectIsKindOfClass(value, [NuBridgedFunction class])
+            || nu_objectIsKindOfClass(value, [NSDictionary class])
+            || nu_objectIsKindOfClass(value, [NSArray class]));
+}
+
+// Returns YES if a value can be written to the image.
+static BOOL nu_image_can_write(nu_image_writer *writer, id value)
+{
+    if (!value || (value == Nu__null) || (value == writer->top)
+        || (value == writer->parser) || (value == writer->symbolTable))
+        return YES;
+    if (nu_objectIsKindOfClass(value, [NuCell class])
+        || nu_objectIsKindOfClass(value, [NuSymbol class])
+        || nu_objectIsKindOfClass(value, [NSString class])
+        || nu_objectIsKindOfClass(value, [NSRegularExpression class])
+        || nu_objectIsKindOfClass(value, [NuClass class])
+        || nu_objectIsKindOfClass(value, [NuMacro_0 class])
+        || nu_objectIsKindOfClass(value, [NuBridgedFunction class])
+        || nu_objectIsKindOfClass(value, [NSArray class]))
+        return YES;
+    if (nu_objectIsKindOfClass(value, [NSNumber class])) {
+        char type = [value objCType][0];
+        return nu_image_is_integer_type(type) || (type == 'd') || (type == 'f');
+    }
+    // blocks are only saved with the parser whose context they were created in
+    if (nu_objectIsKindOfClass(value, [NuBlock class]))
+        return nu_image_top_context([(NuBlock *) value context]) == writer->top;
+    // the top-level contexts of other parsers aren't saved
+    if (nu_objectIsKindOfClass(value, [NSDictionary class]))
+        return ![value objectForKey:writer->parserSymbol];
+    return nu_image_is_class(value);
+}
+
+// Returns YES if a key of a block's context is one that the block sets itself.
+static BOOL nu_image_is_block_key(id key)
+{
+    return nu_objectIsKindOfClass(key, [NSString class])
+    && ([key isEqualToString:PARENT_KEY] || [key isEqualToString:SYMBOLS_KEY]);
+}
+
+// Add the objects that a value refers to to the object table.
+static void nu_image_collect(nu_image_writer *writer, id value)
+{
+    while (nu_objectIsKindOfClass(value, [NuCell class])) {
+        nu_image_collect(writer, [value car]);
+        value = [value cdr];
+    }
+    if (!nu_image_is_object(writer, value)
+        || !nu_image_can_write(writer, value)
+        || NSMapGet(writer->objects, value))
+        return;
+    [writer->objectList addObject:value];
+    NSMapInsert(writer->objects, value, (void *) (uintptr_t) [writer->objectList count]);
+    if (nu_objectIsKindOfClass(value, [NuBlock class])) {
+        NSMutableDictionary *context = [(NuBlock *) value context];
+        nu_image_collect(writer, [context objectForKey:PARENT_KEY]);
+        for (id key in [context allKeys]) {
+            if (!nu_image_is_block_key(key)) {
+                nu_image_collect(writer, key);
+                nu_image_collect(writer, [context objectForKey:key]);
+            }
+        }
+    }
+    else if (nu_objectIsKindOfClass(value, [NSDictionary class])) {
+        for (id key in [value allKeys]) {
+            nu_image_collect(writer, key);
+            nu_image_collect(writer, [value objectForKey:key]);
+        }
+    }
+    else if (nu_objectIsKindOfClass(value, [NSArray class])) {
+        for (id element in value)
+            nu_image_collect(writer, element);
+    }
+}
+
+static uint64_t nu_image_file_reference(nu_image_writer *writer, int file)
+{
+    if (file == -1)
+        return 0;
+    NSNumber *key = [NSNumber numberWithInt:file];
+    NSNumber *reference = [writer->files objectForKey:key];
+    if (!reference) {
+        const char *name = nu_parsedFilename(file);
+        [writer->fileNames addObject:[NSString stringWithCString:(name ? name : "") encoding:NSUTF8StringEncoding]];
+        reference = [NSNumber numberWithUnsignedInteger:[writer->fileNames count]];
+        [writer->files setObject:reference forKey:key];
+    }
+    return [reference unsignedLongLongValue];
+}
+
+// Write a value. Objects are written as references to the object table if allowed, and as null otherwise.
+static void nu_image_write_value(nu_image_writer *writer, id value, BOOL allowObjects)
+{
+    NSMutableData *data = writer->data;
+    if (value == nil) {
+        nu_image_write_byte(data, NU_IMAGE_NIL);
+    }
+    else if (value == Nu__null) {
+        nu_image_write_byte(data, NU_IMAGE_NULL);
+    }
+    else if (value == writer->top) {
+        nu_image_write_byte(data, NU_IMAGE_TOP);
+    }
+    else if (value == writer->parser) {
+        nu_image_write_byte(data, NU_IMAGE_PARSER);
+    }
+    else if (value == writer->symbolTable) {
+        nu_image_write_byte(data, NU_IMAGE_SYMBOL_TABLE);
+    }
+    else if (nu_objectIsKindOfClass(value, [NuCell class])) {
+        NSUInteger count = 0;
+        id cursor = value;
+        while (nu_objectIsKindOfClass(cursor, [NuCell class])) {
+            count++;
+            cursor = [cursor cdr];
+        }
+        nu_image_write_byte(data, NU_IMAGE_LIST);
+        nu_image_write_varint(data, count);
+        for (cursor = value; count > 0; count--, cursor = [cursor cdr]) {
+            nu_image_write_varint(data, nu_image_file_reference(writer, [cursor file]));
+            nu_image_write_signed(data, [cursor line]);
+            nu_image_write_value(writer, [cursor car], allowObjects);
+        }
+        nu_image_write_value(writer, cursor, allowObjects);
+    }
+    else if (nu_objectIsKindOfClass(value, [NuSymbol class])) {
+        NSNumber *index = [writer->symbols objectForKey:value];
+        if (!index) {
+            index = [NSNumber numberWithUnsignedInteger:[writer->symbolNames count]];
+            [writer->symbolNames addObject:[value stringValue]];
+            [writer->symbols setObject:index forKey:value];
+        }
+        nu_image_write_byte(data, NU_IMAGE_SYMBOL);
+        nu_image_write_varint(data, [index unsignedLongLongValue]);
+    }
+    else if (nu_objectIsKindOfClass(value, [NSString class])) {
+        nu_image_write_byte(data, NU_IMAGE_STRING);
+        nu_image_write_string(data, value);
+    }
+    else if (nu_objectIsKindOfClass(value, [NSNumber class])) {
+        char type = [value objCType][0];
+        if (nu_image_is_integer_type(type)) {
+            nu_image_write_byte(data, NU_IMAGE_INTEGER);
+            nu_image_write_byte(data, type);
+            nu_image_write_signed(data, [value longLongValue]);
+        }
+        else if ((type == 'd') || (type == 'f')) {
+            double d = [value doubleValue];
+            nu_image_write_byte(data, NU_IMAGE_DOUBLE);
+            [data appendBytes:&d length:sizeof(double)];
+        }
+        else {
+            nu_image_write_byte(data, NU_IMAGE_NULL);
+        }
+    }
+    else if (nu_objectIsKindOfClass(value, [NSRegularExpression class])) {
+        nu_image_write_byte(data, NU_IMAGE_REGEX);
+        nu_image_write_varint(data, [value options]);
+        nu_image_write_string(data, [value pattern]);
+    }
+    else if (nu_objectIsKindOfClass(value, [NuClass class])) {
+        nu_image_write_byte(data, NU_IMAGE_NUCLASS);
+        nu_image_write_string(data, [(NuClass *) value name]);
+    }
+    else {
+        uintptr_t index = (uintptr_t) NSMapGet(writer->objects, value);
+        if (allowObjects && index) {
+            nu_image_write_byte(data, NU_IMAGE_OBJECT);
+            nu_image_write_varint(data, index - 1);
+        }
+        else if (nu_image_is_class(value)) {
+            nu_image_write_byte(data, NU_IMAGE_CLASS);
+            nu_image_write_string(data, [NSString stringWithCString:class_getName(value) encoding:NSUTF8StringEncoding]);
+        }
+        else {
+            nu_image_write_byte(data, NU_IMAGE_NULL);
+        }
+    }
+}
+
+// Write the entries of a dictionary whose keys and values can be written, leaving out some keys.
+static void nu_image_write_entries(nu_image_writer *writer, NSDictionary *dictionary, BOOL (*excluded)(nu_image_writer *, id, id))
+{
+    NSMutableArray *keys = [NSMutableArray array];
+    for (id key in [dictionary allKeys]) {
+        id value = [dictionary objectForKey:key];
+        if (nu_image_can_write(writer, key) && nu_image_can_write(writer, value)
+            && !(excluded && excluded(writer, key, value)))
+            [keys addObject:key];
+    }
+    nu_image_write_varint(writer->data, [keys count]);
+    for (id key in keys) {
+        nu_image_write_value(writer, key, YES);
+        nu_image_write_value(writer, [dictionary objectForKey:key], YES);
+    }
+}
+
+static BOOL nu_image_excludes_block_key(nu_image_writer *writer, id key, id value)
+{
+    return nu_image_is_block_key(key);
+}
+
+static BOOL nu_image_excludes_binding(nu_image_writer *writer, id key, id value)
+{
+    return (key == writer->parserSymbol)
+    || nu_image_is_block_key(key)
+    || ([initialBindings objectForKey:key] == value);
+}
+
+static NSData *nu_image_data(NuParser *parser)
+{
+    nu_image_writer writer;
+    writer.data = [NSMutableData data];
+    writer.symbols = [NSMutableDictionary dictionary];
+    writer.symbolNames = [NSMutableArray array];
+    writer.files = [NSMutableDictionary dictionary];
+    writer.fileNames = [NSMutableArray array];
+    writer.objects = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks, NSIntegerMapValueCallBacks, 0);
+    writer.objectList = [NSMutableArray array];
+    writer.parser = parser;
+    writer.top = [parser context];
+    writer.symbolTable = [parser symbolTable];
+    writer.parserSymbol = [writer.symbolTable symbolWithString:@"_parser"];
+    NSMutableData *data = writer.data;
+
+    // find the definitions that were made in the parser's context
+    NSMutableDictionary *globals = [NSMutableDictionary dictionary];
+    NSMutableArray *classes = [NSMutableArray array];
+    NSMutableArray *methods = [NSMutableArray array];
+    @synchronized([NuImage class]) {
+        for (NuSymbol *symbol in [recordedGlobals allKeys]) {
+            id value = [symbol value];
+            if (([[recordedGlobals objectForKey:symbol] pointerValue] == writer.top)
+                && value && nu_image_can_write(&writer, value))
+                [globals setObject:value forKey:symbol];
+        }
+        for (NSArray *record in recordedClasses) {
+            if ([[record objectAtIndex:1] pointerValue] == writer.top)
+                [classes addObject:[record objectAtIndex:0]];
+        }
+        for (NSString *key in recordedMethodKeys) {
+            NSArray *record = [recordedMethods objectForKey:key];
+            if (nu_image_top_context([(NuBlock *) [record objectAtIndex:3] context]) == writer.top)
+                [methods addObject:record];
+        }
+    }
+    for (id key in [writer.top allKeys]) {
+        if (!nu_image_excludes_binding(&writer, key, [writer.top objectForKey:key]))
+            nu_image_collect(&writer, [writer.top objectForKey:key]);
+    }
+    for (id value in [globals allValues])
+        nu_image_collect(&writer, value);
+    for (NSArray *record in methods)
+        nu_image_collect(&writer, [record objectAtIndex:3]);
+
+    // classes
+    nu_image_write_varint(data, [classes count]);
+    for (NSValue *classValue in classes) {
+        Class c = (Class) [classValue pointerValue];
+        Class superclass = class_getSuperclass(c);
+        nu_image_write_string(data, [NSString stringWithCString:class_getName(c) encoding:NSUTF8StringEncoding]);
+        nu_image_write_string(data, [NSString stringWithCString:(superclass ? class_getName(superclass) : "") encoding:NSUTF8StringEncoding]);
+        unsigned int ivarCount = 0;
+        Ivar *ivars = class_copyIvarList(c, &ivarCount);
+        nu_image_write_varint(data, ivarCount);
+        for (unsigned int i = 0; i < ivarCount; i++) {
+            nu_image_write_string(data, [NSString stringWithCString:ivar_getName(ivars[i]) encoding:NSUTF8StringEncoding]);
+            nu_image_write_string(data, [NSString stringWithCString:ivar_getTypeEncoding(ivars[i]) encoding:NSUTF8StringEncoding]);
+        }
+        free(ivars);
+    }
+
+    // objects
+    nu_image_write_varint(data, [writer.objectList count]);
+    for (id object in writer.objectList) {
+        if (nu_objectIsKindOfClass(object, [NuBlock class]))
+            nu_image_write_byte(data, NU_IMAGE_BLOCK);
+        else if (nu_objectIsKindOfClass(object, [NuMacro_1 class]))
+            nu_image_write_byte(data, NU_IMAGE_MACRO_1);
+        else if (nu_objectIsKindOfClass(object, [NuMacro_0 class]))
+            nu_image_write_byte(data, NU_IMAGE_MACRO_0);
+        else if (nu_objectIsKindOfClass(object, [NuBridgedFunction class]))
+            nu_image_write_byte(data, NU_IMAGE_FUNCTION);
+        else if (nu_objectIsKindOfClass(object, [NSDictionary class]))
+            nu_image_write_byte(data, NU_IMAGE_DICTIONARY);
+        else
+            nu_image_write_byte(data, NU_IMAGE_ARRAY);
+    }
+
+    // definitions
+    for (id object in writer.objectList) {
+        if (nu_objectIsKindOfClass(object, [NuBlock class])) {
+            NuBlock *block = (NuBlock *) object;
+            nu_image_write_value(&writer, [block parameters], NO);
+            nu_image_write_value(&writer, [block body], NO);
+            nu_image_write_value(&writer, [[block context] objectForKey:PARENT_KEY], YES);
+            nu_image_write_byte(data, [block isCompiled] ? 1 : 0);
+        }
+        else if (nu_objectIsKindOfClass(object, [NuMacro_0 class])) {
+            NuMacro_0 *macro = (NuMacro_0 *) object;
+            nu_image_write_value(&writer, [macro name], NO);
+            if (nu_objectIsKindOfClass(macro, [NuMacro_1 class]))
+                nu_image_write_value(&writer, [(NuMacro_1 *) macro parameters], NO);
+            nu_image_write_value(&writer, [macro body], NO);
+            nu_image_write_byte(data, [macro cachesExpansions] ? 1 : 0);
+        }
+        else if (nu_objectIsKindOfClass(object, [NuBridgedFunction class])) {
+            nu_image_write_string(data, [(NuBridgedFunction *) object name]);
+            nu_image_write_string(data, [(NuBridgedFunction *) object signature]);
+        }
+    }
+
+    // contents
+    for (id object in writer.objectList) {
+        if (nu_objectIsKindOfClass(object, [NuBlock class])) {
+            nu_image_write_entries(&writer, [(NuBlock *) object context], nu_image_excludes_block_key);
+        }
+        else if (nu_objectIsKindOfClass(object, [NSDictionary class])) {
+            nu_image_write_entries(&writer, object, NULL);
+        }
+        else if (nu_objectIsKindOfClass(object, [NSArray class])) {
+            nu_image_write_varint(data, [object count]);
+            for (id element in object)
+                nu_image_write_value(&writer, element, YES);
+        }
+    }
+
+    // bindings
+    nu_image_write_entries(&writer, writer.top, nu_image_excludes_binding);
+    nu_image_write_entries(&writer, globals, NULL);
+
+    // methods
+    nu_image_write_varint(data, [methods count]);
+    for (NSArray *record in methods) {
+        Class c = (Class) [[record objectAtIndex:0] pointerValue];
+        nu_image_write_string(data, [NSString stringWithCString:class_getName(c) encoding:NSUTF8StringEncoding]);
+        nu_image_write_byte(data, class_isMetaClass(c) ? 1 : 0);
+        nu_image_write_string(data, [record objectAtIndex:1]);
+        nu_image_write_string(data, [record objectAtIndex:2]);
+        nu_image_write_value(&writer, [record objectAtIndex:3], YES);
+    }
+    NSFreeMapTable(writer.objects);
+
+    NSMutableData *image = [NSMutableData dataWithCapacity:[data length] + 16 * [writer.symbolNames count] + 64];
+    nu_image_write_varint(image, NU_IMAGE_MAGIC);
+    nu_image_write_varint(image, NU_IMAGE_FORMAT);
+    nu_image_write_string(image, @NU_VERSION);
+    nu_image_write_varint(image, [writer.symbolNames count]);
+    for (NSString *name in writer.symbolNames)
+        nu_image_write_string(image, name);
+    nu_image_write_varint(image, [writer.fileNames count]);
+    for (NSString *name in writer.fileNames)
+        nu_image_write_string(image, name);
+    [image appendData:data];
+    return image;
+}
+
+#pragma mark - Reading
+
+typedef struct nu_image_reader {
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger offset;
+    BOOL failed;
+    NSMutableArray *symbols;
+    int *files;                                   // file numbers, with -1 for cells without a file
+    uint64_t fileCount;
+    NSMutableArray *objects;
+    NuParser *parser;
+    NSMutableDictionary *top;
+    NuSymbolTable *symbolTable;
+} nu_image_reader;
+
+static uint8_t nu_image_read_byte(nu_image_reader *reader)
+{
+    if (reader->offset >= reader->length) {
+        reader->failed = YES;
+        return 0;
+    }
+    return reader->bytes[reader->offset++];
+}
+
+static uint64_t nu_image_read_varint(nu_image_reader *reader)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (shift < 64) {
+        uint8_t byte = nu_image_read_byte(reader);
+        value |= ((uint64_t) (byte & 0x7f)) << shift;
+        if (!(byte & 0x80))
+            return value;
+        shift += 7;
+    }
+    reader->failed = YES;
+    return 0;
+}
+
+static int64_t nu_image_read_signed(nu_image_reader *reader)
+{
+    uint64_t value = nu_image_read_varint(reader);
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// Read a count of items that each take at least one byte.
+static uint64_t nu_image_read_count(nu_image_reader *reader)
+{
+    uint64_t count = nu_image_read_varint(reader);
+    if (count > reader->length - reader->offset) {
+        reader->failed = YES;
+        return 0;
+    }
+    return count;
+}
+
+static NSString *nu_image_read_string(nu_image_reader *reader)
+{
+    uint64_t length = nu_image_read_varint(reader);
+    if (reader->failed || (length > reader->length - reader->offset)) {
+        reader->failed = YES;
+        return nil;
+    }
+    NSString *string = [[[NSString alloc] initWithBytes:reader->bytes + reader->offset
+                                                 length:(NSUInteger) length
+                                               encoding:NSUTF8StringEncoding] autorelease];
+    reader->offset += (NSUInteger) length;
+    if (!string)
+        reader->failed = YES;
+    return string;
+}
+
+// Check reader->failed to distinguish a nil value from malformed data.
+static id nu_image_read_value(nu_image_reader *reader)
+{
+    uint8_t tag = nu_image_read_byte(reader);
+    if (reader->failed)
+        return nil;
+    switch (tag) {
+        case NU_IMAGE_NIL:
+            return nil;
+        case NU_IMAGE_NULL:
+            return Nu__null;
+        case NU_IMAGE_TOP:
+            return reader->top;
+        case NU_IMAGE_PARSER:
+            return reader->parser;
+        case NU_IMAGE_SYMBOL_TABLE:
+            return reader->symbolTable;
+        case NU_IMAGE_LIST:
+        {
+            uint64_t count = nu_image_read_count(reader);
+            if (reader->failed || (count == 0)) {
+                reader->failed = YES;
+                return nil;
+            }
+            NuCell *head = [[[NuCell alloc] init] autorelease];
+            NuCell *cell = head;
+            for (;;) {
+                uint64_t file = nu_image_read_varint(reader);
+                int64_t line = nu_image_read_signed(reader);
+                if (reader->failed || (file > reader->fileCount)) {
+                    reader->failed = YES;
+                    return nil;
+                }
+                [cell setFile:reader->files[file] line:(int) line];
+                [cell setCar:nu_image_read_value(reader)];
+                if (reader->failed)
+                    return nil;
+                if (--count == 0)
+                    break;
+                NuCell *next = [[NuCell alloc] init];
+                [cell setCdr:next];
+                [next release];
+                cell = next;
+            }
+            [cell setCdr:nu_image_read_value(reader)];
+            return head;
+        }
+        case NU_IMAGE_SYMBOL:
+        {
+            uint64_t index = nu_image_read_varint(reader);
+            if (reader->failed || (index >= [reader->symbols count])) {
+                reader->failed = YES;
+                return nil;
+            }
+            return [reader->symbols objectAtIndex:(NSUInteger) index];
+        }
+        case NU_IMAGE_STRING:
+            return nu_interpolated_string(nu_image_read_string(reader));
+        case NU_IMAGE_INTEGER:
+        {
+            uint8_t type = nu_image_read_byte(reader);
+            int64_t value = nu_image_read_signed(reader);
+            if (reader->failed)
+                return nil;
+            if (type == 'i')
+                return [NSNumber numberWithInt:(int) value];
+            return nu_number_with_long((long) value);
+        }
+        case NU_IMAGE_DOUBLE:
+        {
+            double d;
+            if (reader->length - reader->offset < sizeof(double)) {
+                reader->failed = YES;
+                return nil;
+            }
+            memcpy(&d, reader->bytes + reader->offset, sizeof(double));
+            reader->offset += sizeof(double);
+            return [NSNumber numberWithDouble:d];
+        }
+        case NU_IMAGE_REGEX:
+        {
+            uint64_t options = nu_image_read_varint(reader);
+            NSString *pattern = nu_image_read_string(reader);
+            if (reader->failed)
+                return nil;
+            return nu_regex_cached(pattern, (NSUInteger) options);
+        }
+        case NU_IMAGE_OBJECT:
+        {
+            uint64_t index = nu_image_read_varint(reader);
+            if (reader->failed || (index >= [reader->objects count])) {
+                reader->failed = YES;
+                return nil;
+            }
+            return [reader->objects objectAtIndex:(NSUInteger) index];
+        }
+        case NU_IMAGE_NUCLASS:
+        {
+            NSString *name = nu_image_read_string(reader);
+            id value = reader->failed ? nil : [NuClass classWithName:name];
+            return value ? value : Nu__null;
+        }
+        case NU_IMAGE_CLASS:
+        {
+            NSString *name = nu_image_read_string(reader);
+            id value = reader->failed ? nil : NSClassFromString(name);
+            return value ? value : Nu__null;
+        }
+        default:
+            reader->failed = YES;
+            return nil;
+    }
+}
+
+// Read entries into a dictionary.
+static void nu_image_read_entries(nu_image_reader *reader, NSMutableDictionary *dictionary)
+{
+    uint64_t count = nu_image_read_count(reader);
+    for (; !reader->failed && (count > 0); count--) {
+        id key = nu_image_read_value(reader);
+        id value = nu_image_read_value(reader);
+        if (!key)
+            reader->failed = YES;
+        if (!reader->failed)
+            [dictionary setPossiblyNullObject:value forKey:key];
+    }
+}
+
+static void nu_image_create_class(nu_image_reader *reader, NSString *name, NSString *superclassName, NSArray *ivars)
+{
+    if (NSClassFromString(name))
+        return;
+    Class superclass = NSClassFromString(superclassName);
+    if (!superclass)
+        [NSException raise:@"NuUndefinedSuperclass" format:@"undefined superclass %@", superclassName];
+#if defined(__x86_64__) || TARGET_OS_IPHONE
+    Class newClass = objc_allocateClassPair(superclass, [name UTF8String], 0);
+    for (NSArray *ivar in ivars)
+        nu_class_addInstanceVariable_withSignature(newClass,
+                                                   [[ivar objectAtIndex:0] UTF8String],
+                                                   [[ivar objectAtIndex:1] UTF8String]);
+    NuClass *nuClass = [NuClass classWithClass:newClass];
+    [nuClass setRegistered:NO];
+    [nuClass registerClass];
+#else
+    [superclass createSubclassNamed:name];
+    Class newClass = NSClassFromString(name);
+#endif
+    nu_image_record_class(newClass, reader->top);
+}
+
+static void nu_image_load(nu_image_reader *reader)
+{
+    NuSymbolTable *symbolTable = reader->symbolTable;
+
+    uint64_t magic = nu_image_read_varint(reader);
+    uint64_t format = nu_image_read_varint(reader);
+    NSString *version = nu_image_read_string(reader);
+    if (reader->failed || (magic != NU_IMAGE_MAGIC) || (format != NU_IMAGE_FORMAT)) {
+        reader->failed = YES;
+        return;
+    }
+    if (![version isEqualToString:@NU_VERSION])
+        [NSException raise:@"NuInvalidImage" format:@"image was written by Nu %@", version];
+
+    uint64_t count = nu_image_read_count(reader);
+    for (; !reader->failed && (count > 0); count--) {
+        NSString *name = nu_image_read_string(reader);
+        if (name)
+            [reader->symbols addObject:[symbolTable symbolWithString:name]];
+    }
+    reader->fileCount = nu_image_read_count(reader);
+    if (reader->failed)
+        return;
+    reader->files = (int *) malloc((reader->fileCount + 1) * sizeof(int));
+    reader->files[0] = -1;
+    for (uint64_t i = 1; !reader->failed && (i <= reader->fileCount); i++) {
+        NSString *name = nu_image_read_string(reader);
+        reader->files[i] = name ? nu_parser_register_filename([name UTF8String]) : -1;
+    }
+
+    // classes
+    count = nu_image_read_count(reader);
+    for (; !reader->failed && (count > 0); count--) {
+        NSString *name = nu_image_read_string(reader);
+        NSString *superclassName = nu_image_read_string(reader);
+        NSMutableArray *ivars = [NSMutableArray array];
+        uint64_t ivarCount = nu_image_read_count(reader);
+        for (; !reader->failed && (ivarCount > 0); ivarCount--) {
+            NSString *ivarName = nu_image_read_string(reader);
+            NSString *ivarType = nu_image_read_string(reader);
+            if (ivarName && ivarType)
+                [ivars addObject:[NSArray arrayWithObjects:ivarName, ivarType, nil]];
+        }
+        if (reader->failed)
+            return;
+        nu_image_create_class(reader, name, superclassName, ivars);
+    }
+
+    // objects
+    count = nu_image_read_count(reader);
+    NSMutableData *kinds = [NSMutableData dataWithLength:(NSUInteger) count];
+    uint8_t *kind = (uint8_t *) [kinds mutableBytes];
+    for (uint64_t i = 0; !reader->failed && (i < count); i++) {
+        kind[i] = nu_image_read_byte(reader);
+        switch (kind[i]) {
+            case NU_IMAGE_DICTIONARY:
+                [reader->objects addObject:[NSMutableDictionary dictionary]];
+                break;
+            case NU_IMAGE_ARRAY:
+                [reader->objects addObject:[NSMutableArray array]];
+                break;
+            case NU_IMAGE_BLOCK: case NU_IMAGE_MACRO_0: case NU_IMAGE_MACRO_1: case NU_IMAGE_FUNCTION:
+                [reader->objects addObject:Nu__null];
+                break;
+            default:
+                reader->failed = YES;
+        }
+    }
+
+    // definitions
+    for (uint64_t i = 0; !reader->failed && (i < count); i++) {
+        id object = nil;
+        switch (kind[i]) {
+            case NU_IMAGE_BLOCK:
+            {
+                id parameters = nu_image_read_value(reader);
+                id body = nu_image_read_value(reader);
+                id context = nu_image_read_value(reader);
+                BOOL compiled = nu_image_read_byte(reader);
+                if (reader->failed || !nu_objectIsKindOfClass(context, [NSMutableDictionary class])) {
+                    reader->failed = YES;
+                    break;
+                }
+                object = [[[NuBlock alloc] initWithParameters:parameters body:body context:context] autorelease];
+                // the block's context may not be filled in yet
+                [[(NuBlock *) object context] setPossiblyNullObject:symbolTable forKey:SYMBOLS_KEY];
+                if (compiled)
+                    [object compile];
+                break;
+            }
+            case NU_IMAGE_MACRO_0: case NU_IMAGE_MACRO_1:
+            {
+                id name = nu_image_read_value(reader);
+                id parameters = (kind[i] == NU_IMAGE_MACRO_1) ? nu_image_read_value(reader) : nil;
+                id body = nu_image_read_value(reader);
+                BOOL caches = nu_image_read_byte(reader);
+                if (reader->failed)
+                    break;
+                if (kind[i] == NU_IMAGE_MACRO_1)
+                    object = [[[NuMacro_1 alloc] initWithName:name parameters:parameters body:body] autorelease];
+                else
+                    object = [[[NuMacro_0 alloc] initWithName:name body:body] autorelease];
+                [object setCachesExpansions:caches];
+                break;
+            }
+            case NU_IMAGE_FUNCTION:
+            {
+                NSString *name = nu_image_read_string(reader);
+                NSString *signature = nu_image_read_string(reader);
+                if (reader->failed)
+                    break;
+                object = [NuBridgedFunction functionWithName:name signature:signature];
+                break;
+            }
+        }
+        if (object)
+            [reader->objects replaceObjectAtIndex:(NSUInteger) i withObject:object];
+    }
+
+    // contents
+    for (uint64_t i = 0; !reader->failed && (i < count); i++) {
+        id object = [reader->objects objectAtIndex:(NSUInteger) i];
+        switch (kind[i]) {
+            case NU_IMAGE_DICTIONARY:
+                nu_image_read_entries(reader, object);
+                break;
+            case NU_IMAGE_BLOCK:
+                nu_image_read_entries(reader, [(NuBlock *) object context]);
+                break;
+            case NU_IMAGE_ARRAY:
+            {
+                uint64_t elementCount = nu_image_read_count(reader);
+                for (; !reader->failed && (elementCount > 0); elementCount--) {
+                    id element = nu_image_read_value(reader);
+                    [object addObject:(element ? element : Nu__null)];
+                }
+                break;
+            }
+        }
+    }
+
+    // bindings
+    if (reader->failed)
+        return;
+    nu_image_read_entries(reader, reader->top);
+    count = nu_image_read_count(reader);
+    for (; !reader->failed && (count > 0); count--) {
+        id symbol = nu_image_read_value(reader);
+        id value = nu_image_read_value(reader);
+        if (!nu_objectIsKindOfClass(symbol, [NuSymbol class]))
+            reader->failed = YES;
+        if (!reader->failed) {
+            [symbol setValue:value];
+            nu_image_record_global(symbol, reader->top);
+        }
+    }
+
+    // methods
+    count = nu_image_read_count(reader);
+    for (; !reader->failed && (count > 0); count--) {
+        NSString *className = nu_image_read_string(reader);
+        BOOL isMeta = nu_image_read_byte(reader);
+        NSString *methodName = nu_image_read_string(reader);
+        NSString *signature = nu_image_read_string(reader);
+        id block = nu_image_read_value(reader);
+        if (reader->failed || !nu_objectIsKindOfClass(block, [NuBlock class])) {
+            reader->failed = YES;
+            break;
+        }
+        Class c = NSClassFromString(className);
+        if (!c)
+            [NSException raise:@"NuUndefinedClass" format:@"undefined class %@", className];
+        add_method_to_class(isMeta ? object_getClass(c) : c, methodName, signature, block);
+    }
+    if (reader->offset != reader->length)
+        reader->failed = YES;
+}
+
+@implementation NuImage
+
++ (void) writeImageOfParser:(NuParser *)parser toFile:(NSString *)path
+{
+    NSData *data = nu_image_data(parser);
+    if (![data writeToFile:path atomically:YES])
+        [NSException raise:@"NuImageError" format:@"can't write image to %@", path];
+}
+
++ (void) loadImageFromFile:(NSString *)path intoParser:(NuParser *)parser
+{
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+    if (!data)
+        [NSException raise:@"NuImageError" format:@"can't read image from %@", path];
+    nu_image_reader reader;
+    reader.bytes = (const uint8_t *) [data bytes];
+    reader.length = [data length];
+    reader.offset = 0;
+    reader.failed = NO;
+    reader.symbols = [NSMutableArray array];
+    reader.files = NULL;
+    reader.fileCount = 0;
+    reader.objects = [NSMutableArray array];
+    reader.parser = parser;
+    reader.top = [parser context];
+    reader.symbolTable = [parser symbolTable];
+    @try {
+        nu_image_load(&reader);
+    }
+    @finally {
+        free(reader.files);
+    }
+    if (reader.failed)
+        [NSException raise:@"NuInvalidImage" format:@"%@ is not a valid image", path];
+}
+
+@end
@@ -0,0 +1,91 @@
+//
+//  NuInlineCache.h
+//  Nu
+//
+//  Method caches for message send call sites.
+//
+
+#import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+
+#define NU_INLINE_CACHE_ENTRIES 4
+
+typedef struct nu_inline_cache_entry {
+    Class receiverClass;    // the class of the receiver, or the wrapped class when the receiver is a NuClass
+    bool wrapper;           // true if the receiver is a NuClass
+    bool classMethod;       // true if the method is a class method of the wrapped class
+    Method method;
+} nu_inline_cache_entry;
+
+/*!
+ @struct nu_inline_cache
+ @abstract The method cache of a message send.
+ @discussion Each list that sends a message gets a cache the first time it is evaluated.
+ The cache holds the message's selector and the methods found for the last few receiver classes,
+ so repeated sends skip both the selector lookup and the method lookup.
+ Caches are emptied when their <b>epoch</b> falls behind the global method epoch, which is advanced
+ whenever Nu adds, replaces or exchanges methods.
+
+ A message may be sent on several threads at once. Its cache is changed by one thread at a time, which
+ makes <b>sequence</b> odd while it writes; readers copy an entry and discard it if the sequence changed.
+ A thread that finds the cache being written just sends its message without caching the method.
+ */
+typedef struct nu_inline_cache {
+    unsigned long sequence;
+    unsigned long epoch;
+    SEL selector;
+    int count;
+    int next;               // the entry to replace when the cache is full
+    nu_inline_cache_entry entries[NU_INLINE_CACHE_ENTRIES];
+} nu_inline_cache;
+
+/*!
+ @class NuInlineCache
+ @abstract Statistics and control for the method caches of message sends.
+ */
+@interface NuInlineCache : NSObject
+/*! Get a dictionary with the number of cache <b>hits</b> and <b>misses</b>, the number of misses
+ that replaced an entry of a full cache (<b>evictions</b>), and the current <b>epoch</b>.
+ The counts are not synchronized, so they are approximate when messages are sent on several threads. */
++ (NSDictionary *) statistics;
+/*! Reset the hit, miss and eviction counts. */
++ (void) resetStatistics;
+/*! Empty all method caches. */
++ (void) invalidate;
+@end
+
+extern unsigned long nu_method_cache_epoch;
+extern unsigned long nu_inline_cache_hits;
+extern unsigned long nu_inline_cache_misses;
+
+// Call this whenever methods are added, replaced or exchanged.
+void nu_invalidate_method_caches(void);
+
+// Create a cache for a message send with the specified selector.
+nu_inline_cache *nu_inline_cache_create(SEL selector);
+
+// Copy the entry for a receiver class into result and return true, or return false if there is none.
+// Caches that were filled before methods last changed have no entries.
+static inline bool nu_inline_cache_lookup(nu_inline_cache *cache, Class receiverClass, bool wrapper, nu_inline_cache_entry *result)
+{
+    unsigned long sequence = __atomic_load_n(&cache->sequence, __ATOMIC_ACQUIRE);
+    if (!(sequence & 1) && (cache->epoch == __atomic_load_n(&nu_method_cache_epoch, __ATOMIC_ACQUIRE))) {
+        int count = cache->count;
+        for (int i = 0; i < count; i++) {
+            nu_inline_cache_entry *entry = &cache->entries[i];
+            if ((entry->receiverClass == receiverClass) && (entry->wrapper == wrapper)) {
+                *result = *entry;
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&cache->sequence, __ATOMIC_RELAXED) != sequence)
+                    break;
+                nu_inline_cache_hits++;
+                return true;
+            }
+        }
+    }
+    nu_inline_cache_misses++;
+    return false;
+}
+
+// Add the method found for a receiver class, replacing an older entry if the cache is full.
+void nu_inline_cache_insert(nu_inline_cache *cache, Class receiverClass, bool wrapper, bool classMethod, Method method);
@@ -0,0 +1,85 @@
+//
+//  NuInlineCache.m
+//  Nu
+//
+//  Method caches for message send call sites.
+//
+
+#import "NuInlineCache.h"
+
+unsigned long nu_method_cache_epoch = 1;
+unsigned long nu_inline_cache_hits = 0;
+unsigned long nu_inline_cache_misses = 0;
+static unsigned long nu_inline_cache_evictions = 0;
+
+void nu_invalidate_method_caches(void)
+{
+    __atomic_add_fetch(&nu_method_cache_epoch, 1, __ATOMIC_RELEASE);
+}
+
+nu_inline_cache *nu_inline_cache_create(SEL selector)
+{
+    nu_inline_cache *cache = (nu_inline_cache *) calloc(1, sizeof(nu_inline_cache));
+    cache->selector = selector;
+    cache->epoch = __atomic_load_n(&nu_method_cache_epoch, __ATOMIC_ACQUIRE);
+    return cache;
+}
+
+void nu_inline_cache_insert(nu_inline_cache *cache, Class receiverClass, bool wrapper, bool classMethod, Method method)
+{
+    // claim the cache by making its sequence odd, unless another thread is writing it
+    unsigned long sequence = __atomic_load_n(&cache->sequence, __ATOMIC_RELAXED);
+    if ((sequence & 1)
+        || !__atomic_compare_exchange_n(&cache->sequence, &sequence, sequence + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    unsigned long epoch = __atomic_load_n(&nu_method_cache_epoch, __ATOMIC_ACQUIRE);
+    if (cache->epoch != epoch) {
+        cache->count = 0;
+        cache->next = 0;
+        cache->epoch = epoch;
+    }
+    nu_inline_cache_entry *entry;
+    if (cache->count < NU_INLINE_CACHE_ENTRIES) {
+        entry = &cache->entries[cache->count];
+    }
+    else {
+        // megamorphic sites keep the most recent classes
+        entry = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % NU_INLINE_CACHE_ENTRIES;
+        nu_inline_cache_evictions++;
+    }
+    entry->receiverClass = receiverClass;
+    entry->wrapper = wrapper;
+    entry->classMethod = classMethod;
+    entry->method = method;
+    if (cache->count < NU_INLINE_CACHE_ENTRIES)
+        cache->count++;
+    __atomic_store_n(&cache->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+@implementation NuInlineCache
+
++ (NSDictionary *) statistics
+{
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+            [NSNumber numberWithUnsignedLong:nu_inline_cache_hits], @"hits",
+            [NSNumber numberWithUnsignedLong:nu_inline_cache_misses], @"misses",
+            [NSNumber numberWithUnsignedLong:nu_inline_cache_evictions], @"evictions",
+            [NSNumber numberWithUnsignedLong:nu_method_cache_epoch], @"epoch",
+            nil];
+}
+
++ (void) resetStatistics
+{
+    nu_inline_cache_hits = 0;
+    nu_inline_cache_misses = 0;
+    nu_inline_cache_evictions = 0;
+}
+
++ (void) invalidate
+{
+    nu_invalidate_method_caches();
+}
+
+@end
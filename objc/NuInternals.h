@@ -20,11 +20,13 @@
 #import "Nu.h"
 
 @class NuBlock;
+@class NuSymbol;
 
 #define IS_NOT_NULL(xyz) ((xyz) && (((id) (xyz)) != Nu__null))
 
 
-extern NSMutableDictionary *nu_block_table;
+// Get the block that implements a method handler, or nil if the implementation wasn't created by Nu.
+NuBlock *nu_block_for_imp(IMP imp);
 
 extern id Nu__null;
 
@@ -66,12 +68,132 @@ extern id Nu__null;
 - (id) blockForReturn;
 @end
 
+// The break, continue and return operators don't throw exceptions; they leave a control signal pending
+// for the current thread. No list is evaluated while a signal is pending, so evaluation unwinds until
+// a loop or block handles the signal. The exceptions above are only thrown to carry a signal through
+// native code, and they are turned back into signals when they reach a list that is being evaluated.
+typedef enum {
+    NuControlSignalNone = 0,
+    NuControlSignalBreak,
+    NuControlSignalContinue,
+    NuControlSignalReturn
+} NuControlSignal;
+
+typedef struct nu_control_state {
+    NuControlSignal signal;
+    id value;                   // retained; the value of a return
+    id blockForReturn;          // weak reference; the target of a return-from
+} nu_control_state;
+
+extern __thread nu_control_state nu_control;
+
+// use these to raise and handle control signals
+void nu_set_control_signal(NuControlSignal signal, id value, id blockForReturn);
+id nu_take_control_value(void);
+void nu_clear_control_signal(void);
+
+// use these to preserve a pending control signal while evaluating code that must run anyway
+void nu_suspend_control_signal(nu_control_state *saved);
+void nu_resume_control_signal(nu_control_state *saved);
+
+// use this where evaluation returns to native code; it throws the exception for a pending signal
+void nu_raise_pending_control_signal(void);
+
+// use this to turn a control exception back into a pending signal; it returns false for other exceptions
+bool nu_control_signal_from_exception(id exception);
+
+// A call of a block in tail position does not evaluate the block; it leaves the block and its prepared
+// context pending for the current thread, and the block whose body it ends evaluates the call in its place.
+typedef struct nu_tail_call_state {
+    bool position;                  // set when the next list to be evaluated is in tail position
+    bool pending;
+    NuBlock *block;                 // retained
+    NSMutableDictionary *context;   // retained
+} nu_tail_call_state;
+
+extern __thread nu_tail_call_state nu_tail_call;
+
+// use this at the beginning of an operator that passes tail position on to one of its expressions
+static inline bool nu_take_tail_position(void)
+{
+    bool tail = nu_tail_call.position;
+    nu_tail_call.position = false;
+    return tail;
+}
+
+// use these around evaluation started by native code; nu_evaluation_begin returns false if the thread is already evaluating.
+// Memory that is retired while threads are evaluating is reclaimed after each of them has passed a quiescent point,
+// where it holds no unretained pointers to global values, scopes or slot symbols (see nu_retire).
+extern unsigned long nu_global_value_epoch;
+bool nu_evaluation_begin(void);
+void nu_evaluation_end(void);
+void nu_evaluation_quiescent(void);
+unsigned long nu_expression_stacks_oldest_epoch(void);
+void nu_release_retired_values(void);
+
+// use this to reclaim memory that other threads may be reading without a lock once they have passed
+// a quiescent point; it is reclaimed by a later call to nu_release_retired_values
+void nu_retire(void *value, void (*reclaim)(void *));
+void nu_retire_object(id object);
+
+// use this at the end of each iteration of a loop; it handles break and continue and returns true if the loop should stop.
+// The end of an iteration is also a quiescent point for the thread.
+static inline bool nu_loop_should_stop(void)
+{
+    nu_evaluation_quiescent();
+    switch (nu_control.signal) {
+        case NuControlSignalNone:
+            return false;
+        case NuControlSignalContinue:
+            nu_control.signal = NuControlSignalNone;
+            return false;
+        case NuControlSignalBreak:
+            nu_control.signal = NuControlSignalNone;
+            return true;
+        default:
+            return true;
+    }
+}
+
 // use this to test a value for "truth"
 bool nu_valueIsTrue(id value);
 
+// use this to get an NSNumber for a long; numbers in a small range around zero are shared
+NSNumber *nu_number_with_long(long value);
+
 // use this to get the filename for a NuCell created by the parser
 const char *nu_parsedFilename(int i);
 
+// use this to add a filename to the parser's table; returns the number used by NuCells parsed from it
+int nu_parser_register_filename(const char *name);
+
+// use this to evaluate the car of a list cell; it uses the cell's lexical address when one is available
+id nu_evaluateCar(id cell, NSMutableDictionary *context);
+
+// use this to evaluate a sequence of expressions; it stops if one of them raises a control signal and returns the value of the last one that completed, or result if none did
+id nu_evaluateBody(id expressions, NSMutableDictionary *context, id result);
+
+// use this to evaluate the car of a cell that is the last expression of a block body or of an operator in tail position
+id nu_evaluateTail(id cell, NSMutableDictionary *context, bool tail);
+
+// use these to get the innermost expression being evaluated on the current thread and to unwind the expression stack after catching an exception
+id nu_current_expression(void);
+NSUInteger nu_expression_stack_depth(void);
+NSUInteger nu_expression_stack_enter(id cell);
+void nu_expression_stack_unwind(NSUInteger depth);
+
+// use this to ask every thread that is evaluating an expression to record a profile sample of its expression stack
+void nu_expression_stacks_request_samples(void);
+
+// use this to assign a value to a symbol the way the set operator does
+id nu_setSymbolValue(NuSymbol *symbol, id result, NSMutableDictionary *context);
+
+// use this to evaluate a list whose head has already been evaluated
+id nu_applyCell(id cell, id value, NSMutableDictionary *context, bool tail);
+
+// use this to handle an exception raised while evaluating a list the way the list would; it rethrows exceptions that don't carry control signals
+id nu_cellValueForException(id cell, NSException *exception, NSUInteger depth);
+
 
 
 id nu_calling_objc_method_handler(id target, Method m, NSMutableArray *args);
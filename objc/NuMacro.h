@@ -14,6 +14,21 @@
 
 @class NuCell;
 
+/*!
+ @struct nu_macro_expansion
+ @abstract The expansion of a macro call that is kept with the call's list.
+ @discussion The expansion is used by later evaluations of the same call as long as the list's head
+ still names the macro that produced it and no macro has been defined or invalidated since.
+ */
+typedef struct nu_macro_expansion {
+    id macro;
+    unsigned long epoch;
+    id expansion;
+} nu_macro_expansion;
+
+// Release a macro call's expansion.
+void nu_macro_expansion_free(nu_macro_expansion *expansion);
+
 /*!
  @class NuMacro_0
  @abstract The Nu implementation of macros.
@@ -37,6 +52,11 @@
  underscore ("__") are replaced with automatically-generated symbols
  that are guaranteed to be unique. In Lisp terminology, these generated
  symbols are called "gensyms".
+
+ A macro that caches its expansions expands each call once and evaluates
+ that expansion every time the call is evaluated again, so its gensyms are
+ also generated once per call. Only macros whose expansions depend on nothing but their
+ arguments should cache them. Defining a macro discards every cached expansion.
  */
 @interface NuMacro_0 : NSObject
 
@@ -60,6 +80,24 @@
 - (id) body:(NuCell *) oldBody withGensymPrefix:(NSString *) prefix symbolTable:(NuSymbolTable *) symbolTable;
 /*! Expand unquotes in macro body. */
 - (id) expandUnquotes:(id) oldBody withContext:(NSMutableDictionary *) context;
+/*! Set whether the macro keeps the expansion of each call for later evaluations of the call. */
+- (void) setCachesExpansions:(BOOL)caches;
+/*! Returns true if the macro keeps the expansions of its calls. */
+- (BOOL) cachesExpansions;
+/*! Get the number of times the macro has been expanded. */
+- (NSUInteger) expansionCount;
+/*! Get the number of times a call of the macro has been evaluated with a kept expansion. */
+- (NSUInteger) cachedExpansionCount;
+/*! Set whether new macros keep the expansions of their calls.
+ The default is taken from the NU_MACRO_CACHE environment variable. */
++ (void) setCachesExpansions:(BOOL)caches;
+/*! Returns true if new macros keep the expansions of their calls. */
++ (BOOL) cachesExpansions;
+/*! Discard the kept expansions of all macro calls. */
++ (void) invalidateExpansions;
+/*! Get the expansion counts of the macros that currently exist, keyed by macro name.
+ Each value is a dictionary with the keys <b>expansions</b> and <b>cached</b>. */
++ (NSDictionary *) expansionStatistics;
 
 @end
 
@@ -94,6 +132,8 @@
 + (id) macroWithName:(NSString *)name parameters:(NuCell*)args body:(NuCell *)body;
 /*! Initialize a macro. */
 - (id) initWithName:(NSString *)name parameters:(NuCell *)args body:(NuCell *)body;
+/*! Get the parameters of a macro. */
+- (NuCell *) parameters;
 /*! Get a string representation of a macro. */
 - (NSString *) stringValue;
 /*! Evaluate a macro. */
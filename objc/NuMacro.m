@@ -7,9 +7,89 @@
 //
 
 #import "NuMacro.h"
+#import "NSString+Nu.h"
 #import "NuMath.h"
 #import "NSDictionary+Nu.h"
 #import "NuCell.h"
+#import "NuFrame.h"
+#import "NuScope.h"
+#include <pthread.h>
+
+#pragma mark - Macro expansions
+
+static BOOL cachesExpansions = NO;
+
+// Changed whenever a macro is created or expansions are invalidated, which discards every kept expansion.
+static unsigned long nu_macro_expansion_epoch = 1;
+
+// The macros that currently exist, for expansion statistics.
+static NSHashTable *macros = nil;
+static pthread_mutex_t macrosLock = PTHREAD_MUTEX_INITIALIZER;
+
+// A call site's expansion may be read and replaced on several threads,
+// so call sites are guarded by locks chosen by their addresses.
+#define NU_MACRO_EXPANSION_LOCKS 64
+static pthread_mutex_t expansionLocks[NU_MACRO_EXPANSION_LOCKS];
+static pthread_once_t expansionLocksOnce = PTHREAD_ONCE_INIT;
+
+static void nu_macro_expansion_locks_init(void)
+{
+    for (int i = 0; i < NU_MACRO_EXPANSION_LOCKS; i++)
+        pthread_mutex_init(&expansionLocks[i], NULL);
+}
+
+static inline pthread_mutex_t *nu_macro_expansion_lock(id site)
+{
+    pthread_once(&expansionLocksOnce, nu_macro_expansion_locks_init);
+    return &expansionLocks[(((uintptr_t) site) >> 4) % NU_MACRO_EXPANSION_LOCKS];
+}
+
+void nu_macro_expansion_free(nu_macro_expansion *expansion)
+{
+    if (expansion) {
+        [expansion->expansion release];
+        free(expansion);
+    }
+}
+
+// Get the list of the macro call that is being evaluated with the specified arguments.
+static id nu_macro_call_site(id cdr)
+{
+    id site = nu_current_expression();
+    return (site && ([site cdr] == cdr)) ? site : nil;
+}
+
+static id nu_macro_cached_expansion(id site, id macro)
+{
+    nu_lexical_address *address = nu_cell_lexical_address(site, false);
+    if (!address)
+        return nil;
+    id expansion = nil;
+    pthread_mutex_t *lock = nu_macro_expansion_lock(site);
+    pthread_mutex_lock(lock);
+    nu_macro_expansion *entry = address->expansion;
+    if (entry && (entry->macro == macro) && (entry->epoch == __atomic_load_n(&nu_macro_expansion_epoch, __ATOMIC_ACQUIRE)))
+        expansion = [[entry->expansion retain] autorelease];
+    pthread_mutex_unlock(lock);
+    return expansion;
+}
+
+static void nu_macro_cache_expansion(id site, id macro, id expansion)
+{
+    nu_lexical_address *address = nu_cell_lexical_address(site, true);
+    pthread_mutex_t *lock = nu_macro_expansion_lock(site);
+    pthread_mutex_lock(lock);
+    if (!address->expansion)
+        address->expansion = (nu_macro_expansion *) calloc(1, sizeof(nu_macro_expansion));
+    nu_macro_expansion *entry = address->expansion;
+    [expansion retain];
+    [entry->expansion release];
+    entry->expansion = expansion;
+    // the macro isn't retained; a new macro at the same address would have changed the epoch
+    entry->macro = macro;
+    entry->epoch = __atomic_load_n(&nu_macro_expansion_epoch, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(lock);
+}
 
 #pragma mark - NuMacro_0.m
 @interface NuMacro_0 ()
@@ -18,11 +98,58 @@
     NSString *name;
     NuCell *body;
     NSMutableSet *gensyms;
+    BOOL caches;
+    NSUInteger expansions;
+    NSUInteger cachedExpansions;
 }
 @end
 
 @implementation NuMacro_0
 
++ (void) initialize
+{
+    if (self == [NuMacro_0 class]) {
+        const char *setting = getenv("NU_MACRO_CACHE");
+        cachesExpansions = (setting && (setting[0] != '\0') && strcmp(setting, "0"));
+        macros = [[NSHashTable alloc] initWithOptions:(NSPointerFunctionsOpaqueMemory | NSPointerFunctionsOpaquePersonality)
+                                             capacity:0];
+    }
+}
+
++ (void) setCachesExpansions:(BOOL)caches
+{
+    cachesExpansions = caches;
+}
+
++ (BOOL) cachesExpansions
+{
+    return cachesExpansions;
+}
+
++ (void) invalidateExpansions
+{
+    __atomic_add_fetch(&nu_macro_expansion_epoch, 1, __ATOMIC_RELEASE);
+}
+
++ (NSDictionary *) expansionStatistics
+{
+    NSMutableDictionary *statistics = [NSMutableDictionary dictionary];
+    pthread_mutex_lock(&macrosLock);
+    for (NuMacro_0 *macro in macros) {
+        NSString *key = [macro->name stringValue];
+        NSDictionary *previous = [statistics objectForKey:key];
+        NSUInteger expansionCount = macro->expansions + [[previous objectForKey:@"expansions"] unsignedIntegerValue];
+        NSUInteger cachedCount = macro->cachedExpansions + [[previous objectForKey:@"cached"] unsignedIntegerValue];
+        [statistics setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                               [NSNumber numberWithUnsignedInteger:expansionCount], @"expansions",
+                               [NSNumber numberWithUnsignedInteger:cachedCount], @"cached",
+                               nil]
+                       forKey:key];
+    }
+    pthread_mutex_unlock(&macrosLock);
+    return statistics;
+}
+
 + (id) macroWithName:(NSString *)n body:(NuCell *)b
 {
     return [[[self alloc] initWithName:n body:b] autorelease];
@@ -30,10 +157,33 @@
 
 - (void) dealloc
 {
+    pthread_mutex_lock(&macrosLock);
+    [macros removeObject:self];
+    pthread_mutex_unlock(&macrosLock);
     [body release];
     [super dealloc];
 }
 
+- (void) setCachesExpansions:(BOOL)c
+{
+    caches = c;
+}
+
+- (BOOL) cachesExpansions
+{
+    return caches;
+}
+
+- (NSUInteger) expansionCount
+{
+    return expansions;
+}
+
+- (NSUInteger) cachedExpansionCount
+{
+    return cachedExpansions;
+}
+
 - (NSString *) name
 {
     return name;
@@ -73,6 +223,12 @@
         body = [b retain];
         gensyms = [[NSMutableSet alloc] init];
         [self collectGensyms:body];
+        caches = cachesExpansions;
+        // a redefined macro must not reuse the expansions of the macro it replaces
+        __atomic_add_fetch(&nu_macro_expansion_epoch, 1, __ATOMIC_RELEASE);
+        pthread_mutex_lock(&macrosLock);
+        [macros addObject:self];
+        pthread_mutex_unlock(&macrosLock);
     }
     return self;
 }
@@ -116,7 +272,7 @@
                                                options:0 range:NSMakeRange(0, [tempString length])];
             }
             //NSLog(@"setting string to %@", tempString);
-            [newBody setCar:tempString];
+            [newBody setCar:nu_interpolated_string(tempString)];
         }
         else {
             [newBody setCar:car];
@@ -165,6 +321,9 @@
 
 - (id) expandAndEval:(id)cdr context:(NSMutableDictionary *)calling_context evalFlag:(BOOL)evalFlag
 {
+    // expansion can bind names in the calling context that its scope analysis didn't see
+    [nu_context_scope(calling_context) markDynamic];
+    
     NuSymbolTable *symbolTable = [calling_context objectForKey:SYMBOLS_KEY];
     
     // save the current value of margs
@@ -173,21 +332,34 @@
     [calling_context setPossiblyNullObject:cdr forKey:[symbolTable symbolWithString:@"margs"]];
     // evaluate the body of the block in the calling context (implicit progn)
     
+    // a call that has been expanded before can reuse its expansion
+    id site = (evalFlag && caches) ? nu_macro_call_site(cdr) : nil;
+    id value = site ? nu_macro_cached_expansion(site, self) : nil;
+    
     // if the macro contains gensyms, give them a unique prefix
     NSUInteger gensymCount = [[self gensyms] count];
     id gensymPrefix = nil;
-    if (gensymCount > 0) {
-        gensymPrefix = [NSString stringWithFormat:@"g%ld", [NuMath random]];
-    }
     
-    id bodyToEvaluate = (gensymCount == 0)
-    ? (id)body : [self body:body withGensymPrefix:gensymPrefix symbolTable:symbolTable];
-    
-    // uncomment this to get the old (no gensym) behavior.
-    //bodyToEvaluate = body;
-    //NSLog(@"evaluating %@", [bodyToEvaluate stringValue]);
-    
-    id value = [self expandUnquotes:bodyToEvaluate withContext:calling_context];
+    if (value) {
+        cachedExpansions++;
+    }
+    else {
+        expansions++;
+        if (gensymCount > 0) {
+            gensymPrefix = [NSString stringWithFormat:@"g%ld", [NuMath random]];
+        }
+        
+        id bodyToEvaluate = (gensymCount == 0)
+        ? (id)body : [self body:body withGensymPrefix:gensymPrefix symbolTable:symbolTable];
+        
+        // uncomment this to get the old (no gensym) behavior.
+        //bodyToEvaluate = body;
+        //NSLog(@"evaluating %@", [bodyToEvaluate stringValue]);
+        
+        value = [self expandUnquotes:bodyToEvaluate withContext:calling_context];
+        if (site)
+            nu_macro_cache_expansion(site, self, value);
+    }
     
     if (evalFlag)
     {
@@ -308,6 +480,11 @@
     return self;
 }
 
+- (NuCell *) parameters
+{
+    return parameters;
+}
+
 - (NSString *) stringValue
 {
     return [NSString stringWithFormat:@"(macro %@ %@ %@)", name, [parameters stringValue], [body stringValue]];
@@ -490,8 +667,32 @@
 
 - (id) expandAndEval:(id)cdr context:(NSMutableDictionary*)calling_context evalFlag:(BOOL)evalFlag
 {
+    // expansion can bind names in the calling context that its scope analysis didn't see
+    [nu_context_scope(calling_context) markDynamic];
+    
     NuSymbolTable *symbolTable = [calling_context objectForKey:SYMBOLS_KEY];
     
+    // a call that has been expanded before only needs its expansion to be evaluated
+    id site = (evalFlag && caches) ? nu_macro_call_site(cdr) : nil;
+    id expansion = site ? nu_macro_cached_expansion(site, self) : nil;
+    if (expansion) {
+        cachedExpansions++;
+        id old_args = [calling_context objectForKey:[symbolTable symbolWithString:@"*args"]];
+        [calling_context setPossiblyNullObject:cdr forKey:[symbolTable symbolWithString:@"*args"]];
+        id value;
+        @try
+        {
+            value = [expansion evalWithContext:calling_context];
+        }
+        @catch (id exception) {
+            [self restoreArgs:old_args context:calling_context];
+            @throw;
+        }
+        [self restoreArgs:old_args context:calling_context];
+        return value;
+    }
+    expansions++;
+    
     NSMutableDictionary* maskedVariables = [[NSMutableDictionary alloc] init];
     
     id plist;
@@ -569,6 +770,8 @@
             Macro1Debug(@"macro expand value: %@", [value stringValue]);
             cursor = [cursor cdr];
         }
+        if (site)
+            nu_macro_cache_expansion(site, self, value);
         
         // Now that macro expansion is done, restore the masked calling context variables
         [self restoreBindings:destructure
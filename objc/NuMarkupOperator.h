@@ -10,6 +10,24 @@
 #import "Nu.h"
 #import "NuOperators.h"
 
+@class NuOutputBuffer;
+
+/*!
+ @class NuMarkupOperator
+ @abstract The operators that generate markup.
+ @discussion Symbols that begin with '&' name markup operators, which are created when they are first evaluated.
+ <b>(&amp;p class:"note" "text" ...)</b> returns the element as a string.
+
+ Elements write their markup to a single output buffer that is shared by the elements nested directly within them,
+ so a document is generated without building a string for each element. <b>(render-markup output expressions...)</b>
+ evaluates expressions with the markup of the elements among them written to output, a NuOutputBuffer, which may
+ write the document to a file as it is generated. Elements that are nested within other expressions
+ (such as the block of a <b>map:</b>) are returned as strings as usual, unless they are rendered with <b>render-markup</b>
+ to the output of the document, which continues the contents of the element that is being written.
+
+ Attribute values are escaped. Attributes that follow an element's contents are still written in its start tag,
+ but the contents of such an element are collected before they are written.
+ */
 @interface NuMarkupOperator : NuOperator
 {
     NSString *tag;
@@ -18,6 +36,8 @@
     NSMutableArray *tagClasses;
     id contents;
     BOOL empty; // aka a "void element"
+    NSData *startTag; // the prefix and the start tag up to its attributes
+    NSData *endTag;
 }
 
 + (id) operatorWithTag:(NSString *) _tag;
@@ -33,4 +53,10 @@
 - (id) contents;
 - (BOOL) empty;
 
+/*! Write the markup for a call of the operator to the current markup output. */
+- (void) renderArguments:(id) cdr context:(NSMutableDictionary *) context;
+
 @end
+
+// Evaluate a list of expressions, writing the markup of the elements among them (and the values of the others) to output.
+void nu_markup_render(NuOutputBuffer *output, id expressions, NSMutableDictionary *context);
@@ -10,11 +10,22 @@
 #import "NuInternals.h"
 #import "NuMarkupOperator.h"
 #import "NuCell.h"
+#import "NuOutputBuffer.h"
+
+// Elements write to the output of the innermost markup operator or render-markup call that is being evaluated
+// on a thread. An element's start tag is left open for its attributes until its contents are written.
+typedef struct nu_markup_state {
+    NuOutputBuffer *output;
+    bool tagOpen;
+} nu_markup_state;
+
+static __thread nu_markup_state markup = {nil, false};
 
 @implementation NuMarkupOperator
 
 static NSSet *voidHTMLElements = nil;
 static NSDictionary *elementPrefixes = nil;
+static id trueSymbol = nil;
 
 + (void) initialize {
     voidHTMLElements = [[NSSet setWithObjects:
@@ -38,6 +49,7 @@ static NSDictionary *elementPrefixes = nil;
     elementPrefixes = [[NSDictionary dictionaryWithObjectsAndKeys:
                         @"<!DOCTYPE html>", @"html",
                         nil] retain];
+    trueSymbol = [[[NuSymbolTable sharedSymbolTable] symbolWithString:@"t"] retain];
 }
 
 + (id) operatorWithTag:(NSString *) _tag
@@ -64,14 +76,19 @@ static NSDictionary *elementPrefixes = nil;
 {
     self = [super init];
     
-    // Scan through the tag looking for "." or "#" characters.
-    // When we find them, we split the and use the following strings as class or id attributes.
-    if (_tag) {
-        NSScanner *scanner = [NSScanner scannerWithString:_tag];
-        NSCharacterSet *scanSet = [NSCharacterSet characterSetWithCharactersInString:@".#"];
-        NSString *token;
-        char typeFlag = 0;
-        while ([scanner scanUpToCharactersFromSet:scanSet intoString:&token]) {
+    // Split the tag at "." and "#" characters, which introduce class and id attributes.
+    // Each name takes its kind from the last of the characters before it.
+    NSUInteger length = [_tag length];
+    if (length && ([_tag characterAtIndex:0] != '.') && ([_tag characterAtIndex:0] != '#')) {
+        unichar *characters = (unichar *) malloc(length * sizeof(unichar));
+        [_tag getCharacters:characters range:NSMakeRange(0, length)];
+        NSUInteger i = 0;
+        unichar typeFlag = 0;
+        while (i < length) {
+            NSUInteger start = i;
+            while ((i < length) && (characters[i] != '.') && (characters[i] != '#'))
+                i++;
+            NSString *token = [NSString stringWithCharacters:characters + start length:i - start];
             if (typeFlag == 0) {
                 _tag = token;
             } else if (typeFlag == '.') {
@@ -79,20 +96,16 @@ static NSDictionary *elementPrefixes = nil;
                     tagClasses = [[NSMutableArray alloc] init];
                 }
                 [tagClasses addObject:token];
-            } else if (typeFlag == '#') {
+            } else {
                 if (!tagIds) {
                     tagIds = [[NSMutableArray alloc] init];
                 }
                 [tagIds addObject:token];
-           	}
-            if ([scanner scanCharactersFromSet:scanSet intoString:&token]) {
-                if ([token length]) {
-                    typeFlag = [token characterAtIndex:[token length] - 1];
-                } else {
-                    typeFlag = 0;
-                }
             }
+            while ((i < length) && ((characters[i] == '.') || (characters[i] == '#')))
+                typeFlag = characters[i++];
         }
+        free(characters);
     }
     tag = _tag ? [_tag stringByReplacingOccurrencesOfString:@"=" withString:@":"] : nil;
     [tag retain];
@@ -104,6 +117,18 @@ static NSDictionary *elementPrefixes = nil;
     contents = _contents ? _contents : Nu__null;
     [contents retain];
     empty = [voidHTMLElements containsObject:tag];
+    
+    if (tag) {
+        NSMutableString *start = [NSMutableString stringWithFormat:@"%@<%@", prefix, tag];
+        for (NSString *tagId in tagIds) {
+            [start appendFormat:@" id=\"%@\"", tagId];
+        }
+        for (NSString *tagClass in tagClasses) {
+            [start appendFormat:@" class=\"%@\"", tagClass];
+        }
+        startTag = [[start dataUsingEncoding:NSUTF8StringEncoding] retain];
+        endTag = [[[NSString stringWithFormat:@"</%@>", tag] dataUsingEncoding:NSUTF8StringEncoding] retain];
+    }
     return self;
 }
 
@@ -114,6 +139,8 @@ static NSDictionary *elementPrefixes = nil;
     [contents release];
     [tagIds release];
     [tagClasses release];
+    [startTag release];
+    [endTag release];
     [super dealloc];
 }
 
@@ -122,87 +149,235 @@ static NSDictionary *elementPrefixes = nil;
     empty = e;
 }
 
-- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+// Finish the start tag of the element whose contents are about to be written.
+static inline void nu_markup_close_start_tag(void)
 {
-    NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
-    id t_symbol = [symbolTable symbolWithString:@"t"];
-    
-    NSMutableString *body = [NSMutableString string];
-    NSMutableString *attributes = [NSMutableString string];
-    
-    static id NuSymbol = nil;
-    if (!NuSymbol) {
-        NuSymbol = NSClassFromString(@"NuSymbol");
+    if (markup.tagOpen) {
+        nu_output_append_bytes(markup.output, ">", 1);
+        markup.tagOpen = false;
     }
-    if (tagIds) {
-        for (int i = 0; i < [tagIds count]; i++) {
-            [attributes appendFormat:@" id=\"%@\"", [tagIds objectAtIndex:i]];
+}
+
+// Append contents to the current element.
+static void nu_markup_append_string(NSString *string)
+{
+    if ([string length] == 0)
+        return;
+    nu_markup_close_start_tag();
+    nu_output_append_string(markup.output, string);
+}
+
+static void nu_markup_append_value(id value)
+{
+    if (!value || (value == Nu__null)) {
+        // do nothing
+    }
+    else if ([value isKindOfClass:[NSString class]]) {
+        nu_markup_append_string(value);
+    }
+    else if ([value isKindOfClass:[NSArray class]]) {
+        for (id member in (NSArray *) value) {
+            nu_markup_append_string([member stringValue]);
         }
     }
-    if (tagClasses) {
-        for (int i = 0; i < [tagClasses count]; i++) {
-            [attributes appendFormat:@" class=\"%@\"", [tagClasses objectAtIndex:i]];
+    else {
+        nu_markup_append_string([value stringValue]);
+    }
+}
+
+// Evaluate an item of an element's contents. Elements that are items are written directly to the output.
+static void nu_markup_render_item(id item, NSMutableDictionary *context)
+{
+    if (nu_objectIsKindOfClass(item, [NuCell class])) {
+        id head = [item car];
+        if (nu_objectIsKindOfClass(head, [NuSymbol class]) && ([[head stringValue] characterAtIndex:0] == '&')) {
+            id operator = [head evalWithContext:context];
+            if (nu_objectIsKindOfClass(operator, [NuMarkupOperator class])) {
+                [operator renderArguments:[item cdr] context:context];
+                return;
+            }
+        }
+    }
+    nu_markup_append_value([item evalWithContext:context]);
+}
+
+// Append an attribute value with &, <, > and " escaped.
+static void nu_markup_append_escaped(NuOutputBuffer *output, NSString *string)
+{
+    const char *bytes = [string UTF8String];
+    if (!bytes)
+        return;
+    const char *run = bytes;
+    for (const char *cursor = bytes; *cursor; cursor++) {
+        const char *entity;
+        switch (*cursor) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            default: continue;
+        }
+        nu_output_append_bytes(output, run, cursor - run);
+        nu_output_append_bytes(output, entity, strlen(entity));
+        run = cursor + 1;
+    }
+    nu_output_append_bytes(output, run, strlen(run));
+}
+
+static void nu_markup_append_attribute(NuOutputBuffer *output, NuSymbol *label, id value)
+{
+    if ([value isEqual:Nu__null]) {
+        // omit attributes that are "false"
+        return;
+    }
+    NSString *attributeName = [[label labelName] stringByReplacingOccurrencesOfString:@"=" withString:@":"];
+    nu_output_append_bytes(output, " ", 1);
+    nu_output_append_string(output, attributeName);
+    if (![value isEqual:trueSymbol]) {
+        // boolean attributes with "true" are written without values
+        nu_output_append_bytes(output, "=\"", 2);
+        nu_markup_append_escaped(output, [value stringValue]);
+        nu_output_append_bytes(output, "\"", 1);
+    }
+}
+
+static inline bool nu_markup_is_label(id item)
+{
+    return nu_objectIsKindOfClass(item, [NuSymbol class]) && [item isLabel];
+}
+
+// Returns true if no attribute of an element follows any of its contents, so that its start tag can be finished
+// before its contents are evaluated.
+static bool nu_markup_attributes_lead(id first, id second)
+{
+    bool contentsSeen = false;
+    for (int i = 0; i < 2; i++) {
+        id cursor = (i == 0) ? first : second;
+        while (cursor && (cursor != Nu__null)) {
+            if (nu_markup_is_label([cursor car])) {
+                if (contentsSeen)
+                    return false;
+                cursor = [cursor cdr];
+            }
+            else {
+                contentsSeen = true;
+            }
+            if (cursor && (cursor != Nu__null))
+                cursor = [cursor cdr];
         }
     }
+    return true;
+}
+
+// Evaluate the attributes and contents of an element in order, writing attributes to attributeOutput
+// (or discarding them if it is nil) and contents to the current markup output.
+static void nu_markup_render_arguments(id first, id second, NuOutputBuffer *attributeOutput, NSMutableDictionary *context)
+{
     for (int i = 0; i < 2; i++) {
-        id cursor = (i == 0) ? contents : cdr;
+        id cursor = (i == 0) ? first : second;
         while (cursor && (cursor != Nu__null)) {
             id item = [cursor car];
-            if ([item isKindOfClass:[NuSymbol class]] && [item isLabel]) {
+            if (nu_markup_is_label(item)) {
                 cursor = [cursor cdr];
                 if (cursor && (cursor != Nu__null)) {
                     id value = [[cursor car] evalWithContext:context];
-                    id attributeName = [[item labelName] stringByReplacingOccurrencesOfString:@"=" withString:@":"];
-                    if ([value isEqual:Nu__null]) {
-                        // omit attributes that are "false"
-                    } else if ([value isEqual:t_symbol]) {
-                        // boolean attributes with "true" are written without values
-                        [attributes appendFormat:@" %@", attributeName];
-                    } else {
-                        id stringValue = [value isEqual:Nu__null] ? @"" : [value stringValue];
-                        [attributes appendFormat:@" %@=\"%@\"", attributeName, stringValue];
-                    }
+                    if (attributeOutput)
+                        nu_markup_append_attribute(attributeOutput, item, value);
                 }
             }
             else {
-                id evaluatedItem = [item evalWithContext:context];
-                if (!evaluatedItem || (evaluatedItem == Nu__null)) {
-                    // do nothing
-                }
-                else if ([evaluatedItem isKindOfClass:[NSString class]]) {
-                    [body appendString:evaluatedItem];
-                }
-                else if ([evaluatedItem isKindOfClass:[NSArray class]]) {
-                    NSArray *evaluatedArray = (NSArray *) evaluatedItem;
-                    NSUInteger max = [evaluatedArray count];
-                    for (int i = 0; i < max; i++) {
-                        id objectAtIndex = [evaluatedArray objectAtIndex:i];
-                        [body appendString:[objectAtIndex stringValue]];
-                    }
-                }
-                else {
-                    [body appendString:[evaluatedItem stringValue]];
-                }
+                nu_markup_render_item(item, context);
             }
             if (cursor && (cursor != Nu__null))
                 cursor = [cursor cdr];
         }
     }
-    
+}
+
+- (void) renderArguments:(id) cdr context:(NSMutableDictionary *) context
+{
     if (!tag) {
-        return body;
+        nu_markup_render_arguments(contents, cdr, nil, context);
+        return;
+    }
+    nu_markup_close_start_tag();
+    NuOutputBuffer *output = markup.output;
+    if (nu_markup_attributes_lead(contents, cdr)) {
+        nu_output_append_bytes(output, [startTag bytes], [startTag length]);
+        markup.tagOpen = true;
+        nu_markup_render_arguments(contents, cdr, output, context);
+        if (markup.tagOpen) {
+            markup.tagOpen = false;
+            if (empty) {
+                nu_output_append_bytes(output, "/>", 2);
+                return;
+            }
+            nu_output_append_bytes(output, ">", 1);
+        }
+        nu_output_append_bytes(output, [endTag bytes], [endTag length]);
+        return;
     }
-    else if ([body length] || !empty) {
-        return [NSString stringWithFormat:@"%@<%@%@>%@</%@>", prefix, tag, attributes, body, tag];
+    // collect the attributes and contents before writing the start tag
+    NuOutputBuffer *attributes = [NuOutputBuffer buffer];
+    NuOutputBuffer *body = [NuOutputBuffer buffer];
+    markup.output = body;
+    @try {
+        nu_markup_render_arguments(contents, cdr, attributes, context);
+    }
+    @finally {
+        markup.output = output;
+        markup.tagOpen = false;
+    }
+    nu_output_append_bytes(output, [startTag bytes], [startTag length]);
+    NSData *attributeData = [attributes data];
+    nu_output_append_bytes(output, [attributeData bytes], [attributeData length]);
+    if ([body length] || !empty) {
+        NSData *bodyData = [body data];
+        nu_output_append_bytes(output, ">", 1);
+        nu_output_append_bytes(output, [bodyData bytes], [bodyData length]);
+        nu_output_append_bytes(output, [endTag bytes], [endTag length]);
     }
     else {
-        return [NSString stringWithFormat:@"%@<%@%@/>", prefix, tag, attributes];
+        nu_output_append_bytes(output, "/>", 2);
     }
 }
 
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    // elements that aren't written to an enclosing element's output are returned as strings
+    NuOutputBuffer *output = [NuOutputBuffer buffer];
+    nu_markup_state saved = markup;
+    markup.output = output;
+    markup.tagOpen = false;
+    @try {
+        [self renderArguments:cdr context:context];
+    }
+    @finally {
+        markup = saved;
+    }
+    return [output stringValue];
+}
+
 - (NSString *) tag {return tag;}
 - (NSString *) prefix {return prefix;}
 - (id) contents {return contents;}
 - (BOOL) empty {return empty;}
 
 @end
+
+void nu_markup_render(NuOutputBuffer *output, id expressions, NSMutableDictionary *context)
+{
+    if (output == markup.output) {
+        // the expressions continue the contents of the element that is being written
+        nu_markup_close_start_tag();
+    }
+    nu_markup_state saved = markup;
+    markup.output = output;
+    markup.tagOpen = false;
+    @try {
+        nu_markup_render_arguments(expressions, Nu__null, nil, context);
+    }
+    @finally {
+        markup = saved;
+    }
+}
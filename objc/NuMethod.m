@@ -88,12 +88,7 @@
 
 - (NuBlock *) block
 {
-    IMP imp = method_getImplementation(m);
-    NuBlock *block = nil;
-    if (nu_block_table) {
-        block = [nu_block_table objectForKey:[NSNumber numberWithUnsignedLong:(unsigned long) imp]];
-    }
-    return block;
+    return nu_block_for_imp(method_getImplementation(m));
 }
 
 - (NSComparisonResult) compare:(NuMethod *) anotherMethod
@@ -8,11 +8,14 @@
 
 #import "NuObjCRuntime.h"
 #import "NuInternals.h"
+#import "NuInlineCache.h"
 
 #pragma mark - NuObjCRuntime.m
 
 IMP nu_class_replaceMethod(Class cls, SEL name, IMP imp, const char *types)
 {
+    // methods that message sends have cached may now be overridden or replaced
+    nu_invalidate_method_caches();
     if (class_addMethod(cls, name, imp, types)) {
         return imp;
     } else {
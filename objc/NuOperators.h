@@ -30,5 +30,10 @@
  This method should be overridden by implementations of new operators.
  */
 - (id) callWithArguments:(id) cdr context:(NSMutableDictionary *) context;
+/*! Returns true if the operator evaluates one of its expressions in its own tail position.
+ Calls in that position are evaluated by the enclosing block without growing the stack.
+ Operators that return true must call nu_take_tail_position() before they evaluate anything.
+ */
+- (BOOL) propagatesTailPosition;
 
 @end
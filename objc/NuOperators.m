@@ -17,6 +17,15 @@
 #import "NuBridge.h"
 #import "NuBridgedFunction.h"
 #import "NuClass.h"
+#import "NuScope.h"
+#import "NuParseCache.h"
+#import "NuImage.h"
+#import "NuFuture.h"
+#import "NuChannel.h"
+#import "NuActor.h"
+#import "NuMarkupOperator.h"
+#import "NuOutputBuffer.h"
+#import "NuProfiler.h"
 #if !TARGET_OS_IPHONE
 #include <readline/readline.h>
 #endif
@@ -82,9 +91,87 @@
 
 @end
 
+__thread nu_control_state nu_control = {NuControlSignalNone, nil, nil};
+
+void nu_set_control_signal(NuControlSignal signal, id value, id blockForReturn)
+{
+    [value retain];
+    [nu_control.value release];
+    nu_control.signal = signal;
+    nu_control.value = value;
+    nu_control.blockForReturn = blockForReturn;
+}
+
+id nu_take_control_value(void)
+{
+    id value = [nu_control.value autorelease];
+    nu_control.signal = NuControlSignalNone;
+    nu_control.value = nil;
+    nu_control.blockForReturn = nil;
+    return value;
+}
+
+void nu_clear_control_signal(void)
+{
+    if (nu_control.signal)
+        nu_take_control_value();
+}
+
+void nu_suspend_control_signal(nu_control_state *saved)
+{
+    *saved = nu_control;
+    nu_control.signal = NuControlSignalNone;
+    nu_control.value = nil;
+    nu_control.blockForReturn = nil;
+}
+
+void nu_resume_control_signal(nu_control_state *saved)
+{
+    if (nu_control.signal) {
+        // a signal raised while the saved one was suspended replaces it
+        [saved->value release];
+        return;
+    }
+    nu_control = *saved;
+}
+
+void nu_raise_pending_control_signal(void)
+{
+    switch (nu_control.signal) {
+        case NuControlSignalBreak:
+            nu_clear_control_signal();
+            @throw [[[NuBreakException alloc] init] autorelease];
+        case NuControlSignalContinue:
+            nu_clear_control_signal();
+            @throw [[[NuContinueException alloc] init] autorelease];
+        case NuControlSignalReturn:
+        {
+            id block = nu_control.blockForReturn;
+            id value = nu_take_control_value();
+            @throw [[[NuReturnException alloc] initWithValue:value blockForReturn:block] autorelease];
+        }
+        default:
+            break;
+    }
+}
+
+bool nu_control_signal_from_exception(id exception)
+{
+    if (nu_objectIsKindOfClass(exception, [NuBreakException class]))
+        nu_set_control_signal(NuControlSignalBreak, nil, nil);
+    else if (nu_objectIsKindOfClass(exception, [NuContinueException class]))
+        nu_set_control_signal(NuControlSignalContinue, nil, nil);
+    else if (nu_objectIsKindOfClass(exception, [NuReturnException class]))
+        nu_set_control_signal(NuControlSignalReturn, [exception value], [exception blockForReturn]);
+    else
+        return false;
+    return true;
+}
+
 @implementation NuOperator : NSObject
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context {return nil;}
 - (id) evalWithArguments:(id)cdr context:(NSMutableDictionary *)context {return [self callWithArguments:cdr context:context];}
+- (BOOL) propagatesTailPosition {return NO;}
 @end
 
 @interface Nu_car_operator : NuOperator {}
@@ -164,6 +251,297 @@
 
 @end
 
+#pragma mark - Arithmetic
+
+@interface Nu_add_operator : NuOperator {}
+@end
+
+@interface Nu_subtract_operator : NuOperator {}
+@end
+
+@interface Nu_multiply_operator : NuOperator {}
+@end
+
+@interface Nu_divide_operator : NuOperator {}
+@end
+
+typedef enum {
+    NuArithmeticNone,
+    NuArithmeticAdd,
+    NuArithmeticSubtract,
+    NuArithmeticMultiply,
+    NuArithmeticDivide
+} NuArithmeticOperation;
+
+typedef enum {
+    NuOperandObject,
+    NuOperandInteger,
+    NuOperandDouble
+} NuOperandKind;
+
+// An operand of an arithmetic or comparison operator. Integers are kept in a long so that
+// arithmetic on them stays exact, and results of nested arithmetic are kept unboxed until
+// an object is needed; object holds the operand's boxed value when there is one.
+typedef struct nu_operand {
+    NuOperandKind kind;
+    long i;
+    double d;
+    id object;
+} nu_operand;
+
+// Classes and symbols that arithmetic checks for. They are set by nu_arithmetic_initialize,
+// which load_builtins calls before any operator can be evaluated.
+static Class numberClass, cellClass;
+static Class addClass, subtractClass, multiplyClass, divideClass;
+static NuSymbol *classDeclarationSymbol, *methodDeclarationSymbol;
+
+// Get the value of an NSNumber with an integer type. Chars are skipped because BOOLs are chars on some platforms.
+static inline bool nu_number_long_value(id object, long *value)
+{
+    if (!object || !nu_objectIsKindOfClass(object, numberClass))
+        return false;
+    switch (*[object objCType]) {
+        case 'C': case 's': case 'S': case 'i': case 'I': case 'l':
+            *value = [object longValue];
+            return true;
+        case 'q': {
+            long long v = [object longLongValue];
+            if ((v < LONG_MIN) || (v > LONG_MAX))
+                return false;
+            *value = (long) v;
+            return true;
+        }
+        case 'L': case 'Q': {
+            unsigned long long v = [object unsignedLongLongValue];
+            if (v > LONG_MAX)
+                return false;
+            *value = (long) v;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static inline void nu_operand_set_object(nu_operand *operand, id object)
+{
+    operand->object = object;
+    operand->kind = nu_number_long_value(object, &operand->i) ? NuOperandInteger : NuOperandObject;
+}
+
+static inline double nu_operand_double(nu_operand *operand)
+{
+    switch (operand->kind) {
+        case NuOperandInteger:
+            return (double) operand->i;
+        case NuOperandDouble:
+            return operand->d;
+        default:
+            return [operand->object doubleValue];
+    }
+}
+
+static inline id nu_operand_object(nu_operand *operand)
+{
+    if (!operand->object && (operand->kind != NuOperandObject)) {
+        if (operand->kind == NuOperandInteger)
+            operand->object = nu_number_with_long(operand->i);
+        else
+            operand->object = [NSNumber numberWithDouble:operand->d];
+    }
+    return operand->object;
+}
+
+// Combine an operand with an accumulated result. Integer results that overflow a long become doubles.
+static inline void nu_operand_combine(nu_operand *result, NuArithmeticOperation operation, nu_operand *operand)
+{
+    long i;
+    if ((result->kind == NuOperandInteger) && (operand->kind == NuOperandInteger)) {
+        bool overflow;
+        switch (operation) {
+            case NuArithmeticAdd:
+                overflow = __builtin_add_overflow(result->i, operand->i, &i);
+                break;
+            case NuArithmeticSubtract:
+                overflow = __builtin_sub_overflow(result->i, operand->i, &i);
+                break;
+            case NuArithmeticMultiply:
+                overflow = __builtin_mul_overflow(result->i, operand->i, &i);
+                break;
+            default:
+                overflow = true;
+                break;
+        }
+        if (!overflow) {
+            result->i = i;
+            return;
+        }
+    }
+    double a = nu_operand_double(result);
+    double b = nu_operand_double(operand);
+    switch (operation) {
+        case NuArithmeticAdd:
+            result->d = a + b;
+            break;
+        case NuArithmeticSubtract:
+            result->d = a - b;
+            break;
+        case NuArithmeticMultiply:
+            result->d = a * b;
+            break;
+        default:
+            result->d = a / b;
+            break;
+    }
+    result->kind = NuOperandDouble;
+}
+
+// Returns true if evaluation is inside a class declaration and outside a method declaration,
+// where + and - declare methods instead of doing arithmetic.
+static inline bool nu_context_declares_methods(NSMutableDictionary *context)
+{
+    return [context objectForKey:classDeclarationSymbol] && ![context objectForKey:methodDeclarationSymbol];
+}
+
+static NuArithmeticOperation nu_arithmetic_operation(id head, NSMutableDictionary *context)
+{
+    Class headClass = object_getClass(head);
+    if (headClass == multiplyClass)
+        return NuArithmeticMultiply;
+    if (headClass == divideClass)
+        return NuArithmeticDivide;
+    if ((headClass == addClass) || (headClass == subtractClass)) {
+        if (nu_context_declares_methods(context))
+            return NuArithmeticNone;
+        return (headClass == addClass) ? NuArithmeticAdd : NuArithmeticSubtract;
+    }
+    return NuArithmeticNone;
+}
+
+static void nu_arithmetic_initialize(NuSymbolTable *symbolTable)
+{
+    numberClass = [NSNumber class];
+    cellClass = [NuCell class];
+    addClass = [Nu_add_operator class];
+    subtractClass = [Nu_subtract_operator class];
+    multiplyClass = [Nu_multiply_operator class];
+    divideClass = [Nu_divide_operator class];
+    classDeclarationSymbol = [symbolTable symbolWithString:@"_class"];
+    methodDeclarationSymbol = [symbolTable symbolWithString:@"_method"];
+}
+
+static bool nu_arithmetic_evaluate(NuArithmeticOperation operation, id cdr, NSMutableDictionary *context, nu_operand *result);
+
+// Append the string values of the remaining arguments of an addition whose first argument isn't a number.
+static id nu_concatenate(id first, id cursor, NSMutableDictionary *context)
+{
+    NSMutableString *result = [NSMutableString stringWithString:[first stringValue]];
+    while (cursor && (cursor != Nu__null)) {
+        id carValue = nu_evaluateCar(cursor, context);
+        if (nu_control.signal)
+            return Nu__null;
+        if (carValue && (carValue != Nu__null)) {
+            [result appendString:[carValue stringValue]];
+        }
+        cursor = [cursor cdr];
+    }
+    return result;
+}
+
+// Evaluate the car of a cell as an operand. Lists that apply an arithmetic operator are evaluated
+// here so that their results can be used without being boxed; everything else is evaluated normally.
+static void nu_evaluate_operand(id cell, NSMutableDictionary *context, nu_operand *operand)
+{
+    id expression = [cell car];
+    if (nu_control.signal || !nu_objectIsKindOfClass(expression, cellClass)) {
+        nu_operand_set_object(operand, nu_evaluateCar(cell, context));
+        return;
+    }
+    NSUInteger depth = nu_expression_stack_depth();
+    id head = nil;
+    @try
+    {
+        head = nu_evaluateCar(expression, context);
+        NuArithmeticOperation operation = nu_arithmetic_operation(head, context);
+        if (operation != NuArithmeticNone) {
+            nu_expression_stack_enter(expression);
+            if (!nu_arithmetic_evaluate(operation, [expression cdr], context, operand))
+                nu_operand_set_object(operand, nu_concatenate(operand->object, [[expression cdr] cdr], context));
+            nu_expression_stack_unwind(depth);
+            return;
+        }
+    }
+    @catch (NSException *exception) {
+        nu_operand_set_object(operand, nu_cellValueForException(expression, exception, depth));
+        return;
+    }
+    nu_operand_set_object(operand, nu_applyCell(expression, head, context, false));
+}
+
+// Evaluate the arguments of an arithmetic operator and combine them into an unboxed result.
+// Returns false without evaluating anything else if the first argument of an addition isn't a number.
+// An argument that raises a control signal ends the evaluation with a null result.
+static bool nu_arithmetic_evaluate(NuArithmeticOperation operation, id cdr, NSMutableDictionary *context, nu_operand *result)
+{
+    id cursor = cdr;
+    if (operation == NuArithmeticMultiply) {
+        result->kind = NuOperandInteger;
+        result->i = 1;
+    }
+    else {
+        nu_evaluate_operand(cursor, context, result);
+        if (nu_control.signal) {
+            nu_operand_set_object(result, Nu__null);
+            return true;
+        }
+        if ((operation == NuArithmeticAdd) && (result->kind == NuOperandObject)
+            && !nu_objectIsKindOfClass(result->object, [NSValue class]))
+            return false;
+        cursor = [cursor cdr];
+        if ((operation == NuArithmeticSubtract) && (!cursor || (cursor == Nu__null))) {
+            // if there is just one operand, negate it
+            nu_operand zero = {NuOperandInteger, 0, 0, nil};
+            nu_operand_combine(&zero, NuArithmeticSubtract, result);
+            *result = zero;
+            return true;
+        }
+        if ((result->kind == NuOperandObject) || (operation == NuArithmeticDivide)) {
+            result->d = nu_operand_double(result);
+            result->kind = NuOperandDouble;
+        }
+    }
+    result->object = nil;
+    while (cursor && (cursor != Nu__null)) {
+        nu_operand operand;
+        nu_evaluate_operand(cursor, context, &operand);
+        if (nu_control.signal) {
+            nu_operand_set_object(result, Nu__null);
+            return true;
+        }
+        nu_operand_combine(result, operation, &operand);
+        cursor = [cursor cdr];
+    }
+    return true;
+}
+
+// Compare two operands for the ordering operators. Integers are compared exactly; other values with compare:.
+static inline NSComparisonResult nu_operand_compare(nu_operand *a, nu_operand *b)
+{
+    if ((a->kind == NuOperandInteger) && (b->kind == NuOperandInteger)) {
+        if (a->i == b->i)
+            return NSOrderedSame;
+        return (a->i < b->i) ? NSOrderedAscending : NSOrderedDescending;
+    }
+    return [nu_operand_object(a) compare:nu_operand_object(b)];
+}
+
+static inline bool nu_operand_equal(nu_operand *a, nu_operand *b)
+{
+    if ((a->kind == NuOperandInteger) && (b->kind == NuOperandInteger))
+        return a->i == b->i;
+    return [nu_operand_object(a) isEqual:nu_operand_object(b)];
+}
+
 @interface Nu_eq_operator : NuOperator {}
 @end
 
@@ -171,12 +549,17 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
+    nu_operand current, next;
     id cursor = cdr;
-    id current = [[cursor car] evalWithContext:context];
+    nu_evaluate_operand(cursor, context, &current);
+    if (nu_control.signal)
+        return Nu__null;
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        id next = [[cursor car] evalWithContext: context];
-        if (![current isEqual:next])
+        nu_evaluate_operand(cursor, context, &next);
+        if (nu_control.signal)
+            return Nu__null;
+        if (!nu_operand_equal(&current, &next))
             return Nu__null;
         current = next;
         cursor = [cursor cdr];
@@ -196,6 +579,8 @@
     id caddr = [[cdr cdr] car];
     id value1 = [cadr evalWithContext:context];
     id value2 = [caddr evalWithContext:context];
+    if (nu_control.signal)
+        return Nu__null;
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
     if ((value1 == nil) && (value2 == nil)) {
         return Nu__null;
@@ -245,8 +630,10 @@
                 cursor = newList;
             }
             else {
-                [cursor setCdr: [[[NuCell alloc] init] autorelease]];
-                cursor = [cursor cdr];
+                NuCell *next = [[NuCell alloc] init];
+                [cursor setCdr:next];
+                [next release];
+                cursor = next;
             }
             id item = [item_to_append car];
             [cursor setCar: item];
@@ -295,7 +682,7 @@
             qargs_cursor = [qargs_cursor cdr];
         }
         
-        id item = [[cursor car] evalWithContext:context];
+        id item = nu_evaluateCar(cursor, context);
         id qitem = [self prependCell:item withSymbol:quoteSymbol];
         [qargs_cursor setCar:qitem];
         cursor = [cursor cdr];
@@ -336,18 +723,20 @@
 @end
 
 @implementation Nu_cond_operator
+- (BOOL) propagatesTailPosition {return YES;}
+
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
+    bool tail = nu_take_tail_position();
     id pairs = cdr;
     id value = Nu__null;
     while (pairs != Nu__null) {
-        id condition = [[pairs car] car];
-        id test = [condition evalWithContext:context];
+        id test = nu_evaluateCar([pairs car], context);
         if (nu_valueIsTrue(test)) {
             value = test;
             id cursor = [[pairs car] cdr];
             while (cursor && (cursor != Nu__null)) {
-                value = [[cursor car] evalWithContext:context];
+                value = nu_evaluateTail(cursor, context, tail && !IS_NOT_NULL([cursor cdr]));
                 cursor = [cursor cdr];
             }
             return value;
@@ -363,9 +752,12 @@
 @end
 
 @implementation Nu_case_operator
+- (BOOL) propagatesTailPosition {return YES;}
+
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id target = [[cdr car] evalWithContext:context];
+    bool tail = nu_take_tail_position();
+    id target = nu_evaluateCar(cdr, context);
     id cases = [cdr cdr];
     while ([cases cdr] != Nu__null) {
         id condition = [[cases car] car];
@@ -374,7 +766,7 @@
             id value = Nu__null;
             id cursor = [[cases car] cdr];
             while (cursor && (cursor != Nu__null)) {
-                value = [[cursor car] evalWithContext:context];
+                value = nu_evaluateTail(cursor, context, tail && !IS_NOT_NULL([cursor cdr]));
                 cursor = [cursor cdr];
             }
             return value;
@@ -385,7 +777,7 @@
     id value = Nu__null;
     id cursor = [[cases car] cdr];
     while (cursor && (cursor != Nu__null)) {
-        value = [[cursor car] evalWithContext:context];
+        value = nu_evaluateTail(cursor, context, tail && !IS_NOT_NULL([cursor cdr]));
         cursor = [cursor cdr];
     }
     return value;
@@ -397,7 +789,35 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context flipped:(bool)flip;
 @end
 
+// Returns true if an if operator would evaluate any of its remaining expressions.
+static bool nu_if_evaluates_more(id expressions, id elseSymbol, bool testIsTrue, bool noneIsTrue)
+{
+    while (IS_NOT_NULL(expressions)) {
+        id nextExpression = [expressions car];
+        if (nu_objectIsKindOfClass(nextExpression, [NuCell class])) {
+            if ([nextExpression car] == elseSymbol) {
+                if (noneIsTrue)
+                    return true;
+            }
+            else if (testIsTrue) {
+                return true;
+            }
+        }
+        else if (nextExpression == elseSymbol) {
+            testIsTrue = noneIsTrue;
+            noneIsTrue = NO;
+        }
+        else if (testIsTrue) {
+            return true;
+        }
+        expressions = [expressions cdr];
+    }
+    return false;
+}
+
 @implementation Nu_if_operator
+- (BOOL) propagatesTailPosition {return YES;}
+
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     return [self callWithArguments:cdr context:context flipped:NO];
@@ -405,13 +825,14 @@
 
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context flipped:(bool)flip
 {
+    bool tail = nu_take_tail_position();
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
     //id thenSymbol = [symbolTable symbolWithString:@"then"];
     id elseSymbol = [symbolTable symbolWithString:@"else"];
     //id elseifSymbol = [symbolTable symbolWithString:@"elseif"];
     
     id result = Nu__null;
-    id test = [[cdr car] evalWithContext:context];
+    id test = nu_evaluateCar(cdr, context);
     
     bool testIsTrue = flip ^ nu_valueIsTrue(test);
     bool noneIsTrue = !testIsTrue;
@@ -431,11 +852,11 @@
              else */
             if ([nextExpression car] == elseSymbol) {
                 if (noneIsTrue)
-                    result = [nextExpression evalWithContext:context];
+                    result = nu_evaluateTail(expressions, context, tail && !nu_if_evaluates_more([expressions cdr], elseSymbol, testIsTrue, noneIsTrue));
             }
             else {
                 if (testIsTrue)
-                    result = [nextExpression evalWithContext:context];
+                    result = nu_evaluateTail(expressions, context, tail && !nu_if_evaluates_more([expressions cdr], elseSymbol, testIsTrue, noneIsTrue));
             }
         }
         else {
@@ -452,7 +873,7 @@
             }
             else {
                 if (testIsTrue)
-                    result = [nextExpression evalWithContext:context];
+                    result = nu_evaluateTail(expressions, context, tail && !nu_if_evaluates_more([expressions cdr], elseSymbol, testIsTrue, noneIsTrue));
             }
         }
         expressions = [expressions cdr];
@@ -480,26 +901,12 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id result = Nu__null;
-    id test = [[cdr car] evalWithContext:context];
+    id test = nu_evaluateCar(cdr, context);
     while (nu_valueIsTrue(test)) {
-        @try
-        {
-            id expressions = [cdr cdr];
-            while (expressions && (expressions != Nu__null)) {
-                result = [[expressions car] evalWithContext:context];
-                expressions = [expressions cdr];
-            }
-        }
-        @catch (NuBreakException *exception) {
+        result = nu_evaluateBody([cdr cdr], context, result);
+        if (nu_loop_should_stop())
             break;
-        }
-        @catch (NuContinueException *exception) {
-            // do nothing, just continue with the next loop iteration
-        }
-        @catch (id exception) {
-            @throw(exception);
-        }
-        test = [[cdr car] evalWithContext:context];
+        test = nu_evaluateCar(cdr, context);
     }
     return result;
 }
@@ -513,26 +920,12 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id result = Nu__null;
-    id test = [[cdr car] evalWithContext:context];
+    id test = nu_evaluateCar(cdr, context);
     while (!nu_valueIsTrue(test)) {
-        @try
-        {
-            id expressions = [cdr cdr];
-            while (expressions && (expressions != Nu__null)) {
-                result = [[expressions car] evalWithContext:context];
-                expressions = [expressions cdr];
-            }
-        }
-        @catch (NuBreakException *exception) {
+        result = nu_evaluateBody([cdr cdr], context, result);
+        if (nu_loop_should_stop())
             break;
-        }
-        @catch (NuContinueException *exception) {
-            // do nothing, just continue with the next loop iteration
-        }
-        @catch (id exception) {
-            @throw(exception);
-        }
-        test = [[cdr car] evalWithContext:context];
+        test = nu_evaluateCar(cdr, context);
     }
     return result;
 }
@@ -555,23 +948,9 @@
     // evaluate the loop condition
     id test = [looptest evalWithContext:context];
     while (nu_valueIsTrue(test)) {
-        @try
-        {
-            id expressions = [cdr cdr];
-            while (expressions && (expressions != Nu__null)) {
-                result = [[expressions car] evalWithContext:context];
-                expressions = [expressions cdr];
-            }
-        }
-        @catch (NuBreakException *exception) {
+        result = nu_evaluateBody([cdr cdr], context, result);
+        if (nu_loop_should_stop())
             break;
-        }
-        @catch (NuContinueException *exception) {
-            // do nothing, just continue with the next loop iteration
-        }
-        @catch (id exception) {
-            @throw(exception);
-        }
         // perform the end of loop increment step
         [loopincr evalWithContext:context];
         // evaluate the loop condition
@@ -592,6 +971,7 @@
     id catchSymbol = [symbolTable symbolWithString:@"catch"];
     id finallySymbol = [symbolTable symbolWithString:@"finally"];
     id result = Nu__null;
+    NSUInteger depth = nu_expression_stack_depth();
     
     @try
     {
@@ -607,10 +987,17 @@
             else {
                 result = [nextExpression evalWithContext:context];
             }
+            if (nu_control.signal)
+                break;
             expressions = [expressions cdr];
         }
     }
     @catch (id thrownObject) {
+        // expressions that were interrupted by the exception are no longer being evaluated
+        nu_expression_stack_unwind(depth);
+        // catch blocks run even when the exception interrupted a break, continue or return
+        nu_control_state pending;
+        nu_suspend_control_signal(&pending);
         // evaluate all the expressions that are in catch blocks
         id expressions = cdr;
         while (expressions && (expressions != Nu__null)) {
@@ -625,17 +1012,21 @@
                     [context setValue:thrownObject forKey:name];
                     // now we loop over the rest of the expressions and evaluate them one by one
                     id cursor = [[nextExpression cdr] cdr];
-                    while (cursor && (cursor != Nu__null)) {
-                        result = [[cursor car] evalWithContext:context];
+                    while (cursor && (cursor != Nu__null) && !nu_control.signal) {
+                        result = nu_evaluateCar(cursor, context);
                         cursor = [cursor cdr];
                     }
                 }
             }
             expressions = [expressions cdr];
         }
+        nu_resume_control_signal(&pending);
     }
     @finally
     {
+        // finally blocks run even when a break, continue or return is unwinding through the try
+        nu_control_state pending;
+        nu_suspend_control_signal(&pending);
         // evaluate all the expressions that are in finally blocks
         id expressions = cdr;
         while (expressions && (expressions != Nu__null)) {
@@ -646,13 +1037,14 @@
                     // loop over the rest of the expressions and evaluate them one by one
                     id cursor = [nextExpression cdr];
                     while (cursor && (cursor != Nu__null)) {
-                        result = [[cursor car] evalWithContext:context];
+                        result = nu_evaluateCar(cursor, context);
                         cursor = [cursor cdr];
                     }
                 }
             }
             expressions = [expressions cdr];
         }
+        nu_resume_control_signal(&pending);
     }
     return result;
 }
@@ -665,7 +1057,7 @@
 @implementation Nu_throw_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id exception = [[cdr car] evalWithContext:context];
+    id exception = nu_evaluateCar(cdr, context);
     @throw exception;
     return exception;
 }
@@ -680,7 +1072,7 @@
 {
     //  NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
     
-    id object = [[cdr car] evalWithContext:context];
+    id object = nu_evaluateCar(cdr, context);
     id result = Nu__null;
     
     @synchronized(object) {
@@ -697,6 +1089,176 @@
 
 @end
 
+@interface Nu_future_operator : NuOperator {}
+@end
+
+@implementation Nu_future_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    NuBlock *block = [[[NuBlock alloc] initWithParameters:Nu__null body:cdr context:context] autorelease];
+    NuFuture *future = [[[NuFuture alloc] initWithBlock:block] autorelease];
+    [future start];
+    return future;
+}
+
+@end
+
+@interface Nu_await_operator : NuOperator {}
+@end
+
+@implementation Nu_await_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    id value = nu_evaluateCar(cdr, context);
+    if ([value isKindOfClass:[NuFuture class]])
+        return [value value];
+    return value;
+}
+
+@end
+
+@interface Nu_all_operator : NuOperator {}
+@end
+
+@implementation Nu_all_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    id futures = nu_evaluateCar(cdr, context);
+    NSMutableArray *results = [NSMutableArray array];
+    if (!IS_NOT_NULL(futures))
+        return results;
+    if ([futures isKindOfClass:[NuCell class]])
+        futures = [futures array];
+    else if (![futures isKindOfClass:[NSArray class]])
+        [NSException raise:@"NuAllError" format:@"all requires a list or array of futures"];
+    // every future is awaited, so that none is still running when an exception is raised
+    id exception = nil;
+    for (NSUInteger i = 0; i < [futures count]; i++) {
+        id future = [futures objectAtIndex:i];
+        id value = future;
+        if ([future isKindOfClass:[NuFuture class]]) {
+            @try {
+                value = [future value];
+            }
+            @catch (id e) {
+                if (!exception)
+                    exception = e;
+                value = Nu__null;
+            }
+        }
+        [results addObject:(value ? value : Nu__null)];
+    }
+    if (exception)
+        @throw exception;
+    return results;
+}
+
+@end
+
+@interface Nu_channel_operator : NuOperator {}
+@end
+
+@implementation Nu_channel_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    int capacity = 1;
+    if (cdr && (cdr != Nu__null))
+        capacity = [nu_evaluateCar(cdr, context) intValue];
+    return [[[NuChannel alloc] initWithCapacity:((capacity > 0) ? capacity : 1)] autorelease];
+}
+
+@end
+
+@interface Nu_select_operator : NuOperator {}
+@end
+
+@implementation Nu_select_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    NSMutableArray *channels = [NSMutableArray array];
+    NSMutableArray *handlers = [NSMutableArray array];
+    id otherwise = nil;
+    id cursor = cdr;
+    while (cursor && (cursor != Nu__null)) {
+        id clause = [cursor car];
+        if (!nu_objectIsKindOfClass(clause, [NuCell class]))
+            [NSException raise:@"NuSelectError" format:@"select clauses must be lists"];
+        id head = [clause car];
+        if (nu_objectIsKindOfClass(head, [NuSymbol class]) && [[head stringValue] isEqualToString:@"else"]) {
+            otherwise = [clause cdr];
+        }
+        else {
+            id channel = nu_evaluateCar(clause, context);
+            if (!nu_objectIsKindOfClass(channel, [NuChannel class]))
+                [NSException raise:@"NuSelectError" format:@"select requires channels, but got %@", channel];
+            [channels addObject:channel];
+            [handlers addObject:nu_evaluateCar([clause cdr], context)];
+        }
+        cursor = [cursor cdr];
+    }
+    NSUInteger count = [channels count];
+    NuChannel **buffer = (NuChannel **) [[NSMutableData dataWithLength:(count ? count : 1) * sizeof(NuChannel *)] mutableBytes];
+    [channels getObjects:buffer range:NSMakeRange(0, count)];
+    id value = nil;
+    NSInteger index = nu_channel_select(buffer, count, (otherwise == nil), &value);
+    if (index >= 0) {
+        id handler = [handlers objectAtIndex:index];
+        if ([handler respondsToSelector:@selector(evalWithArguments:context:)])
+            return [handler evalWithArguments:[NuCell cellWithCar:value cdr:Nu__null] context:nil];
+        return value;
+    }
+    id result = Nu__null;
+    while (otherwise && (otherwise != Nu__null)) {
+        result = [[otherwise car] evalWithContext:context];
+        otherwise = [otherwise cdr];
+    }
+    return result;
+}
+
+@end
+
+@interface Nu_actor_operator : NuOperator {}
+@end
+
+@implementation Nu_actor_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    return [[[NuActor alloc] initWithBlock:nu_evaluateCar(cdr, context)] autorelease];
+}
+
+@end
+
+@interface Nu_render_markup_operator : NuOperator {}
+@end
+
+@implementation Nu_render_markup_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    id output = nu_evaluateCar(cdr, context);
+    if (!nu_objectIsKindOfClass(output, [NuOutputBuffer class])) {
+        [NSException raise:@"NuRenderMarkupError" format:@"render-markup requires a NuOutputBuffer, but got %@", output];
+    }
+    nu_markup_render(output, [cdr cdr], context);
+    return output;
+}
+
+@end
+
+@interface Nu_profile_report_operator : NuOperator {}
+@end
+
+@implementation Nu_profile_report_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    NuProfiler *profiler = [NuProfiler defaultProfiler];
+    if (cdr && (cdr != Nu__null)) {
+        return [profiler reportWithLimit:[nu_evaluateCar(cdr, context) unsignedIntegerValue]];
+    }
+    return [profiler report];
+}
+
+@end
+
 @interface Nu_quote_operator : NuOperator {}
 @end
 
@@ -899,17 +1461,11 @@
 
 @end
 
-@interface Nu_set_operator : NuOperator {}
-@end
-
-@implementation Nu_set_operator
-- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+id nu_setSymbolValue(NuSymbol *symbol, id result, NSMutableDictionary *context)
 {
-    
-    NuSymbol *symbol = [cdr car];
-    id value = [[cdr cdr] car];
-    id result = [value evalWithContext:context];
-    
+    // a value computed while a control signal is pending is incomplete and must not be assigned
+    if (nu_control.signal)
+        return Nu__null;
     char c = (char) [[symbol stringValue] characterAtIndex:0];
     if (c == '$') {
         [symbol setValue:result];
@@ -941,6 +1497,18 @@
     return result;
 }
 
+@interface Nu_set_operator : NuOperator {}
+@end
+
+@implementation Nu_set_operator
+- (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
+{
+    
+    NuSymbol *symbol = [cdr car];
+    id result = nu_evaluateCar([cdr cdr], context);
+    return nu_setSymbolValue(symbol, result, context);
+}
+
 @end
 
 @interface Nu_local_operator : NuOperator {}
@@ -951,8 +1519,9 @@
 {
     
     NuSymbol *symbol = [cdr car];
-    id value = [[cdr cdr] car];
-    id result = [value evalWithContext:context];
+    id result = nu_evaluateCar([cdr cdr], context);
+    if (nu_control.signal)
+        return Nu__null;
     [context setPossiblyNullObject:result forKey:symbol];
     return result;
 }
@@ -968,9 +1537,11 @@
 {
     
     NuSymbol *symbol = [cdr car];
-    id value = [[cdr cdr] car];
-    id result = [value evalWithContext:context];
+    id result = nu_evaluateCar([cdr cdr], context);
+    if (nu_control.signal)
+        return Nu__null;
     [symbol setValue:result];
+    nu_image_record_global(symbol, context);
     return result;
 }
 
@@ -982,9 +1553,12 @@
 @implementation Nu_regex_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id value = [cdr car];
-    value = [value evalWithContext:context];
-    return [NSRegularExpression regexWithPattern:value];
+    id value = nu_evaluateCar(cdr, context);
+    id options = [cdr cdr];
+    if (options && (options != Nu__null)) {
+        return nu_regex_cached(value, [nu_evaluateCar(options, context) unsignedIntegerValue]);
+    }
+    return nu_regex_cached(value, 0);
 }
 
 @end
@@ -1036,6 +1610,7 @@
     if (nu_objectIsKindOfClass(value, [NuBlock class])) {
         //NSLog(@"setting context[%@] = %@", symbol, value);
         [((NSMutableDictionary *)[value context]) setPossiblyNullObject:value forKey:symbol];
+        [[value scope] bindSymbol:symbol];
     }
     return value;
 }
@@ -1115,10 +1690,12 @@
             result_cursor = result;
         }
         else {
-            [result_cursor setCdr:[[[NuCell alloc] init] autorelease]];
-            result_cursor = [result_cursor cdr];
+            NuCell *next = [[NuCell alloc] init];
+            [result_cursor setCdr:next];
+            [next release];
+            result_cursor = next;
         }
-        id value = [[cursor car] evalWithContext:context];
+        id value = nu_evaluateCar(cursor, context);
         [result_cursor setCar:value];
         cursor = [cursor cdr];
     }
@@ -1127,96 +1704,54 @@
 
 @end
 
-@interface Nu_add_operator : NuOperator {}
-@end
-
 @implementation Nu_add_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
-    if ([context objectForKey:[symbolTable symbolWithString:@"_class"]] && ![context objectForKey:[symbolTable symbolWithString:@"_method"]]) {
+    if (nu_context_declares_methods(context)) {
         // we are inside a class declaration and outside a method declaration.
         // treat this as a "cmethod" call
+        NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
         NuClass *classWrapper = [context objectForKey:[symbolTable symbolWithString:@"_class"]];
         [classWrapper registerClass];
         Class classToExtend = [classWrapper wrappedClass];
         return help_add_method_to_class(classToExtend, cdr, context, YES);
     }
     // otherwise, it's an addition
-    id firstArgument = [[cdr car] evalWithContext:context];
-    if (nu_objectIsKindOfClass(firstArgument, [NSValue class])) {
-        double sum = [firstArgument doubleValue];
-        id cursor = [cdr cdr];
-        while (cursor && (cursor != Nu__null)) {
-            sum += [[[cursor car] evalWithContext:context] doubleValue];
-            cursor = [cursor cdr];
-        }
-        return [NSNumber numberWithDouble:sum];
-    }
-    else {
-        NSMutableString *result = [NSMutableString stringWithString:[firstArgument stringValue]];
-        id cursor = [cdr cdr];
-        while (cursor && (cursor != Nu__null)) {
-            id carValue = [[cursor car] evalWithContext:context];
-            if (carValue && (carValue != Nu__null)) {
-                [result appendString:[carValue stringValue]];
-            }
-            cursor = [cursor cdr];
-        }
-        return result;
-    }
+    nu_operand sum;
+    if (nu_arithmetic_evaluate(NuArithmeticAdd, cdr, context, &sum))
+        return nu_operand_object(&sum);
+    // or a concatenation
+    return nu_concatenate(sum.object, [cdr cdr], context);
 }
 
 @end
 
-@interface Nu_multiply_operator : NuOperator {}
-@end
-
 @implementation Nu_multiply_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    double product = 1;
-    id cursor = cdr;
-    while (cursor && (cursor != Nu__null)) {
-        product *= [[[cursor car] evalWithContext:context] doubleValue];
-        cursor = [cursor cdr];
-    }
-    return [NSNumber numberWithDouble:product];
+    nu_operand product;
+    nu_arithmetic_evaluate(NuArithmeticMultiply, cdr, context, &product);
+    return nu_operand_object(&product);
 }
 
 @end
 
-@interface Nu_subtract_operator : NuOperator {}
-@end
-
 @implementation Nu_subtract_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
-    if ([context objectForKey:[symbolTable symbolWithString:@"_class"]] && ![context objectForKey:[symbolTable symbolWithString:@"_method"]]) {
+    if (nu_context_declares_methods(context)) {
         // we are inside a class declaration and outside a method declaration.
         // treat this as an "imethod" call
+        NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
         NuClass *classWrapper = [context objectForKey:[symbolTable symbolWithString:@"_class"]];
         [classWrapper registerClass];
         Class classToExtend = [classWrapper wrappedClass];
         return help_add_method_to_class(classToExtend, cdr, context, NO);
     }
     // otherwise, it's a subtraction
-    id cursor = cdr;
-    double sum = [[[cursor car] evalWithContext:context] doubleValue];
-    cursor = [cursor cdr];
-    if (!cursor || (cursor == Nu__null)) {
-        // if there is just one operand, negate it
-        sum = -sum;
-    }
-    else {
-        // otherwise, subtract all the remaining operands from the first one
-        while (cursor && (cursor != Nu__null)) {
-            sum -= [[[cursor car] evalWithContext:context] doubleValue];
-            cursor = [cursor cdr];
-        }
-    }
-    return [NSNumber numberWithDouble:sum];
+    nu_operand difference;
+    nu_arithmetic_evaluate(NuArithmeticSubtract, cdr, context, &difference);
+    return nu_operand_object(&difference);
 }
 
 @end
@@ -1228,10 +1763,16 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id cursor = cdr;
-    double result = [[[cursor car] evalWithContext:context] doubleValue];
+    id value = nu_evaluateCar(cursor, context);
+    if (nu_control.signal)
+        return Nu__null;
+    double result = [value doubleValue];
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        result = pow(result, [[[cursor car] evalWithContext:context] doubleValue]);
+        value = nu_evaluateCar(cursor, context);
+        if (nu_control.signal)
+            return Nu__null;
+        result = pow(result, [value doubleValue]);
         cursor = [cursor cdr];
     }
     return [NSNumber numberWithDouble:result];
@@ -1239,20 +1780,12 @@
 
 @end
 
-@interface Nu_divide_operator : NuOperator {}
-@end
-
 @implementation Nu_divide_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id cursor = cdr;
-    double product = [[[cursor car] evalWithContext:context] doubleValue];
-    cursor = [cursor cdr];
-    while (cursor && (cursor != Nu__null)) {
-        product /= [[[cursor car] evalWithContext:context] doubleValue];
-        cursor = [cursor cdr];
-    }
-    return [NSNumber numberWithDouble:product];
+    nu_operand quotient;
+    nu_arithmetic_evaluate(NuArithmeticDivide, cdr, context, &quotient);
+    return nu_operand_object(&quotient);
 }
 
 @end
@@ -1264,13 +1797,19 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id cursor = cdr;
-    int product = [[[cursor car] evalWithContext:context] intValue];
+    id value = nu_evaluateCar(cursor, context);
+    if (nu_control.signal)
+        return Nu__null;
+    int product = [value intValue];
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        product %= [[[cursor car] evalWithContext:context] intValue];
+        value = nu_evaluateCar(cursor, context);
+        if (nu_control.signal)
+            return Nu__null;
+        product %= [value intValue];
         cursor = [cursor cdr];
     }
-    return @(product);
+    return nu_number_with_long(product);
 }
 
 @end
@@ -1282,10 +1821,16 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id cursor = cdr;
-    long result = [[[cursor car] evalWithContext:context] longValue];
+    id value = nu_evaluateCar(cursor, context);
+    if (nu_control.signal)
+        return Nu__null;
+    long result = [value longValue];
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        result &= [[[cursor car] evalWithContext:context] longValue];
+        value = nu_evaluateCar(cursor, context);
+        if (nu_control.signal)
+            return Nu__null;
+        result &= [value longValue];
         cursor = [cursor cdr];
     }
     return [NSNumber numberWithLong:result];
@@ -1300,10 +1845,16 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id cursor = cdr;
-    long result = [[[cursor car] evalWithContext:context] longValue];
+    id value = nu_evaluateCar(cursor, context);
+    if (nu_control.signal)
+        return Nu__null;
+    long result = [value longValue];
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        result |= [[[cursor car] evalWithContext:context] longValue];
+        value = nu_evaluateCar(cursor, context);
+        if (nu_control.signal)
+            return Nu__null;
+        result |= [value longValue];
         cursor = [cursor cdr];
     }
     return [NSNumber numberWithLong:result];
@@ -1318,12 +1869,17 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
+    nu_operand current, next;
     id cursor = cdr;
-    id current = [[cursor car] evalWithContext:context];
+    nu_evaluate_operand(cursor, context, &current);
+    if (nu_control.signal)
+        return Nu__null;
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        id next = [[cursor car] evalWithContext:context];
-        NSComparisonResult result = [current compare:next];
+        nu_evaluate_operand(cursor, context, &next);
+        if (nu_control.signal)
+            return Nu__null;
+        NSComparisonResult result = nu_operand_compare(&current, &next);
         if (result != NSOrderedDescending)
             return Nu__null;
         current = next;
@@ -1341,12 +1897,17 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
+    nu_operand current, next;
     id cursor = cdr;
-    id current = [[cursor car] evalWithContext:context];
+    nu_evaluate_operand(cursor, context, &current);
+    if (nu_control.signal)
+        return Nu__null;
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        id next = [[cursor car] evalWithContext:context];
-        NSComparisonResult result = [current compare:next];
+        nu_evaluate_operand(cursor, context, &next);
+        if (nu_control.signal)
+            return Nu__null;
+        NSComparisonResult result = nu_operand_compare(&current, &next);
         if (result != NSOrderedAscending)
             return Nu__null;
         current = next;
@@ -1364,12 +1925,17 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
+    nu_operand current, next;
     id cursor = cdr;
-    id current = [[cursor car] evalWithContext:context];
+    nu_evaluate_operand(cursor, context, &current);
+    if (nu_control.signal)
+        return Nu__null;
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        id next = [[cursor car] evalWithContext:context];
-        NSComparisonResult result = [current compare:next];
+        nu_evaluate_operand(cursor, context, &next);
+        if (nu_control.signal)
+            return Nu__null;
+        NSComparisonResult result = nu_operand_compare(&current, &next);
         if (result == NSOrderedAscending)
             return Nu__null;
         current = next;
@@ -1387,12 +1953,17 @@
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
+    nu_operand current, next;
     id cursor = cdr;
-    id current = [[cursor car] evalWithContext:context];
+    nu_evaluate_operand(cursor, context, &current);
+    if (nu_control.signal)
+        return Nu__null;
     cursor = [cursor cdr];
     while (cursor && (cursor != Nu__null)) {
-        id next = [[cursor car] evalWithContext:context];
-        NSComparisonResult result = [current compare:next];
+        nu_evaluate_operand(cursor, context, &next);
+        if (nu_control.signal)
+            return Nu__null;
+        NSComparisonResult result = nu_operand_compare(&current, &next);
         if (result == NSOrderedDescending)
             return Nu__null;
         current = next;
@@ -1409,8 +1980,11 @@
 @implementation Nu_leftshift_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    long result = [[[cdr car] evalWithContext:context] longValue];
-    result = result << [[[[cdr cdr] car] evalWithContext:context] longValue];
+    id value = nu_evaluateCar(cdr, context);
+    id shift = [[[cdr cdr] car] evalWithContext:context];
+    if (nu_control.signal)
+        return Nu__null;
+    long result = [value longValue] << [shift longValue];
     return [NSNumber numberWithLong:result];
 }
 
@@ -1422,8 +1996,11 @@
 @implementation Nu_rightshift_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    long result = [[[cdr car] evalWithContext:context] longValue];
-    result = result >> [[[[cdr cdr] car] evalWithContext:context] longValue];
+    id value = nu_evaluateCar(cdr, context);
+    id shift = [[[cdr cdr] car] evalWithContext:context];
+    if (nu_control.signal)
+        return Nu__null;
+    long result = [value longValue] >> [shift longValue];
     return [NSNumber numberWithLong:result];
 }
 
@@ -1438,7 +2015,7 @@
     id cursor = cdr;
     id value = Nu__null;
     while (cursor && (cursor != Nu__null)) {
-        value = [[cursor car] evalWithContext:context];
+        value = nu_evaluateCar(cursor, context);
         if (!nu_valueIsTrue(value))
             return Nu__null;
         cursor = [cursor cdr];
@@ -1456,7 +2033,7 @@
 {
     id cursor = cdr;
     while (cursor && (cursor != Nu__null)) {
-        id value = [[cursor car] evalWithContext:context];
+        id value = nu_evaluateCar(cursor, context);
         if (nu_valueIsTrue(value))
             return value;
         cursor = [cursor cdr];
@@ -1475,7 +2052,7 @@
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
     id cursor = cdr;
     if (cursor && (cursor != Nu__null)) {
-        id value = [[cursor car] evalWithContext:context];
+        id value = nu_evaluateCar(cursor, context);
         return nu_valueIsTrue(value) ? Nu__null : [symbolTable symbolWithString:@"t"];
     }
     return Nu__null;
@@ -1503,7 +2080,7 @@
     NSString *string;
     id cursor = cdr;
     while (cursor && (cursor != Nu__null)) {
-        id value = [[cursor car] evalWithContext:context];
+        id value = nu_evaluateCar(cursor, context);
         if (value) {
             string = [value stringValue];
 #if !TARGET_OS_IPHONE
@@ -1553,7 +2130,7 @@
     NSString *string;
     id cursor = cdr;
     while (cursor && (cursor != Nu__null)) {
-        string = [[[cursor car] evalWithContext:context] stringValue];
+        string = [nu_evaluateCar(cursor, context) stringValue];
 #if !TARGET_OS_IPHONE
         if (console && (console != Nu__null)) {
             [console write:string];
@@ -1577,7 +2154,7 @@
 @implementation Nu_call_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id function = [[cdr car] evalWithContext:context];
+    id function = nu_evaluateCar(cdr, context);
     id arguments = [cdr cdr];
     id value = [function callWithArguments:arguments context:context];
     return value;
@@ -1591,7 +2168,7 @@
 @implementation Nu_send_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id target = [[cdr car] evalWithContext:context];
+    id target = nu_evaluateCar(cdr, context);
     id message = [cdr cdr];
     id value = [target sendMessage:message withContext:context];
     return value;
@@ -1603,12 +2180,15 @@
 @end
 
 @implementation Nu_progn_operator
+- (BOOL) propagatesTailPosition {return YES;}
+
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
+    bool tail = nu_take_tail_position();
     id value = Nu__null;
     id cursor = cdr;
     while (cursor && (cursor != Nu__null)) {
-        value = [[cursor car] evalWithContext:context];
+        value = nu_evaluateTail(cursor, context, tail && !IS_NOT_NULL([cursor cdr]));
         cursor = [cursor cdr];
     }
     return value;
@@ -1622,7 +2202,7 @@
 @implementation Nu_eval_operator
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id value = [[[cdr car] evalWithContext:context] evalWithContext:context];
+    id value = [nu_evaluateCar(cdr, context) evalWithContext:context];
     return value;
 }
 
@@ -1658,7 +2238,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 {
     NuSymbolTable *symbolTable = [context objectForKey:SYMBOLS_KEY];
     id parser = [context lookupObjectForKey:[symbolTable symbolWithString:@"_parser"]];
-    id resourceName = [[cdr car] evalWithContext:context];
+    id resourceName = nu_evaluateCar(cdr, context);
     
     // does the resourceName contain a colon? if so, it's a framework:nu-source-file pair.
     NSArray *split = [resourceName componentsSeparatedByString:@":"];
@@ -1697,9 +2277,8 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
             }
         }
         if (fileName) {
-            NSString *string = [NSString stringWithContentsOfFile:fileName encoding:NSUTF8StringEncoding error:NULL];
-            if (string) {
-                id body = [parser parse:string asIfFromFilename:[fileName UTF8String]];
+            id body = [NuParseCache parseContentsOfFile:fileName withParser:parser];
+            if (body) {
                 [body evalWithContext:context];
                 return [symbolTable symbolWithString:@"t"];
             }
@@ -1745,8 +2324,11 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 @end
 
 @implementation Nu_let_operator
+- (BOOL) propagatesTailPosition {return YES;}
+
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
+    bool tail = nu_take_tail_position();
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
     id arg_names = [[NuCell alloc] init];
@@ -1774,7 +2356,14 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
     }
     id body = [cdr cdr];
     NuBlock *block = [[NuBlock alloc] initWithParameters:arg_names body:body context:context];
-    id result = [[block evalWithArguments:arg_values context:context] retain];
+    id result;
+    if (tail) {
+        // the enclosing block evaluates the body after its own body has finished
+        result = [[block tailCallWithArguments:arg_values context:context] retain];
+    }
+    else {
+        result = [[block evalWithArguments:arg_values context:context] retain];
+    }
     [block release];
     
     [arg_names release];
@@ -1816,6 +2405,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
         newClass = objc_allocateClassPair(parentClass, [[className stringValue] UTF8String], 0);
         childClass = [NuClass classWithClass:newClass];
         [childClass setRegistered:NO];
+        nu_image_record_class(newClass, context);
         //NSLog(@"created class %@", [childClass name]);
         
         if (!childClass) {
@@ -1835,6 +2425,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 #else
         [parentClass createSubclassNamed:[className stringValue]];
         childClass = [NuClass classWithName:[className stringValue]];
+        nu_image_record_class([childClass wrappedClass], context);
 #endif
         body = [[[cdr cdr] cdr] cdr];
     }
@@ -1969,7 +2560,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 	id cursor = cdr;
     NSMutableString *command = [NSMutableString string];
     while (cursor && (cursor != Nu__null)) {
-        [command appendString:[[[cursor car] evalWithContext:context] stringValue]];
+        [command appendString:[nu_evaluateCar(cursor, context) stringValue]];
         cursor = [cursor cdr];
     }
     const char *commandString = [command UTF8String];
@@ -1987,7 +2578,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     if (cdr && (cdr != Nu__null)) {
-        int status = [[[cdr car] evalWithContext:context] intValue];
+        int status = [nu_evaluateCar(cdr, context) intValue];
         exit(status);
     }
     else {
@@ -2006,7 +2597,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 {
     int result = -1;
     if (cdr && (cdr != Nu__null)) {
-        int seconds = [[[cdr car] evalWithContext:context] intValue];
+        int seconds = [nu_evaluateCar(cdr, context) intValue];
         result = sleep(seconds);
     }
     else {
@@ -2053,7 +2644,7 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    id object = [[cdr car] evalWithContext:context];
+    id object = nu_evaluateCar(cdr, context);
     return [object help];
 }
 
@@ -2066,8 +2657,8 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    @throw [[[NuBreakException alloc] init] autorelease];
-    return nil;                                   // unreached
+    nu_set_control_signal(NuControlSignalBreak, nil, nil);
+    return Nu__null;
 }
 
 @end
@@ -2079,8 +2670,8 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    @throw [[[NuContinueException alloc] init] autorelease];
-    return nil;                                   // unreached
+    nu_set_control_signal(NuControlSignalContinue, nil, nil);
+    return Nu__null;
 }
 
 @end
@@ -2094,10 +2685,10 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 {
     id value = nil;
     if (cdr && cdr != Nu__null) {
-        value = [[cdr car] evalWithContext:context];
+        value = nu_evaluateCar(cdr, context);
     }
-    @throw [[[NuReturnException alloc] initWithValue:value] autorelease];
-    return nil;                                   // unreached
+    nu_set_control_signal(NuControlSignalReturn, value, nil);
+    return Nu__null;
 }
 
 @end
@@ -2113,14 +2704,14 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
     id value = nil;
     id cursor = cdr;
     if (cursor && cursor != Nu__null) {
-        block = [[cursor car] evalWithContext:context];
+        block = nu_evaluateCar(cursor, context);
         cursor = [cursor cdr];
     }
     if (cursor && cursor != Nu__null) {
-        value = [[cursor car] evalWithContext:context];
+        value = nu_evaluateCar(cursor, context);
     }
-    @throw [[[NuReturnException alloc] initWithValue:value blockForReturn:block] autorelease];
-    return nil;                                   // unreached
+    nu_set_control_signal(NuControlSignalReturn, value, block);
+    return Nu__null;
 }
 
 @end
@@ -2146,10 +2737,10 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 {
     if (cdr == Nu__null)
         [NSException raise: @"NuArityError" format:@"min expects at least 1 argument, got 0"];
-    id smallest = [[cdr car] evalWithContext:context];
+    id smallest = nu_evaluateCar(cdr, context);
     id cursor = [cdr cdr];
     while (cursor && (cursor != Nu__null)) {
-        id nextValue = [[cursor car] evalWithContext:context];
+        id nextValue = nu_evaluateCar(cursor, context);
         if([smallest compare:nextValue] == 1) {
             smallest = nextValue;
         }
@@ -2169,10 +2760,10 @@ id loadNuLibraryFile(NSString *nuFileName, id parser, id context, id symbolTable
 {
     if (cdr == Nu__null)
         [NSException raise: @"NuArityError" format:@"max expects at least 1 argument, got 0"];
-    id biggest = [[cdr car] evalWithContext:context];
+    id biggest = nu_evaluateCar(cdr, context);
     id cursor = [cdr cdr];
     while (cursor && (cursor != Nu__null)) {
-        id nextValue = [[cursor car] evalWithContext:context];
+        id nextValue = nu_evaluateCar(cursor, context);
         if([biggest compare:nextValue] == -1) {
             biggest = nextValue;
         }
@@ -2189,7 +2780,7 @@ static id evaluatedArguments(id cdr, NSMutableDictionary *context)
     id cursor = cdr;
     id outCursor = nil;
     while (cursor && (cursor != Nu__null)) {
-        id nextValue = [[cursor car] evalWithContext:context];
+        id nextValue = nu_evaluateCar(cursor, context);
         id newCell = [[[NuCell alloc] init] autorelease];
         [newCell setCar:nextValue];
         if (!outCursor) {
@@ -2237,7 +2828,7 @@ static id evaluatedArguments(id cdr, NSMutableDictionary *context)
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
     id parser = [[[NuParser alloc] init] autorelease];
-    return [parser parse:[[cdr car] evalWithContext:context]];
+    return [parser parse:nu_evaluateCar(cdr, context)];
 }
 
 @end
@@ -2250,7 +2841,7 @@ static id evaluatedArguments(id cdr, NSMutableDictionary *context)
 // signature operator; basically gives access to the static signature_for_identifier function from within Nu code
 - (id) callWithArguments:(id)cdr context:(NSMutableDictionary *)context
 {
-    return signature_for_identifier( [[cdr car] evalWithContext:context],[NuSymbolTable sharedSymbolTable]);
+    return signature_for_identifier( nu_evaluateCar(cdr, context),[NuSymbolTable sharedSymbolTable]);
 }
 
 @end
@@ -2261,6 +2852,8 @@ void load_builtins(NuSymbolTable *symbolTable);
 
 void load_builtins(NuSymbolTable *symbolTable)
 {
+    nu_arithmetic_initialize(symbolTable);
+    
     [(NuSymbol *) [symbolTable symbolWithString:@"t"] setValue:[symbolTable symbolWithString:@"t"]];
     [(NuSymbol *) [symbolTable symbolWithString:@"nil"] setValue:Nu__null];
     [(NuSymbol *) [symbolTable symbolWithString:@"YES"] setValue:[NSNumber numberWithBool:YES]];
@@ -2308,6 +2901,14 @@ void load_builtins(NuSymbolTable *symbolTable)
     
     install(@"throw",    Nu_throw_operator);
     install(@"synchronized", Nu_synchronized_operator);
+    install(@"future",   Nu_future_operator);
+    install(@"await",    Nu_await_operator);
+    install(@"all",      Nu_all_operator);
+    install(@"channel",  Nu_channel_operator);
+    install(@"select",   Nu_select_operator);
+    install(@"actor",    Nu_actor_operator);
+    install(@"render-markup", Nu_render_markup_operator);
+    install(@"profile-report", Nu_profile_report_operator);
     
     install(@"quote",    Nu_quote_operator);
     install(@"eval",     Nu_eval_operator);
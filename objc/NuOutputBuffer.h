@@ -0,0 +1,61 @@
+//
+//  NuOutputBuffer.h
+//  Nu
+//
+//  Append-only buffers for generated text.
+//
+
+#import <Foundation/Foundation.h>
+
+/*!
+ @class NuOutputBuffer
+ @abstract An append-only buffer of UTF-8 text that can be written out in chunks as it grows.
+ @discussion Programs that generate large documents can append their text to an output buffer rather than
+ concatenating strings. A buffer that is created with a file descriptor or an output stream writes its bytes there
+ whenever a chunk has filled, so the whole document is never held in memory; call <b>flush</b> when you are done
+ to write the last partial chunk. A buffer that is created with <b>buffer</b> keeps everything it is given, and its
+ <b>stringValue</b> is the text that was appended.
+
+ Output buffers respond to <b>appendString:</b>, so they can be used wherever a mutable string is being appended to.
+ They are not thread-safe.
+ */
+@interface NuOutputBuffer : NSObject
+
+/*! Create a buffer that keeps its contents in memory. */
++ (NuOutputBuffer *) buffer;
+/*! Create a buffer that writes its contents to a file descriptor, which it doesn't close. */
++ (NuOutputBuffer *) bufferWithFileDescriptor:(int) fileDescriptor;
+/*! Create a buffer that writes its contents to an output stream, opening it if necessary. */
++ (NuOutputBuffer *) bufferWithOutputStream:(NSOutputStream *) stream;
+/*! Initialize a buffer that keeps its contents in memory. */
+- (id) init;
+/*! Initialize a buffer that writes its contents to a file descriptor. */
+- (id) initWithFileDescriptor:(int) fileDescriptor;
+/*! Initialize a buffer that writes its contents to an output stream. */
+- (id) initWithOutputStream:(NSOutputStream *) stream;
+/*! Append the UTF-8 encoding of a string, or of the string value of another object. Nil and null are ignored. */
+- (void) appendString:(id) string;
+/*! Append bytes. */
+- (void) appendBytes:(const void *) bytes length:(NSUInteger) length;
+/*! Append the bytes of a data object. */
+- (void) appendData:(NSData *) data;
+/*! Write the buffered bytes to the buffer's file descriptor or stream. Raises an exception if they can't be written. */
+- (void) flush;
+/*! Get the number of bytes that have been appended. */
+- (unsigned long long) length;
+/*! Get the number of bytes that are collected before they are written out. The default is 64 KB. */
+- (NSUInteger) chunkSize;
+/*! Set the number of bytes that are collected before they are written out. */
+- (void) setChunkSize:(NSUInteger) chunkSize;
+/*! Get the bytes that are in the buffer. */
+- (NSData *) data;
+/*! Get the text that is in the buffer. */
+- (NSString *) stringValue;
+
+@end
+
+// Append bytes to an output buffer. This is what appendBytes:length: does, without sending a message.
+void nu_output_append_bytes(NuOutputBuffer *buffer, const void *bytes, NSUInteger length);
+
+// Append the UTF-8 encoding of a string to an output buffer.
+void nu_output_append_string(NuOutputBuffer *buffer, NSString *string);
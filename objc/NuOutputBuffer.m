@@ -0,0 +1,235 @@
+//
+//  NuOutputBuffer.m
+//  Nu
+//
+//  Append-only buffers for generated text.
+//
+
+#import "NuOutputBuffer.h"
+#import "NuInternals.h"
+
+#import <errno.h>
+#import <string.h>
+#import <unistd.h>
+
+#define NU_OUTPUT_CHUNK_SIZE 65536
+
+@interface NuOutputBuffer ()
+{
+    uint8_t *bytes;
+    NSUInteger used;
+    NSUInteger capacity;
+    NSUInteger chunkSize;
+    bool keepsContents;             // true for buffers without a file descriptor or stream
+    int fileDescriptor;
+    NSOutputStream *stream;
+    unsigned long long total;
+}
+@end
+
+@implementation NuOutputBuffer
+
++ (NuOutputBuffer *) buffer
+{
+    return [[[self alloc] init] autorelease];
+}
+
++ (NuOutputBuffer *) bufferWithFileDescriptor:(int) fd
+{
+    return [[[self alloc] initWithFileDescriptor:fd] autorelease];
+}
+
++ (NuOutputBuffer *) bufferWithOutputStream:(NSOutputStream *) s
+{
+    return [[[self alloc] initWithOutputStream:s] autorelease];
+}
+
+- (id) init
+{
+    if ((self = [super init])) {
+        keepsContents = true;
+        fileDescriptor = -1;
+        chunkSize = NU_OUTPUT_CHUNK_SIZE;
+        capacity = 1024;
+        bytes = (uint8_t *) malloc(capacity);
+    }
+    return self;
+}
+
+- (id) initWithFileDescriptor:(int) fd
+{
+    if ((self = [super init])) {
+        fileDescriptor = fd;
+        chunkSize = NU_OUTPUT_CHUNK_SIZE;
+        capacity = chunkSize;
+        bytes = (uint8_t *) malloc(capacity);
+    }
+    return self;
+}
+
+- (id) initWithOutputStream:(NSOutputStream *) s
+{
+    if ((self = [super init])) {
+        fileDescriptor = -1;
+        stream = [s retain];
+        if ([stream streamStatus] == NSStreamStatusNotOpen)
+            [stream open];
+        chunkSize = NU_OUTPUT_CHUNK_SIZE;
+        capacity = chunkSize;
+        bytes = (uint8_t *) malloc(capacity);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    if (!keepsContents && used) {
+        // there's no one to report an error to
+        @try {
+            [self flush];
+        }
+        @catch (id exception) {
+        }
+    }
+    [stream release];
+    free(bytes);
+    [super dealloc];
+}
+
+// Write bytes to the buffer's file descriptor or stream.
+static void nu_output_write(NuOutputBuffer *buffer, const uint8_t *data, NSUInteger length)
+{
+    while (length > 0) {
+        if (buffer->stream) {
+            NSInteger written = [buffer->stream write:data maxLength:length];
+            if (written <= 0)
+                [NSException raise:@"NuOutputError" format:@"can't write to stream: %@", [buffer->stream streamError]];
+            data += written;
+            length -= written;
+        }
+        else {
+            ssize_t written = write(buffer->fileDescriptor, data, length);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                [NSException raise:@"NuOutputError" format:@"can't write to file descriptor %d: %s",
+                 buffer->fileDescriptor, strerror(errno)];
+            }
+            data += written;
+            length -= written;
+        }
+    }
+}
+
+// Make room for length more bytes, writing out the buffered bytes if necessary.
+// Returns false if the bytes won't fit in a chunk and should be written directly.
+static bool nu_output_reserve(NuOutputBuffer *buffer, NSUInteger length)
+{
+    if (buffer->used + length <= buffer->capacity)
+        return true;
+    if (buffer->keepsContents) {
+        NSUInteger newCapacity = 2 * buffer->capacity;
+        if (newCapacity < buffer->used + length)
+            newCapacity = buffer->used + length;
+        buffer->bytes = (uint8_t *) realloc(buffer->bytes, newCapacity);
+        buffer->capacity = newCapacity;
+        return true;
+    }
+    [buffer flush];
+    return (length <= buffer->capacity);
+}
+
+void nu_output_append_bytes(NuOutputBuffer *buffer, const void *data, NSUInteger length)
+{
+    if (!nu_output_reserve(buffer, length)) {
+        nu_output_write(buffer, (const uint8_t *) data, length);
+        buffer->total += length;
+        return;
+    }
+    memcpy(buffer->bytes + buffer->used, data, length);
+    buffer->used += length;
+    buffer->total += length;
+}
+
+void nu_output_append_string(NuOutputBuffer *buffer, NSString *string)
+{
+    NSUInteger length = [string length];
+    if (length == 0)
+        return;
+    // a UTF-16 code unit never takes more than three bytes of UTF-8
+    if (nu_output_reserve(buffer, 3 * length)) {
+        NSUInteger written = 0;
+        NSRange remaining = NSMakeRange(0, 0);
+        [string getBytes:buffer->bytes + buffer->used maxLength:buffer->capacity - buffer->used usedLength:&written
+                encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, length) remainingRange:&remaining];
+        buffer->used += written;
+        buffer->total += written;
+        if (remaining.length == 0)
+            return;
+        string = [string substringWithRange:remaining];
+    }
+    NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
+    nu_output_append_bytes(buffer, [data bytes], [data length]);
+}
+
+- (void) appendString:(id) string
+{
+    if (!string || (string == Nu__null))
+        return;
+    if (![string isKindOfClass:[NSString class]])
+        string = [string stringValue];
+    nu_output_append_string(self, string);
+}
+
+- (void) appendBytes:(const void *) data length:(NSUInteger) length
+{
+    nu_output_append_bytes(self, data, length);
+}
+
+- (void) appendData:(NSData *) data
+{
+    nu_output_append_bytes(self, [data bytes], [data length]);
+}
+
+- (void) flush
+{
+    if (keepsContents || (used == 0))
+        return;
+    NSUInteger length = used;
+    used = 0;
+    nu_output_write(self, bytes, length);
+}
+
+- (unsigned long long) length
+{
+    return total;
+}
+
+- (NSUInteger) chunkSize
+{
+    return chunkSize;
+}
+
+- (void) setChunkSize:(NSUInteger) size
+{
+    if (size == 0)
+        size = NU_OUTPUT_CHUNK_SIZE;
+    if (!keepsContents) {
+        [self flush];
+        bytes = (uint8_t *) realloc(bytes, size);
+        capacity = size;
+    }
+    chunkSize = size;
+}
+
+- (NSData *) data
+{
+    return [NSData dataWithBytes:bytes length:used];
+}
+
+- (NSString *) stringValue
+{
+    return [[[NSString alloc] initWithBytes:bytes length:used encoding:NSUTF8StringEncoding] autorelease];
+}
+
+@end
@@ -0,0 +1,67 @@
+//
+//  NuParallel.h
+//  Nu
+//
+//  Parallel evaluation of blocks over collections.
+//
+
+#import <Foundation/Foundation.h>
+
+/*!
+ @protocol NuTask
+ @abstract Work that can be submitted to the worker pool.
+ */
+@protocol NuTask
+/*! Do the work of the task. This is called on a pool thread, or on a thread that is waiting for other tasks, inside an autorelease pool of its own. */
+- (void) runTask;
+@end
+
+/*!
+ @class NuParallel
+ @abstract The worker pool used by the parallel collection methods and by futures.
+ @discussion <b>pmap:</b>, <b>pselect:</b>, <b>peach:</b> and <b>preduce:from:combine:</b> divide a collection
+ into ranges of consecutive elements and evaluate their block for the ranges on a pool of worker threads,
+ with one thread for each processor unless <b>setWorkerCount:</b> was called first. The calling thread works on ranges too.
+ Results are returned in the order of the collection.
+
+ Each call of the block gets its own evaluation context, as it does when it is called sequentially, but
+ variables of enclosing contexts are shared by all of the calls; assign to them only with a lock of your own.
+ If calls raise exceptions, the exception of the earliest element is raised once all workers have stopped.
+ <b>break</b> (and <b>return</b>) stop the operation: later elements are not evaluated,
+ and only the results of the elements before the one that stopped are returned.
+ Elements near it may already have been evaluated by other workers.
+
+ Parallel operations that are started by a worker run sequentially on that worker.
+
+ Futures are queued as tasks. Each worker keeps the tasks it starts in a queue of its own and runs the newest of them first;
+ workers without tasks take the oldest tasks of other threads. Parallel operations take priority over tasks.
+ */
+@interface NuParallel : NSObject
+/*! Get the number of threads that work on parallel operations, including the calling thread. */
++ (NSUInteger) workerCount;
+/*! Set the number of threads that work on parallel operations, including the calling thread.
+ This must be called before the pool is first used; it raises an exception afterwards. Zero uses one thread for each processor. */
++ (void) setWorkerCount:(NSUInteger) count;
+@end
+
+// Call function for consecutive ranges of [0, count) on the worker pool and the calling thread,
+// returning when every range has been processed. Ranges start at multiples of grain and may be processed in any order.
+void nu_parallel_for(NSUInteger count, NSUInteger grain, void (*function)(void *info, NSUInteger start, NSUInteger end), void *info);
+
+// Queue a task to be run on the worker pool. The task is retained until it has run.
+void nu_parallel_submit(id<NuTask> task);
+
+// Run one queued task on the calling thread, if there is one. Returns true if a task was run.
+bool nu_parallel_help(void);
+
+// Returns true if the calling thread is one of the threads of the worker pool.
+bool nu_parallel_is_pool_thread(void);
+
+// Evaluate a callable with each item, or each item and its value if values is not nil, and store the retained
+// results in results if it is not NULL; results must be filled with nil. Returns the number of leading items that were evaluated before a break.
+NSUInteger nu_parallel_map(id callable, NSArray *items, NSArray *values, id *results);
+
+// Reduce consecutive ranges of items with a callable, which is called with the accumulated value and each item,
+// or each item and its value if values is not nil. Each range starts from initial, and the range results are
+// combined in order with combiner.
+id nu_parallel_reduce(id callable, NSArray *items, NSArray *values, id initial, id combiner);
@@ -0,0 +1,492 @@
+//
+//  NuParallel.m
+//  Nu
+//
+//  Parallel evaluation of blocks over collections.
+//
+
+#import "NuParallel.h"
+#import "NuInternals.h"
+#import "NuCell.h"
+
+#import <pthread.h>
+
+#pragma mark - Worker pool
+
+// A job is divided into ranges of grain elements, which threads claim in order.
+typedef struct nu_parallel_job {
+    NSUInteger count;
+    NSUInteger grain;
+    NSUInteger ranges;
+    NSUInteger next;                    // the next range to claim
+    void (*function)(void *info, NSUInteger start, NSUInteger end);
+    void *info;
+    int workers;                        // pool threads working on the job; guarded by poolLock
+    struct nu_parallel_job *nextJob;    // the queue of jobs that have ranges to claim; guarded by poolLock
+} nu_parallel_job;
+
+// Tasks (such as futures) wait in deques. Each pool thread pushes the tasks it submits onto the bottom of its own
+// deque and takes its newest task from there; threads that run out of tasks steal the oldest tasks of other threads.
+// Tasks submitted by other threads wait in a deque of their own.
+typedef struct nu_task_deque {
+    pthread_mutex_t lock;
+    id *tasks;                          // retained
+    NSUInteger head;                    // the oldest task
+    NSUInteger count;
+    NSUInteger capacity;
+} nu_task_deque;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;      // signalled when a job or task is queued
+static pthread_cond_t poolIdle = PTHREAD_COND_INITIALIZER;      // signalled when a worker leaves a job
+static nu_parallel_job *queuedJobs = NULL;
+static NSUInteger poolThreads = 0;
+static NSUInteger requestedWorkers = 0;                          // zero for one worker for each processor
+static bool poolStarted = false;
+static nu_task_deque *deques = NULL;                             // one for each pool thread, then one for other threads
+static NSUInteger pendingTasks = 0;
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static __thread NSInteger poolThreadIndex = -1;
+
+static void nu_task_deque_push(nu_task_deque *deque, id task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        NSUInteger capacity = deque->capacity ? 2 * deque->capacity : 64;
+        id *tasks = (id *) malloc(capacity * sizeof(id));
+        for (NSUInteger i = 0; i < deque->count; i++)
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Take the newest task (if newest is true) or the oldest one.
+static id nu_task_deque_take(nu_task_deque *deque, bool newest)
+{
+    id task = nil;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count) {
+        if (newest) {
+            task = deque->tasks[(deque->head + deque->count - 1) % deque->capacity];
+        }
+        else {
+            task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// Take a task for a thread to run: its own newest, then the oldest submitted by other threads, then one stolen from another pool thread.
+static id nu_parallel_take_task(NSInteger index)
+{
+    if (!__atomic_load_n(&pendingTasks, __ATOMIC_ACQUIRE))
+        return nil;
+    id task = nil;
+    if (index >= 0)
+        task = nu_task_deque_take(&deques[index], true);
+    if (!task)
+        task = nu_task_deque_take(&deques[poolThreads], false);
+    for (NSUInteger i = 1; !task && (i <= poolThreads); i++) {
+        NSUInteger victim = ((index >= 0 ? index : 0) + i) % poolThreads;
+        if (victim != index)
+            task = nu_task_deque_take(&deques[victim], false);
+    }
+    if (task)
+        __atomic_sub_fetch(&pendingTasks, 1, __ATOMIC_ACQ_REL);
+    return task;
+}
+
+static void nu_parallel_run_task(id<NuTask> task)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    [task runTask];
+    [pool drain];
+    [task release];
+}
+
+// Process ranges of a job until every range has been claimed.
+static void nu_parallel_job_work(nu_parallel_job *job)
+{
+    NSUInteger range;
+    while ((range = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->ranges) {
+        NSUInteger start = range * job->grain;
+        NSUInteger end = MIN(start + job->grain, job->count);
+        job->function(job->info, start, end);
+    }
+}
+
+// Take a job off the queue once its ranges have been claimed. Must be called with poolLock held.
+static void nu_parallel_job_dequeue(nu_parallel_job *job)
+{
+    nu_parallel_job **cursor = &queuedJobs;
+    while (*cursor) {
+        if (*cursor == job) {
+            *cursor = job->nextJob;
+            return;
+        }
+        cursor = &(*cursor)->nextJob;
+    }
+}
+
+@interface NuParallelWorker : NSObject
+- (void) run:(NSNumber *) index;
+@end
+
+@implementation NuParallelWorker
+
+// Jobs of parallel collection methods come first, since their callers are waiting for them.
+- (void) run:(NSNumber *) index
+{
+    poolThreadIndex = [index integerValue];
+    pthread_mutex_lock(&poolLock);
+    while (1) {
+        while (!queuedJobs && !__atomic_load_n(&pendingTasks, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&poolWork, &poolLock);
+        nu_parallel_job *job = queuedJobs;
+        if (job)
+            job->workers++;
+        pthread_mutex_unlock(&poolLock);
+        if (job) {
+            NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+            nu_parallel_job_work(job);
+            [pool drain];
+            pthread_mutex_lock(&poolLock);
+            nu_parallel_job_dequeue(job);
+            job->workers--;
+            pthread_cond_broadcast(&poolIdle);
+        }
+        else {
+            id task = nu_parallel_take_task(poolThreadIndex);
+            if (task)
+                nu_parallel_run_task(task);
+            pthread_mutex_lock(&poolLock);
+        }
+    }
+}
+
+@end
+
+static void nu_parallel_start_workers(void)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    pthread_mutex_lock(&poolLock);
+    NSUInteger workers = requestedWorkers;
+    if (!workers)
+        workers = [[NSProcessInfo processInfo] activeProcessorCount];
+    // the thread that starts a job is one of its workers
+    poolThreads = (workers > 1) ? workers - 1 : 0;
+    deques = (nu_task_deque *) calloc(poolThreads + 1, sizeof(nu_task_deque));
+    for (NSUInteger i = 0; i <= poolThreads; i++)
+        pthread_mutex_init(&deques[i].lock, NULL);
+    poolStarted = true;
+    pthread_mutex_unlock(&poolLock);
+    for (NSUInteger i = 0; i < poolThreads; i++) {
+        NuParallelWorker *worker = [[[NuParallelWorker alloc] init] autorelease];
+        [NSThread detachNewThreadSelector:@selector(run:) toTarget:worker withObject:[NSNumber numberWithUnsignedInteger:i]];
+    }
+    [pool drain];
+}
+
+void nu_parallel_submit(id<NuTask> task)
+{
+    pthread_once(&poolOnce, nu_parallel_start_workers);
+    NSInteger index = poolThreadIndex;
+    nu_task_deque_push(&deques[(index >= 0) ? index : poolThreads], [task retain]);
+    __atomic_add_fetch(&pendingTasks, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&poolLock);
+    pthread_cond_signal(&poolWork);
+    pthread_mutex_unlock(&poolLock);
+}
+
+bool nu_parallel_help(void)
+{
+    pthread_once(&poolOnce, nu_parallel_start_workers);
+    id task = nu_parallel_take_task(poolThreadIndex);
+    if (!task)
+        return false;
+    nu_parallel_run_task(task);
+    return true;
+}
+
+bool nu_parallel_is_pool_thread(void)
+{
+    return poolThreadIndex >= 0;
+}
+
+void nu_parallel_for(NSUInteger count, NSUInteger grain, void (*function)(void *info, NSUInteger start, NSUInteger end), void *info)
+{
+    if (count == 0)
+        return;
+    pthread_once(&poolOnce, nu_parallel_start_workers);
+    nu_parallel_job job;
+    memset(&job, 0, sizeof(job));
+    job.count = count;
+    job.grain = (grain > 0) ? grain : 1;
+    job.ranges = (count + job.grain - 1) / job.grain;
+    job.function = function;
+    job.info = info;
+    if ((poolThreadIndex >= 0) || (poolThreads == 0) || (job.ranges == 1)) {
+        // workers don't wait for each other, so nested jobs run where they start
+        nu_parallel_job_work(&job);
+        return;
+    }
+    pthread_mutex_lock(&poolLock);
+    job.nextJob = queuedJobs;
+    queuedJobs = &job;
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolLock);
+
+    nu_parallel_job_work(&job);
+
+    pthread_mutex_lock(&poolLock);
+    nu_parallel_job_dequeue(&job);
+    while (job.workers > 0)
+        pthread_cond_wait(&poolIdle, &poolLock);
+    pthread_mutex_unlock(&poolLock);
+}
+
+#pragma mark - Evaluation
+
+typedef struct nu_parallel_state {
+    id callable;
+    id *items;
+    id *values;             // the second argument of each call, or NULL
+    id *results;            // for maps, the result of each item
+    id initial;             // for reductions
+    id *partials;           // for reductions, the result of each range
+    NSUInteger grain;
+    NSUInteger limit;       // items at or after the limit are not evaluated
+    pthread_mutex_t lock;
+    NSUInteger exceptionIndex;
+    id exception;           // retained
+} nu_parallel_state;
+
+static NSUInteger nu_parallel_grain(NSUInteger count)
+{
+    pthread_once(&poolOnce, nu_parallel_start_workers);
+    // several ranges for each thread, so that threads that finish early can help the others
+    NSUInteger grain = count / ((poolThreads + 1) * 8);
+    return (grain > 0) ? grain : 1;
+}
+
+// Get the objects of an array in a buffer that is released with the current autorelease pool.
+static id *nu_parallel_objects(NSArray *array)
+{
+    if (!array)
+        return NULL;
+    NSUInteger count = [array count];
+    id *objects = (id *) [[NSMutableData dataWithLength:(count ? count : 1) * sizeof(id)] mutableBytes];
+    [array getObjects:objects range:NSMakeRange(0, count)];
+    return objects;
+}
+
+static void nu_parallel_state_init(nu_parallel_state *state, id callable, NSArray *items, NSArray *values)
+{
+    memset(state, 0, sizeof(nu_parallel_state));
+    state->callable = callable;
+    state->items = nu_parallel_objects(items);
+    state->values = nu_parallel_objects(values);
+    state->limit = [items count];
+    state->grain = nu_parallel_grain([items count]);
+    pthread_mutex_init(&state->lock, NULL);
+}
+
+// Stop evaluating items at or after index.
+static void nu_parallel_stop_at(nu_parallel_state *state, NSUInteger index)
+{
+    NSUInteger limit = __atomic_load_n(&state->limit, __ATOMIC_RELAXED);
+    while ((index < limit)
+           && !__atomic_compare_exchange_n(&state->limit, &limit, index, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Keep the exception of the earliest item, which is the one that a sequential evaluation would have raised.
+static void nu_parallel_fail_at(nu_parallel_state *state, NSUInteger index, id exception)
+{
+    pthread_mutex_lock(&state->lock);
+    if (!state->exception || (index < state->exceptionIndex)) {
+        [exception retain];
+        [state->exception release];
+        state->exception = exception;
+        state->exceptionIndex = index;
+    }
+    pthread_mutex_unlock(&state->lock);
+    nu_parallel_stop_at(state, index);
+}
+
+// Returns true if the call that just returned left a signal that stops the operation.
+// Continue only ends its own call, and return can't leave a block on another thread, so it acts like break.
+static bool nu_parallel_take_break(void)
+{
+    if (nu_control.signal == NuControlSignalNone)
+        return false;
+    bool stop = (nu_control.signal != NuControlSignalContinue);
+    nu_clear_control_signal();
+    return stop;
+}
+
+// Evaluate the callable for the item at index. Returns false if the operation should stop.
+static bool nu_parallel_call(nu_parallel_state *state, id args, NSUInteger index, id *result)
+{
+    *result = Nu__null;
+    @try {
+        *result = [state->callable evalWithArguments:args context:nil];
+    }
+    @catch (id exception) {
+        if (!nu_control_signal_from_exception(exception)) {
+            nu_parallel_fail_at(state, index, exception);
+            return false;
+        }
+    }
+    if (nu_parallel_take_break()) {
+        nu_parallel_stop_at(state, index);
+        return false;
+    }
+    return true;
+}
+
+static inline bool nu_parallel_should_evaluate(nu_parallel_state *state, NSUInteger index)
+{
+    return index < __atomic_load_n(&state->limit, __ATOMIC_RELAXED);
+}
+
+static void nu_parallel_map_range(void *info, NSUInteger start, NSUInteger end)
+{
+    nu_parallel_state *state = (nu_parallel_state *) info;
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    // each thread has its own argument list
+    NuCell *args = [[NuCell alloc] init];
+    if (state->values)
+        [args setCdr:[[[NuCell alloc] init] autorelease]];
+    for (NSUInteger i = start; (i < end) && nu_parallel_should_evaluate(state, i); i++) {
+        [args setCar:state->items[i]];
+        if (state->values)
+            [[args cdr] setCar:state->values[i]];
+        id result;
+        if (!nu_parallel_call(state, args, i, &result))
+            break;
+        if (state->results)
+            state->results[i] = [result retain];
+    }
+    [args release];
+    [pool drain];
+}
+
+static void nu_parallel_reduce_range(void *info, NSUInteger start, NSUInteger end)
+{
+    nu_parallel_state *state = (nu_parallel_state *) info;
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NuCell *args = [[NuCell alloc] init];
+    [args setCdr:[[[NuCell alloc] init] autorelease]];
+    if (state->values)
+        [[args cdr] setCdr:[[[NuCell alloc] init] autorelease]];
+    id accumulator = state->initial;
+    for (NSUInteger i = start; (i < end) && nu_parallel_should_evaluate(state, i); i++) {
+        [args setCar:accumulator];
+        [[args cdr] setCar:state->items[i]];
+        if (state->values)
+            [[[args cdr] cdr] setCar:state->values[i]];
+        id result;
+        if (!nu_parallel_call(state, args, i, &result))
+            break;
+        accumulator = result;
+    }
+    state->partials[start / state->grain] = [accumulator retain];
+    [args release];
+    [pool drain];
+}
+
+// Release the state and raise the exception of the earliest item that raised one.
+static void nu_parallel_state_finish(nu_parallel_state *state)
+{
+    pthread_mutex_destroy(&state->lock);
+    if (state->exception) {
+        id exception = [state->exception autorelease];
+        state->exception = nil;
+        @throw exception;
+    }
+}
+
+NSUInteger nu_parallel_map(id callable, NSArray *items, NSArray *values, id *results)
+{
+    NSUInteger count = [items count];
+    nu_parallel_state state;
+    nu_parallel_state_init(&state, callable, items, values);
+    state.results = results;
+    nu_parallel_for(count, state.grain, nu_parallel_map_range, &state);
+    NSUInteger limit = state.limit;
+    if (results) {
+        // items after a break may have been evaluated by threads that hadn't seen it yet
+        for (NSUInteger i = state.exception ? 0 : limit; i < count; i++) {
+            [results[i] release];
+            results[i] = nil;
+        }
+    }
+    nu_parallel_state_finish(&state);
+    return limit;
+}
+
+id nu_parallel_reduce(id callable, NSArray *items, NSArray *values, id initial, id combiner)
+{
+    NSUInteger count = [items count];
+    nu_parallel_state state;
+    nu_parallel_state_init(&state, callable, items, values);
+    state.initial = initial;
+    NSUInteger ranges = (count + state.grain - 1) / state.grain;
+    state.partials = (id *) [[NSMutableData dataWithLength:(ranges ? ranges : 1) * sizeof(id)] mutableBytes];
+    nu_parallel_for(count, state.grain, nu_parallel_reduce_range, &state);
+
+    // the ranges before the limit were reduced completely, and the range that holds it up to the limit
+    id result = initial;
+    @try {
+        nu_parallel_state_finish(&state);
+        NuCell *args = [[[NuCell alloc] init] autorelease];
+        [args setCdr:[[[NuCell alloc] init] autorelease]];
+        for (NSUInteger range = 0; (range < ranges) && (range * state.grain < state.limit); range++) {
+            if (range == 0) {
+                result = state.partials[0];
+            }
+            else {
+                [args setCar:result];
+                [[args cdr] setCar:state.partials[range]];
+                result = [combiner evalWithArguments:args context:nil];
+            }
+        }
+        [[result retain] autorelease];
+    }
+    @finally {
+        for (NSUInteger range = 0; range < ranges; range++)
+            [state.partials[range] release];
+    }
+    return result;
+}
+
+@implementation NuParallel
+
++ (NSUInteger) workerCount
+{
+    pthread_once(&poolOnce, nu_parallel_start_workers);
+    return poolThreads + 1;
+}
+
++ (void) setWorkerCount:(NSUInteger) count
+{
+    pthread_mutex_lock(&poolLock);
+    bool started = poolStarted;
+    if (!started)
+        requestedWorkers = count;
+    pthread_mutex_unlock(&poolLock);
+    if (started)
+        [NSException raise:@"NuParallelError" format:@"the worker pool has already started with %lu workers",
+         (unsigned long) (poolThreads + 1)];
+}
+
+@end
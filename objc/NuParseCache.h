@@ -0,0 +1,44 @@
+//
+//  NuParseCache.h
+//  Nu
+//
+//  Cached parse trees for Nu source files.
+//
+
+#import <Foundation/Foundation.h>
+
+@class NuParser;
+
+/*!
+ @class NuParseCache
+ @abstract A cache of parsed Nu source files.
+ @discussion When a cache directory is set, files that are loaded with <b>load</b>, from bundles,
+ or as scripts by <b>nush</b> are parsed once and their parse trees are written to the directory
+ in a compact binary form. Later loads of an unchanged file read the tree back instead of parsing the source.
+
+ A cached tree is used only if the file's path, modification time and size and the version of Nu all
+ match the ones it was written for. Trees keep their symbols, numbers, strings, regular expressions,
+ comments and source locations.
+
+ The cache directory is initially the value of the <b>NU_PARSE_CACHE</b> environment variable;
+ when that isn't set, files are always parsed.
+ */
+@interface NuParseCache : NSObject
+
+/*! Set the directory that parse trees are kept in, creating it if necessary. Setting nil disables the cache. */
++ (void) setCacheDirectory:(NSString *)directory;
+/*! Get the directory that parse trees are kept in, or nil if the cache is disabled. */
++ (NSString *) cacheDirectory;
+/*! Parse the contents of a file with a parser, using a cached tree when there is a valid one.
+ Returns nil if the file can't be read. */
++ (id) parseContentsOfFile:(NSString *)path withParser:(NuParser *)parser;
+/*! Remove every cached tree from the cache directory. */
++ (void) removeAllCachedTrees;
+/*! Get counts of the trees that were read from the cache (<b>hits</b>), parsed (<b>misses</b>) and written (<b>writes</b>). */
++ (NSDictionary *) statistics;
+/*! Encode a parse tree in the cache's binary form. Returns nil if the tree contains values that can't be encoded. */
++ (NSData *) dataWithParseTree:(id)tree;
+/*! Decode a parse tree from the cache's binary form. Returns nil if the data is malformed. */
++ (id) parseTreeWithData:(NSData *)data;
+
+@end
@@ -0,0 +1,639 @@
+//
+//  NuParseCache.m
+//  Nu
+//
+//  Cached parse trees for Nu source files.
+//
+
+#import "NuParseCache.h"
+#import "NuParser.h"
+#import "NuCell.h"
+#import "NuSymbol.h"
+#import "NuInternals.h"
+#import "NSString+Nu.h"
+#import "NuRegex.h"
+#include <sys/stat.h>
+
+// A cached tree is a header followed by the tree's symbols, the names of the files that its
+// cells were parsed from, and the tree itself. Integers are written as base-128 varints,
+// strings as a length and UTF-8 bytes, and lists as a count of cells, each cell's
+// location and car, and the list's terminating cdr. Values are tagged with a byte.
+//
+// The header holds the path, modification time and size of the source file and the version of Nu;
+// a tree is only read back when all of them match.
+
+#define NU_PARSE_CACHE_MAGIC    0x4e755054          // "NuPT", also detects trees written with another byte order
+#define NU_PARSE_CACHE_FORMAT   1
+#define NU_PARSE_CACHE_SUFFIX   @"nutree"
+
+enum {
+    NU_TREE_NULL,
+    NU_TREE_NIL,
+    NU_TREE_LIST,
+    NU_TREE_SYMBOL,
+    NU_TREE_STRING,
+    NU_TREE_INTEGER,
+    NU_TREE_DOUBLE,
+    NU_TREE_REGEX
+};
+
+// Cell flags
+#define NU_TREE_CELL_COMMENTS 1
+
+// File references: cells with no file, cells from the file being loaded, and cells from other files.
+#define NU_TREE_NO_FILE     0
+#define NU_TREE_LOADED_FILE 1
+#define NU_TREE_FIRST_FILE  2
+
+static NSString *cacheDirectory = nil;
+static unsigned long cacheHits = 0;
+static unsigned long cacheMisses = 0;
+static unsigned long cacheWrites = 0;
+
+#pragma mark - Writing
+
+typedef struct nu_tree_writer {
+    NSMutableData *data;
+    NSMutableDictionary *symbols;                 // symbol -> index
+    NSMutableArray *symbolNames;
+    NSMutableDictionary *files;                   // file number -> reference
+    NSMutableArray *fileNames;
+    const char *loadedFilename;
+} nu_tree_writer;
+
+static void nu_tree_write_byte(NSMutableData *data, uint8_t byte)
+{
+    [data appendBytes:&byte length:1];
+}
+
+static void nu_tree_write_varint(NSMutableData *data, uint64_t value)
+{
+    uint8_t buffer[10];
+    int count = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        buffer[count++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    [data appendBytes:buffer length:count];
+}
+
+static void nu_tree_write_signed(NSMutableData *data, int64_t value)
+{
+    nu_tree_write_varint(data, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static BOOL nu_tree_write_string(NSMutableData *data, NSString *string)
+{
+    NSData *bytes = [string dataUsingEncoding:NSUTF8StringEncoding];
+    if (!bytes)
+        return NO;
+    nu_tree_write_varint(data, [bytes length]);
+    [data appendData:bytes];
+    return YES;
+}
+
+static uint64_t nu_tree_file_reference(nu_tree_writer *writer, int file)
+{
+    if (file == -1)
+        return NU_TREE_NO_FILE;
+    NSNumber *key = [NSNumber numberWithInt:file];
+    NSNumber *reference = [writer->files objectForKey:key];
+    if (!reference) {
+        const char *name = nu_parsedFilename(file);
+        if (!name)
+            name = "";
+        if (writer->loadedFilename && !strcmp(name, writer->loadedFilename)) {
+            reference = [NSNumber numberWithUnsignedInteger:NU_TREE_LOADED_FILE];
+        }
+        else {
+            [writer->fileNames addObject:[NSString stringWithCString:name encoding:NSUTF8StringEncoding]];
+            reference = [NSNumber numberWithUnsignedInteger:NU_TREE_FIRST_FILE + [writer->fileNames count] - 1];
+        }
+        [writer->files setObject:reference forKey:key];
+    }
+    return [reference unsignedLongLongValue];
+}
+
+static BOOL nu_tree_write_value(nu_tree_writer *writer, id value)
+{
+    NSMutableData *data = writer->data;
+    if (value == nil) {
+        nu_tree_write_byte(data, NU_TREE_NIL);
+    }
+    else if (value == Nu__null) {
+        nu_tree_write_byte(data, NU_TREE_NULL);
+    }
+    else if (nu_objectIsKindOfClass(value, [NuCell class])) {
+        NSUInteger count = 0;
+        id cursor = value;
+        while (nu_objectIsKindOfClass(cursor, [NuCell class])) {
+            count++;
+            cursor = [cursor cdr];
+        }
+        nu_tree_write_byte(data, NU_TREE_LIST);
+        nu_tree_write_varint(data, count);
+        for (cursor = value; count > 0; count--, cursor = [cursor cdr]) {
+            Class cellClass = [cursor class];
+            if (cellClass == [NuCellWithComments class]) {
+                nu_tree_write_byte(data, NU_TREE_CELL_COMMENTS);
+                if (!nu_tree_write_value(writer, [cursor comments]))
+                    return NO;
+            }
+            else if (cellClass == [NuCell class]) {
+                nu_tree_write_byte(data, 0);
+            }
+            else {
+                return NO;
+            }
+            nu_tree_write_varint(data, nu_tree_file_reference(writer, [cursor file]));
+            nu_tree_write_signed(data, [cursor line]);
+            if (!nu_tree_write_value(writer, [cursor car]))
+                return NO;
+        }
+        return nu_tree_write_value(writer, cursor);
+    }
+    else if (nu_objectIsKindOfClass(value, [NuSymbol class])) {
+        NSNumber *index = [writer->symbols objectForKey:value];
+        if (!index) {
+            index = [NSNumber numberWithUnsignedInteger:[writer->symbolNames count]];
+            [writer->symbolNames addObject:[value stringValue]];
+            [writer->symbols setObject:index forKey:value];
+        }
+        nu_tree_write_byte(data, NU_TREE_SYMBOL);
+        nu_tree_write_varint(data, [index unsignedLongLongValue]);
+    }
+    else if (nu_objectIsKindOfClass(value, [NSString class])) {
+        nu_tree_write_byte(data, NU_TREE_STRING);
+        return nu_tree_write_string(data, value);
+    }
+    else if (nu_objectIsKindOfClass(value, [NSNumber class])) {
+        char type = [value objCType][0];
+        switch (type) {
+            case 'c': case 'C': case 's': case 'S': case 'i': case 'I':
+            case 'l': case 'L': case 'q':
+                nu_tree_write_byte(data, NU_TREE_INTEGER);
+                nu_tree_write_byte(data, type);
+                nu_tree_write_signed(data, [value longLongValue]);
+                break;
+            case 'd':
+            {
+                double d = [value doubleValue];
+                nu_tree_write_byte(data, NU_TREE_DOUBLE);
+                [data appendBytes:&d length:sizeof(double)];
+                break;
+            }
+            default:
+                return NO;
+        }
+    }
+    else if (nu_objectIsKindOfClass(value, [NSRegularExpression class])) {
+        nu_tree_write_byte(data, NU_TREE_REGEX);
+        nu_tree_write_varint(data, [value options]);
+        return nu_tree_write_string(data, [value pattern]);
+    }
+    else {
+        return NO;
+    }
+    return YES;
+}
+
+// Encode a tree, leaving the file number of the file being loaded (if any) to be supplied when it is read.
+static NSData *nu_tree_data(id tree, const char *loadedFilename)
+{
+    nu_tree_writer writer;
+    writer.data = [NSMutableData data];
+    writer.symbols = [NSMutableDictionary dictionary];
+    writer.symbolNames = [NSMutableArray array];
+    writer.files = [NSMutableDictionary dictionary];
+    writer.fileNames = [NSMutableArray array];
+    writer.loadedFilename = loadedFilename;
+    if (!nu_tree_write_value(&writer, tree))
+        return nil;
+
+    NSMutableData *data = [NSMutableData dataWithCapacity:[writer.data length] + 16 * [writer.symbolNames count]];
+    nu_tree_write_varint(data, [writer.symbolNames count]);
+    for (NSString *name in writer.symbolNames) {
+        if (!nu_tree_write_string(data, name))
+            return nil;
+    }
+    nu_tree_write_varint(data, [writer.fileNames count]);
+    for (NSString *name in writer.fileNames) {
+        if (!nu_tree_write_string(data, name))
+            return nil;
+    }
+    [data appendData:writer.data];
+    return data;
+}
+
+#pragma mark - Reading
+
+typedef struct nu_tree_reader {
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger offset;
+    BOOL failed;
+    NuSymbol **symbols;
+    uint64_t symbolCount;
+    int *files;
+    uint64_t fileCount;
+} nu_tree_reader;
+
+static uint8_t nu_tree_read_byte(nu_tree_reader *reader)
+{
+    if (reader->offset >= reader->length) {
+        reader->failed = YES;
+        return 0;
+    }
+    return reader->bytes[reader->offset++];
+}
+
+static uint64_t nu_tree_read_varint(nu_tree_reader *reader)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (shift < 64) {
+        uint8_t byte = nu_tree_read_byte(reader);
+        value |= ((uint64_t) (byte & 0x7f)) << shift;
+        if (!(byte & 0x80))
+            return value;
+        shift += 7;
+    }
+    reader->failed = YES;
+    return 0;
+}
+
+static int64_t nu_tree_read_signed(nu_tree_reader *reader)
+{
+    uint64_t value = nu_tree_read_varint(reader);
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// Returns a retained string, or nil if the data is malformed.
+static id nu_tree_read_string(nu_tree_reader *reader, Class stringClass)
+{
+    uint64_t length = nu_tree_read_varint(reader);
+    if (reader->failed || (length > reader->length - reader->offset)) {
+        reader->failed = YES;
+        return nil;
+    }
+    id string = [[stringClass alloc] initWithBytes:reader->bytes + reader->offset length:(NSUInteger) length encoding:NSUTF8StringEncoding];
+    reader->offset += (NSUInteger) length;
+    if (!string)
+        reader->failed = YES;
+    return string;
+}
+
+// Returns a retained value. Check reader->failed to distinguish a nil value from malformed data.
+static id nu_tree_read_value(nu_tree_reader *reader)
+{
+    uint8_t tag = nu_tree_read_byte(reader);
+    if (reader->failed)
+        return nil;
+    switch (tag) {
+        case NU_TREE_NULL:
+            return [Nu__null retain];
+        case NU_TREE_NIL:
+            return nil;
+        case NU_TREE_LIST:
+        {
+            uint64_t count = nu_tree_read_varint(reader);
+            if (reader->failed || (count == 0)) {
+                reader->failed = YES;
+                return nil;
+            }
+            NuCell *head = nil;
+            NuCell *tail = nil;
+            for (; count > 0; count--) {
+                uint8_t flags = nu_tree_read_byte(reader);
+                NuCell *cell;
+                if (flags & NU_TREE_CELL_COMMENTS) {
+                    id comments = nu_tree_read_value(reader);
+                    cell = [[NuCellWithComments alloc] init];
+                    [(NuCellWithComments *) cell setComments:comments];
+                    [comments release];
+                }
+                else {
+                    cell = [[NuCell alloc] init];
+                }
+                if (head) {
+                    [tail setCdr:cell];
+                    [cell release];
+                }
+                else {
+                    head = cell;
+                }
+                tail = cell;
+                uint64_t file = nu_tree_read_varint(reader);
+                int64_t line = nu_tree_read_signed(reader);
+                if (reader->failed || (file >= reader->fileCount)) {
+                    reader->failed = YES;
+                    break;
+                }
+                [cell setFile:reader->files[file] line:(int) line];
+                id car = nu_tree_read_value(reader);
+                [cell setCar:car];
+                [car release];
+                if (reader->failed)
+                    break;
+            }
+            if (!reader->failed) {
+                id cdr = nu_tree_read_value(reader);
+                [tail setCdr:cdr];
+                [cdr release];
+            }
+            if (reader->failed) {
+                [head release];
+                return nil;
+            }
+            return head;
+        }
+        case NU_TREE_SYMBOL:
+        {
+            uint64_t index = nu_tree_read_varint(reader);
+            if (reader->failed || (index >= reader->symbolCount)) {
+                reader->failed = YES;
+                return nil;
+            }
+            return [reader->symbols[index] retain];
+        }
+        case NU_TREE_STRING:
+        {
+            // literals are read as the parser would have made them
+            NSString *string = nu_tree_read_string(reader, [NSString class]);
+            NSString *literal = nu_interpolated_string(string);
+            if (literal != string) {
+                [literal retain];
+                [string release];
+            }
+            return literal;
+        }
+        case NU_TREE_INTEGER:
+        {
+            uint8_t type = nu_tree_read_byte(reader);
+            int64_t value = nu_tree_read_signed(reader);
+            if (reader->failed)
+                return nil;
+            if (type == 'i')
+                return [[NSNumber alloc] initWithInt:(int) value];
+            return [nu_number_with_long((long) value) retain];
+        }
+        case NU_TREE_DOUBLE:
+        {
+            double d;
+            if (reader->length - reader->offset < sizeof(double)) {
+                reader->failed = YES;
+                return nil;
+            }
+            memcpy(&d, reader->bytes + reader->offset, sizeof(double));
+            reader->offset += sizeof(double);
+            return [[NSNumber alloc] initWithDouble:d];
+        }
+        case NU_TREE_REGEX:
+        {
+            uint64_t options = nu_tree_read_varint(reader);
+            NSString *pattern = nu_tree_read_string(reader, [NSString class]);
+            if (reader->failed)
+                return nil;
+            id regex = [nu_regex_cached(pattern, (NSUInteger) options) retain];
+            [pattern release];
+            return regex;
+        }
+        default:
+            reader->failed = YES;
+            return nil;
+    }
+}
+
+// Decode a tree whose cells from the file being loaded get the file number loadedFile.
+static id nu_tree_with_bytes(const uint8_t *bytes, NSUInteger length, NuSymbolTable *symbolTable, int loadedFile)
+{
+    nu_tree_reader reader = {bytes, length, 0, NO, NULL, 0, NULL, 0};
+    id tree = nil;
+
+    reader.symbolCount = nu_tree_read_varint(&reader);
+    if (reader.failed || (reader.symbolCount > length))
+        return nil;
+    reader.symbols = (NuSymbol **) malloc((size_t) (reader.symbolCount + 1) * sizeof(NuSymbol *));
+    uint64_t i;
+    for (i = 0; i < reader.symbolCount; i++) {
+        NSString *name = nu_tree_read_string(&reader, [NSString class]);
+        if (reader.failed)
+            goto done;
+        reader.symbols[i] = [symbolTable symbolWithString:name];
+        [name release];
+    }
+
+    uint64_t otherFiles = nu_tree_read_varint(&reader);
+    if (reader.failed || (otherFiles > length))
+        goto done;
+    reader.fileCount = NU_TREE_FIRST_FILE + otherFiles;
+    reader.files = (int *) malloc((size_t) reader.fileCount * sizeof(int));
+    reader.files[NU_TREE_NO_FILE] = -1;
+    reader.files[NU_TREE_LOADED_FILE] = loadedFile;
+    for (i = 0; i < otherFiles; i++) {
+        NSString *name = nu_tree_read_string(&reader, [NSString class]);
+        if (reader.failed)
+            goto done;
+        reader.files[NU_TREE_FIRST_FILE + i] = nu_parser_register_filename([name UTF8String]);
+        [name release];
+    }
+
+    tree = nu_tree_read_value(&reader);
+    if (reader.failed || (reader.offset != reader.length)) {
+        [tree release];
+        tree = nil;
+    }
+done:
+    free(reader.symbols);
+    free(reader.files);
+    return [tree autorelease];
+}
+
+#pragma mark - Cache files
+
+typedef struct nu_source_stamp {
+    int64_t seconds;
+    int64_t nanoseconds;
+    uint64_t size;
+} nu_source_stamp;
+
+static BOOL nu_source_stamp_for_path(NSString *path, nu_source_stamp *stamp)
+{
+    struct stat status;
+    if (stat([path fileSystemRepresentation], &status) != 0)
+        return NO;
+#ifdef DARWIN
+    stamp->seconds = status.st_mtimespec.tv_sec;
+    stamp->nanoseconds = status.st_mtimespec.tv_nsec;
+#else
+    stamp->seconds = status.st_mtim.tv_sec;
+    stamp->nanoseconds = status.st_mtim.tv_nsec;
+#endif
+    stamp->size = status.st_size;
+    return YES;
+}
+
+static NSString *nu_absolute_path(NSString *path)
+{
+    if (![path isAbsolutePath])
+        path = [[[NSFileManager defaultManager] currentDirectoryPath] stringByAppendingPathComponent:path];
+    return [path stringByStandardizingPath];
+}
+
+static NSString *nu_cache_path_for_source(NSString *directory, NSString *absolutePath)
+{
+    const char *bytes = [absolutePath UTF8String];
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *bytes; bytes++) {
+        hash = (hash ^ (uint8_t) *bytes) * 1099511628211ULL;
+    }
+    NSString *name = [NSString stringWithFormat:@"%016llx.%@", (unsigned long long) hash, NU_PARSE_CACHE_SUFFIX];
+    return [directory stringByAppendingPathComponent:name];
+}
+
+static void nu_write_cache_header(NSMutableData *data, NSString *absolutePath, nu_source_stamp stamp)
+{
+    uint32_t words[2] = {NU_PARSE_CACHE_MAGIC, NU_PARSE_CACHE_FORMAT};
+    [data appendBytes:words length:sizeof(words)];
+    nu_tree_write_string(data, @NU_VERSION);
+    nu_tree_write_signed(data, stamp.seconds);
+    nu_tree_write_signed(data, stamp.nanoseconds);
+    nu_tree_write_varint(data, stamp.size);
+    nu_tree_write_string(data, absolutePath);
+}
+
+// Check the header of a cached tree, returning the offset of the tree or 0 if it is stale.
+static NSUInteger nu_check_cache_header(NSData *data, NSString *absolutePath, nu_source_stamp stamp)
+{
+    nu_tree_reader reader = {[data bytes], [data length], 0, NO, NULL, 0, NULL, 0};
+    uint32_t words[2];
+    if (reader.length < sizeof(words))
+        return 0;
+    memcpy(words, reader.bytes, sizeof(words));
+    if ((words[0] != NU_PARSE_CACHE_MAGIC) || (words[1] != NU_PARSE_CACHE_FORMAT))
+        return 0;
+    reader.offset = sizeof(words);
+    NSString *version = nu_tree_read_string(&reader, [NSString class]);
+    int64_t seconds = nu_tree_read_signed(&reader);
+    int64_t nanoseconds = nu_tree_read_signed(&reader);
+    uint64_t size = nu_tree_read_varint(&reader);
+    NSString *path = nu_tree_read_string(&reader, [NSString class]);
+    BOOL valid = (!reader.failed
+                  && [version isEqualToString:@NU_VERSION]
+                  && (seconds == stamp.seconds)
+                  && (nanoseconds == stamp.nanoseconds)
+                  && (size == stamp.size)
+                  && [path isEqualToString:absolutePath]);
+    [version release];
+    [path release];
+    return valid ? reader.offset : 0;
+}
+
+@implementation NuParseCache
+
++ (void) initialize
+{
+    if (self == [NuParseCache class]) {
+        const char *setting = getenv("NU_PARSE_CACHE");
+        if (setting && (setting[0] != '\0')) {
+            [self setCacheDirectory:[NSString stringWithCString:setting encoding:NSUTF8StringEncoding]];
+        }
+    }
+}
+
++ (void) setCacheDirectory:(NSString *)directory
+{
+    if (directory) {
+        directory = [directory stringByExpandingTildeInPath];
+        [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    }
+    [directory retain];
+    [cacheDirectory release];
+    cacheDirectory = directory;
+}
+
++ (NSString *) cacheDirectory
+{
+    return cacheDirectory;
+}
+
++ (id) parseContentsOfFile:(NSString *)path withParser:(NuParser *)parser
+{
+    NSString *directory = [[cacheDirectory retain] autorelease];
+    NSString *absolutePath = nil;
+    NSString *cachePath = nil;
+    nu_source_stamp stamp;
+    if (directory) {
+        absolutePath = nu_absolute_path(path);
+        if (nu_source_stamp_for_path(absolutePath, &stamp)) {
+            cachePath = nu_cache_path_for_source(directory, absolutePath);
+            NSData *cached = [NSData dataWithContentsOfFile:cachePath options:NSDataReadingMappedIfSafe error:NULL];
+            NSUInteger offset = cached ? nu_check_cache_header(cached, absolutePath, stamp) : 0;
+            if (offset) {
+                int file = nu_parser_register_filename([path UTF8String]);
+                id tree = nu_tree_with_bytes((const uint8_t *) [cached bytes] + offset, [cached length] - offset,
+                                             [parser symbolTable], file);
+                if (tree) {
+                    __atomic_add_fetch(&cacheHits, 1, __ATOMIC_RELAXED);
+                    return tree;
+                }
+            }
+        }
+    }
+
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+    if (!data)
+        return nil;
+    id tree = [parser parseData:data asIfFromFilename:[path UTF8String]];
+    if (cachePath) {
+        __atomic_add_fetch(&cacheMisses, 1, __ATOMIC_RELAXED);
+        // incomplete files leave the parser waiting for more input and produce no tree to cache
+        if (nu_objectIsKindOfClass(tree, [NuCell class])) {
+            NSData *treeData = nu_tree_data(tree, [path UTF8String]);
+            if (treeData) {
+                NSMutableData *cacheData = [NSMutableData dataWithCapacity:[treeData length] + 64];
+                nu_write_cache_header(cacheData, absolutePath, stamp);
+                [cacheData appendData:treeData];
+                if ([cacheData writeToFile:cachePath atomically:YES])
+                    __atomic_add_fetch(&cacheWrites, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return tree;
+}
+
++ (void) removeAllCachedTrees
+{
+    NSString *directory = [[cacheDirectory retain] autorelease];
+    if (!directory)
+        return;
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *name in [fileManager contentsOfDirectoryAtPath:directory error:NULL]) {
+        if ([[name pathExtension] isEqualToString:NU_PARSE_CACHE_SUFFIX])
+            [fileManager removeItemAtPath:[directory stringByAppendingPathComponent:name] error:NULL];
+    }
+}
+
++ (NSDictionary *) statistics
+{
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+            [NSNumber numberWithUnsignedLong:__atomic_load_n(&cacheHits, __ATOMIC_RELAXED)], @"hits",
+            [NSNumber numberWithUnsignedLong:__atomic_load_n(&cacheMisses, __ATOMIC_RELAXED)], @"misses",
+            [NSNumber numberWithUnsignedLong:__atomic_load_n(&cacheWrites, __ATOMIC_RELAXED)], @"writes",
+            nil];
+}
+
++ (NSData *) dataWithParseTree:(id)tree
+{
+    return nu_tree_data(tree, NULL);
+}
+
++ (id) parseTreeWithData:(NSData *)data
+{
+    if (!data)
+        return nil;
+    return nu_tree_with_bytes([data bytes], [data length], [NuSymbolTable sharedSymbolTable], -1);
+}
+
+@end
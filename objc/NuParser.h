@@ -32,6 +32,13 @@
 - (id) parse:(NSString *)string;
 /*! Call -parse: while specifying the name of the source file for the string to be parsed. */
 - (id) parse:(NSString *)string asIfFromFilename:(const char *) filename;
+/*! Parse Nu source from a buffer of UTF-8 text, such as the contents of a mapped file.
+ Tokens are read directly from the bytes of the buffer, so this is the fastest way to parse a file. */
+- (id) parseUTF8Bytes:(const char *)bytes length:(NSUInteger)length;
+/*! Parse Nu source from data containing UTF-8 text. */
+- (id) parseData:(NSData *)data;
+/*! Call -parseData: while specifying the name of the source file for the data to be parsed. */
+- (id) parseData:(NSData *)data asIfFromFilename:(const char *) filename;
 /*! Evaluate a parsed Nu expression in the parser's evaluation context. */
 - (id) eval: (id) code;
 /*! Parse Nu source text and evaluate it in the parser's evalation context. */
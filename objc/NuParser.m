@@ -14,9 +14,11 @@
 #import "NSDictionary+Nu.h"
 #import "NuException.h"
 #import "NuCell.h"
+#import "NuRegex.h"
 #if !TARGET_OS_IPHONE
 #include <readline/readline.h>
 #endif
+#import <pthread.h>
 
 #define PARSE_NORMAL     0
 #define PARSE_COMMENT    1
@@ -26,7 +28,8 @@
 
 #define MAX_FILES 1024
 static char *filenames[MAX_FILES];
-static int filecount = 0;
+static int filecount = 0;          // published after its filename is stored; names are never changed
+static pthread_mutex_t filenamesLock = PTHREAD_MUTEX_INITIALIZER;
 
 // Turn debug output on and off for this file only
 //#define PARSER_DEBUG 1
@@ -42,6 +45,21 @@ const char *nu_parsedFilename(int i)
     return (i < 0) ? NULL: filenames[i];
 }
 
+int nu_parser_register_filename(const char *name)
+{
+    pthread_mutex_lock(&filenamesLock);
+    int filenum = filecount;
+    if (filenum < MAX_FILES) {
+        filenames[filenum] = strdup(name);
+        __atomic_store_n(&filecount, filenum + 1, __ATOMIC_RELEASE);
+    }
+    else {
+        filenum = -1;
+    }
+    pthread_mutex_unlock(&filenamesLock);
+    return filenum;
+}
+
 @interface NuParser(Internal)
 - (int) depth;
 - (int) parens;
@@ -61,25 +79,206 @@ const char *nu_parsedFilename(int i)
 - (int) interact;
 @end
 
-static id atomWithString(NSString *string, NuSymbolTable *symbolTable)
+// Tokens are accumulated as UTF-8 bytes and are only converted to objects when they are complete.
+typedef struct nu_token {
+    unsigned char *bytes;
+    NSUInteger length;
+    NSUInteger capacity;
+} nu_token;
+
+static void nu_token_reserve(nu_token *token, NSUInteger count)
+{
+    // leave room for a terminating NUL
+    if (token->length + count + 1 > token->capacity) {
+        NSUInteger capacity = token->capacity ? 2 * token->capacity : 256;
+        while (capacity < token->length + count + 1)
+            capacity *= 2;
+        token->bytes = (unsigned char *) realloc(token->bytes, capacity);
+        token->capacity = capacity;
+    }
+}
+
+static inline void nu_token_append_byte(nu_token *token, unsigned char c)
+{
+    nu_token_reserve(token, 1);
+    token->bytes[token->length++] = c;
+}
+
+static inline void nu_token_append_bytes(nu_token *token, const unsigned char *bytes, NSUInteger count)
 {
-    const char *cstring = [string UTF8String];
-    char *endptr;
-    // If the string can be converted to a long, it's an NSNumber.
-    long lvalue = strtol(cstring, &endptr, 0);
-    if (*endptr == 0) {
-        return [NSNumber numberWithLong:lvalue];
+    nu_token_reserve(token, count);
+    memcpy(token->bytes + token->length, bytes, count);
+    token->length += count;
+}
+
+// Append a character as UTF-8. Unpaired surrogates can't be encoded and are replaced with U+FFFD.
+static void nu_token_append_character(nu_token *token, uint32_t c)
+{
+    if ((c >= 0xD800) && (c <= 0xDFFF))
+        c = 0xFFFD;
+    if (c < 0x80) {
+        nu_token_append_byte(token, c);
     }
-    // If the string can be converted to a double, it's an NSNumber.
-    double dvalue = strtod(cstring, &endptr);
-    if (*endptr == 0) {
-        return [NSNumber numberWithDouble:dvalue];
+    else if (c < 0x800) {
+        nu_token_append_byte(token, 0xC0 | (c >> 6));
+        nu_token_append_byte(token, 0x80 | (c & 0x3F));
     }
-    // Otherwise, it's a symbol.
-    NuSymbol *symbol = [symbolTable symbolWithString:string];
+    else if (c < 0x10000) {
+        nu_token_append_byte(token, 0xE0 | (c >> 12));
+        nu_token_append_byte(token, 0x80 | ((c >> 6) & 0x3F));
+        nu_token_append_byte(token, 0x80 | (c & 0x3F));
+    }
+    else {
+        nu_token_append_byte(token, 0xF0 | (c >> 18));
+        nu_token_append_byte(token, 0x80 | ((c >> 12) & 0x3F));
+        nu_token_append_byte(token, 0x80 | ((c >> 6) & 0x3F));
+        nu_token_append_byte(token, 0x80 | (c & 0x3F));
+    }
+}
+
+static inline const char *nu_token_cstring(nu_token *token)
+{
+    nu_token_reserve(token, 0);
+    token->bytes[token->length] = 0;
+    return (const char *) token->bytes;
+}
+
+static NSString *nu_string_with_bytes(const unsigned char *bytes, NSUInteger length)
+{
+    if (length == 0) return @"";
+    NSString *string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+    if (!string) {
+        [NSException raise:@"NuParseError" format:@"invalid UTF-8 in source text"];
+    }
+    return [string autorelease];
+}
+
+static inline NSString *nu_token_string(nu_token *token)
+{
+    return nu_string_with_bytes(token->bytes, token->length);
+}
+
+// Decode the UTF-8 sequence that begins at bytes[i], returning 0xFFFFFFFF if it is malformed.
+static uint32_t nu_utf8_decode(const unsigned char *bytes, NSUInteger i, NSUInteger imax, NSUInteger *length)
+{
+    unsigned char c = bytes[i];
+    uint32_t value;
+    NSUInteger count;
+    if (c < 0x80) {
+        *length = 1;
+        return c;
+    }
+    else if ((c & 0xE0) == 0xC0) {
+        value = c & 0x1F;
+        count = 2;
+    }
+    else if ((c & 0xF0) == 0xE0) {
+        value = c & 0x0F;
+        count = 3;
+    }
+    else if ((c & 0xF8) == 0xF0) {
+        value = c & 0x07;
+        count = 4;
+    }
+    else {
+        return 0xFFFFFFFF;
+    }
+    if (i + count > imax) {
+        return 0xFFFFFFFF;
+    }
+    NSUInteger j;
+    for (j = 1; j < count; j++) {
+        if ((bytes[i+j] & 0xC0) != 0x80)
+            return 0xFFFFFFFF;
+        value = (value << 6) | (bytes[i+j] & 0x3F);
+    }
+    *length = count;
+    return value;
+}
+
+// Get the number of UTF-16 units contributed by a byte of UTF-8, so that columns are counted in characters.
+static inline int nu_utf8_width(unsigned char c)
+{
+    return ((c & 0xC0) == 0x80) ? 0 : ((c >= 0xF0) ? 2 : 1);
+}
+
+static int nu_utf8_run_width(const unsigned char *bytes, NSUInteger i, NSUInteger j)
+{
+    int width = 0;
+    for (; i < j; i++)
+        width += nu_utf8_width(bytes[i]);
+    return width;
+}
+
+#define NU_SYMBOL_CACHE_SIZE 1024
+
+// Parsers remember the symbols that they have recently read, so that most symbols are found without creating a string.
+// Symbols are never removed from their tables, so the cache doesn't retain them.
+typedef struct nu_symbol_cache_entry {
+    NSUInteger hash;
+    NSUInteger length;
+    unsigned char *bytes;
+    NuSymbol *symbol;
+} nu_symbol_cache_entry;
+
+static NuSymbol *nu_symbol_with_bytes(const unsigned char *bytes, NSUInteger length,
+                                      NuSymbolTable *symbolTable, nu_symbol_cache_entry *cache)
+{
+    NSUInteger hash = 2166136261u;
+    NSUInteger i;
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    nu_symbol_cache_entry *entry = &cache[hash & (NU_SYMBOL_CACHE_SIZE - 1)];
+    if (entry->symbol && (entry->hash == hash) && (entry->length == length) && !memcmp(entry->bytes, bytes, length)) {
+        return entry->symbol;
+    }
+    NuSymbol *symbol = [symbolTable symbolWithString:nu_string_with_bytes(bytes, length)];
+    entry->bytes = (unsigned char *) realloc(entry->bytes, length ? length : 1);
+    memcpy(entry->bytes, bytes, length);
+    entry->length = length;
+    entry->hash = hash;
+    entry->symbol = symbol;
     return symbol;
 }
 
+// Returns true if strtol() or strtod() might accept a token, which must begin
+// (after any whitespace and sign) with a digit, a decimal point, "inf" or "nan".
+static bool nu_token_may_be_number(nu_token *token)
+{
+    const unsigned char *bytes = token->bytes;
+    NSUInteger length = token->length;
+    NSUInteger i = 0;
+    while ((i < length) && isspace(bytes[i]))
+        i++;
+    if ((i < length) && ((bytes[i] == '+') || (bytes[i] == '-')))
+        i++;
+    if (i == length)
+        return false;
+    unsigned char c = bytes[i];
+    return ((c >= '0') && (c <= '9')) || (c == '.') || (c == 'i') || (c == 'I') || (c == 'n') || (c == 'N');
+}
+
+static id nu_atom_with_token(nu_token *token, NuSymbolTable *symbolTable, nu_symbol_cache_entry *cache)
+{
+    if (nu_token_may_be_number(token)) {
+        const char *cstring = nu_token_cstring(token);
+        char *endptr;
+        // If the string can be converted to a long, it's an NSNumber.
+        long lvalue = strtol(cstring, &endptr, 0);
+        if (*endptr == 0) {
+            return nu_number_with_long(lvalue);
+        }
+        // If the string can be converted to a double, it's an NSNumber.
+        double dvalue = strtod(cstring, &endptr);
+        if (*endptr == 0) {
+            return [NSNumber numberWithDouble:dvalue];
+        }
+    }
+    // Otherwise, it's a symbol.
+    return nu_symbol_with_bytes(token->bytes, token->length, symbolTable, cache);
+}
+
 static id regexWithString(NSString *string)
 {
     // If the first character of the string is a forward slash, it's a regular expression literal.
@@ -108,9 +307,7 @@ static id regexWithString(NSString *string)
             }
         }
         NSString *pattern = [string substringWithRange:NSMakeRange(1, lastSlash-1)];
-        return [NSRegularExpression regularExpressionWithPattern:pattern
-                                                         options:options
-                                                           error:NULL];
+        return nu_regex_cached(pattern, options);
     }
     else {
         return nil;
@@ -143,7 +340,8 @@ static id regexWithString(NSString *string)
     NuStack *opens;
     NuSymbolTable *symbolTable;
     NSMutableDictionary *context;
-    NSMutableString *partial;
+    nu_token token;
+    nu_symbol_cache_entry *symbolCache;
     NSMutableString *comments;
     NSString *pattern;                            // used for herestrings
 }
@@ -153,7 +351,7 @@ static id regexWithString(NSString *string)
 
 + (const char *) filename:(int)i
 {
-    if ((i < 0) || (i >= filecount))
+    if ((i < 0) || (i >= __atomic_load_n(&filecount, __ATOMIC_ACQUIRE)))
         return "";
     else
         return filenames[i];
@@ -164,9 +362,7 @@ static id regexWithString(NSString *string)
     if (name == NULL)
         filenum = -1;
     else {
-        filenames[filecount] = strdup(name);
-        filenum = filecount;
-        filecount++;
+        filenum = nu_parser_register_filename(name);
     }
     linenum = 1;
 }
@@ -232,7 +428,7 @@ static id regexWithString(NSString *string)
 - (void) reset
 {
     state = PARSE_NORMAL;
-    [partial setString:@""];
+    token.length = 0;
     depth = 0;
     parens = 0;
     
@@ -271,7 +467,7 @@ static id regexWithString(NSString *string)
         [context setPossiblyNullObject:self forKey:[symbolTable symbolWithString:@"_parser"]];
         [context setPossiblyNullObject:symbolTable forKey:SYMBOLS_KEY];
         
-        partial = [[NSMutableString alloc] initWithString:@""];
+        symbolCache = (nu_symbol_cache_entry *) calloc(NU_SYMBOL_CACHE_SIZE, sizeof(nu_symbol_cache_entry));
         
         [self reset];
     }
@@ -294,7 +490,12 @@ static id regexWithString(NSString *string)
     [comments release];
     [readerMacroStack release];
     [pattern release];
-    [partial release];
+    free(token.bytes);
+    int i;
+    for (i = 0; i < NU_SYMBOL_CACHE_SIZE; i++) {
+        free(symbolCache[i].bytes);
+    }
+    free(symbolCache);
     [super dealloc];
 }
 
@@ -315,14 +516,14 @@ static id regexWithString(NSString *string)
     
     NuCell *newCell;
     if (comments) {
-        NuCellWithComments *newCellWithComments = [[[NuCellWithComments alloc] init] autorelease];
+        NuCellWithComments *newCellWithComments = [[NuCellWithComments alloc] init];
         [newCellWithComments setComments:comments];
         newCell = newCellWithComments;
         [comments release];
         comments = nil;
     }
     else {
-        newCell = [[[NuCell alloc] init] autorelease];
+        newCell = [[NuCell alloc] init];
         [newCell setFile:filenum line:linenum];
     }
     if (addToCar) {
@@ -332,6 +533,8 @@ static id regexWithString(NSString *string)
     else {
         [current setCdr:newCell];
     }
+    // the list holds the new cell now
+    [newCell release];
     current = newCell;
     [current setCar:atom];
     addToCar = false;
@@ -342,7 +545,7 @@ static id regexWithString(NSString *string)
     ParserDebug(@"openListCell: depth = %d", depth);
     
     depth++;
-    NuCell *newCell = [[[NuCell alloc] init] autorelease];
+    NuCell *newCell = [[NuCell alloc] init];
     [newCell setFile:filenum line:linenum];
     if (addToCar) {
         [current setCar:newCell];
@@ -351,6 +554,7 @@ static id regexWithString(NSString *string)
     else {
         [current setCdr:newCell];
     }
+    [newCell release];
     current = newCell;
     
     addToCar = true;
@@ -494,53 +698,53 @@ static unichar nu_unicode_digits_to_unichar(unichar c1, unichar c2, unichar c3,
     return value;
 }
 
-static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUInteger imax, NSMutableString *partial)
+// Read the escape sequence that begins with the backslash at bytes[i].
+// The character it denotes is stored in *value and the index of its last byte is returned.
+static NSUInteger nu_parse_escape_sequence(const unsigned char *bytes, NSUInteger i, NSUInteger imax, uint32_t *value)
 {
     i++;
-    unichar c = [string characterAtIndex:i];
+    if (i >= imax) {
+        [NSException raise:@"NuParseError" format:@"incomplete escape sequence"];
+    }
+    unsigned char c = bytes[i];
     switch(c) {
-        case 'n': [partial appendCharacter:0x0a]; break;
-        case 'r': [partial appendCharacter:0x0d]; break;
-        case 'f': [partial appendCharacter:0x0c]; break;
-        case 't': [partial appendCharacter:0x09]; break;
-        case 'b': [partial appendCharacter:0x08]; break;
-        case 'a': [partial appendCharacter:0x07]; break;
-        case 'e': [partial appendCharacter:0x1b]; break;
-        case 's': [partial appendCharacter:0x20]; break;
+        case 'n': *value = 0x0a; break;
+        case 'r': *value = 0x0d; break;
+        case 'f': *value = 0x0c; break;
+        case 't': *value = 0x09; break;
+        case 'b': *value = 0x08; break;
+        case 'a': *value = 0x07; break;
+        case 'e': *value = 0x1b; break;
+        case 's': *value = 0x20; break;
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
         {
             // octal. expect two more digits (\nnn).
-            if (imax < i+2) {
+            if (i + 2 >= imax) {
                 [NSException raise:@"NuParseError" format:@"not enough characters for octal constant"];
             }
-            char c1 = [string characterAtIndex:++i];
-            char c2 = [string characterAtIndex:++i];
-            [partial appendCharacter:nu_octal_digits_to_unichar(c, c1, c2)];
+            *value = nu_octal_digits_to_unichar(c, bytes[i+1], bytes[i+2]);
+            i += 2;
             break;
         }
         case 'x':
         {
             // hex. expect two more digits (\xnn).
-            if (imax < i+2) {
+            if (i + 2 >= imax) {
                 [NSException raise:@"NuParseError" format:@"not enough characters for hex constant"];
             }
-            char c1 = [string characterAtIndex:++i];
-            char c2 = [string characterAtIndex:++i];
-            [partial appendCharacter:nu_hex_digits_to_unichar(c1, c2)];
+            *value = nu_hex_digits_to_unichar(bytes[i+1], bytes[i+2]);
+            i += 2;
             break;
         }
         case 'u':
         {
             // unicode. expect four more digits (\unnnn)
-            if (imax < i+4) {
+            if (i + 4 >= imax) {
                 [NSException raise:@"NuParseError" format:@"not enough characters for unicode constant"];
             }
-            char c1 = [string characterAtIndex:++i];
-            char c2 = [string characterAtIndex:++i];
-            char c3 = [string characterAtIndex:++i];
-            char c4 = [string characterAtIndex:++i];
-            [partial appendCharacter:nu_unicode_digits_to_unichar(c1, c2, c3, c4)];
+            *value = nu_unicode_digits_to_unichar(bytes[i+1], bytes[i+2], bytes[i+3], bytes[i+4]);
+            i += 4;
             break;
         }
         case 'c': case 'C':
@@ -552,7 +756,58 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
             // meta character. Unsupported, fall through to default.
         }
         default:
-            [partial appendCharacter:c];
+        {
+            NSUInteger length;
+            *value = nu_utf8_decode(bytes, i, imax, &length);
+            if (*value == 0xFFFFFFFF) {
+                [NSException raise:@"NuParseError" format:@"invalid UTF-8 in source text"];
+            }
+            i += length - 1;
+        }
+    }
+    return i;
+}
+
+// Append the character denoted by the escape sequence at bytes[i] to a token, returning the index of its last byte.
+// A \u escape of a high surrogate that is followed by one of a low surrogate is combined into a single character.
+static NSUInteger nu_parse_escape_sequences(const unsigned char *bytes, NSUInteger i, NSUInteger imax, nu_token *token)
+{
+    uint32_t value;
+    i = nu_parse_escape_sequence(bytes, i, imax, &value);
+    if ((value >= 0xD800) && (value <= 0xDBFF) && (i + 6 < imax) && (bytes[i+1] == '\\') && (bytes[i+2] == 'u')) {
+        uint32_t low;
+        NSUInteger j = nu_parse_escape_sequence(bytes, i+1, imax, &low);
+        if ((low >= 0xDC00) && (low <= 0xDFFF)) {
+            value = 0x10000 + ((value - 0xD800) << 10) + (low - 0xDC00);
+            i = j;
+        }
+    }
+    nu_token_append_character(token, value);
+    return i;
+}
+
+static inline bool nu_is_ascii_alnum(unsigned char c)
+{
+    return ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+
+// Bytes that end a run of ordinary symbol characters. Each is handled individually by the tokenizer.
+static const bool nu_token_breaks[256] = {
+    [0] = true, ['\t'] = true, ['\n'] = true, [' '] = true, ['('] = true, [')'] = true,
+    ['"'] = true, ['\''] = true, ['`'] = true, [','] = true, ['~'] = true, [';'] = true,
+    [':'] = true, ['/'] = true, ['<'] = true
+};
+
+// Get the end of the run of ordinary symbol characters that continues a token at bytes[i].
+static inline NSUInteger nu_token_run_end(const unsigned char *bytes, NSUInteger i, NSUInteger imax)
+{
+    while (i < imax) {
+        unsigned char c = bytes[i];
+        if (nu_token_breaks[c])
+            break;
+        if (((c == '-') || (c == '+')) && (i + 1 < imax) && (bytes[i+1] == '"'))
+            break;                                // this begins a string
+        i++;
     }
     return i;
 }
@@ -560,18 +815,32 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
 -(id) parse:(NSString*)string
 {
     if (!string) return Nu__null;            // don't crash, at least.
+    NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
+    return [self parseUTF8Bytes:(const char *) [data bytes] length:[data length]];
+}
+
+- (id) parseData:(NSData *)data
+{
+    if (!data) return Nu__null;
+    return [self parseUTF8Bytes:(const char *) [data bytes] length:[data length]];
+}
+
+- (id) parseUTF8Bytes:(const char *)source length:(NSUInteger)imax
+{
+    const unsigned char *bytes = (const unsigned char *) source;
     
     column = 0;
     if (state != PARSE_REGEX)
-        [partial setString:@""];
-    else
-        [partial autorelease];
+        token.length = 0;
+    
+    // the tag that ends the current here string
+    const unsigned char *patternBytes = (const unsigned char *) [pattern UTF8String];
+    NSUInteger patternLength = patternBytes ? strlen((const char *) patternBytes) : 0;
     
     NSUInteger i = 0;
-    NSUInteger imax = [string length];
     for (i = 0; i < imax; i++) {
-        column++;
-        unichar stri = [string characterAtIndex:i];
+        unsigned char stri = bytes[i];
+        column += nu_utf8_width(stri);
         switch (state) {
             case PARSE_NORMAL:
                 switch(stri) {
@@ -579,7 +848,7 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                         ParserDebug(@"Parser: (  %d on line %d", column, linenum);
                         [opens push:@(column)];
                         parens++;
-                        if ([partial length] == 0) {
+                        if (token.length == 0) {
                             [self openList];
                         }
                         break;
@@ -588,9 +857,9 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                         [opens pop];
                         parens--;
                         if (parens < 0) parens = 0;
-                        if ([partial length] > 0) {
-                            [self addAtom:atomWithString(partial, symbolTable)];
-                            [partial setString:@""];
+                        if (token.length > 0) {
+                            [self addAtom:nu_atom_with_token(&token, symbolTable, symbolCache)];
+                            token.length = 0;
                         }
                         if (depth > 0) {
                             [self closeList];
@@ -603,50 +872,53 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                     {
                         state = PARSE_STRING;
                         parseEscapes = YES;
-                        [partial setString:@""];
+                        token.length = 0;
                         break;
                     }
                     case '-':
                     case '+':
                     {
-                        if ((i+1 < imax) && ([string characterAtIndex:i+1] == '"')) {
+                        if ((i+1 < imax) && (bytes[i+1] == '"')) {
                             state = PARSE_STRING;
                             parseEscapes = (stri == '+');
-                            [partial setString:@""];
+                            token.length = 0;
                             i++;
                         }
                         else {
-                            [partial appendCharacter:stri];
+                            NSUInteger j = nu_token_run_end(bytes, i+1, imax);
+                            nu_token_append_bytes(&token, bytes + i, j - i);
+                            column += nu_utf8_run_width(bytes, i+1, j);
+                            i = j - 1;
                         }
                         break;
                     }
                     case '/':
                     {
                         if (i+1 < imax) {
-                            unichar nextc = [string characterAtIndex:i+1];
+                            unsigned char nextc = bytes[i+1];
                             if (nextc == ' ') {
-                                [partial appendCharacter:stri];
+                                nu_token_append_byte(&token, stri);
                             }
                             else {
                                 state = PARSE_REGEX;
-                                [partial setString:@""];
-                                [partial appendCharacter:'/'];
+                                token.length = 0;
+                                nu_token_append_byte(&token, '/');
                             }
                         }
                         else {
-                            [partial appendCharacter:stri];
+                            nu_token_append_byte(&token, stri);
                         }
                         break;
                     }
                     case ':':
-                        [partial appendCharacter:':'];
+                        nu_token_append_byte(&token, ':');
                         // ordinarily we break symbols on trailing colons.
                         // one exception: we don't do it when the symbol begins with an ampersand.
                         // that's because these symbols are usually markup generators, and
                         // sometimes we want to generate markup tags that contain colons.
-                        if ([partial characterAtIndex:0] != '&') {
-                            [self addAtom:atomWithString(partial, symbolTable)];
-                            [partial setString:@""];
+                        if (token.bytes[0] != '&') {
+                            [self addAtom:nu_atom_with_token(&token, symbolTable, symbolCache)];
+                            token.length = 0;
                         }
                         break;
                     case '\'':
@@ -656,43 +928,41 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                         bool isACharacterLiteral = false;
                         int characterLiteralValue = 0;
                         if (i + 2 < imax) {
-                            if ([string characterAtIndex:i+1] != '\\') {
-                                if ([string characterAtIndex:i+2] == '\'') {
-                                    isACharacterLiteral = true;
-                                    characterLiteralValue = [string characterAtIndex:i+1];
-                                    i = i + 2;
+                            NSUInteger length = 0;
+                            uint32_t c = (bytes[i+1] != '\\') ? nu_utf8_decode(bytes, i+1, imax, &length) : 0;
+                            if (bytes[i+1] == '\\') {
+                                // look for an escaped character
+                                uint32_t value;
+                                i = nu_parse_escape_sequence(bytes, i+1, imax, &value);
+                                isACharacterLiteral = true;
+                                // characters outside the BMP are represented by their leading surrogates
+                                characterLiteralValue = (value < 0x10000) ? value : (0xD800 + ((value - 0x10000) >> 10));
+                                // make sure that we have a closing single-quote
+                                if ((i + 1 < imax) && (bytes[i+1] == '\'')) {
+                                    i = i + 1;// move past the closing single-quote
                                 }
-                                else if ((i + 5 < imax) &&
-                                         isalnum([string characterAtIndex:i+1]) &&
-                                         isalnum([string characterAtIndex:i+2]) &&
-                                         isalnum([string characterAtIndex:i+3]) &&
-                                         isalnum([string characterAtIndex:i+4]) &&
-                                         ([string characterAtIndex:i+5] == '\'')) {
-                                    characterLiteralValue =
-                                    ((([string characterAtIndex:i+1]*256
-                                       + [string characterAtIndex:i+2])*256
-                                      + [string characterAtIndex:i+3])*256
-                                     + [string characterAtIndex:i+4]);
-                                    isACharacterLiteral = true;
-                                    i = i + 5;
+                                else {
+                                    [NSException raise:@"NuParseError" format:@"missing close quote from character literal"];
                                 }
                             }
-                            else {
-                                // look for an escaped character
-                                NSUInteger newi = nu_parse_escape_sequences(string, i+1, imax, partial);
-                                if ([partial length] > 0) {
-                                    isACharacterLiteral = true;
-                                    characterLiteralValue = [partial characterAtIndex:0];
-                                    [partial setString:@""];
-                                    i = newi;
-                                    // make sure that we have a closing single-quote
-                                    if ((i + 1 < imax) && ([string characterAtIndex:i+1] == '\'')) {
-                                        i = i + 1;// move past the closing single-quote
-                                    }
-                                    else {
-                                        [NSException raise:@"NuParseError" format:@"missing close quote from character literal"];
-                                    }
-                                }
+                            else if ((c < 0x10000) && (i + 1 + length < imax) && (bytes[i+1+length] == '\'')) {
+                                isACharacterLiteral = true;
+                                characterLiteralValue = c;
+                                i = i + 1 + length;
+                            }
+                            else if ((i + 5 < imax) &&
+                                     nu_is_ascii_alnum(bytes[i+1]) &&
+                                     nu_is_ascii_alnum(bytes[i+2]) &&
+                                     nu_is_ascii_alnum(bytes[i+3]) &&
+                                     nu_is_ascii_alnum(bytes[i+4]) &&
+                                     (bytes[i+5] == '\'')) {
+                                characterLiteralValue =
+                                ((((bytes[i+1]*256
+                                    + bytes[i+2])*256
+                                   + bytes[i+3])*256
+                                  + bytes[i+4]));
+                                isACharacterLiteral = true;
+                                i = i + 5;
                             }
                         }
                         if (isACharacterLiteral) {
@@ -716,7 +986,7 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                     }
                     case ',':
                     {
-                        if ((i + 1 < imax) && ([string characterAtIndex:i+1] == '@')) {
+                        if ((i + 1 < imax) && (bytes[i+1] == '@')) {
                             [self quasiquoteSpliceNextElement];
                             i = i + 1;
                         }
@@ -731,84 +1001,95 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                     case ' ':                     // end of token
                     case '\t':
                     case 0:                       // end of string
-                        if ([partial length] > 0) {
-                            [self addAtom:atomWithString(partial, symbolTable)];
-                            [partial setString:@""];
+                        if (token.length > 0) {
+                            [self addAtom:nu_atom_with_token(&token, symbolTable, symbolCache)];
+                            token.length = 0;
                         }
                         break;
                     case ';':
                     case '#':
-                        if ((stri == '#') && ([partial length] > 0)) {
+                        if ((stri == '#') && (token.length > 0)) {
                             // this allows us to include '#' in symbols (but not as the first character)
-                            [partial appendCharacter:'#'];
+                            nu_token_append_byte(&token, '#');
                         } else {
-                            if ([partial length]) {
-                                NuSymbol *symbol = [symbolTable symbolWithString:partial];
+                            if (token.length) {
+                                NuSymbol *symbol = nu_symbol_with_bytes(token.bytes, token.length, symbolTable, symbolCache);
                                 [self addAtom:symbol];
-                                [partial setString:@""];
+                                token.length = 0;
                             }
                             state = PARSE_COMMENT;
                         }
                         break;
                     case '<':
-                        if ((i+3 < imax) && ([string characterAtIndex:i+1] == '<')
-                            && (([string characterAtIndex:i+2] == '-') || ([string characterAtIndex:i+2] == '+'))) {
+                        if ((i+3 < imax) && (bytes[i+1] == '<')
+                            && ((bytes[i+2] == '-') || (bytes[i+2] == '+'))) {
                             // parse a here string
                             state = PARSE_HERESTRING;
-                            parseEscapes = ([string characterAtIndex:i+2] == '+');
+                            parseEscapes = (bytes[i+2] == '+');
                             // get the tag to match
                             NSUInteger j = i+3;
-                            while ((j < imax) && ([string characterAtIndex:j] != '\n')) {
+                            while ((j < imax) && (bytes[j] != '\n')) {
                                 j++;
                             }
+                            if (j == i+3) {
+                                [NSException raise:@"NuParseError" format:@"missing tag for here string"];
+                            }
                             [pattern release];
-                            pattern = [[string substringWithRange:NSMakeRange(i+3, j-(i+3))] retain];
+                            pattern = [nu_string_with_bytes(bytes + i + 3, j - (i + 3)) retain];
+                            patternBytes = bytes + i + 3;
+                            patternLength = j - (i + 3);
                             //NSLog(@"herestring pattern: %@", pattern);
-                            [partial setString:@""];
+                            token.length = 0;
                             // skip the newline
                             i = j;
-                            //NSLog(@"parsing herestring that ends with %@ from %@", pattern, [string substringFromIndex:i]);
                             hereString = nil;
                             hereStringOpened = true;
                             break;
                         }
                         // if this is not a here string, fall through to the general handler
                     default:
-                        [partial appendCharacter:stri];
+                    {
+                        // take the rest of the run of ordinary characters at once
+                        NSUInteger j = nu_token_run_end(bytes, i+1, imax);
+                        nu_token_append_bytes(&token, bytes + i, j - i);
+                        column += nu_utf8_run_width(bytes, i+1, j);
+                        i = j - 1;
+                    }
                 }
                 break;
             case PARSE_HERESTRING:
                 //NSLog(@"pattern %@", pattern);
-                if ((stri == [pattern characterAtIndex:0]) &&
-                    (i + [pattern length] < imax) &&
-                    ([pattern isEqual:[string substringWithRange:NSMakeRange(i, [pattern length])]])) {
+                if ((stri == patternBytes[0]) &&
+                    (i + patternLength < imax) &&
+                    !memcmp(bytes + i, patternBytes, patternLength)) {
                     // everything up to here is the string
-                    NSString *string = [[[NSString alloc] initWithString:partial] autorelease];
-                    [partial setString:@""];
+                    NSString *string = nu_token_string(&token);
+                    token.length = 0;
                     if (!hereString)
                         hereString = [[[NSMutableString alloc] init] autorelease];
                     else
                         [hereString appendString:@"\n"];
                     [hereString appendString:string];
-                    if (hereString == nil)
-                        hereString = [NSMutableString string];
                     //NSLog(@"got herestring **%@**", hereString);
-                    [self addAtom:hereString];
+                    [self addAtom:nu_interpolated_string(hereString)];
                     // to continue, set i to point to the next character after the tag
-                    i = i + [pattern length] - 1;
-                    //NSLog(@"continuing parsing with:%s", &str[i+1]);
-                    //NSLog(@"ok------------");
+                    i = i + patternLength - 1;
                     state = PARSE_NORMAL;
                     start = -1;
                 }
+                else if (parseEscapes && (stri == '\\')) {
+                    // parse escape sequencs in here strings
+                    i = nu_parse_escape_sequences(bytes, i, imax, &token);
+                }
                 else {
-                    if (parseEscapes && (stri == '\\')) {
-                        // parse escape sequencs in here strings
-                        i = nu_parse_escape_sequences(string, i, imax, partial);
-                    }
-                    else {
-                        [partial appendCharacter:stri];
+                    // take everything up to the next possible tag or escape
+                    NSUInteger j = i + 1;
+                    while ((j < imax) && (bytes[j] != patternBytes[0]) && !(parseEscapes && (bytes[j] == '\\'))) {
+                        j++;
                     }
+                    nu_token_append_bytes(&token, bytes + i, j - i);
+                    column += nu_utf8_run_width(bytes, i+1, j);
+                    i = j - 1;
                 }
                 break;
             case PARSE_STRING:
@@ -816,34 +1097,40 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                     case '"':
                     {
                         state = PARSE_NORMAL;
-                        NSString *string = [NSString stringWithString:partial];
+                        NSString *string = nu_token_string(&token);
                         //NSLog(@"parsed string:%@:", string);
-                        [self addAtom:string];
-                        [partial setString:@""];
+                        [self addAtom:nu_interpolated_string(string)];
+                        token.length = 0;
                         break;
                     }
                     case '\n':
                     {
                         column = 0;
                         linenum++;
-                        NSString *string = [[NSString alloc] initWithString:partial];
+                        NSString *string = nu_token_string(&token);
+                        token.length = 0;
                         [NSException raise:@"NuParseError" format:@"partial string (terminated by newline): %@", string];
-                        [partial setString:@""];
                         break;
                     }
                     case '\\':
                     {                             // parse escape sequences in strings
                         if (parseEscapes) {
-                            i = nu_parse_escape_sequences(string, i, imax, partial);
+                            i = nu_parse_escape_sequences(bytes, i, imax, &token);
                         }
                         else {
-                            [partial appendCharacter:stri];
+                            nu_token_append_byte(&token, stri);
                         }
                         break;
                     }
                     default:
                     {
-                        [partial appendCharacter:stri];
+                        NSUInteger j = i + 1;
+                        while ((j < imax) && (bytes[j] != '"') && (bytes[j] != '\n') && (bytes[j] != '\\')) {
+                            j++;
+                        }
+                        nu_token_append_bytes(&token, bytes + i, j - i);
+                        column += nu_utf8_run_width(bytes, i+1, j);
+                        i = j - 1;
                     }
                 }
                 break;
@@ -851,35 +1138,44 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                 switch(stri) {
                     case '/':                     // that's the end of it
                     {
-                        [partial appendCharacter:'/'];
+                        nu_token_append_byte(&token, '/');
                         i++;
                         // add any remaining option characters
                         while (i < imax) {
-                            unichar nextc = [string characterAtIndex:i];
+                            unsigned char nextc = bytes[i];
                             if ((nextc >= 'a') && (nextc <= 'z')) {
-                                [partial appendCharacter:nextc];
+                                nu_token_append_byte(&token, nextc);
                                 i++;
                             }
                             else {
-                                i--;              // back up to revisit this character
                                 break;
                             }
                         }
-                        [self addAtom:regexWithString(partial)];
-                        [partial setString:@""];
+                        i--;                      // back up to revisit this character
+                        [self addAtom:regexWithString(nu_token_string(&token))];
+                        token.length = 0;
                         state = PARSE_NORMAL;
                         break;
                     }
                     case '\\':
                     {
-                        [partial appendCharacter:stri];
+                        nu_token_append_byte(&token, stri);
                         i++;
-                        [partial appendCharacter:[string characterAtIndex:i]];
+                        if (i >= imax) {
+                            [NSException raise:@"NuParseError" format:@"incomplete escape sequence"];
+                        }
+                        nu_token_append_byte(&token, bytes[i]);
                         break;
                     }
                     default:
                     {
-                        [partial appendCharacter:stri];
+                        NSUInteger j = i + 1;
+                        while ((j < imax) && (bytes[j] != '/') && (bytes[j] != '\\')) {
+                            j++;
+                        }
+                        nu_token_append_bytes(&token, bytes + i, j - i);
+                        column += nu_utf8_run_width(bytes, i+1, j);
+                        i = j - 1;
                     }
                 }
                 break;
@@ -889,8 +1185,8 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                     {
                         if (!comments) comments = [[NSMutableString alloc] init];
                         else [comments appendString:@"\n"];
-                        [comments appendString:[[[NSString alloc] initWithString:partial] autorelease]];
-                        [partial setString:@""];
+                        [comments appendString:nu_token_string(&token)];
+                        token.length = 0;
                         column = 0;
                         linenum++;
                         state = PARSE_NORMAL;
@@ -898,28 +1194,31 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                     }
                     default:
                     {
-                        [partial appendCharacter:stri];
+                        const unsigned char *newline = memchr(bytes + i, '\n', imax - i);
+                        NSUInteger j = newline ? (newline - bytes) : imax;
+                        nu_token_append_bytes(&token, bytes + i, j - i);
+                        i = j - 1;
                     }
                 }
         }
     }
     // close off anything that is still being scanned.
     if (state == PARSE_NORMAL) {
-        if ([partial length] > 0) {
-            [self addAtom:atomWithString(partial, symbolTable)];
+        if (token.length > 0) {
+            [self addAtom:nu_atom_with_token(&token, symbolTable, symbolCache)];
         }
-        [partial setString:@""];
+        token.length = 0;
     }
     else if (state == PARSE_COMMENT) {
         if (!comments) comments = [[NSMutableString alloc] init];
-        [comments appendString:[[[NSString alloc] initWithString:partial] autorelease]];
-        [partial setString:@""];
+        [comments appendString:nu_token_string(&token)];
+        token.length = 0;
         column = 0;
         linenum++;
         state = PARSE_NORMAL;
     }
     else if (state == PARSE_STRING) {
-        [NSException raise:@"NuParseError" format:@"partial string (terminated by newline): %@", partial];
+        [NSException raise:@"NuParseError" format:@"partial string (terminated by newline): %@", nu_token_string(&token)];
     }
     else if (state == PARSE_HERESTRING) {
         if (hereStringOpened) {
@@ -932,14 +1231,13 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
             else {
                 hereString = [[NSMutableString alloc] init];
             }
-            [hereString appendString:partial];
-            [partial setString:@""];
+            [hereString appendString:nu_token_string(&token)];
+            token.length = 0;
         }
     }
     else if (state == PARSE_REGEX) {
         // we stay in this state and leave the regex open.
-        [partial appendCharacter:'\n'];
-        [partial retain];
+        nu_token_append_byte(&token, '\n');
     }
     if ([self incomplete]) {
         return Nu__null;
@@ -961,6 +1259,14 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
     return result;
 }
 
+- (id) parseData:(NSData *)data asIfFromFilename:(const char *) filename;
+{
+    [self setFilename:filename];
+    id result = [self parseData:data];
+    [self setFilename:NULL];
+    return result;
+}
+
 - (void) newline
 {
     linenum++;
@@ -968,7 +1274,10 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
 
 - (id) eval: (id) code
 {
-    return [code evalWithContext:context];
+    id result = [code evalWithContext:context];
+    // break, continue and return are errors at the top level
+    nu_raise_pending_control_signal();
+    return result;
 }
 
 - (id) valueForKey:(NSString *)string
@@ -1060,6 +1369,7 @@ static NSUInteger nu_parse_escape_sequences(NSString *string, NSUInteger i, NSUI
                         @try
                         {
                             id result = [expression evalWithContext:context];
+                            nu_raise_pending_control_signal();
                             if (result) {
                                 id stringToDisplay;
                                 if ([result respondsToSelector:@selector(escapedStringRepresentation)]) {
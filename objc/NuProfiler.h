@@ -8,8 +8,62 @@
 
 #import <Foundation/Foundation.h>
 
+/*!
+ @class NuProfiler
+ @abstract Profiles of the time spent evaluating Nu code.
+ @discussion Sections of code can be timed by bracketing them with <b>start:</b> and <b>stop</b>.
+ The times of sections with the same name are added together over all threads.
+
+ The default profiler can also sample the expressions that are being evaluated. While sampling is on, a sampler thread
+ wakes at a fixed frequency and asks each thread that is evaluating Nu code to record the stack of expressions it is in,
+ which the thread does the next time it enters or leaves an expression; a long call of native code is attributed
+ to the expression that made it. Each frame of a sample is named by the function, operator or message that its expression
+ calls and the file and line that the expression was parsed from, and samples with the same frames are counted together.
+ <b>collapsedStacks</b> returns the counts in the collapsed-stack format that flame graph tools read, and <b>report</b>
+ (or the <b>profile-report</b> operator) summarizes the expressions that the samples were taken in.
+
+ If the <b>NU_PROFILE</b> environment variable is set to the path of a file when Nu is initialized, sampling starts at
+ 100 samples per second and the collapsed stacks are written to the file when the process exits.
+ */
 @interface NuProfiler : NSObject
 
+/*! Get the profiler that <b>profile-report</b> and <b>NU_PROFILE</b> use. Only this profiler can sample. */
 + (NuProfiler *) defaultProfiler;
 
-@end
\ No newline at end of file
+/*! Start timing a section with a name on the calling thread. Sections may be nested. */
+- (void) start:(NSString *) name;
+/*! Stop timing the innermost section that was started on the calling thread. */
+- (void) stop;
+/*! Get the total times and counts of the sections that have been timed, keyed by name. */
+- (NSMutableDictionary *) sections;
+/*! Forget the timed sections and the samples. */
+- (void) reset;
+
+/*! Start sampling 100 times a second. */
+- (void) startSampling;
+/*! Start sampling at a frequency in samples per second. Raises an exception if this isn't the default profiler. */
+- (void) startSamplingWithFrequency:(double) hertz;
+/*! Stop sampling. Samples that threads have not recorded yet may still be added. */
+- (void) stopSampling;
+/*! Returns true while sampling. */
+- (BOOL) isSampling;
+/*! Get the number of samples that have been recorded. */
+- (NSUInteger) sampleCount;
+/*! Get the counts of the samples that have been recorded, keyed by their frames, outermost first, separated by semicolons. */
+- (NSDictionary *) samples;
+/*! Get the samples in collapsed-stack format, one stack and its count per line. */
+- (NSString *) collapsedStacks;
+/*! Write the samples to a file in collapsed-stack format. Returns NO if the file can't be written. */
+- (BOOL) writeCollapsedStacksToFile:(NSString *) path;
+/*! Summarize the samples, listing the 20 frames that the most samples were taken in. */
+- (NSString *) report;
+/*! Summarize the samples, listing up to limit frames. */
+- (NSString *) reportWithLimit:(NSUInteger) limit;
+
+@end
+
+// Record count samples of a stack of expressions, outermost first. Threads call this when they have pending samples.
+void nu_profiler_record_sample(id *cells, NSUInteger depth, NSUInteger count);
+
+// Start sampling if the NU_PROFILE environment variable is set.
+void nu_profiler_start_from_environment(void);
@@ -7,13 +7,34 @@
 //
 
 #import "NuProfiler.h"
-
+#import "NuInternals.h"
+#import "NuCell.h"
+#import "NuSymbol.h"
+#import <pthread.h>
+#import <time.h>
 
 #ifdef DARWIN
 #import <mach/mach.h>
 #import <mach/mach_time.h>
 #endif
 
+#define NU_PROFILER_DEFAULT_FREQUENCY 100.0
+
+// Get a monotonic time in nanoseconds.
+static uint64_t nu_profiler_now(void)
+{
+#ifdef DARWIN
+    static struct mach_timebase_info info = {0, 0};
+    if (!info.denom)
+        mach_timebase_info(&info);
+    return mach_absolute_time() * info.numer / info.denom;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
 @interface NuProfileStackElement : NSObject
 {
 @public
@@ -58,21 +79,39 @@
 
 @end
 
+// Each thread has its own stack of sections, and the times of all threads are added together.
 @interface NuProfiler ()
 {
     NSMutableDictionary *sections;
-    NuProfileStackElement *stack;
+    NSMutableDictionary *stacks;    // keyed by thread
+    NSMutableDictionary *samples;   // counts keyed by collapsed stack
+    NSUInteger sampleCount;
+    double frequency;
+    bool sampling;
+    pthread_t sampler;
+    pthread_mutex_t lock;
 }
+- (void) addSamples:(NSUInteger) count forStack:(NSString *) stack;
 @end
 
+static NSNumber *nu_profiler_thread_key(void)
+{
+    return [NSNumber numberWithUnsignedLong:(unsigned long) pthread_self()];
+}
+
 @implementation NuProfiler
 
 static NuProfiler *defaultProfiler = nil;
+static pthread_once_t defaultProfilerOnce = PTHREAD_ONCE_INIT;
+
+static void nu_create_default_profiler(void)
+{
+    defaultProfiler = [[NuProfiler alloc] init];
+}
 
 + (NuProfiler *) defaultProfiler
 {
-    if (!defaultProfiler)
-        defaultProfiler = [[NuProfiler alloc] init];
+    pthread_once(&defaultProfilerOnce, nu_create_default_profiler);
     return defaultProfiler;
 }
 
@@ -80,30 +119,44 @@ static NuProfiler *defaultProfiler = nil;
 {
     self = [super init];
     sections = [[NSMutableDictionary alloc] init];
-    stack = nil;
+    stacks = [[NSMutableDictionary alloc] init];
+    samples = [[NSMutableDictionary alloc] init];
+    pthread_mutex_init(&lock, NULL);
     return self;
 }
 
+- (void) dealloc
+{
+    [self stopSampling];
+    [self reset];
+    [sections release];
+    [stacks release];
+    [samples release];
+    pthread_mutex_destroy(&lock);
+    [super dealloc];
+}
+
 - (void) start:(NSString *) name
 {
-#ifdef DARWIN
     NuProfileStackElement *stackElement = [[NuProfileStackElement alloc] init];
     stackElement->name = [name retain];
-    stackElement->start = mach_absolute_time();
-    stackElement->parent = stack;
-    stack = stackElement;
-#endif
+    NSNumber *key = nu_profiler_thread_key();
+    pthread_mutex_lock(&lock);
+    stackElement->parent = [[stacks objectForKey:key] pointerValue];
+    // the stack holds its elements with the retain from alloc
+    [stacks setObject:[NSValue valueWithPointer:stackElement] forKey:key];
+    pthread_mutex_unlock(&lock);
+    stackElement->start = nu_profiler_now();
 }
 
 - (void) stop
 {
-#ifdef DARWIN
+    uint64_t current_time = nu_profiler_now();
+    NSNumber *key = nu_profiler_thread_key();
+    pthread_mutex_lock(&lock);
+    NuProfileStackElement *stack = [[stacks objectForKey:key] pointerValue];
     if (stack) {
-        uint64_t current_time = mach_absolute_time();
-        uint64_t time_delta = current_time - stack->start;
-        struct mach_timebase_info info;
-        mach_timebase_info(&info);
-        float timeDelta = 1e-9 * time_delta * (double) info.numer / info.denom;
+        float timeDelta = 1e-9 * (current_time - stack->start);
         //NSNumber *delta = [NSNumber numberWithFloat:timeDelta];
         NuProfileTimeSlice *entry = [sections objectForKey:stack->name];
         if (!entry) {
@@ -120,23 +173,285 @@ static NuProfiler *defaultProfiler = nil;
         NuProfileStackElement *top = stack;
         stack = stack->parent;
         [top release];
+        if (stack)
+            [stacks setObject:[NSValue valueWithPointer:stack] forKey:key];
+        else
+            [stacks removeObjectForKey:key];
     }
-#endif
+    pthread_mutex_unlock(&lock);
 }
 
+// Returns a copy, since other threads may be adding to the sections.
 - (NSMutableDictionary *) sections
 {
-    return sections;
+    pthread_mutex_lock(&lock);
+    NSMutableDictionary *copy = [[sections mutableCopy] autorelease];
+    pthread_mutex_unlock(&lock);
+    return copy;
 }
 
 - (void) reset
 {
+    pthread_mutex_lock(&lock);
     [sections removeAllObjects];
-    while (stack) {
-        NuProfileStackElement *top = stack;
-        stack = stack->parent;
-        [top release];
+    for (NSValue *value in [stacks allValues]) {
+        NuProfileStackElement *stack = [value pointerValue];
+        while (stack) {
+            NuProfileStackElement *top = stack;
+            stack = stack->parent;
+            [top->name release];
+            [top release];
+        }
+    }
+    [stacks removeAllObjects];
+    [samples removeAllObjects];
+    sampleCount = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+#pragma mark - Sampling
+
+// The sampler thread asks the evaluating threads for samples at the profiler's frequency.
+// Ticks that are missed because the process was busy are skipped rather than made up.
+static void *nu_profiler_sample(void *info)
+{
+    NuProfiler *profiler = (NuProfiler *) info;
+    uint64_t period = (uint64_t) (1e9 / profiler->frequency);
+    uint64_t next = nu_profiler_now();
+    while (__atomic_load_n(&profiler->sampling, __ATOMIC_ACQUIRE)) {
+        next += period;
+        uint64_t now = nu_profiler_now();
+        if (next > now) {
+            struct timespec delay = {(time_t) ((next - now) / 1000000000ull), (long) ((next - now) % 1000000000ull)};
+            nanosleep(&delay, NULL);
+        }
+        else {
+            next = now;
+        }
+        nu_expression_stacks_request_samples();
+    }
+    return NULL;
+}
+
+- (void) startSampling
+{
+    [self startSamplingWithFrequency:NU_PROFILER_DEFAULT_FREQUENCY];
+}
+
+- (void) startSamplingWithFrequency:(double) hertz
+{
+    if (self != [NuProfiler defaultProfiler]) {
+        [NSException raise:@"NuProfilerError" format:@"only the default profiler can sample"];
+    }
+    if (!(hertz > 0) || (hertz > 1e6)) {
+        [NSException raise:@"NuProfilerError" format:@"sampling frequency must be between 0 and 1000000 samples per second"];
+    }
+    [self stopSampling];
+    pthread_mutex_lock(&lock);
+    frequency = hertz;
+    __atomic_store_n(&sampling, true, __ATOMIC_RELEASE);
+    if (pthread_create(&sampler, NULL, nu_profiler_sample, self) != 0) {
+        __atomic_store_n(&sampling, false, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&lock);
+        [NSException raise:@"NuProfilerError" format:@"unable to start the sampler thread"];
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+- (void) stopSampling
+{
+    pthread_mutex_lock(&lock);
+    bool wasSampling = __atomic_exchange_n(&sampling, false, __ATOMIC_ACQ_REL);
+    pthread_t thread = sampler;
+    pthread_mutex_unlock(&lock);
+    if (wasSampling)
+        pthread_join(thread, NULL);
+}
+
+- (BOOL) isSampling
+{
+    return __atomic_load_n(&sampling, __ATOMIC_ACQUIRE);
+}
+
+- (NSUInteger) sampleCount
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger count = sampleCount;
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+- (NSDictionary *) samples
+{
+    pthread_mutex_lock(&lock);
+    NSDictionary *copy = [[samples copy] autorelease];
+    pthread_mutex_unlock(&lock);
+    return copy;
+}
+
+- (void) addSamples:(NSUInteger) count forStack:(NSString *) stack
+{
+    pthread_mutex_lock(&lock);
+    NSNumber *previous = [samples objectForKey:stack];
+    [samples setObject:[NSNumber numberWithUnsignedInteger:[previous unsignedIntegerValue] + count] forKey:stack];
+    sampleCount += count;
+    pthread_mutex_unlock(&lock);
+}
+
+- (NSString *) collapsedStacks
+{
+    NSDictionary *counts = [self samples];
+    NSMutableString *result = [NSMutableString string];
+    for (NSString *stack in [[counts allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        [result appendFormat:@"%@ %@\n", stack, [counts objectForKey:stack]];
     }
+    return result;
+}
+
+- (BOOL) writeCollapsedStacksToFile:(NSString *) path
+{
+    return [[self collapsedStacks] writeToFile:path atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+}
+
+static NSComparisonResult nu_profiler_compare_frames(id a, id b, void *info)
+{
+    NSDictionary *selfCounts = [(NSArray *) info objectAtIndex:0];
+    NSDictionary *totalCounts = [(NSArray *) info objectAtIndex:1];
+    NSComparisonResult result = [[selfCounts objectForKey:b] compare:[selfCounts objectForKey:a]];
+    if (result == NSOrderedSame)
+        result = [[totalCounts objectForKey:b] compare:[totalCounts objectForKey:a]];
+    if (result == NSOrderedSame)
+        result = [a compare:b];
+    return result;
+}
+
+- (NSString *) report
+{
+    return [self reportWithLimit:20];
+}
+
+- (NSString *) reportWithLimit:(NSUInteger) limit
+{
+    NSDictionary *counts = [self samples];
+    NSUInteger total = 0;
+    // a frame's self count is the number of samples taken in it and its total count is the number of samples
+    // taken in it or in the expressions it called, counting recursive frames once
+    NSMutableDictionary *selfCounts = [NSMutableDictionary dictionary];
+    NSMutableDictionary *totalCounts = [NSMutableDictionary dictionary];
+    for (NSString *stack in counts) {
+        NSUInteger count = [[counts objectForKey:stack] unsignedIntegerValue];
+        total += count;
+        NSArray *frames = [stack componentsSeparatedByString:@";"];
+        NSString *leaf = [frames lastObject];
+        [selfCounts setObject:[NSNumber numberWithUnsignedInteger:[[selfCounts objectForKey:leaf] unsignedIntegerValue] + count]
+                       forKey:leaf];
+        for (NSString *frame in [NSSet setWithArray:frames]) {
+            [totalCounts setObject:[NSNumber numberWithUnsignedInteger:[[totalCounts objectForKey:frame] unsignedIntegerValue] + count]
+                            forKey:frame];
+        }
+    }
+    for (NSString *frame in totalCounts) {
+        if (![selfCounts objectForKey:frame])
+            [selfCounts setObject:[NSNumber numberWithUnsignedInteger:0] forKey:frame];
+    }
+    NSMutableString *report = [NSMutableString stringWithFormat:@"%lu samples\n", (unsigned long) total];
+    if (!total)
+        return report;
+    [report appendString:@"  self   total  expression\n"];
+    NSArray *frames = [[totalCounts allKeys] sortedArrayUsingFunction:nu_profiler_compare_frames
+                                                               context:[NSArray arrayWithObjects:selfCounts, totalCounts, nil]];
+    NSUInteger listed = 0;
+    for (NSString *frame in frames) {
+        if (listed++ == limit)
+            break;
+        [report appendFormat:@"%5.1f%%  %5.1f%%  %@\n",
+         100.0 * [[selfCounts objectForKey:frame] unsignedIntegerValue] / total,
+         100.0 * [[totalCounts objectForKey:frame] unsignedIntegerValue] / total,
+         frame];
+    }
+    return report;
 }
 
 @end
+
+// Name a frame by what its expression calls: a function or operator by its symbol and a message by its
+// receiver and selector. Semicolons and line breaks are replaced, since they separate frames and stacks.
+static NSString *nu_profiler_frame_name(id cell)
+{
+    if (!nu_objectIsKindOfClass(cell, [NuCell class]))
+        return [[cell class] description];
+    id head = [cell car];
+    id rest = [cell cdr];
+    NSMutableString *name = [NSMutableString string];
+    if (nu_objectIsKindOfClass(head, [NuCell class])) {
+        [name appendString:@"(...)"];
+    }
+    else {
+        NSString *headName = [head stringValue];
+        if ([headName length] > 24)
+            headName = [[headName substringToIndex:24] stringByAppendingString:@"..."];
+        [name appendString:headName ? headName : @"nil"];
+    }
+    id second = nu_objectIsKindOfClass(rest, [NuCell class]) ? [rest car] : nil;
+    if (nu_objectIsKindOfClass(second, [NuSymbol class]) && [second isLabel]) {
+        [name insertString:@"[" atIndex:0];
+        [name appendString:@" "];
+        while (nu_objectIsKindOfClass(rest, [NuCell class])) {
+            id label = [rest car];
+            if (nu_objectIsKindOfClass(label, [NuSymbol class]) && [label isLabel])
+                [name appendString:[label stringValue]];
+            rest = [rest cdr];
+            rest = nu_objectIsKindOfClass(rest, [NuCell class]) ? [rest cdr] : nil;
+        }
+        [name appendString:@"]"];
+    }
+    int line = [cell line];
+    const char *file = ([cell file] >= 0) ? nu_parsedFilename([cell file]) : NULL;
+    if (file && (line >= 0))
+        [name appendFormat:@" (%s:%d)", file, line];
+    else if (line >= 0)
+        [name appendFormat:@" (line %d)", line];
+    [name replaceOccurrencesOfString:@";" withString:@"," options:0 range:NSMakeRange(0, [name length])];
+    [name replaceOccurrencesOfString:@"\n" withString:@" " options:0 range:NSMakeRange(0, [name length])];
+    return name;
+}
+
+void nu_profiler_record_sample(id *cells, NSUInteger depth, NSUInteger count)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    @try {
+        NSMutableString *stack = [NSMutableString string];
+        for (NSUInteger i = 0; i < depth; i++) {
+            if (i)
+                [stack appendString:@";"];
+            [stack appendString:nu_profiler_frame_name(cells[i])];
+        }
+        [[NuProfiler defaultProfiler] addSamples:count forStack:stack];
+    }
+    @catch (id exception) {
+        // samples that can't be described are dropped rather than disturbing the evaluation they were taken in
+    }
+    [pool drain];
+}
+
+static char *profilePath = NULL;
+
+static void nu_profiler_write_on_exit(void)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NuProfiler *profiler = [NuProfiler defaultProfiler];
+    [profiler stopSampling];
+    if (![profiler writeCollapsedStacksToFile:[NSString stringWithUTF8String:profilePath]])
+        NSLog(@"unable to write profile samples to %s", profilePath);
+    [pool drain];
+}
+
+void nu_profiler_start_from_environment(void)
+{
+    const char *path = getenv("NU_PROFILE");
+    if (!path || !*path || profilePath)
+        return;
+    profilePath = strdup(path);
+    [[NuProfiler defaultProfiler] startSampling];
+    atexit(nu_profiler_write_on_exit);
+}
@@ -88,5 +88,58 @@
  Calls replaceWithString:inString:limit: with no limit. */
 - (NSString *)replaceWithString:(NSString *)rep inString:(NSString *)str;
 
+/*!
+ @method cachedRegexWithPattern:options:
+ Returns a regex for the given pattern string and option flags from a cache of recently used regexes, compiling it only if it isn't there.
+ The cache holds the most recently used regexes up to its limit (initially 256). Returns nil if the pattern string is invalid. */
++ (id)cachedRegexWithPattern:(NSString *)pattern options:(int)options;
+
+/*!
+ @method regexCacheLimit
+ Returns the number of regexes that are kept in the cache used by cachedRegexWithPattern:options:. */
++ (NSUInteger)regexCacheLimit;
+
+/*!
+ @method setRegexCacheLimit:
+ Sets the number of regexes that are kept in the cache, removing the least recently used ones if there are more. Zero disables the cache. */
++ (void)setRegexCacheLimit:(NSUInteger)limit;
+
+/*!
+ @method removeAllCachedRegexes
+ Empties the regex cache. */
++ (void)removeAllCachedRegexes;
+
+/*!
+ @method regexCacheStatistics
+ Returns counts of the lookups that found a cached regex (<b>hits</b>), compiled one (<b>misses</b>) and removed one to make room (<b>evictions</b>), and the number of cached regexes (<b>count</b>). */
++ (NSDictionary *)regexCacheStatistics;
+
+/*!
+ @method countInString:
+ Returns the number of non-overlapping occurrences of the regex in the target string without creating match objects for them. */
+- (NSUInteger)countInString:(NSString *)string;
+
+/*!
+ @method countsInStrings:
+ Returns an array with the number of occurrences of the regex in each member of an array of strings. */
+- (NSArray *)countsInStrings:(NSArray *)strings;
+
+/*!
+ @method matchingStrings:
+ Returns the members of an array of strings that contain at least one occurrence of the regex, in order. */
+- (NSArray *)matchingStrings:(NSArray *)strings;
+
+/*!
+ @method rangesInString:
+ Returns the ranges of all non-overlapping occurrences of the regex in the target string, packed as consecutive NSRange values. */
+- (NSData *)rangesInString:(NSString *)string;
+
 @end
 
+// Get a regex for a pattern and options from the regex cache, compiling and caching it if necessary. Returns nil if the pattern is invalid.
+NSRegularExpression *nu_regex_cached(NSString *pattern, NSUInteger options);
+
+// Find the ranges of the non-overlapping occurrences of a regex within range of a string, storing up to capacity of them in ranges.
+// Returns the number of occurrences, which may be greater than capacity.
+NSUInteger nu_regex_match_ranges(NSRegularExpression *regex, NSString *string, NSRange range, NSRange *ranges, NSUInteger capacity);
+
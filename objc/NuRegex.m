@@ -14,6 +14,8 @@
 
 #import "NuRegex.h"
 #import "Nu.h"
+#import "NuInternals.h"
+#import <pthread.h>
 
 #pragma mark - NuRegex.m
 
@@ -61,6 +63,149 @@
 
 @end
 
+#pragma mark - Regex cache
+
+// Cached regexes are kept in a list ordered by use and are found through a dictionary of their patterns.
+// Regexes with the same pattern and different options are chained from the same dictionary entry.
+typedef struct nu_regex_cache_entry {
+    NSString *pattern;
+    NSUInteger options;
+    NSRegularExpression *regex;
+    struct nu_regex_cache_entry *newer;
+    struct nu_regex_cache_entry *older;
+    struct nu_regex_cache_entry *samePattern;
+} nu_regex_cache_entry;
+
+static pthread_mutex_t regexCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableDictionary *regexCacheEntries = nil;
+static nu_regex_cache_entry *regexCacheNewest = NULL;
+static nu_regex_cache_entry *regexCacheOldest = NULL;
+static NSUInteger regexCacheCount = 0;
+static NSUInteger regexCacheLimit = 256;
+static unsigned long regexCacheHits = 0;
+static unsigned long regexCacheMisses = 0;
+static unsigned long regexCacheEvictions = 0;
+
+static void nu_regex_cache_unlink(nu_regex_cache_entry *entry)
+{
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        regexCacheNewest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        regexCacheOldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void nu_regex_cache_push(nu_regex_cache_entry *entry)
+{
+    entry->older = regexCacheNewest;
+    entry->newer = NULL;
+    if (regexCacheNewest)
+        regexCacheNewest->newer = entry;
+    regexCacheNewest = entry;
+    if (!regexCacheOldest)
+        regexCacheOldest = entry;
+}
+
+// Remove the least recently used regex. Called with the lock held.
+static void nu_regex_cache_evict(void)
+{
+    nu_regex_cache_entry *entry = regexCacheOldest;
+    if (!entry)
+        return;
+    nu_regex_cache_unlink(entry);
+    nu_regex_cache_entry *first = (nu_regex_cache_entry *) [[regexCacheEntries objectForKey:entry->pattern] pointerValue];
+    if (first == entry) {
+        if (entry->samePattern)
+            [regexCacheEntries setObject:[NSValue valueWithPointer:entry->samePattern] forKey:entry->pattern];
+        else
+            [regexCacheEntries removeObjectForKey:entry->pattern];
+    }
+    else {
+        while (first->samePattern != entry)
+            first = first->samePattern;
+        first->samePattern = entry->samePattern;
+    }
+    [entry->pattern release];
+    [entry->regex release];
+    free(entry);
+    regexCacheCount--;
+    regexCacheEvictions++;
+}
+
+NSRegularExpression *nu_regex_cached(NSString *pattern, NSUInteger options)
+{
+    if (!nu_objectIsKindOfClass(pattern, [NSString class])) {
+        return [NSRegularExpression regexWithPattern:pattern options:(int) options];
+    }
+    pthread_mutex_lock(&regexCacheLock);
+    if (!regexCacheEntries) {
+        regexCacheEntries = [[NSMutableDictionary alloc] init];
+    }
+    nu_regex_cache_entry *entry = (nu_regex_cache_entry *) [[regexCacheEntries objectForKey:pattern] pointerValue];
+    while (entry && (entry->options != options))
+        entry = entry->samePattern;
+    if (entry) {
+        if (entry != regexCacheNewest) {
+            nu_regex_cache_unlink(entry);
+            nu_regex_cache_push(entry);
+        }
+        NSRegularExpression *regex = [[entry->regex retain] autorelease];
+        regexCacheHits++;
+        pthread_mutex_unlock(&regexCacheLock);
+        return regex;
+    }
+    regexCacheMisses++;
+    pthread_mutex_unlock(&regexCacheLock);
+    
+    // compile without the lock; if another thread caches the same regex first, both copies work.
+    NSRegularExpression *regex = [NSRegularExpression regexWithPattern:pattern options:(int) options];
+    if (!regex) {
+        return nil;
+    }
+    pthread_mutex_lock(&regexCacheLock);
+    if (regexCacheLimit) {
+        nu_regex_cache_entry *first = (nu_regex_cache_entry *) [[regexCacheEntries objectForKey:pattern] pointerValue];
+        nu_regex_cache_entry *existing = first;
+        while (existing && (existing->options != options))
+            existing = existing->samePattern;
+        if (!existing) {
+            entry = (nu_regex_cache_entry *) calloc(1, sizeof(nu_regex_cache_entry));
+            entry->pattern = [pattern copy];
+            entry->options = options;
+            entry->regex = [regex retain];
+            entry->samePattern = first;
+            [regexCacheEntries setObject:[NSValue valueWithPointer:entry] forKey:entry->pattern];
+            nu_regex_cache_push(entry);
+            regexCacheCount++;
+            while (regexCacheCount > regexCacheLimit) {
+                nu_regex_cache_evict();
+            }
+        }
+    }
+    pthread_mutex_unlock(&regexCacheLock);
+    return regex;
+}
+
+NSUInteger nu_regex_match_ranges(NSRegularExpression *regex, NSString *string, NSRange range, NSRange *ranges, NSUInteger capacity)
+{
+    __block NSUInteger count = 0;
+    [regex enumerateMatchesInString:string
+                            options:0
+                              range:range
+                         usingBlock:^(NSTextCheckingResult *match, NSMatchingFlags flags, BOOL *stop) {
+                             if (!match)
+                                 return;
+                             if (count < capacity)
+                                 ranges[count] = [match range];
+                             count++;
+                         }];
+    return count;
+}
+
 @implementation NSRegularExpression (NuRegex)
 
 /*!
@@ -165,6 +310,84 @@
     
 }
 
++ (id)cachedRegexWithPattern:(NSString *)pattern options:(int)options {
+    return nu_regex_cached(pattern, options);
+}
+
++ (NSUInteger)regexCacheLimit {
+    pthread_mutex_lock(&regexCacheLock);
+    NSUInteger limit = regexCacheLimit;
+    pthread_mutex_unlock(&regexCacheLock);
+    return limit;
+}
+
++ (void)setRegexCacheLimit:(NSUInteger)limit {
+    pthread_mutex_lock(&regexCacheLock);
+    regexCacheLimit = limit;
+    while (regexCacheCount > regexCacheLimit) {
+        nu_regex_cache_evict();
+    }
+    pthread_mutex_unlock(&regexCacheLock);
+}
+
++ (void)removeAllCachedRegexes {
+    pthread_mutex_lock(&regexCacheLock);
+    while (regexCacheCount) {
+        nu_regex_cache_evict();
+    }
+    pthread_mutex_unlock(&regexCacheLock);
+}
+
++ (NSDictionary *)regexCacheStatistics {
+    pthread_mutex_lock(&regexCacheLock);
+    NSDictionary *statistics = [NSDictionary dictionaryWithObjectsAndKeys:
+                                [NSNumber numberWithUnsignedLong:regexCacheHits], @"hits",
+                                [NSNumber numberWithUnsignedLong:regexCacheMisses], @"misses",
+                                [NSNumber numberWithUnsignedLong:regexCacheEvictions], @"evictions",
+                                [NSNumber numberWithUnsignedLong:regexCacheCount], @"count",
+                                nil];
+    pthread_mutex_unlock(&regexCacheLock);
+    return statistics;
+}
+
+- (NSUInteger)countInString:(NSString *)string {
+    return [self numberOfMatchesInString:string options:0 range:NSMakeRange(0, [string length])];
+}
+
+- (NSArray *)countsInStrings:(NSArray *)strings {
+    NSMutableArray *counts = [NSMutableArray arrayWithCapacity:[strings count]];
+    for (id string in strings) {
+        NSUInteger count = nu_objectIsKindOfClass(string, [NSString class]) ? [self countInString:string] : 0;
+        [counts addObject:[NSNumber numberWithUnsignedInteger:count]];
+    }
+    return counts;
+}
+
+- (NSArray *)matchingStrings:(NSArray *)strings {
+    NSMutableArray *matches = [NSMutableArray array];
+    for (id string in strings) {
+        if (nu_objectIsKindOfClass(string, [NSString class]) &&
+            ([self rangeOfFirstMatchInString:string options:0 range:NSMakeRange(0, [string length])].location != NSNotFound)) {
+            [matches addObject:string];
+        }
+    }
+    return matches;
+}
+
+- (NSData *)rangesInString:(NSString *)string {
+    NSRange range = NSMakeRange(0, [string length]);
+    NSUInteger capacity = 64;
+    NSMutableData *data = [NSMutableData dataWithLength:capacity * sizeof(NSRange)];
+    NSUInteger count = nu_regex_match_ranges(self, string, range, (NSRange *) [data mutableBytes], capacity);
+    if (count > capacity) {
+        // scan again now that the number of matches is known
+        [data setLength:count * sizeof(NSRange)];
+        nu_regex_match_ranges(self, string, range, (NSRange *) [data mutableBytes], count);
+    }
+    [data setLength:count * sizeof(NSRange)];
+    return data;
+}
+
 #ifdef LINUX
 - (BOOL) isEqual:(NSRegularExpression *)other
 {
@@ -0,0 +1,104 @@
+//
+//  NuScope.h
+//  Nu
+//
+//  Lexical scope analysis for blocks.
+//
+
+#import <Foundation/Foundation.h>
+
+@class NuScope;
+struct nu_inline_cache;
+struct nu_macro_expansion;
+
+/*!
+ @struct nu_lexical_address
+ @abstract Resolution information attached to a NuCell by the scope analyzer.
+ @discussion When the car of a cell is a symbol, <b>scope</b> and <b>depth</b> record the scope
+ it was resolved in and the number of evaluation contexts that can be skipped before
+ searching for it. If the symbol was found in the scope of the context at that depth,
+ <b>slot</b> is its index in that context's frame; otherwise it is -1.
+ When a cell begins the body of a block, <b>bodyScope</b> holds the
+ scope of that block so that the analysis is reused each time the block is created,
+ and <b>bytecode</b> holds the body's compiled code once it has been compiled.
+ When a cell begins a message that is sent to an object, <b>inlineCache</b> holds the methods
+ that were found for it (see NuInlineCache.h), and when it begins a call of a macro that caches
+ its expansions, <b>expansion</b> holds the call's expansion (see NuMacro.h).
+
+ Addresses are shared by every thread that evaluates their cells. Each field is filled in once and then
+ published, so readers never see one half-built; <b>depth</b> and <b>slot</b> change together when a
+ reference is resolved again, and should be read with nu_lexical_address_location.
+ */
+typedef struct nu_lexical_address {
+    NuScope *scope;
+    union {
+        struct {
+            int depth;
+            int slot;
+        };
+        uint64_t location;
+    };
+    NuScope *bodyScope;
+    id bytecode;
+    struct nu_inline_cache *inlineCache;
+    struct nu_macro_expansion *expansion;
+} nu_lexical_address;
+
+/*!
+ @class NuScope
+ @abstract Lexical scope information for Nu blocks.
+ @discussion When a block is created, its body is walked once to find every symbol that can be
+ bound in the block's evaluation context: its parameters, the implicit <b>*args</b>, and the
+ names assigned by <b>set</b>, <b>local</b>, <b>function</b>, <b>macro</b> and <b>catch</b> forms
+ that appear in the body. Blocks created by nested <b>do</b>, <b>function</b> and <b>let</b> forms
+ are analyzed in the same walk and get scopes of their own.
+
+ Each symbol reference is then annotated with the number of enclosing evaluation contexts that
+ cannot contain it, so that evaluation can skip them instead of searching each one.
+ A scope whose body uses <b>context</b>, <b>eval</b>, <b>load</b> or a macro may gain bindings
+ that the walk cannot see; such scopes are marked dynamic and lookups never skip past them.
+
+ The order of a scope's symbols gives the slot layout of the frames (NuFrame) that its block is called in.
+ Symbols are only ever appended, so slot indices stay valid for the life of the scope.
+
+ Analysis is serialized by a lock that is shared by all scopes, so blocks may be created and called
+ on several threads at once. Frames read a scope's slots without locking; a scope that grows
+ publishes a new copy of its slot symbols and keeps the old ones until it is deallocated.
+ */
+@interface NuScope : NSObject
+
+/*! Get the scope for a block with the specified parameters and body that is being created in the specified context,
+ analyzing the body if necessary. */
++ (NuScope *) scopeForBlockWithParameters:(id)parameters body:(id)body context:(NSMutableDictionary *)context;
+/*! Get the lexically enclosing scope, or nil if the scope's enclosing contexts are unknown. */
+- (NuScope *) parent;
+/*! Get the symbols that can be bound in evaluation contexts of this scope. */
+- (NSArray *) symbols;
+/*! Returns true if evaluation contexts of this scope can gain bindings that were not found by analysis. */
+- (BOOL) isDynamic;
+/*! Mark the scope as dynamic and re-resolve the symbol references in its body. */
+- (void) markDynamic;
+/*! Add a symbol that is bound in this scope's contexts outside of its body, re-resolving references if necessary. */
+- (void) bindSymbol:(id)symbol;
+
+@end
+
+// Get the number of slots in frames of a scope and the symbols that occupy them.
+NSUInteger nu_scope_slot_count(NuScope *scope);
+
+id *nu_scope_slot_symbols(NuScope *scope);
+
+// Get the lexically enclosing scope of a scope.
+NuScope *nu_scope_parent(NuScope *scope);
+
+// Get the lexical address attached to a cell, creating one if create is true.
+nu_lexical_address *nu_cell_lexical_address(id cell, bool create);
+
+// Read the depth and slot of a lexical address together.
+static inline void nu_lexical_address_location(nu_lexical_address *address, int *depth, int *slot)
+{
+    nu_lexical_address copy;
+    copy.location = __atomic_load_n(&address->location, __ATOMIC_ACQUIRE);
+    *depth = copy.depth;
+    *slot = copy.slot;
+}
@@ -0,0 +1,454 @@
+//
+//  NuScope.m
+//  Nu
+//
+//  Lexical scope analysis for blocks.
+//
+
+#import "NuScope.h"
+#import "NuInternals.h"
+#import "NuCell.h"
+#import "NuSymbol.h"
+#import "NuFrame.h"
+
+#import <pthread.h>
+
+enum {
+    NU_SCOPE_COLLECT,       // create scopes and record the symbols bound in them
+    NU_SCOPE_RESOLVE        // annotate symbol references with lexical addresses
+};
+
+@interface NuScope ()
+{
+    NuScope *parent;
+    NSMutableArray *symbols;        // only changed while holding the analysis lock
+    id *slotSymbols;                // the contents of symbols, for frames; replaced when symbols are added
+    NSUInteger slotCount;           // published after slotSymbols
+    id body;                // not retained; the first cell of the body retains its scope
+    BOOL dynamic;
+    BOOL resolved;
+}
+- (id) initWithParent:(NuScope *)p parameters:(id)parameters body:(id)b;
+- (void) setResolved;
+- (void) updateSlotSymbols;
+@end
+
+static void nu_scope_walk_body(id body, NuScope *scope, int pass);
+
+// Analysis changes scopes and lexical addresses that other threads may be using, so it is done
+// by one thread at a time. The lock is recursive because binding a symbol re-resolves references.
+static pthread_mutex_t nu_scope_lock;
+static pthread_once_t nu_scope_lock_once = PTHREAD_ONCE_INIT;
+
+static void nu_scope_lock_init(void)
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&nu_scope_lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+static void nu_scope_lock_acquire(void)
+{
+    pthread_once(&nu_scope_lock_once, nu_scope_lock_init);
+    pthread_mutex_lock(&nu_scope_lock);
+}
+
+static void nu_scope_lock_release(void)
+{
+    pthread_mutex_unlock(&nu_scope_lock);
+}
+
+// Release a scope that has been replaced in a lexical address. Other threads may have read it from the
+// address without retaining it, so it is retired like replaced slot symbols and freed after they pass a quiescent point.
+static void nu_scope_retire(NuScope *scope)
+{
+    nu_retire_object(scope);
+}
+
+static bool nu_is_symbol(id object)
+{
+    return object && (object_getClass(object) == [NuSymbol class]);
+}
+
+static bool nu_is_cell(id object)
+{
+    return object && (object != Nu__null) && nu_objectIsKindOfClass(object, [NuCell class]);
+}
+
+// Symbols that are bound by the runtime rather than by code that we can see.
+static bool nu_symbol_is_reserved(NuSymbol *symbol)
+{
+    NSString *name = [symbol stringValue];
+    unichar c = [name characterAtIndex:0];
+    if ((c == '@') || [symbol isLabel])
+        return true;
+    return ([name isEqualToString:@"self"]
+            || [name isEqualToString:@"super"]
+            || [name isEqualToString:@"_class"]
+            || [name isEqualToString:@"_method"]
+            || [name isEqualToString:@"_parser"]
+            || [name isEqualToString:@"margs"]);
+}
+
+static void nu_scope_annotate(id holder, NuSymbol *symbol, NuScope *scope)
+{
+    if (nu_symbol_is_reserved(symbol))
+        return;
+    int depth = 0;
+    int slot = -1;
+    NuScope *cursor = scope;
+    while (cursor) {
+        NSUInteger count = nu_scope_slot_count(cursor);
+        id *slots = nu_scope_slot_symbols(cursor);
+        for (NSUInteger i = 0; (i < count) && (slot < 0); i++) {
+            if (slots[i] == symbol)
+                slot = (int) i;
+        }
+        if ((slot >= 0) || [cursor isDynamic])
+            break;
+        depth++;
+        cursor = [cursor parent];
+    }
+    nu_lexical_address *address = nu_cell_lexical_address(holder, true);
+    nu_lexical_address location;
+    location.depth = depth;
+    location.slot = slot;
+    __atomic_store_n(&address->location, location.location, __ATOMIC_RELEASE);
+    if (address->scope != scope) {
+        NuScope *old = address->scope;
+        __atomic_store_n(&address->scope, [scope retain], __ATOMIC_RELEASE);
+        nu_scope_retire(old);
+    }
+}
+
+// Analyze a block whose body is nested in the body being walked.
+static void nu_scope_walk_nested(id parameters, id body, NuScope *scope, id extraSymbol, int pass)
+{
+    if (!nu_is_cell(body))
+        return;
+    if (pass == NU_SCOPE_COLLECT) {
+        NuScope *nested = [[NuScope alloc] initWithParent:scope parameters:parameters body:body];
+        if (extraSymbol)
+            [nested bindSymbol:extraSymbol];
+        nu_lexical_address *address = nu_cell_lexical_address(body, true);
+        NuScope *old = address->bodyScope;
+        __atomic_store_n(&address->bodyScope, nested, __ATOMIC_RELEASE);
+        nu_scope_retire(old);
+        nu_scope_walk_body(body, nested, pass);
+    }
+    else {
+        nu_lexical_address *address = nu_cell_lexical_address(body, false);
+        if (address && address->bodyScope)
+            nu_scope_walk_body(body, address->bodyScope, pass);
+    }
+}
+
+static void nu_scope_bind(NuScope *scope, id symbol, int pass)
+{
+    if ((pass == NU_SCOPE_COLLECT) && nu_is_symbol(symbol))
+        [scope bindSymbol:symbol];
+}
+
+static void nu_scope_walk_list(id list, NuScope *scope, int pass);
+
+// Walk the expression held in the car of a cell.
+static void nu_scope_walk_expression(id holder, NuScope *scope, int pass)
+{
+    id form = [holder car];
+    if (nu_is_symbol(form)) {
+        if (pass == NU_SCOPE_RESOLVE)
+            nu_scope_annotate(holder, form, scope);
+        return;
+    }
+    if (!nu_is_cell(form))
+        return;
+    id head = [form car];
+    if (!nu_is_symbol(head)) {
+        nu_scope_walk_list(form, scope, pass);
+        return;
+    }
+    if (pass == NU_SCOPE_RESOLVE)
+        nu_scope_annotate(form, head, scope);
+
+    NSString *name = [head stringValue];
+    id args = [form cdr];
+    if ([name isEqualToString:@"quote"]
+        || [name isEqualToString:@"quasiquote"]
+        || [name isEqualToString:@"class"]) {
+        // quoted data is never evaluated here, and class bodies are analyzed when their blocks are created
+        return;
+    }
+    if ([name isEqualToString:@"macro"]) {
+        nu_scope_bind(scope, [args car], pass);
+        if (pass == NU_SCOPE_COLLECT)
+            [scope markDynamic];
+        return;
+    }
+    if ([name isEqualToString:@"context"]
+        || [name isEqualToString:@"eval"]
+        || [name isEqualToString:@"load"]
+        || [name isEqualToString:@"macrox"]) {
+        if (pass == NU_SCOPE_COLLECT)
+            [scope markDynamic];
+        nu_scope_walk_list(args, scope, pass);
+        return;
+    }
+    if ([name isEqualToString:@"-"]
+        || [name isEqualToString:@"+"]
+        || [name isEqualToString:@"imethod"]
+        || [name isEqualToString:@"cmethod"]) {
+        // method declarations are analyzed when their blocks are created
+        id cursor = args;
+        while (nu_is_cell(cursor)) {
+            if (nu_is_symbol([cursor car]) && [[[cursor car] stringValue] isEqualToString:@"is"])
+                return;
+            cursor = [cursor cdr];
+        }
+    }
+    if ([name isEqualToString:@"set"]) {
+        id target = [args car];
+        if (nu_is_symbol(target)) {
+            unichar c = [[target stringValue] characterAtIndex:0];
+            if ((c != '$') && (c != '@'))
+                nu_scope_bind(scope, target, pass);
+        }
+        nu_scope_walk_list([args cdr], scope, pass);
+        return;
+    }
+    if ([name isEqualToString:@"local"]) {
+        nu_scope_bind(scope, [args car], pass);
+        nu_scope_walk_list([args cdr], scope, pass);
+        return;
+    }
+    if ([name isEqualToString:@"global"]) {
+        nu_scope_walk_list([args cdr], scope, pass);
+        return;
+    }
+    if ([name isEqualToString:@"do"]) {
+        nu_scope_walk_nested([args car], [args cdr], scope, nil, pass);
+        return;
+    }
+    if ([name isEqualToString:@"future"]) {
+        // the expressions of a future are the body of a block without parameters
+        nu_scope_walk_nested(Nu__null, args, scope, nil, pass);
+        return;
+    }
+    if ([name isEqualToString:@"function"] || [name isEqualToString:@"def"]) {
+        nu_scope_bind(scope, [args car], pass);
+        nu_scope_walk_nested([[args cdr] car], [[args cdr] cdr], scope, nil, pass);
+        return;
+    }
+    if ([name isEqualToString:@"label"]) {
+        id value = [[args cdr] car];
+        if (nu_is_cell(value) && nu_is_symbol([value car]) && [[[value car] stringValue] isEqualToString:@"do"]) {
+            if (pass == NU_SCOPE_RESOLVE)
+                nu_scope_annotate(value, [value car], scope);
+            nu_scope_walk_nested([[value cdr] car], [[value cdr] cdr], scope, [args car], pass);
+        }
+        else {
+            nu_scope_walk_list([args cdr], scope, pass);
+        }
+        return;
+    }
+    if ([name isEqualToString:@"let"]) {
+        // the values are evaluated in the enclosing context, the body in a new one
+        id bindings = [args car];
+        NSMutableArray *names = [NSMutableArray array];
+        if (nu_is_cell(bindings) && [[bindings car] atom]) {
+            [names addObject:[bindings car]];
+            nu_scope_walk_list([bindings cdr], scope, pass);
+        }
+        else {
+            id cursor = bindings;
+            while (nu_is_cell(cursor)) {
+                id binding = [cursor car];
+                if (nu_is_cell(binding)) {
+                    [names addObject:[binding car]];
+                    nu_scope_walk_list([binding cdr], scope, pass);
+                }
+                cursor = [cursor cdr];
+            }
+        }
+        nu_scope_walk_nested(names, [args cdr], scope, nil, pass);
+        return;
+    }
+    if ([name isEqualToString:@"catch"]) {
+        nu_scope_bind(scope, [[args car] car], pass);
+        nu_scope_walk_body([args cdr], scope, pass);
+        return;
+    }
+    nu_scope_walk_list(args, scope, pass);
+}
+
+static void nu_scope_walk_list(id list, NuScope *scope, int pass)
+{
+    id cursor = list;
+    while (nu_is_cell(cursor)) {
+        nu_scope_walk_expression(cursor, scope, pass);
+        cursor = [cursor cdr];
+    }
+}
+
+static void nu_scope_walk_body(id body, NuScope *scope, int pass)
+{
+    nu_scope_walk_list(body, scope, pass);
+    if (pass == NU_SCOPE_RESOLVE)
+        [scope setResolved];
+}
+
+@implementation NuScope
+
++ (NuScope *) scopeForBlockWithParameters:(id)parameters body:(id)body context:(NSMutableDictionary *)context
+{
+    if (!nu_is_cell(body))
+        return [[[NuScope alloc] initWithParent:nil parameters:parameters body:nil] autorelease];
+
+    // Reuse an existing analysis if it was made for the context that the block is being created in.
+    NuScope *contextScope = nu_context_scope(context);
+    nu_lexical_address *address = nu_cell_lexical_address(body, false);
+    NuScope *scope = address ? __atomic_load_n(&address->bodyScope, __ATOMIC_ACQUIRE) : nil;
+    if (scope && (!scope->parent || (scope->parent == contextScope)))
+        return scope;
+
+    nu_scope_lock_acquire();
+    // another thread may have analyzed the body while we waited
+    address = nu_cell_lexical_address(body, true);
+    scope = address->bodyScope;
+    if (!scope || (scope->parent && (scope->parent != contextScope))) {
+        // Otherwise analyze the body as the outermost scope of a new analysis.
+        scope = [[NuScope alloc] initWithParent:nil parameters:parameters body:body];
+        nu_scope_walk_body(body, scope, NU_SCOPE_COLLECT);
+        nu_scope_walk_body(body, scope, NU_SCOPE_RESOLVE);
+        // publish the scope once it is complete, since it is read without locking
+        NuScope *old = address->bodyScope;
+        __atomic_store_n(&address->bodyScope, scope, __ATOMIC_RELEASE);
+        nu_scope_retire(old);
+    }
+    nu_scope_lock_release();
+    return scope;
+}
+
+- (id) initWithParent:(NuScope *)p parameters:(id)parameters body:(id)b
+{
+    if ((self = [super init])) {
+        parent = [p retain];
+        body = b;
+        symbols = [[NSMutableArray alloc] init];
+        [symbols addObject:[[NuSymbolTable sharedSymbolTable] symbolWithString:@"*args"]];
+        if ([parameters isKindOfClass:[NSArray class]]) {
+            [symbols addObjectsFromArray:parameters];
+        }
+        else {
+            id cursor = parameters;
+            while (nu_is_cell(cursor)) {
+                [symbols addObject:[cursor car]];
+                cursor = [cursor cdr];
+            }
+        }
+        dynamic = NO;
+        resolved = NO;
+        [self updateSlotSymbols];
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    [parent release];
+    [symbols release];
+    free(slotSymbols);
+    [super dealloc];
+}
+
+// Frames read the slot symbols without locking while they are evaluating, so a replaced copy
+// is retired and freed after every thread that is evaluating has passed a quiescent point.
+- (void) updateSlotSymbols
+{
+    NSUInteger count = [symbols count];
+    id *newSlotSymbols = (id *) malloc((count ? count : 1) * sizeof(id));
+    [symbols getObjects:newSlotSymbols range:NSMakeRange(0, count)];
+    id *old = slotSymbols;
+    __atomic_store_n(&slotSymbols, newSlotSymbols, __ATOMIC_RELEASE);
+    __atomic_store_n(&slotCount, count, __ATOMIC_RELEASE);
+    if (old)
+        nu_retire(old, free);
+}
+
+// Read the count before the symbols, so that the symbols are at least as new as the count.
+NSUInteger nu_scope_slot_count(NuScope *scope)
+{
+    return __atomic_load_n(&scope->slotCount, __ATOMIC_ACQUIRE);
+}
+
+id *nu_scope_slot_symbols(NuScope *scope)
+{
+    return __atomic_load_n(&scope->slotSymbols, __ATOMIC_ACQUIRE);
+}
+
+NuScope *nu_scope_parent(NuScope *scope)
+{
+    return scope ? scope->parent : nil;
+}
+
+- (NuScope *) parent
+{
+    return parent;
+}
+
+- (NSArray *) symbols
+{
+    NSUInteger count = nu_scope_slot_count(self);
+    return [NSArray arrayWithObjects:nu_scope_slot_symbols(self) count:count];
+}
+
+- (BOOL) isDynamic
+{
+    return __atomic_load_n(&dynamic, __ATOMIC_ACQUIRE);
+}
+
+- (void) setResolved
+{
+    resolved = YES;
+}
+
+- (void) markDynamic
+{
+    if ([self isDynamic])
+        return;
+    nu_scope_lock_acquire();
+    if (!dynamic) {
+        __atomic_store_n(&dynamic, YES, __ATOMIC_RELEASE);
+        if (resolved && body)
+            nu_scope_walk_body(body, self, NU_SCOPE_RESOLVE);
+    }
+    nu_scope_lock_release();
+}
+
+- (void) bindSymbol:(id)symbol
+{
+    // blocks bind self and super each time they are called, so look for the symbol without locking first
+    NSUInteger count = nu_scope_slot_count(self);
+    id *slots = nu_scope_slot_symbols(self);
+    for (NSUInteger i = 0; i < count; i++) {
+        if (slots[i] == symbol)
+            return;
+    }
+    nu_scope_lock_acquire();
+    if ([symbols indexOfObjectIdenticalTo:symbol] == NSNotFound) {
+        [symbols addObject:symbol];
+        [self updateSlotSymbols];
+        // references in the body may already have been resolved past this scope
+        if (resolved && body && !dynamic)
+            nu_scope_walk_body(body, self, NU_SCOPE_RESOLVE);
+    }
+    nu_scope_lock_release();
+}
+
+- (NSString *) description
+{
+    return [NSString stringWithFormat:@"<NuScope %@%@>", [[self symbols] description], [self isDynamic] ? @" dynamic" : @""];
+}
+
+@end
@@ -21,7 +21,7 @@
  */
 @interface NuSymbol : NSObject <NSCoding, NSCopying>
 
-/*! Get the global value of a symbol. */
+/*! Get the global value of a symbol. The value is retained and autoreleased, so it stays valid if another thread replaces it. */
 - (id) value;
 /*! Set the global value of a symbol. */
 - (void) setValue:(id)v;
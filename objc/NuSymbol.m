@@ -14,6 +14,8 @@
 #import "NuBridgedConstant.h"
 #import "NuClass.h"
 
+#import <pthread.h>
+
 #pragma mark - NuSymbol.m
 
 @interface NuSymbol ()
@@ -26,70 +28,190 @@
     NSString *stringValue;			  // let's keep this for efficiency
 }
 - (void) _setStringValue:(NSString *) string;
+- (id) cacheValue:(id) v;
 @end
 
+// Global values that are replaced are retired, not released: another thread may have loaded the old value
+// and not retained it yet. Each retired value is tagged with a new epoch, and it is released once every thread
+// that is evaluating has announced a later epoch at a quiescent point (see nu_evaluation_quiescent).
+// Other shared memory that readers use without locking (like scopes and their slot symbols) is retired the same way.
+unsigned long nu_global_value_epoch = 1;
+
+typedef struct nu_retired_value {
+    void *value;
+    void (*reclaim)(void *);
+    unsigned long epoch;
+    struct nu_retired_value *next;
+} nu_retired_value;
+
+static pthread_mutex_t retiredValuesLock = PTHREAD_MUTEX_INITIALIZER;
+static nu_retired_value *retiredValues = NULL;   // newest first, so epochs decrease along the list
+
+void nu_release_retired_values(void)
+{
+    if (!__atomic_load_n(&retiredValues, __ATOMIC_RELAXED))
+        return;
+    unsigned long oldest = nu_expression_stacks_oldest_epoch();
+    pthread_mutex_lock(&retiredValuesLock);
+    nu_retired_value **link = &retiredValues;
+    while (*link && ((*link)->epoch > oldest))
+        link = &(*link)->next;
+    nu_retired_value *released = *link;
+    *link = NULL;
+    pthread_mutex_unlock(&retiredValuesLock);
+    // releasing may run arbitrary code, so it is done outside the lock
+    while (released) {
+        nu_retired_value *next = released->next;
+        released->reclaim(released->value);
+        free(released);
+        released = next;
+    }
+}
+
+void nu_retire(void *value, void (*reclaim)(void *))
+{
+    nu_retired_value *retired = (nu_retired_value *) malloc(sizeof(nu_retired_value));
+    retired->value = value;
+    retired->reclaim = reclaim;
+    pthread_mutex_lock(&retiredValuesLock);
+    retired->epoch = __atomic_add_fetch(&nu_global_value_epoch, 1, __ATOMIC_SEQ_CST);
+    retired->next = retiredValues;
+    __atomic_store_n(&retiredValues, retired, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&retiredValuesLock);
+}
+
+static void nu_release_object(void *object)
+{
+    [(id) object release];
+}
+
+void nu_retire_object(id object)
+{
+    if (object)
+        nu_retire(object, nu_release_object);
+}
+
+// Symbols are divided among shards by the hashes of their names, so that threads interning
+// different symbols rarely wait for each other. Lookups only take a shard's read lock.
+#define NU_SYMBOL_TABLE_SHARDS 64
+
+typedef struct nu_symbol_table_shard {
+    pthread_rwlock_t lock;
+    NSMutableDictionary *symbols;
+} nu_symbol_table_shard;
+
 @interface NuSymbolTable ()
 {
-    NSMutableDictionary *symbol_table;
+    nu_symbol_table_shard shards[NU_SYMBOL_TABLE_SHARDS];
 }
 @end
 
 void load_builtins(NuSymbolTable *);
 
 static NuSymbolTable *sharedSymbolTable = 0;
+static pthread_mutex_t sharedSymbolTableLock = PTHREAD_MUTEX_INITIALIZER;
+// the table that this thread is loading builtins into, which the builtins may ask for
+static __thread NuSymbolTable *loadingSymbolTable = nil;
 
+static inline nu_symbol_table_shard *nu_symbol_table_shard_for_string(nu_symbol_table_shard *shards, NSString *string)
+{
+    return &shards[[string hash] % NU_SYMBOL_TABLE_SHARDS];
+}
 
 @implementation NuSymbolTable
 
 + (NuSymbolTable *) sharedSymbolTable
 {
+    NuSymbolTable *table = __atomic_load_n(&sharedSymbolTable, __ATOMIC_ACQUIRE);
+    if (table)
+        return table;
+    if (loadingSymbolTable)
+        return loadingSymbolTable;
+    pthread_mutex_lock(&sharedSymbolTableLock);
     if (!sharedSymbolTable) {
-        sharedSymbolTable = [[self alloc] init];
-        load_builtins(sharedSymbolTable);
+        loadingSymbolTable = [[self alloc] init];
+        load_builtins(loadingSymbolTable);
+        // publish the table only after its builtins are installed
+        __atomic_store_n(&sharedSymbolTable, loadingSymbolTable, __ATOMIC_RELEASE);
+        loadingSymbolTable = nil;
     }
+    pthread_mutex_unlock(&sharedSymbolTableLock);
     return sharedSymbolTable;
 }
 
+- (id) init
+{
+    if ((self = [super init])) {
+        for (int i = 0; i < NU_SYMBOL_TABLE_SHARDS; i++) {
+            pthread_rwlock_init(&shards[i].lock, NULL);
+            shards[i].symbols = [[NSMutableDictionary alloc] init];
+        }
+    }
+    return self;
+}
+
 - (void) dealloc
 {
     NSLog(@"WARNING: deleting a symbol table. Leaking stored symbols.");
+    for (int i = 0; i < NU_SYMBOL_TABLE_SHARDS; i++)
+        pthread_rwlock_destroy(&shards[i].lock);
     [super dealloc];
 }
 
 // Designated initializer
 - (NuSymbol *) symbolWithString:(NSString *)string
 {
-    if (!symbol_table) symbol_table = [[NSMutableDictionary alloc] init];
+    nu_symbol_table_shard *shard = nu_symbol_table_shard_for_string(shards, string);
     
     // If the symbol is already in the table, return it.
     NuSymbol *symbol;
-    symbol = [symbol_table objectForKey:string];
+    pthread_rwlock_rdlock(&shard->lock);
+    symbol = [shard->symbols objectForKey:string];
+    pthread_rwlock_unlock(&shard->lock);
     if (symbol) {
         return symbol;
     }
     
-    // If not, create it.
-    symbol = [[[NuSymbol alloc] init] autorelease];             // keep construction private
-    [symbol _setStringValue:string];
-    
-    // Put the new symbol in the symbol table and return it.
-    [symbol_table setObject:symbol forKey:string];
+    // If not, create it, unless another thread did while we weren't holding the lock.
+    pthread_rwlock_wrlock(&shard->lock);
+    symbol = [shard->symbols objectForKey:string];
+    if (!symbol) {
+        symbol = [[[NuSymbol alloc] init] autorelease];             // keep construction private
+        [symbol _setStringValue:string];
+        
+        // Put the new symbol in the symbol table and return it.
+        [shard->symbols setObject:symbol forKey:string];
+    }
+    pthread_rwlock_unlock(&shard->lock);
     return symbol;
 }
 
 - (NuSymbol *) lookup:(NSString *) string
 {
-    return [symbol_table objectForKey:string];
+    nu_symbol_table_shard *shard = nu_symbol_table_shard_for_string(shards, string);
+    pthread_rwlock_rdlock(&shard->lock);
+    NuSymbol *symbol = [shard->symbols objectForKey:string];
+    pthread_rwlock_unlock(&shard->lock);
+    return symbol;
 }
 
 - (NSArray *) all
 {
-    return [symbol_table allValues];
+    NSMutableArray *all = [NSMutableArray array];
+    for (int i = 0; i < NU_SYMBOL_TABLE_SHARDS; i++) {
+        pthread_rwlock_rdlock(&shards[i].lock);
+        [all addObjectsFromArray:[shards[i].symbols allValues]];
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+    return all;
 }
 
 - (void) removeSymbol:(NuSymbol *) symbol
 {
-    [symbol_table removeObjectForKey:[symbol stringValue]];
+    nu_symbol_table_shard *shard = nu_symbol_table_shard_for_string(shards, [symbol stringValue]);
+    pthread_rwlock_wrlock(&shard->lock);
+    [shard->symbols removeObjectForKey:[symbol stringValue]];
+    pthread_rwlock_unlock(&shard->lock);
 }
 
 @end
@@ -118,16 +240,37 @@ static NuSymbolTable *sharedSymbolTable = 0;
     return (self == other) ? 1l : 0l;
 }
 
+// The value is retained before the thread can pass a quiescent point, so it stays valid after it is replaced.
 - (id) value
 {
-    return value;
+    bool outermost = nu_evaluation_begin();
+    id v = [__atomic_load_n(&value, __ATOMIC_ACQUIRE) retain];
+    if (outermost)
+        nu_evaluation_end();
+    return [v autorelease];
 }
 
+// Threads that are reading the old value may not have retained it yet,
+// so it is retired instead of released.
 - (void) setValue:(id)v
 {
     [v retain];
-    [value release];
-    value = v;
+    id old = __atomic_exchange_n(&value, v, __ATOMIC_SEQ_CST);
+    if (old) {
+        nu_retire_object(old);
+        nu_release_retired_values();
+    }
+}
+
+// Store a value that was found for the symbol unless another thread stored one first,
+// and return the value that the symbol has. Takes ownership of v.
+- (id) cacheValue:(id) v
+{
+    id expected = nil;
+    if (__atomic_compare_exchange_n(&value, &expected, v, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return [[v retain] autorelease];
+    [v release];
+    return [self value];
 }
 
 - (NSString *) description
@@ -201,8 +344,9 @@ static NuSymbolTable *sharedSymbolTable = 0;
 #endif
     
     // Next, return the global value assigned to the value.
-    if (value)
-        return value;
+    id globalValue = [self value];
+    if (globalValue)
+        return globalValue;
     
     // If the symbol is a label (ends in ':'), then it will evaluate to itself.
     if (isLabel)
@@ -211,9 +355,9 @@ static NuSymbolTable *sharedSymbolTable = 0;
     // If the symbol is still unknown, try to find a class with this name.
     id className = [self stringValue];
     // the symbol should retain its value.
-    value = [[NuClass classWithName:className] retain];
-    if (value)
-        return value;
+    id classValue = [[NuClass classWithName:className] retain];
+    if (classValue)
+        return [self cacheValue:classValue];
     
     // Undefined globals evaluate to null.
     if (c == '$')
@@ -227,33 +371,29 @@ static NuSymbolTable *sharedSymbolTable = 0;
         // is it an enum?
         id enumValue = [[bridgeSupport valueForKey:@"enums"] valueForKey:[self stringValue]];
         if (enumValue) {
-            value = enumValue;
-            return value;
+            return [self cacheValue:[enumValue retain]];
         }
         // is it a constant?
         id constantSignature = [[bridgeSupport valueForKey:@"constants"] valueForKey:[self stringValue]];
         if (constantSignature) {
-            value = [[NuBridgedConstant constantWithName:[self stringValue] signature:constantSignature] retain];
-            return value;
+            return [self cacheValue:[[NuBridgedConstant constantWithName:[self stringValue] signature:constantSignature] retain]];
         }
         // is it a function?
         id functionSignature = [[bridgeSupport valueForKey:@"functions"] valueForKey:[self stringValue]];
         if (functionSignature) {
-            value = [[NuBridgedFunction functionWithName:[self stringValue] signature:functionSignature] retain];
-            return value;
+            return [self cacheValue:[[NuBridgedFunction functionWithName:[self stringValue] signature:functionSignature] retain]];
         }
     }
     
     // Automatically create markup operators
     if ([[self stringValue] characterAtIndex:0] == '&') {
         NuMarkupOperator *newOperator = [NuMarkupOperator operatorWithTag:[[self stringValue] substringFromIndex:1]];
-        [self setValue:newOperator];
-        return newOperator;
+        return [self cacheValue:[newOperator retain]];
     }
     
     // Still-undefined symbols throw an exception.
     NSMutableString *errorDescription = [NSMutableString stringWithFormat:@"undefined symbol %@", [self stringValue]];
-    id expression = [context lookupObjectForKey:[symbolTable symbolWithString:@"_expression"]];
+    id expression = nu_current_expression();
     if (expression) {
         [errorDescription appendFormat:@" while evaluating expression %@", [expression stringValue]];
         const char *filename = nu_parsedFilename([expression file]);